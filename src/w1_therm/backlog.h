@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+/**
+ * @brief a sample buffered while influxdb is unreachable
+ */
+struct backlog_record
+{
+    int64_t     id_{ 0 };    ///< increases with insertion order
+    std::string name_{ };
+    double      value_{ 0 };
+    time_t      time_{ 0 };
+    uint32_t    series_{ 0 }; ///< 0 for a raw reading, else see rollup_series
+};
@@ -0,0 +1,280 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#include "alloc_counter.h"
+#include "bench.h"
+#include "deadband.h"
+#include "fake_influx.h"
+#include "fake_w1.h"
+#include "history.h"
+#include "latest_table.h"
+#include "lib_heap.h"
+#include "rollup.h"
+#include "storage.h"
+#include "uploader.h"
+#include "w1_bus.h"
+
+namespace
+{
+
+constexpr time_t t0 = 1700000000;
+
+const char * sensor(size_t i)
+{
+    static const char * const names[] = { "kitchen", "cellar", "living-room", "28-000005e2fdc3" };
+    return names[i % 4];
+}
+
+double value(size_t i) { return 15 + static_cast<double>(i % 97) / 8; }
+
+/**
+ * @brief hands every call to the influxdb sink, noting the allocations its thread made so far
+ */
+class counted_sink : public sink
+{
+public:
+    explicit counted_sink(storage_t & target) : target_{ target } { }
+
+    const char * name() const override { return target_.name(); }
+
+    void write(const sample & s) override { target_.write(s); note(); }
+
+    int fd() const override { return target_.fd(); }
+
+    void on_ready() override { target_.on_ready(); note(); }
+
+    void tick() override { target_.tick(); note(); }
+
+    std::optional<std::chrono::steady_clock::time_point> deadline() override
+    {
+        auto const d = target_.deadline();
+        note();
+        return d;
+    }
+
+    void flush() override { target_.flush(); }
+
+    uint64_t sent() const override { return target_.sent(); }
+
+    uint64_t dropped() const override { return target_.dropped(); }
+
+    /**
+     * @brief allocations of the uploader thread, as of its last call
+     */
+    size_t allocs() const { return allocs_.load(std::memory_order_acquire); }
+
+    /**
+     * @brief no write in flight as of the last call
+     */
+    bool idle() const { return idle_.load(std::memory_order_acquire); }
+
+private:
+    void note()
+    {
+        idle_.store(target_.influx_.in_flight() == 0, std::memory_order_release);
+        allocs_.store(thread_alloc_count(), std::memory_order_release);
+    }
+
+private:
+    storage_t &         target_;
+    std::atomic<size_t> allocs_{ 0 };
+    std::atomic<bool>   idle_{ true };
+};
+
+/**
+ * @brief sample, encode, post or buffer, none of it may allocate once warm
+ *
+ * The sampler pushes a reading at a time and waits for the uploader to
+ * settle it, as the sweep does a few seconds apart. Only the allocations
+ * of those two threads count, not those of the server; libcurl & sqlite
+ * allocate from lib_heap, whose misses reach malloc & count.
+ */
+bool run(const char * name, const std::filesystem::path & dir, bool up, size_t warm, size_t count)
+{
+    auto const db = (dir / (std::string{ name } + ".db")).string();
+
+    fake_influx::options opt;
+    if (!up)
+    {
+        opt.unavailable_rate_ = 1;
+        opt.retry_after_ = 3600;
+    }
+    fake_influx server{ opt };
+
+    storage_t storage{ sqlite_storage{ db.c_str() },
+                       influx_storage{ server.host(), "org", "bucket", "token", "home", "temperature", { } } };
+    counted_sink target{ storage };
+
+    size_t sampler = 0, uploader_allocs = 0;
+    double seconds = 0;
+    bool settled = true;
+    {
+        fanout upload;
+        upload.add(target, 1024, overflow_policy::drop_oldest);
+        auto const & u = *upload.uploaders()[0];
+
+        size_t pushed = 0;
+        auto const push = [&](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+            {
+                upload.push(sensor(pushed), value(pushed), t0 + static_cast<time_t>(pushed));
+                ++pushed;
+
+                auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+                while ((u.written() != pushed || !target.idle()) && std::chrono::steady_clock::now() < deadline)
+                    std::this_thread::yield();
+                settled = settled && u.written() == pushed && target.idle();
+            }
+        };
+
+        push(warm);
+        auto const sampler_bgn = thread_alloc_count();
+        auto const uploader_bgn = target.allocs();
+        seconds = bench_seconds([&] { push(count); });
+        sampler = thread_alloc_count() - sampler_bgn;
+        uploader_allocs = target.allocs() - uploader_bgn;
+    }
+    storage.flush();
+
+    auto const buffered = storage.backlog([](auto & b) { return b.count(); });
+    bench_report(name, "round trip", seconds / static_cast<double>(count) * 1e6, "us");
+    bench_report(name, "sampler allocations", static_cast<double>(sampler), "count");
+    bench_report(name, "uploader allocations", static_cast<double>(uploader_allocs), "count");
+
+    // the first failure buffers everything after it, a good post nothing
+    auto const path = up ? buffered == 0 : buffered == warm + count;
+    if (sampler != 0 || uploader_allocs != 0 || !settled || !path)
+    {
+        fprintf(stderr, "%s: %zu sampler & %zu uploader allocations after warm-up, %zu rows buffered%s\n",
+                name, sampler, uploader_allocs, buffered, settled ? "" : ", a sample did not settle");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief takes the readings & drops them
+ */
+class null_sink : public sink
+{
+public:
+    const char * name() const override { return "null"; }
+
+    void write(const sample &) override { written_.fetch_add(1, std::memory_order_release); }
+
+    size_t written() const { return written_.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<size_t> written_{ 0 };
+};
+
+/**
+ * @brief the sweep of the timer: scan, read, deadband, rollups, latest & history, none of it may allocate once warm
+ *
+ * The workers of the bus read the sensors, so the allocations of every
+ * thread count. The readings stand still, the deadband passes them on
+ * its heartbeat and the rollups close a window every sixth sweep. Adding
+ * or renaming a sensor allocates, a sweep finding the known ones does not.
+ */
+bool run_sampler(const std::filesystem::path & dir, size_t warm, size_t count)
+{
+    fake_w1 w1{ dir / "w1" };
+    w1.set("28-000000000001", 21500);
+    w1.set("28-000000000002", -1250);
+    w1.set("28-000000000003", 19125);
+    w1.set("28-000000000004", 30000, false);
+    w1_bus::name_map const names{ { "28-000000000001", "kitchen" }, { "28-000000000002", "cellar" } };
+
+    null_sink target;
+    size_t allocs = 0, pushed = 0;
+    double seconds = 0;
+    {
+        fanout upload;
+        upload.add(target, 1024, overflow_policy::drop_oldest);
+
+        w1_bus bus{ w1.root().string(), 2 };
+        deadband filter{ { 0.1, std::chrono::seconds{ 300 } } };
+        latest_table latest{ "/w1_therm_bench_alloc", 16 };
+        history recent{ { 256, 1 << 20 } };
+        rollup rollups{ { 60, 3600 }, [&](const char * name, double value, time_t start, uint32_t series)
+        {
+            upload.push(name, value, start, series);
+            ++pushed;
+        } };
+
+        size_t sweeps = 0;
+        auto const sweep = [&](size_t n) {
+            for (size_t i = 0; i < n; ++i, ++sweeps)
+            {
+                auto const now = t0 + static_cast<time_t>(sweeps * 10);
+                bus.scan(names);
+                bus.sweep();
+                rollups.close_due(now);
+                for (auto const & sensor : bus.sensors())
+                {
+                    if (!sensor.therm_)
+                    {
+                        latest.fail(sensor.name_.c_str(), now);
+                        continue;
+                    }
+
+                    auto const value = *sensor.therm_ / double(1000);
+                    if (filter.pass(sensor.id_, value, now))
+                    {
+                        upload.push(sensor.name_.c_str(), value, now);
+                        ++pushed;
+                    }
+                    rollups.add(sensor.name_.c_str(), value, now);
+                    latest.publish(sensor.name_.c_str(), value, now);
+                    recent.add(sensor.name_.c_str(), value, now);
+                }
+            }
+        };
+
+        sweep(warm);
+        auto const bgn = alloc_count();
+        seconds = bench_seconds([&] { sweep(count); });
+        allocs = alloc_count() - bgn;
+
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+        while (target.written() != pushed && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+    }
+
+    bench_report("alloc.sweep", "sweep", seconds / static_cast<double>(count) * 1e6, "us");
+    bench_report("alloc.sweep", "allocations", static_cast<double>(allocs), "count");
+
+    auto const ok = allocs == 0 && pushed != 0 && target.written() == pushed;
+    if (!ok)
+        fprintf(stderr, "alloc.sweep: %zu allocations after warm-up, %zu of %zu readings written\n",
+                allocs, target.written(), pushed);
+    return ok;
+}
+
+} // namespace
+
+/**
+ * @brief the sweep & the sample→encode→store→upload path allocate nothing once warm
+ */
+int main(int argc, char ** argv)
+{
+    lib_heap::install();
+
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000ul;
+    std::filesystem::path const dir = argc > 2 ? argv[2] : "/tmp/w1_therm_bench_alloc";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    auto ok = run_sampler(dir, 400, count);
+    ok = run("alloc.upload", dir, true, 256, count) && ok;
+    ok = run("alloc.backlog", dir, false, 256, count) && ok;
+
+    std::filesystem::remove_all(dir);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// Replaces malloc, calloc & realloc to count heap allocations, operator new
+// included since it calls malloc. The executable's definitions interpose on
+// those of glibc for the shared libraries as well, so libcurl, sqlite, zlib
+// & libc itself are counted. Include in exactly one translation unit of a
+// benchmark binary.
+
+#include <cstddef>
+
+#include <atomic>
+
+extern "C" void * __libc_malloc(size_t size) noexcept;
+extern "C" void * __libc_calloc(size_t n, size_t size) noexcept;
+extern "C" void * __libc_realloc(void * p, size_t size) noexcept;
+
+inline std::atomic<size_t> g_alloc_count{ 0 };
+
+inline thread_local size_t t_alloc_count{ 0 };
+
+inline size_t alloc_count() { return g_alloc_count.load(std::memory_order_relaxed); }
+
+// Allocations of the calling thread only, e.g. not those of an in-process server.
+inline size_t thread_alloc_count() { return t_alloc_count; }
+
+inline void count_alloc()
+{
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    ++t_alloc_count;
+}
+
+extern "C" void * malloc(size_t size) noexcept
+{
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+extern "C" void * calloc(size_t n, size_t size) noexcept
+{
+    count_alloc();
+    return __libc_calloc(n, size);
+}
+
+// Shrinking or growing in place counts as well, the allocator was asked.
+extern "C" void * realloc(void * p, size_t size) noexcept
+{
+    count_alloc();
+    return __libc_realloc(p, size);
+}
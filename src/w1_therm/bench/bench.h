@@ -0,0 +1,67 @@
+#pragma once
+
+#include <sys/utsname.h>
+
+#include <cmath>
+#include <cstdio>
+
+#include <chrono>
+#include <utility>
+
+/**
+ * @brief run f once and return the elapsed wall time in seconds
+ */
+template <typename F>
+inline double bench_seconds(F && f)
+{
+    auto const bgn = std::chrono::steady_clock::now();
+    std::forward<F>(f)();
+    auto const end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - bgn).count();
+}
+
+/**
+ * @brief print s as a JSON string
+ */
+inline void bench_json_string(const char * s)
+{
+    putchar('"');
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+            putchar('\\');
+        if (static_cast<unsigned char>(*s) < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+/**
+ * @brief print one result as a JSON object on its own line
+ *
+ * The output of all benchmarks concatenates into a JSON Lines file, each
+ * result tagged with the host & machine so runs on different boards can be
+ * compared release over release.
+ */
+inline void bench_report(const char * name, const char * metric, double value, const char * unit)
+{
+    static utsname const host = [] { utsname u{ }; uname(&u); return u; }();
+
+    printf("{\"bench\":");
+    bench_json_string(name);
+    printf(",\"metric\":");
+    bench_json_string(metric);
+    // JSON has no NaN, a failed measurement is null
+    if (std::isfinite(value))
+        printf(",\"value\":%.6g,\"unit\":", value);
+    else
+        printf(",\"value\":null,\"unit\":");
+    bench_json_string(unit);
+    printf(",\"host\":");
+    bench_json_string(host.nodename);
+    printf(",\"machine\":");
+    bench_json_string(host.machine);
+    printf("}\n");
+}
@@ -0,0 +1,220 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "fake_influx.h"
+#include "series.h"
+#include "storage.h"
+
+namespace
+{
+
+constexpr time_t t0 = 1699999200;   ///< a multiple of 900
+
+const char * sensor(size_t i) { return i % 2 ? "kitchen" : "cellar"; }
+
+double value(size_t i) { return 15 + static_cast<double>(i % 97) / 8; }
+
+/**
+ * @brief a compaction step replaces a window of raw rows by their exact min, max & mean
+ */
+bool check_compact(const std::filesystem::path & dir)
+{
+    auto const db = (dir / "compact.db").string();
+    sqlite_storage s{ db.c_str() };
+
+    // an hour of both sensors a second apart, a rollup row that must stay as it is
+    s.insert("cellar", 7, t0, rollup_series(60, rollup_stat::last));
+    for (size_t i = 0; i < 7200; ++i)
+        s.insert(sensor(i), value(i), t0 + static_cast<time_t>(i / 2));
+    s.insert("cellar", 0, t0 + 3600);
+    s.flush();
+
+    size_t steps = 0, raw = 0, aggregates = 0;
+    for (sqlite_storage::compaction c; (c = s.compact(900, 4096)).raw_ != 0; ++steps)
+    {
+        raw += c.raw_;
+        aggregates += c.aggregates_;
+    }
+
+    std::vector<backlog_record> rows;
+    s.select(0, 100, rows);
+    auto ok = steps == 4 && raw == 7200 && aggregates == 32 && rows.size() == 34 && s.count() == 34;
+
+    // the first window of the cellar, the even readings of the first 900 s
+    double sum = 0, lo = INFINITY, hi = -INFINITY;
+    for (size_t i = 0; i < 1800; i += 2)
+    {
+        sum += value(i);
+        lo = std::min(lo, value(i));
+        hi = std::max(hi, value(i));
+    }
+    auto const find = [&](rollup_stat stat) {
+        auto const it = std::find_if(rows.begin(), rows.end(), [&](auto const & r) {
+            return r.name_ == "cellar" && r.time_ == t0 && r.series_ == rollup_series(900, stat);
+        });
+        return it == rows.end() ? NAN : it->value_;
+    };
+    ok = ok && find(rollup_stat::min) == lo && find(rollup_stat::max) == hi &&
+         std::fabs(find(rollup_stat::mean) - sum / 900) < 1e-9 && find(rollup_stat::count) == 900 &&
+         rows.front().series_ == rollup_series(60, rollup_stat::last) && rows.front().value_ == 7;
+    if (!ok)
+        fprintf(stderr, "budget_bench: %zu steps compacted %zu rows into %zu, %zu rows left\n",
+                steps, raw, aggregates, rows.size());
+    return ok;
+}
+
+/**
+ * @brief a window holding more raw rows than a step looks at ends with one min, max, mean & count
+ */
+bool check_split_window(const std::filesystem::path & dir)
+{
+    auto const db = (dir / "split.db").string();
+    sqlite_storage s{ db.c_str() };
+
+    // ten sensors a second apart over one window, the coldest reading comes first
+    constexpr size_t sensors = 10;
+    constexpr size_t rows = sensors * 900;
+    static_assert(rows > storage_t::compact_rows);
+    auto const reading = [](size_t i) { return i < sensors ? -50.0 : 20.0 + static_cast<double>(i % 7); };
+    for (size_t i = 0; i < rows; ++i)
+        s.insert(("s" + std::to_string(i % sensors)).c_str(), reading(i), t0 + static_cast<time_t>(i / sensors));
+    s.insert("s0", 0, t0 + 900);
+    s.flush();
+
+    size_t steps = 0, raw = 0, aggregates = 0;
+    for (sqlite_storage::compaction c; (c = s.compact(900, storage_t::compact_rows)).raw_ != 0; ++steps)
+    {
+        raw += c.raw_;
+        aggregates += c.aggregates_;
+    }
+
+    std::vector<backlog_record> left;
+    s.select(0, 100, left);
+    auto ok = steps == 3 && raw == rows && aggregates == sensors * 4 && left.size() == sensors * 4 + 1 &&
+              s.count() == left.size();
+
+    for (size_t k = 0; k < sensors && ok; ++k)
+    {
+        auto const name = "s" + std::to_string(k);
+        double sum = 0, lo = INFINITY, hi = -INFINITY;
+        for (size_t i = k; i < rows; i += sensors)
+        {
+            sum += reading(i);
+            lo = std::min(lo, reading(i));
+            hi = std::max(hi, reading(i));
+        }
+
+        size_t found = 0;
+        for (auto const & r : left)
+        {
+            if (r.name_ != name || r.series_ == 0) continue;
+            ++found;
+            auto const stat = series_stat(r.series_);
+            ok = ok && r.time_ == t0 &&
+                 ((stat == rollup_stat::min && r.value_ == lo) || (stat == rollup_stat::max && r.value_ == hi) ||
+                  (stat == rollup_stat::mean && std::fabs(r.value_ - sum / 900) < 1e-9) ||
+                  (stat == rollup_stat::count && r.value_ == 900));
+        }
+        ok = ok && found == 4;
+    }
+    if (!ok)
+        fprintf(stderr, "budget_bench: %zu steps compacted %zu rows of one window into %zu, %zu rows left\n",
+                steps, raw, aggregates, left.size());
+    return ok;
+}
+
+/**
+ * @brief influxdb down for good, the backlog stays within its bound
+ *
+ * With room for the compacted history nothing is dropped; with less the
+ * oldest rows go, the newest never.
+ */
+bool run(const char * name, const std::filesystem::path & dir, size_t rows, size_t max_bytes, bool may_evict)
+{
+    auto const db = (dir / (std::string{ name } + ".db")).string();
+
+    fake_influx::options down;
+    down.unavailable_rate_ = 1;
+    down.retry_after_ = 3600;
+    fake_influx server{ down };
+
+    backlog_limits limits;
+    limits.max_bytes_ = max_bytes;
+    limits.high_water_percent_ = 50;
+    limits.compact_window_ = 900;
+    storage_t storage{ sqlite_storage{ db.c_str() },
+                       influx_storage{ server.host(), "org", "bucket", "token", "home", "temperature", { } },
+                       { }, limits };
+
+    auto const compacted = global_metrics().backlog_compacted_.get();
+    auto const evicted = global_metrics().backlog_evicted_.get();
+
+    // the uploader ticks after every write, & again on the deadline while shrinking
+    std::chrono::nanoseconds slowest{ 0 };
+    auto const seconds = bench_seconds([&] {
+        for (size_t i = 0; i < rows; ++i)
+        {
+            storage.insert(sensor(i), value(i), t0 + static_cast<time_t>(i / 2));
+            auto const bgn = std::chrono::steady_clock::now();
+            storage.tick();
+            slowest = std::max(slowest, std::chrono::steady_clock::now() - bgn);
+        }
+        while (storage.shrinking_)
+            storage.tick();
+    });
+    storage.flush();
+
+    auto const bytes = storage.backlog([](auto & b) { return b.size_bytes(); });
+    auto const raw = global_metrics().backlog_compacted_.get() - compacted;
+    auto const dropped = global_metrics().backlog_evicted_.get() - evicted;
+    std::vector<backlog_record> last;
+    auto const left = storage.backlog([&](auto & b) { return b.count(); });
+    storage.backlog([&](auto & b) { return b.select(0, left, last); });
+
+    bench_report(name, "insert", static_cast<double>(rows) / seconds, "records/s");
+    bench_report(name, "slowest tick", std::chrono::duration<double, std::milli>(slowest).count(), "ms");
+    bench_report(name, "compacted", static_cast<double>(raw), "rows");
+    bench_report(name, "evicted", static_cast<double>(dropped), "rows");
+    bench_report(name, "bytes", static_cast<double>(bytes), "bytes");
+
+    // the newest reading is still raw, the bound holds within a step
+    auto const newest = std::any_of(last.begin(), last.end(), [&](auto const & r) {
+        return r.series_ == 0 && r.time_ == t0 + static_cast<time_t>((rows - 1) / 2);
+    });
+    if (bytes > max_bytes + max_bytes / 20 || raw == 0 || !newest || (dropped != 0) != may_evict)
+    {
+        fprintf(stderr, "%s: %zu of %zu bytes, %zu compacted, %zu evicted, newest %s\n",
+                name, bytes, max_bytes, raw, dropped, newest ? "kept" : "lost");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+/**
+ * @brief compaction & eviction of a bounded backlog while influxdb is down
+ */
+int main(int argc, char ** argv)
+{
+    auto const rows = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000ul;
+    std::filesystem::path const dir = argc > 2 ? argv[2] : "/tmp/w1_therm_bench_budget";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    auto ok = check_compact(dir);
+    ok = check_split_window(dir) && ok;
+    ok = run("budget.compact", dir, rows, 1 << 20, false) && ok;
+    ok = run("budget.evict", dir, rows, 64 << 10, true) && ok;
+
+    std::filesystem::remove_all(dir);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
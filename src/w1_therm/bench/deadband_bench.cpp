@@ -0,0 +1,102 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "deadband.h"
+
+namespace
+{
+
+/**
+ * @brief what passes the band, the heartbeat and a per-sensor delta
+ */
+bool check_filter()
+{
+    deadband filter{ { 0.1, std::chrono::seconds{ 60 } }, { { "28-b", 1.0 } } };
+    struct step { const char * id_; double value_; time_t time_; bool pass_; };
+    step const steps[] = {
+        { "28-a", 21.0, 0, true },      // the first reading of a sensor
+        { "28-a", 21.0625, 10, false }, // one DS18B20 step of noise
+        { "28-a", 20.9375, 20, false },
+        { "28-a", 21.125, 30, true },   // out of the band of 21.0
+        { "28-a", 21.1875, 40, false }, // a slow drift, 0.0625 from 21.125
+        { "28-a", 21.25, 50, true },    // adds up to more than the delta
+        { "28-a", 21.25, 109, false },
+        { "28-a", 21.25, 110, true },   // the heartbeat
+        { "28-a", 21.25, 100, true },   // the clock stepped back
+        { "28-b", 30.0, 0, true },
+        { "28-b", 30.75, 10, false },   // within its own delta of 1
+        { "28-b", 31.5, 20, true },
+        { "28-a", NAN, 120, true },     // never hide a broken reading
+    };
+
+    auto ok = true;
+    for (auto const & s : steps)
+    {
+        if (filter.pass(s.id_, s.value_, s.time_) != s.pass_)
+        {
+            fprintf(stderr, "deadband_bench: %s %g at %ld should %s\n", s.id_, s.value_,
+                    static_cast<long>(s.time_), s.pass_ ? "pass" : "be suppressed");
+            ok = false;
+        }
+    }
+    return ok && filter.readings() == std::size(steps) && filter.suppressed() == 5;
+}
+
+} // namespace
+
+/**
+ * @brief suppression ratio over a day of a room sampled every 10 s, and the
+ *        cost of the filter per reading
+ */
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000ul;
+    auto ok = check_filter();
+
+    // a room drifting by a degree over the day, read through the 1/16 degree
+    // quantization of the DS18B20 with a step of noise now and then
+    std::vector<std::string> ids;
+    size_t const sensors = 10;
+    for (size_t i = 0; i < sensors; ++i)
+        ids.push_back("28-00000000000" + std::to_string(i));
+    std::mt19937 rng{ 1 };
+    std::uniform_int_distribution<int> noise{ -1, 1 };
+    auto const room = [&](size_t s, time_t t) {
+        auto const celsius = 21 + 0.5 * std::sin(2 * M_PI * static_cast<double>(t) / 86400 + static_cast<double>(s));
+        return std::round(celsius * 16 + noise(rng) * (rng() % 4 == 0)) / 16;
+    };
+
+    for (auto const delta : { 0.0, 0.1, 0.25 })
+    {
+        deadband filter{ { delta, std::chrono::seconds{ 900 } } };
+        size_t passed = 0;
+        for (time_t t = 0; t < 86400; t += 10)
+        {
+            for (size_t s = 0; s < sensors; ++s)
+                passed += filter.pass(ids[s], room(s, t), t);
+        }
+
+        auto const name = "deadband.day." + std::to_string(delta).substr(0, 4);
+        bench_report(name.c_str(), "suppression", filter.ratio() * 100, "%");
+        bench_report(name.c_str(), "points", double(passed), "points/day");
+    }
+
+    deadband filter{ { 0.1, std::chrono::seconds{ 900 } } };
+    std::vector<double> values(4096);
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i] = room(i % sensors, static_cast<time_t>(i * 10));
+    size_t passed = 0;
+    auto const t = bench_seconds([&] {
+        for (size_t i = 0; i < count; ++i)
+            passed += filter.pass(ids[i % sensors], values[i % values.size()], static_cast<time_t>(i / sensors * 10));
+    });
+    bench_report("deadband.pass", "latency", t / count * 1e9, "ns/reading");
+
+    return ok && passed != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,69 @@
+#include <cstdlib>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "event_loop.h"
+#include "http_stub.h"
+#include "storage.h"
+
+/**
+ * @brief fill the backlog as if influxdb was down, then time how long the
+ *        next storage_t::insert takes to drain it to a local stand-in server
+ */
+template <typename Backlog>
+static bool run(const char * name, const std::filesystem::path & path, http_stub & server, size_t count)
+{
+    {
+        Backlog offline{ path.c_str() };
+        for (size_t i = 0; i < count; ++i)
+            offline.insert(i % 2 ? "kitchen" : "living-room", 20 + i / 64.0, static_cast<time_t>(1700000000 + i));
+        offline.flush();
+    }
+
+    storage_t storage{ Backlog{ path.c_str() },
+                       influx_storage{ server.host(), "org", "bucket", "token", "home", "temperature" } };
+
+    event_loop loop;
+    loop.add(storage.fd(), EPOLLIN, [&](uint32_t) { storage.on_ready(); });
+
+    auto const requests = server.requests();
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::minutes{ 1 };
+    auto const seconds = bench_seconds([&] {
+        // the next sample starts the drain, the completions carry it on
+        storage.insert("kitchen", 21, 1800000000);
+        while ((storage.backlogged() || storage.influx_.in_flight() != 0) &&
+               std::chrono::steady_clock::now() < deadline)
+            loop.run_once(100);
+        storage.flush();
+    });
+
+    std::vector<backlog_record> rows;
+    if (storage.backlog([&](auto & b) { return b.select(0, 1, rows); }) != 0)
+        return false;
+
+    bench_report(name, "drain", (count + 1) / seconds, "records/s");
+    bench_report(name, "requests", double(server.requests() - requests), "count");
+    bench_report(name, "final batch budget", double(storage.budget_.bytes()), "bytes");
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000ul;
+    std::filesystem::path const dir = argc > 2 ? argv[2] : "/tmp/w1_therm_bench_drain";
+
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    http_stub server;
+    auto const ok =
+        run<sqlite_storage>("storage.drain.sqlite", dir / "bench.db", server, count) &&
+        run<spool_storage>("storage.drain.spool", dir / "spool", server, count);
+
+    std::filesystem::remove_all(dir);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
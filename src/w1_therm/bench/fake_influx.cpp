@@ -0,0 +1,79 @@
+#include <getopt.h>
+#include <pthread.h>
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+#include "bench.h"
+#include "fake_influx.h"
+
+/**
+ * @brief run the stand-in server until SIGINT or SIGTERM, then print its stats
+ *
+ * Point the daemon at it with `influx 127.0.0.1:<port>/org/bucket/token`.
+ */
+int main(int argc, char ** argv)
+{
+    fake_influx::options opt;
+    opt.port_ = 8086;
+
+    static option const longopts[] = {
+        { "port", required_argument, nullptr, 'p' },
+        { "latency", required_argument, nullptr, 'l' },
+        { "error-rate", required_argument, nullptr, 'e' },
+        { "throttle-rate", required_argument, nullptr, 't' },
+        { "unavailable-rate", required_argument, nullptr, 'u' },
+        { "reset-rate", required_argument, nullptr, 'r' },
+        { "retry-after", required_argument, nullptr, 'a' },
+        { "read-rate", required_argument, nullptr, 's' },
+        { "seed", required_argument, nullptr, 'x' },
+        { nullptr, 0, nullptr, 0 },
+    };
+
+    for (int r; (r = getopt_long(argc, argv, "", longopts, nullptr)) != -1; )
+    {
+        switch (r)
+        {
+        case 'p': opt.port_ = static_cast<uint16_t>(strtoul(optarg, nullptr, 10)); break;
+        case 'l': opt.latency_ = std::chrono::milliseconds{ strtoul(optarg, nullptr, 10) }; break;
+        case 'e': opt.error_rate_ = strtod(optarg, nullptr); break;
+        case 't': opt.throttle_rate_ = strtod(optarg, nullptr); break;
+        case 'u': opt.unavailable_rate_ = strtod(optarg, nullptr); break;
+        case 'r': opt.reset_rate_ = strtod(optarg, nullptr); break;
+        case 'a': opt.retry_after_ = static_cast<unsigned>(strtoul(optarg, nullptr, 10)); break;
+        case 's': opt.read_rate_ = strtoul(optarg, nullptr, 10); break;
+        case 'x': opt.seed_ = static_cast<unsigned>(strtoul(optarg, nullptr, 10)); break;
+        default:
+            fprintf(stderr, "usage: %s [--port 8086] [--latency ms] [--error-rate r] [--throttle-rate r]\n"
+                            "  [--unavailable-rate r] [--reset-rate r] [--retry-after s] [--read-rate bytes/s] [--seed n]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // blocked before the server threads start, so only sigwait sees them
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    fake_influx server{ opt };
+    fprintf(stderr, "fake influxdb listening on %s\n", server.host().c_str());
+
+    int sig;
+    sigwait(&set, &sig);
+
+    auto const s = server.snapshot();
+    bench_report("fake_influx", "connections", double(s.connections_), "count");
+    bench_report("fake_influx", "writes", double(s.writes_), "count");
+    bench_report("fake_influx", "errors", double(s.errors_), "count");
+    bench_report("fake_influx", "throttled", double(s.throttled_), "count");
+    bench_report("fake_influx", "unavailable", double(s.unavailable_), "count");
+    bench_report("fake_influx", "resets", double(s.resets_), "count");
+    bench_report("fake_influx", "points", double(s.points_), "count");
+    bench_report("fake_influx", "unique points", double(server.unique_points()), "count");
+    bench_report("fake_influx", "duplicates", double(s.duplicates_), "count");
+    return EXIT_SUCCESS;
+}
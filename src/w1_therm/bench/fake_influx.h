@@ -0,0 +1,364 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief stand-in for influxdb v2 with fault injection & delivery accounting
+ *
+ * Serves `/ping`, `/api/v2/buckets` and `/api/v2/write` over HTTP/1.1 with
+ * keep-alive, one thread per connection. Each write draws at most one fault:
+ * a reset connection, a 500, or a 429 or 503 with Retry-After. A write that
+ * draws none is accepted and each of its lines is remembered by hash, so lost
+ * and duplicated points show up in the stats. Point influx_storage at host().
+ */
+class fake_influx
+{
+public:
+    /**
+     * @brief latency & fault rates, the rates are per write and add up to at most 1
+     */
+    struct options
+    {
+        uint16_t                  port_{ 0 };             ///< 0 picks a free port
+        std::chrono::milliseconds latency_{ 0 };          ///< before a write is answered
+        double                    error_rate_{ 0 };       ///< writes answered 500
+        double                    throttle_rate_{ 0 };    ///< writes answered 429
+        double                    unavailable_rate_{ 0 }; ///< writes answered 503
+        double                    reset_rate_{ 0 };       ///< writes whose connection is reset
+        unsigned                  retry_after_{ 1 };      ///< Retry-After of 429 & 503, in seconds
+        size_t                    read_rate_{ 0 };        ///< bytes/s a body is read at, 0 unlimited
+        unsigned                  seed_{ 1 };             ///< of the fault draws
+    };
+
+    struct stats
+    {
+        size_t connections_{ 0 };
+        size_t writes_{ 0 };      ///< accepted writes
+        size_t errors_{ 0 };      ///< writes answered 500
+        size_t throttled_{ 0 };   ///< writes answered 429
+        size_t unavailable_{ 0 }; ///< writes answered 503
+        size_t resets_{ 0 };      ///< writes answered by a reset
+        size_t points_{ 0 };      ///< points of the accepted writes, duplicates included
+        size_t duplicates_{ 0 };  ///< points accepted before
+        size_t bytes_{ 0 };       ///< body bytes received, as sent
+    };
+
+    fake_influx() : fake_influx(options{ }) { }
+
+    explicit fake_influx(const options & opt)
+        : options_{ opt }
+        , rng_{ opt.seed_ }
+    {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0)
+            throw std::runtime_error{ "socket failed" };
+
+        int const on = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+        if (opt.read_rate_ != 0)
+        {
+            // a small window lets the slow reads push back on the sender
+            int const window = 16384;
+            setsockopt(listen_fd_, SOL_SOCKET, SO_RCVBUF, &window, sizeof window);
+        }
+
+        sockaddr_in addr{ };
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(opt.port_);
+        socklen_t len = sizeof addr;
+        if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), len) != 0 ||
+            listen(listen_fd_, 64) != 0 ||
+            getsockname(listen_fd_, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+        {
+            close(listen_fd_);
+            throw std::runtime_error{ "cannot listen" };
+        }
+
+        host_ = "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+        acceptor_ = std::thread{ [this] { accept_run(); } };
+    }
+
+    fake_influx(const fake_influx &) = delete;
+
+    ~fake_influx()
+    {
+        shutdown(listen_fd_, SHUT_RDWR);
+        acceptor_.join();
+        close(listen_fd_);
+
+        {
+            std::lock_guard<std::mutex> lock{ mutex_ };
+            stopping_ = true;
+            for (auto const fd : clients_) shutdown(fd, SHUT_RDWR);
+        }
+
+        for (auto & t : workers_) t.join();
+    }
+
+    fake_influx & operator=(const fake_influx &) = delete;
+
+    const std::string & host() const { return host_; }
+
+    stats snapshot() const
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        return stats_;
+    }
+
+    /**
+     * @brief distinct points accepted
+     */
+    size_t unique_points() const
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        return seen_.size();
+    }
+
+    /**
+     * @brief whether a line of line protocol was accepted, without its newline
+     */
+    bool contains(std::string_view line) const
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        return seen_.count(std::hash<std::string_view>{ }(line)) != 0;
+    }
+
+private:
+    enum class fault { none, reset, error, throttle, unavailable };
+
+    void accept_run()
+    {
+        for (int fd; (fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC)) >= 0; )
+        {
+            std::lock_guard<std::mutex> lock{ mutex_ };
+            if (stopping_)
+            {
+                close(fd);
+                break;
+            }
+            ++stats_.connections_;
+            clients_.insert(fd);
+            workers_.emplace_back([this, fd] { serve(fd); });
+        }
+    }
+
+    fault draw()
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        auto x = std::uniform_real_distribution<double>{ 0, 1 }(rng_);
+        for (auto const & [rate, f] : { std::pair{ options_.reset_rate_, fault::reset },
+                                      std::pair{ options_.error_rate_, fault::error },
+                                      std::pair{ options_.throttle_rate_, fault::throttle },
+                                      std::pair{ options_.unavailable_rate_, fault::unavailable } })
+        {
+            if (x < rate) return f;
+            x -= rate;
+        }
+        return fault::none;
+    }
+
+    /**
+     * @brief read until buf holds want bytes, at read_rate_ if it is set
+     */
+    bool fill(int fd, std::string & buf, size_t want, bool throttled)
+    {
+        char tmp[16384];
+        auto const slow = throttled && options_.read_rate_ != 0;
+        auto const step = slow ? std::clamp<size_t>(options_.read_rate_ / 100, 1, sizeof tmp) : sizeof tmp;
+        while (buf.size() < want)
+        {
+            auto const n = read(fd, tmp, step);
+            if (n <= 0) return false;
+            buf.append(tmp, static_cast<size_t>(n));
+            if (slow)
+                std::this_thread::sleep_for(std::chrono::microseconds{ static_cast<size_t>(n) * 1000000 / options_.read_rate_ });
+        }
+        return true;
+    }
+
+    void serve(int fd)
+    {
+        std::string buf;
+        for (;;)
+        {
+            size_t head_end;
+            while ((head_end = buf.find("\r\n\r\n")) == std::string::npos)
+                if (!fill(fd, buf, buf.size() + 1, false)) goto done;
+
+            {
+                // a copy, reading the body may move buf
+                std::string const head{ buf.data(), head_end };
+                size_t body_len = 0;
+                bool gzip = false;
+                for (size_t pos = 0; (pos = head.find("\r\n", pos)) != std::string::npos; )
+                {
+                    pos += 2;
+                    if (strncasecmp(head.c_str() + pos, "content-length:", 15) == 0)
+                        body_len = strtoul(head.c_str() + pos + 15, nullptr, 10);
+                    else if (strncasecmp(head.c_str() + pos, "content-encoding: gzip", 22) == 0)
+                        gzip = true;
+                }
+
+                auto const write = head.starts_with("POST /api/v2/write");
+                auto const total = head_end + 4 + body_len;
+                if (!fill(fd, buf, total, write)) goto done;
+
+                std::string_view const body{ buf.data() + head_end + 4, body_len };
+                if (!respond(fd, head, write, gzip, body)) goto done;
+                buf.erase(0, total);
+            }
+        }
+
+    done:
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        clients_.erase(fd);
+        close(fd);
+    }
+
+    bool respond(int fd, std::string_view head, bool write, bool gzip, std::string_view body)
+    {
+        if (!write)
+        {
+            if (head.starts_with("GET /api/v2/buckets"))
+            {
+                auto const bgn = head.find("name=") + 5;
+                auto const end = head.find_first_of("& ", bgn);
+                std::string json = "{\"buckets\":[{\"name\":\"";
+                json.append(head.substr(bgn, end - bgn));
+                json += "\"}]}";
+                return send_all(fd, "200 OK", "Content-Type: application/json\r\n", json);
+            }
+            if (head.starts_with("GET /ping") || head.starts_with("HEAD /ping"))
+                return send_all(fd, "204 No Content", "", "");
+            return send_all(fd, "404 Not Found", "", "");
+        }
+
+        auto const f = draw();
+        if (f == fault::reset)
+        {
+            // RST instead of FIN, the client sees a broken connection
+            linger const abort{ 1, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_LINGER, &abort, sizeof abort);
+            std::lock_guard<std::mutex> lock{ mutex_ };
+            ++stats_.resets_;
+            return false;
+        }
+
+        if (options_.latency_.count() != 0)
+            std::this_thread::sleep_for(options_.latency_);
+
+        auto const retry_after = "Retry-After: " + std::to_string(options_.retry_after_) + "\r\n";
+        switch (f)
+        {
+        case fault::error:
+            count(stats_.errors_);
+            return send_all(fd, "500 Internal Server Error", "", "");
+        case fault::throttle:
+            count(stats_.throttled_);
+            return send_all(fd, "429 Too Many Requests", retry_after, "");
+        case fault::unavailable:
+            count(stats_.unavailable_);
+            return send_all(fd, "503 Service Unavailable", retry_after, "");
+        default:
+            break;
+        }
+
+        std::string plain;
+        if (gzip && !gunzip(body, plain))
+            return send_all(fd, "400 Bad Request", "", "{\"code\":\"invalid\",\"message\":\"bad gzip\"}");
+        accept(gzip ? plain : body, body.size());
+        return send_all(fd, "204 No Content", "", "");
+    }
+
+    void count(size_t & counter)
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        ++counter;
+    }
+
+    void accept(std::string_view text, size_t wire_bytes)
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        ++stats_.writes_;
+        stats_.bytes_ += wire_bytes;
+        while (!text.empty())
+        {
+            auto const eol = text.find('\n');
+            auto const line = text.substr(0, eol);
+            text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+            if (line.empty()) continue;
+
+            ++stats_.points_;
+            if (!seen_.insert(std::hash<std::string_view>{ }(line)).second)
+                ++stats_.duplicates_;
+        }
+    }
+
+    static bool gunzip(std::string_view in, std::string & out)
+    {
+        z_stream zs{ };
+        if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+            return false;
+
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+        zs.avail_in = static_cast<uInt>(in.size());
+        int rc;
+        do
+        {
+            char tmp[65536];
+            zs.next_out = reinterpret_cast<Bytef *>(tmp);
+            zs.avail_out = sizeof tmp;
+            rc = inflate(&zs, Z_NO_FLUSH);
+            out.append(tmp, sizeof tmp - zs.avail_out);
+        } while (rc == Z_OK);
+
+        inflateEnd(&zs);
+        return rc == Z_STREAM_END;
+    }
+
+    static bool send_all(int fd, std::string_view status, std::string_view headers, std::string_view body)
+    {
+        std::string rsp{ "HTTP/1.1 " };
+        rsp.append(status).append("\r\n").append(headers);
+        rsp += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        rsp.append(body);
+        // the client may have timed out and gone
+        return send(fd, rsp.data(), rsp.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(rsp.size());
+    }
+
+private:
+    options                    options_;
+    int                        listen_fd_{ -1 };
+    std::string                host_{ };
+    std::thread                acceptor_{ };
+    mutable std::mutex         mutex_{ };
+    std::minstd_rand           rng_;
+    std::set<int>              clients_{ };
+    std::vector<std::thread>   workers_{ };
+    std::unordered_set<size_t> seen_{ };          ///< hashes of the accepted lines
+    stats                      stats_{ };
+    bool                       stopping_{ false };
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdio>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief a fake `/sys/bus/w1/devices` tree in a scratch directory
+ *
+ * Like sysfs, each sensor is a `28-*` directory in the master directory
+ * `w1_bus_master1`, linked from the root. It holds a `w1_slave` dump in the
+ * format of the w1_therm kernel driver, a `resolution` attribute and
+ * optionally a `temperature` attribute.
+ */
+class fake_w1
+{
+public:
+    explicit fake_w1(std::filesystem::path root)
+        : root_{ std::move(root) }
+    {
+        std::filesystem::remove_all(root_);
+        std::filesystem::create_directories(master());
+    }
+
+    fake_w1(const fake_w1 &) = delete;
+
+    ~fake_w1()
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(root_, ec);
+    }
+
+    fake_w1 & operator=(const fake_w1 &) = delete;
+
+    const std::filesystem::path & root() const { return root_; }
+
+    std::filesystem::path master() const { return root_ / "w1_bus_master1"; }
+
+    std::filesystem::path slave_path(const std::string & id) const { return root_ / id / "w1_slave"; }
+
+    /**
+     * @brief add or update a sensor reading milli_celsius, crc_ok false dumps a CRC failure
+     */
+    void set(const std::string & id, int milli_celsius, bool crc_ok = true)
+    {
+        add(id);
+        auto const fp = fopen(slave_path(id).c_str(), "w");
+        if (!fp)
+            throw std::runtime_error{ "cannot write " + slave_path(id).string() };
+        fprintf(fp, "72 01 4b 46 7f ff 0e 10 57 : crc=57 %s\n", crc_ok ? "YES" : "NO");
+        fprintf(fp, "72 01 4b 46 7f ff 0e 10 57 t=%d\n", milli_celsius);
+        fclose(fp);
+    }
+
+    /**
+     * @brief add or update the `temperature` attribute of newer kernels
+     */
+    void set_temperature(const std::string & id, int milli_celsius)
+    {
+        add(id);
+        write(master() / id / "temperature", std::to_string(milli_celsius) + "\n");
+    }
+
+    /**
+     * @brief give the master the `therm_bulk_read` attribute of newer kernels
+     */
+    void enable_bulk_read() { write(master() / "therm_bulk_read", "0\n"); }
+
+    /**
+     * @brief content of an attribute, of the master if id is empty
+     */
+    std::string attribute(const std::string & id, const char * name) const
+    {
+        std::ifstream in{ (id.empty() ? master() : master() / id) / name };
+        std::ostringstream text;
+        text << in.rdbuf();
+        return text.str();
+    }
+
+    void remove(const std::string & id)
+    {
+        std::filesystem::remove(root_ / id);
+        std::filesystem::remove_all(master() / id);
+    }
+
+private:
+    void add(const std::string & id)
+    {
+        if (std::filesystem::exists(master() / id))
+            return;
+        std::filesystem::create_directories(master() / id);
+        std::filesystem::create_directory_symlink(master() / id, root_ / id);
+        write(master() / id / "resolution", "12\n");
+    }
+
+    static void write(const std::filesystem::path & path, const std::string & text)
+    {
+        std::ofstream out{ path, std::ios::trunc };
+        if (!(out << text))
+            throw std::runtime_error{ "cannot write " + path.string() };
+    }
+
+private:
+    std::filesystem::path root_;
+};
@@ -0,0 +1,287 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "file_sink.h"
+#include "series.h"
+#include "socket_sink.h"
+#include "uploader.h"
+
+namespace
+{
+
+/**
+ * @brief counts what it is given, sleeping per sample like a sink on a slow uplink
+ */
+class counting_sink : public sink
+{
+public:
+    counting_sink(const char * name, std::chrono::microseconds delay) : name_{ name }, delay_{ delay } { }
+
+    const char * name() const override { return name_; }
+
+    void write(const sample &) override
+    {
+        if (delay_.count() != 0) std::this_thread::sleep_for(delay_);
+        written_.fetch_add(1, std::memory_order_release);
+    }
+
+    size_t written() const { return written_.load(std::memory_order_acquire); }
+
+private:
+    const char *              name_;
+    std::chrono::microseconds delay_;
+    std::atomic<size_t>       written_{ 0 };
+};
+
+/**
+ * @brief the fast sink keeps up with the sampler while the slow one drops
+ */
+bool check_isolation(size_t count)
+{
+    counting_sink fast{ "fast", std::chrono::microseconds{ 0 } };
+    counting_sink slow{ "slow", std::chrono::microseconds{ 2000 } };
+
+    double seconds = 0;
+    size_t fast_written = 0, slow_dropped = 0;
+    {
+        fanout upload;
+        upload.add(fast, count, overflow_policy::drop_oldest);
+        upload.add(slow, 64, overflow_policy::drop_newest);
+
+        seconds = bench_seconds([&] {
+            for (size_t i = 0; i < count; ++i)
+                upload.push("kitchen", 21.5, static_cast<time_t>(1700000000 + i));
+
+            // the fast sink is done long before the slow one drained its ring
+            auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+            while (fast.written() != count && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::sleep_for(std::chrono::microseconds{ 100 });
+        });
+        fast_written = fast.written();
+        slow_dropped = upload.uploaders()[1]->dropped();
+
+        bench_report("fanout.fast", "push to sink", count / seconds, "samples/s");
+        bench_report("fanout.slow", "dropped", double(slow_dropped), "samples");
+    }
+
+    auto const ok = fast_written == count && slow_dropped != 0 && slow.written() + slow_dropped == count;
+    if (!ok)
+        fprintf(stderr, "fanout_bench: fast sink got %zu of %zu, slow sink dropped %zu and got %zu\n",
+                fast_written, count, slow_dropped, slow.written());
+    return ok;
+}
+
+/**
+ * @brief each sink takes the raw readings, the rollups or both, from the sampler & from a feed alike
+ */
+bool check_output(size_t count)
+{
+    counting_sink raw{ "raw", std::chrono::microseconds{ 0 } };
+    counting_sink rolled{ "rollup", std::chrono::microseconds{ 0 } };
+    counting_sink both{ "both", std::chrono::microseconds{ 0 } };
+
+    bool takes_raw = false;
+    size_t fed = 0;
+    {
+        fanout upload{ 1 };
+        upload.add(rolled, 1024, overflow_policy::drop_newest, nullptr, rollup_output::rollup);
+        takes_raw = upload.takes_raw();
+        upload.add(raw, 1024, overflow_policy::drop_newest, nullptr, rollup_output::raw);
+        upload.add(both, 1024, overflow_policy::drop_newest, nullptr, rollup_output::both);
+
+        // every other sample a rollup, half from the sampler & half as a node's batch
+        std::vector<sample> batch;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto const series = i % 2 ? rollup_series(60, rollup_stat::mean) : 0u;
+            auto const t = static_cast<time_t>(1700000000 + i);
+            if (i < count / 2)
+                upload.push("kitchen", 21.5, t, series);
+            else
+                batch.push_back(make_sample("cellar", 19.5, t, series));
+            if (upload.uploaders()[2]->depth() > 512)
+                std::this_thread::sleep_for(std::chrono::microseconds{ 100 });
+        }
+        for (size_t i = 0; i < batch.size(); i += 256)
+        {
+            auto const n = std::min<size_t>(256, batch.size() - i);
+            fed += upload.feed(0, batch.data() + i, n, std::chrono::seconds{ 5 }) ? n : 0;
+        }
+
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+        while (both.written() != count && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::microseconds{ 100 });
+    }
+
+    auto const rollups = count / 2;
+    auto const ok = !takes_raw && fed == count - count / 2 && both.written() == count &&
+                    rolled.written() == rollups && raw.written() == count - rollups;
+    if (!ok)
+        fprintf(stderr, "fanout_bench: %zu raw, %zu rollup & %zu of %zu to both%s\n", raw.written(),
+                rolled.written(), both.written(), count, takes_raw ? ", a rollup sink takes raw readings" : "");
+    return ok;
+}
+
+/**
+ * @brief the file sink writes one line per sample once its batch is due or flushed
+ */
+bool check_file(const std::filesystem::path & path, size_t count)
+{
+    std::filesystem::remove(path);
+    {
+        file_sink::options opt;
+        opt.batch_lines_ = 100;
+        file_sink file{ path.c_str(), opt };
+        fanout upload;
+        upload.add(file, 1024, overflow_policy::drop_newest);
+
+        auto const seconds = bench_seconds([&] {
+            for (size_t i = 0; i < count; ++i)
+            {
+                upload.push(i % 2 ? "kitchen" : "cellar", 20 + static_cast<double>(i % 64) / 16,
+                            static_cast<time_t>(1700000000 + i));
+                // the file is faster than the sampler of a real bus, never overflow the ring here
+                if (upload.uploaders()[0]->depth() > 512)
+                    std::this_thread::sleep_for(std::chrono::microseconds{ 100 });
+            }
+        });
+        bench_report("fanout.file", "push to file", count / seconds, "samples/s");
+    }
+
+    size_t lines = 0;
+    std::ifstream in{ path };
+    for (std::string line; std::getline(in, line); ++lines)
+    {
+        if (line.rfind("home,name=", 0) != 0)
+        {
+            fprintf(stderr, "fanout_bench: bad line in the file: %s\n", line.c_str());
+            return false;
+        }
+    }
+    std::filesystem::remove(path);
+
+    if (lines != count)
+        fprintf(stderr, "fanout_bench: the file has %zu lines, not %zu\n", lines, count);
+    return lines == count;
+}
+
+/**
+ * @brief the udp sink packs lines below the packet size, every line the kernel took arrives on loopback
+ *
+ * A sink without a listener counts its lines as dropped instead of blocking.
+ */
+bool check_socket(size_t count)
+{
+    unique_fd listener{ ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0) };
+    int const rcvbuf = 8 << 20;
+    setsockopt(listener.get(), SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    sockaddr_in addr{ };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof addr;
+    if (!listener || bind(listener.get(), reinterpret_cast<sockaddr *>(&addr), len) != 0 ||
+        getsockname(listener.get(), reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+    {
+        fprintf(stderr, "fanout_bench: no udp listener on loopback\n");
+        return false;
+    }
+
+    std::atomic<bool> done{ false };
+    size_t received = 0, largest = 0;
+    std::thread reader{ [&] {
+        char buf[65536];
+        pollfd p{ listener.get(), POLLIN, 0 };
+        while (poll(&p, 1, 200) > 0 || !done.load(std::memory_order_acquire))
+        {
+            auto const n = recv(listener.get(), buf, sizeof buf, MSG_DONTWAIT);
+            if (n <= 0) continue;
+            largest = std::max(largest, static_cast<size_t>(n));
+            for (ssize_t i = 0; i < n; ++i)
+                received += buf[i] == '\n';
+        }
+    } };
+
+    socket_sink::options opt;
+    opt.packet_bytes_ = 1400;
+    uint64_t sent = 0, dropped = 0, packets = 0, lost_sent = 0, lost_dropped = 0;
+    {
+        socket_sink udp{ socket_sink::mode::udp, "127.0.0.1:" + std::to_string(ntohs(addr.sin_port)), opt };
+        socket_sink lost{ socket_sink::mode::unix_dgram, "/tmp/w1_therm_bench_nobody.sock", opt };
+        {
+            fanout upload;
+            upload.add(udp, 1024, overflow_policy::drop_newest);
+            upload.add(lost, 1024, overflow_policy::drop_newest);
+
+            auto const seconds = bench_seconds([&] {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    upload.push(i % 2 ? "kitchen" : "cellar", 20 + static_cast<double>(i % 64) / 16,
+                                static_cast<time_t>(1700000000 + i));
+                    if (upload.uploaders()[0]->depth() > 512 || upload.uploaders()[1]->depth() > 512)
+                        std::this_thread::sleep_for(std::chrono::microseconds{ 100 });
+                }
+            });
+            bench_report("fanout.udp", "push to udp", count / seconds, "samples/s");
+        }
+        sent = udp.sent();
+        dropped = udp.dropped();
+        packets = udp.packets();
+        lost_sent = lost.sent();
+        lost_dropped = lost.dropped();
+    }
+    done.store(true, std::memory_order_release);
+    reader.join();
+    bench_report("fanout.udp", "lines per packet", packets ? double(sent) / packets : 0, "lines");
+
+    auto ok = true;
+    if (sent + dropped != count || received != sent)
+    {
+        fprintf(stderr, "fanout_bench: udp sent %llu, dropped %llu, received %zu of %zu\n",
+                static_cast<unsigned long long>(sent), static_cast<unsigned long long>(dropped), received, count);
+        ok = false;
+    }
+    if (largest > opt.packet_bytes_)
+    {
+        fprintf(stderr, "fanout_bench: a udp packet has %zu bytes\n", largest);
+        ok = false;
+    }
+    if (lost_sent != 0 || lost_dropped != count)
+    {
+        fprintf(stderr, "fanout_bench: without a listener %llu sent, %llu dropped\n",
+                static_cast<unsigned long long>(lost_sent), static_cast<unsigned long long>(lost_dropped));
+        ok = false;
+    }
+    return ok;
+}
+
+} // namespace
+
+/**
+ * @brief a slow sink does not hold back a fast one, each takes its output, and the cost of the file & socket sinks
+ */
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000ul;
+    std::filesystem::path const path = argc > 2 ? argv[2] : "/tmp/w1_therm_bench_fanout.lp";
+
+    auto ok = check_isolation(count);
+    ok = check_output(count) && ok;
+    ok = check_file(path, count) && ok;
+    ok = check_socket(count) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,161 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "event_loop.h"
+#include "fake_influx.h"
+#include "storage.h"
+
+/**
+ * @brief a fault profile of the server and the client settings facing it
+ */
+struct scenario
+{
+    const char *              name_;
+    fake_influx::options      server_;
+    size_t                    max_batch_;      ///< largest backlog batch, in bytes
+    std::chrono::milliseconds timeout_;        ///< of a whole request
+    bool                      may_duplicate_;  ///< a timed out write may have landed anyway
+    size_t                    window_{ 1 };    ///< backlog batches in flight at once
+};
+
+static const char * sensor(size_t i) { return i % 2 ? "kitchen" : "living-room"; }
+
+static double value(size_t i) { return 20 + static_cast<double>(i % 1000) / 64; }
+
+/**
+ * @brief buffer rows offline, then drain them while the sampler keeps inserting
+ *
+ * Every point has its own timestamp, so the server must end up with exactly
+ * the rows buffered plus the live ones: none lost, none twice.
+ */
+static bool run(const scenario & sc, const std::filesystem::path & dir, size_t rows)
+{
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    auto const db = (dir / "bench.db").string();
+    time_t constexpr t0 = 1700000000;
+
+    {
+        sqlite_storage offline{ db.c_str() };
+        for (size_t i = 0; i < rows; ++i)
+            offline.insert(sensor(i), value(i), t0 + static_cast<time_t>(i));
+        offline.flush();
+    }
+
+    fake_influx server{ sc.server_ };
+
+    influx_storage::options opt;
+    opt.timeout_ = sc.timeout_;
+    opt.max_in_flight_ = sc.window_;
+    opt.backoff_min_ = std::chrono::milliseconds{ 10 };
+    opt.backoff_max_ = std::chrono::milliseconds{ 200 };
+    batch_options batch;
+    batch.max_bytes_ = sc.max_batch_;
+    storage_t storage{ sqlite_storage{ db.c_str() },
+                       influx_storage{ server.host(), "org", "bucket", "token", "home", "temperature", opt },
+                       batch };
+
+    event_loop loop;
+    loop.add(storage.fd(), EPOLLIN, [&](uint32_t) { storage.on_ready(); });
+
+    // the preloaded rows have the lowest ids, they are gone once the backlog starts past them
+    std::vector<backlog_record> first;
+    auto const preload_drained = [&] {
+        return storage.backlog([&](auto & b) { return b.select(0, 1, first); }) == 0 ||
+               first.front().id_ > static_cast<int64_t>(rows);
+    };
+
+    // a sample a millisecond while the preload drains, a live sample spills
+    // behind a write in flight, then only the kicks a failure stopped drain needs
+    size_t live = 0;
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::minutes{ 10 };
+    auto const seconds = bench_seconds([&] {
+        while (std::chrono::steady_clock::now() < deadline && !preload_drained())
+        {
+            auto const i = rows + live++;
+            storage.insert(sensor(i), value(i), t0 + static_cast<time_t>(i));
+            loop.run_once(1);
+        }
+        while (std::chrono::steady_clock::now() < deadline &&
+               (storage.backlogged() || storage.influx_.in_flight() != 0))
+        {
+            if (storage.influx_.in_flight() == 0)
+            {
+                auto const i = rows + live++;
+                storage.insert(sensor(i), value(i), t0 + static_cast<time_t>(i));
+            }
+            loop.run_once(10);
+        }
+        storage.flush();
+    });
+
+    auto const s = server.snapshot();
+    auto const expected = rows + live;
+    auto const unique = server.unique_points();
+    auto const lost = expected > unique ? expected - unique : 0;
+
+    bench_report(sc.name_, "drain", expected / seconds, "records/s");
+    bench_report(sc.name_, "accepted writes", double(s.writes_), "count");
+    bench_report(sc.name_, "faults", double(s.errors_ + s.throttled_ + s.unavailable_ + s.resets_), "count");
+    bench_report(sc.name_, "lost", double(lost), "points");
+    bench_report(sc.name_, "duplicates", double(s.duplicates_), "points");
+    bench_report(sc.name_, "final batch budget", double(storage.budget_.bytes()), "bytes");
+
+    std::filesystem::remove_all(dir);
+    if (lost != 0 || unique != expected || (s.duplicates_ != 0 && !sc.may_duplicate_))
+    {
+        fprintf(stderr, "%s: expected %zu points, got %zu unique, %zu duplicates\n",
+                sc.name_, expected, unique, s.duplicates_);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    auto const rows = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000ul;
+    std::filesystem::path const dir = argc > 2 ? argv[2] : "/tmp/w1_therm_bench_fault";
+
+    using std::chrono::milliseconds;
+    std::vector<scenario> scenarios;
+
+    fake_influx::options clean;
+    scenarios.push_back({ "fault.clean", clean, 1 << 20, milliseconds{ 10000 }, false });
+
+    fake_influx::options latency;
+    latency.latency_ = milliseconds{ 50 };
+    scenarios.push_back({ "fault.latency_50ms", latency, 1 << 20, milliseconds{ 10000 }, false });
+
+    // the same with batches in flight at once, acknowledged in order
+    scenarios.push_back({ "fault.latency_50ms_window4", latency, 1 << 20, milliseconds{ 10000 }, false, 4 });
+
+    fake_influx::options errors;
+    errors.error_rate_ = 0.05;
+    errors.reset_rate_ = 0.02;
+    scenarios.push_back({ "fault.errors_resets", errors, 64 << 10, milliseconds{ 10000 }, false });
+
+    // the answered batches behind a failed one are posted again with it
+    scenarios.push_back({ "fault.errors_resets_window4", errors, 64 << 10, milliseconds{ 10000 }, true, 4 });
+
+    fake_influx::options throttled;
+    throttled.throttle_rate_ = 0.005;
+    throttled.unavailable_rate_ = 0.005;
+    throttled.retry_after_ = 1;
+    scenarios.push_back({ "fault.retry_after", throttled, 64 << 10, milliseconds{ 10000 }, false });
+
+    // 1 MB batches need 250 ms at this rate, past the timeout until the budget shrinks
+    fake_influx::options slow;
+    slow.read_rate_ = 4 << 20;
+    scenarios.push_back({ "fault.slow_read", slow, 1 << 20, milliseconds{ 200 }, true });
+
+    bool ok = true;
+    for (auto const & sc : scenarios)
+        ok = run(sc, dir, rows) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
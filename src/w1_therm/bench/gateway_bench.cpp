@@ -0,0 +1,394 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "fake_influx.h"
+#include "gateway.h"
+#include "metrics.h"
+#include "series.h"
+#include "storage.h"
+#include "uploader.h"
+
+namespace
+{
+
+/**
+ * @brief counts what it is given and sums the values, to check nothing is lost or altered
+ */
+class counting_sink : public sink
+{
+public:
+    const char * name() const override { return "count"; }
+
+    void write(const sample & s) override
+    {
+        sum_ += s.value_;
+        written_.fetch_add(1, std::memory_order_release);
+    }
+
+    size_t written() const { return written_.load(std::memory_order_acquire); }
+
+    double sum() const { return sum_; }
+
+private:
+    std::atomic<size_t> written_{ 0 };
+    double              sum_{ 0 };
+};
+
+/**
+ * @brief what point_format encodes decodes back to the same sample, anything else is refused
+ */
+bool check_decode()
+{
+    point_format const format{ "home", "temperature" };
+    line_encoder enc;
+    auto ok = true;
+
+    sample const samples[] = {
+        make_sample("28-000001", 21.5, 1700000000),
+        make_sample("kitchen, north=1", -3.25, 1700000060),
+        make_sample("cellar", 19.125, 1700000120, rollup_series(60, rollup_stat::mean)),
+        make_sample("cellar", 42, 1700003600, rollup_series(3600, rollup_stat::count)),
+        make_sample("attic", 30, 1700086400, rollup_series(86400, rollup_stat::max)),
+    };
+    for (auto const & s : samples)
+    {
+        enc.clear();
+        format.encode(enc, s.name_, s.value_, s.time_, s.series_);
+        auto line = enc.view();
+        line.remove_suffix(1);
+
+        sample d;
+        if (!format.decode(line, d) || strcmp(d.name_, s.name_) != 0 || d.value_ != s.value_ ||
+            d.time_ != s.time_ || d.series_ != s.series_)
+        {
+            fprintf(stderr, "gateway_bench: %.*s does not decode back\n", static_cast<int>(line.size()), line.data());
+            ok = false;
+        }
+    }
+
+    char const * const invalid[] = {
+        "",
+        "home",
+        "office,name=a temperature=1 1700000000",
+        "home,name=a temperature=1",
+        "home,name=a temperature=x 1700000000",
+        "home,name=a temperature=1 17000000x",
+        "home,name=a temperature=1,humidity=2 1700000000",
+        "home,name=a,floor=1 temperature=1 1700000000",
+        "home,name=a,window=1m temperature=1 1700000000",
+        "home,name=a temperature_mean=1 1700000000",
+        "home,name=a,window=1y temperature_max=1 1700000000",
+        "home,name=a,window=1m temperature_count=1 1700000000",
+        "home temperature=1 1700000000",
+    };
+    for (auto const line : invalid)
+    {
+        sample d;
+        if (format.decode(line, d))
+        {
+            fprintf(stderr, "gateway_bench: \"%s\" decodes\n", line);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief send count points to the gateway on loopback in writes cutting the lines anywhere
+ */
+bool send_points(uint16_t port, size_t node, size_t count)
+{
+    auto const fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{ };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) != 0)
+    {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    point_format const format{ "home", "temperature" };
+    line_encoder enc{ 64 << 10 };
+    auto const name = "28-" + std::to_string(node);
+    auto ok = true;
+    auto const flush = [&] {
+        // odd sizes, so lines straddle the reads of the gateway
+        for (auto data = enc.view(); ok && !data.empty(); )
+        {
+            auto const n = ::send(fd, data.data(), std::min<size_t>(data.size(), 1000 + node * 7), MSG_NOSIGNAL);
+            if (n <= 0) ok = false;
+            else data.remove_prefix(static_cast<size_t>(n));
+        }
+        enc.clear();
+    };
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        format.encode(enc, name.c_str(), static_cast<double>(i % 64) / 4, static_cast<time_t>(1700000000 + i));
+        if (enc.size() > (32 << 10)) flush();
+    }
+    // one line nobody understands, then a point cut inside its time, as by a reset
+    enc.begin("office").tag("name", name).field("temperature", 1.0).end(1700000000);
+    flush();
+    auto const last = std::string{ "home,name=" } + name + " temperature=1 17000";
+    if (ok && ::send(fd, last.data(), last.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(last.size()))
+        ok = false;
+
+    close(fd);
+    return ok;
+}
+
+/**
+ * @brief many nodes on loopback, every point reaches the sink once and intact, no cut one does
+ */
+bool check_loopback(size_t nodes, size_t count, size_t workers)
+{
+    counting_sink target;
+    fanout upload{ workers };
+    upload.add(target, 1 << 12, overflow_policy::drop_newest);
+
+    gateway::options opt;
+    opt.workers_ = workers;
+    gateway gw{ "127.0.0.1:0", opt, [&](size_t worker, const sample * samples, size_t n) {
+        return upload.feed(worker, samples, n, std::chrono::seconds{ 5 });
+    } };
+
+    auto const total = nodes * count;
+    double expected = 0;
+    for (size_t i = 0; i < count; ++i)
+        expected += static_cast<double>(i % 64) / 4;
+    expected *= static_cast<double>(nodes);
+
+    std::atomic<bool> sent{ true };
+    auto const seconds = bench_seconds([&] {
+        std::vector<std::thread> senders;
+        for (size_t node = 0; node < nodes; ++node)
+            senders.emplace_back([&, node] { if (!send_points(gw.port(), node, count)) sent = false; });
+        for (auto & t : senders)
+            t.join();
+
+        // the last reads & the uploader's ring, bounded so a loss does not hang the check
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+        while ((target.written() < total || gw.clients() != 0) && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    });
+
+    char name[64];
+    snprintf(name, sizeof name, "gateway.loopback_%zux%zu", nodes, workers);
+    bench_report(name, "points", static_cast<double>(gw.points()) / seconds, "points/s");
+
+    auto ok = sent.load();
+    if (!ok)
+        fprintf(stderr, "gateway_bench: a node could not send\n");
+    if (gw.points() != total || gw.dropped() != 0 || target.written() != total || gw.rejected() != 2 * nodes || gw.accepted() != nodes)
+    {
+        fprintf(stderr, "gateway_bench: %llu points, %zu written, %llu rejected, %llu accepted, expected %zu points\n",
+                static_cast<unsigned long long>(gw.points()), target.written(),
+                static_cast<unsigned long long>(gw.rejected()), static_cast<unsigned long long>(gw.accepted()), total);
+        ok = false;
+    }
+    if (std::fabs(target.sum() - expected) > 1e-6 * expected)
+    {
+        fprintf(stderr, "gateway_bench: values sum to %f, not %f\n", target.sum(), expected);
+        ok = false;
+    }
+    return ok;
+}
+
+/**
+ * @brief hands every call to the influxdb sink, noting the most rows its backlog held
+ */
+class backlog_watch : public sink
+{
+public:
+    explicit backlog_watch(storage_t & target) : target_{ target } { }
+
+    const char * name() const override { return target_.name(); }
+
+    void write(const sample & s) override { target_.write(s); note(); }
+
+    int fd() const override { return target_.fd(); }
+
+    void on_ready() override { target_.on_ready(); note(); }
+
+    void tick() override { target_.tick(); note(); }
+
+    std::optional<std::chrono::steady_clock::time_point> deadline() override { return target_.deadline(); }
+
+    void flush() override { target_.flush(); note(); }
+
+    uint64_t sent() const override { return target_.sent(); }
+
+    /**
+     * @brief rows are only settled on a completion, after the call that buffered them
+     */
+    int64_t peak() const { return peak_.load(std::memory_order_acquire); }
+
+private:
+    void note()
+    {
+        auto const rows = global_metrics().backlog_rows_.get();
+        if (rows > peak_.load(std::memory_order_relaxed))
+            peak_.store(rows, std::memory_order_release);
+    }
+
+private:
+    storage_t &          target_;
+    std::atomic<int64_t> peak_{ 0 };
+};
+
+/**
+ * @brief nodes through the gateway to influxdb, the points arriving while writes are in flight go together
+ *
+ * The server answers each write after latency, so without batching every
+ * point would be a write of its own or a detour through the backlog.
+ */
+bool check_influx(const std::filesystem::path & dir, size_t nodes, size_t count, std::chrono::milliseconds latency)
+{
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    auto const db = (dir / "gateway.db").string();
+
+    fake_influx::options opt;
+    opt.latency_ = latency;
+    fake_influx server{ opt };
+
+    auto const total = nodes * count;
+    size_t backlog_rows = 0;
+    int64_t backlog_peak = 0;
+    double seconds = 0;
+    {
+        storage_t storage{ sqlite_storage{ db.c_str() },
+                           influx_storage{ server.host(), "org", "bucket", "token", "home", "temperature", { } } };
+        backlog_watch target{ storage };
+        {
+            fanout upload{ 1 };
+            upload.add(target, 1 << 14, overflow_policy::drop_newest);
+
+            gateway::options gw_opt;
+            gw_opt.workers_ = 1;
+            gateway gw{ "127.0.0.1:0", gw_opt, [&](size_t worker, const sample * samples, size_t n) {
+                return upload.feed(worker, samples, n, std::chrono::seconds{ 5 });
+            } };
+
+            seconds = bench_seconds([&] {
+                std::vector<std::thread> senders;
+                for (size_t node = 0; node < nodes; ++node)
+                    senders.emplace_back([&, node] { send_points(gw.port(), node, count); });
+                for (auto & t : senders)
+                    t.join();
+
+                auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 30 };
+                while (server.unique_points() < total && std::chrono::steady_clock::now() < deadline)
+                    std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+            });
+        }
+        storage.flush();
+        backlog_rows = storage.backlog([](auto & b) { return b.count(); });
+        backlog_peak = target.peak();
+    }
+    std::filesystem::remove_all(dir);
+
+    auto const stats = server.snapshot();
+    auto const per_write = stats.writes_ ? static_cast<double>(stats.points_) / static_cast<double>(stats.writes_) : 0;
+    char name[64];
+    snprintf(name, sizeof name, "gateway.influx_%zux%lldms", nodes, static_cast<long long>(latency.count()));
+    bench_report(name, "points", static_cast<double>(total) / seconds, "points/s");
+    bench_report(name, "points per write", per_write, "points");
+
+    // four writes in flight, a batch per completion, far fewer writes than points & none through the backlog
+    auto const ok = server.unique_points() == total && backlog_rows == 0 && backlog_peak == 0 &&
+                    stats.writes_ * 16 < total;
+    if (!ok)
+        fprintf(stderr, "gateway_bench: influxdb got %zu of %zu points in %zu writes, %lld rows went through the "
+                "backlog & %zu are left\n", server.unique_points(), total, stats.writes_,
+                static_cast<long long>(backlog_peak), backlog_rows);
+    return ok;
+}
+
+/**
+ * @brief takes nothing until released, so the rings fill up
+ */
+class stuck_sink : public sink
+{
+public:
+    const char * name() const override { return "stuck"; }
+
+    void write(const sample &) override
+    {
+        while (!released_.load(std::memory_order_acquire))
+            std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+
+    void release() { released_.store(true, std::memory_order_release); }
+
+private:
+    std::atomic<bool> released_{ false };
+};
+
+/**
+ * @brief a worker whose rings stay full gives the points of its read & its connection up
+ */
+bool check_stall(size_t count)
+{
+    stuck_sink target;
+    fanout upload{ 1 };
+    upload.add(target, 64, overflow_policy::drop_newest);
+
+    gateway::options opt;
+    opt.workers_ = 1;
+    gateway gw{ "127.0.0.1:0", opt, [&](size_t worker, const sample * samples, size_t n) {
+        return upload.feed(worker, samples, n, std::chrono::milliseconds{ 50 });
+    } };
+
+    // the node sees its connection reset, whatever it still had to send is lost
+    send_points(gw.port(), 0, count);
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+    while ((gw.accepted() == 0 || gw.clients() != 0) && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    target.release();
+
+    auto const ok = gw.dropped() != 0 && gw.clients() == 0 && gw.points() + gw.dropped() <= count;
+    if (!ok)
+        fprintf(stderr, "gateway_bench: a stalled worker delivered %llu, dropped %llu, %zu clients left\n",
+                static_cast<unsigned long long>(gw.points()), static_cast<unsigned long long>(gw.dropped()),
+                gw.clients());
+    return ok;
+}
+
+} // namespace
+
+/**
+ * @brief line protocol round trip, then nodes pushing to a gateway on loopback & on to influxdb
+ */
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 50000ul;
+
+    auto ok = check_decode();
+    ok = check_loopback(1, count, 1) && ok;
+    ok = check_loopback(32, count, 4) && ok;
+    ok = check_stall(count) && ok;
+    ok = check_influx("/tmp/w1_therm_bench_gateway", 8, count / 8, std::chrono::milliseconds{ 0 }) && ok;
+    ok = check_influx("/tmp/w1_therm_bench_gateway", 8, count / 8, std::chrono::milliseconds{ 20 }) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
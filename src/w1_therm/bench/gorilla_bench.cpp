@@ -0,0 +1,173 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "bench.h"
+#include "gorilla.h"
+#include "influx_storage.h"
+#include "line_protocol.h"
+
+namespace
+{
+
+struct point
+{
+    time_t time_;
+    double value_;
+};
+
+/**
+ * @brief a room read every interval seconds through the 1/16 degree steps of
+ *        a DS18B20, the timer late by a second now and then
+ */
+std::vector<point> room(size_t count, time_t interval, unsigned seed)
+{
+    std::mt19937 rng{ seed };
+    std::vector<point> points;
+    time_t t = 1700000000;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto const celsius = 21 + 0.5 * std::sin(2 * M_PI * static_cast<double>(t) / 86400);
+        points.push_back({ t + (rng() % 16 == 0), std::round(celsius * 16 + (rng() % 4 == 0)) / 16 });
+        t += interval;
+    }
+    return points;
+}
+
+/**
+ * @brief what a decoder gives back is what was encoded, bit for bit
+ */
+bool round_trip(const char * what, const std::vector<point> & points)
+{
+    gorilla_encoder enc;
+    for (auto const & p : points)
+        enc.append(p.time_, p.value_);
+
+    gorilla_decoder dec{ enc.data(), enc.count() };
+    auto ok = enc.count() == points.size();
+    for (size_t i = 0; ok && i < points.size(); ++i)
+    {
+        time_t time;
+        double value;
+        ok = dec.next(time, value) && time == points[i].time_ &&
+             memcmp(&value, &points[i].value_, sizeof value) == 0;
+    }
+    time_t time;
+    double value;
+    ok = ok && !dec.next(time, value);
+
+    // a truncated stream stops without reading past its end
+    if (ok && enc.data().size() > 1)
+    {
+        gorilla_decoder cut{ enc.data().substr(0, enc.data().size() / 2), enc.count() };
+        size_t n = 0;
+        while (cut.next(time, value)) ++n;
+        ok = n < points.size();
+    }
+
+    if (!ok)
+        fprintf(stderr, "gorilla_bench: %s does not round-trip\n", what);
+    return ok;
+}
+
+bool check_round_trips()
+{
+    auto ok = round_trip("a room", room(10000, 10, 1));
+    ok = round_trip("a single point", { { 1700000000, 21.5 } }) && ok;
+
+    // clock steps of every bucket size, both ways, and absurd times
+    std::vector<point> clock;
+    time_t t = 1700000000;
+    for (int64_t step : { 0, 1, -1, 63, -64, 64, 255, -256, 2047, -2048, 2048, 1 << 20, -(1 << 30), 0, 0 })
+    {
+        t += 300 + step;
+        clock.push_back({ t, 20 });
+    }
+    clock.push_back({ 0, 20 });
+    clock.push_back({ std::numeric_limits<time_t>::max(), 20 });
+    clock.push_back({ std::numeric_limits<time_t>::min(), 20 });
+    ok = round_trip("clock steps", clock) && ok;
+
+    // values a broken sensor or a rollup count may bring
+    std::vector<point> odd;
+    for (double v : { 0.0, -0.0, -55.0, 125.0, double(NAN), double(INFINITY), -double(INFINITY), 1e-300, 85.0, 85.0, 3.0, 21.0625 })
+        odd.push_back({ static_cast<time_t>(1700000000 + odd.size() * 60), v });
+    ok = round_trip("odd values", odd) && ok;
+
+    std::mt19937_64 rng{ 7 };
+    std::vector<point> noise;
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        auto bits = rng();
+        double v;
+        memcpy(&v, &bits, sizeof v);
+        noise.push_back({ static_cast<time_t>(rng() % 4000000000), v });
+    }
+    return round_trip("random bits", noise) && ok;
+}
+
+} // namespace
+
+/**
+ * @brief size of a compressed backlog and the cost of encoding it, decoding
+ *        it and decoding it into line protocol as the drain does
+ */
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000ul;
+    auto ok = check_round_trips();
+
+    // blocks of 1024 points, the default of sqlite_blocks
+    size_t constexpr block = 1024;
+    for (time_t const interval : { 10, 300 })
+    {
+        auto const points = room(count, interval, 3);
+        std::vector<gorilla_encoder> blocks((count + block - 1) / block);
+
+        auto const encode = bench_seconds([&] {
+            for (size_t i = 0; i < count; ++i)
+                blocks[i / block].append(points[i].time_, points[i].value_);
+        });
+        size_t bytes = 0;
+        for (auto const & b : blocks) bytes += b.data().size();
+
+        time_t time;
+        double value;
+        size_t decoded = 0;
+        auto const decode = bench_seconds([&] {
+            for (auto const & b : blocks)
+            {
+                gorilla_decoder dec{ b.data(), b.count() };
+                while (dec.next(time, value)) ++decoded;
+            }
+        });
+
+        influx_storage influx{ "localhost", "org", "bucket", "token", "home", "temperature" };
+        line_encoder enc;
+        auto const drain = bench_seconds([&] {
+            for (auto const & b : blocks)
+            {
+                gorilla_decoder dec{ b.data(), b.count() };
+                while (dec.next(time, value))
+                {
+                    if (enc.size() >= 64 << 10) enc.clear();
+                    influx.prepare_data(enc, "kitchen", value, time);
+                }
+            }
+        });
+
+        auto const name = "gorilla.room_" + std::to_string(interval) + "s";
+        bench_report(name.c_str(), "size", double(bytes) / count, "bytes/point");
+        bench_report(name.c_str(), "encode", count / encode / 1e6, "Mpoints/s");
+        bench_report(name.c_str(), "decode", count / decode / 1e6, "Mpoints/s");
+        bench_report(name.c_str(), "decode to line protocol", count / drain / 1e6, "Mpoints/s");
+        ok = ok && decoded == count;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
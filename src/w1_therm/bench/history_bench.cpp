@@ -0,0 +1,206 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "bench.h"
+#include "history.h"
+#include "metrics_server.h"
+
+namespace
+{
+
+constexpr time_t start = 1700000000;
+
+/**
+ * @brief a day of 30 s sweeps of 64 sensors, then ranges queried raw & downsampled
+ */
+bool bench_query(size_t queries)
+{
+    constexpr size_t sensors = 64, points = 2880;
+    history h{ { points, sensors * points * 8 } };
+
+    std::string names[sensors];
+    for (size_t i = 0; i < sensors; ++i)
+        names[i] = "28-" + std::to_string(100000 + i);
+
+    // two days, the first one is overwritten
+    auto const add = bench_seconds([&] {
+        for (size_t t = 0; t < 2 * points; ++t)
+            for (size_t i = 0; i < sensors; ++i)
+                h.add(names[i].c_str(), static_cast<double>(t % 100) / 4, start + static_cast<time_t>(t * 30));
+    });
+    bench_report("history.add", "latency", add * 1e9 / static_cast<double>(2 * points * sensors), "ns/op");
+
+    std::string out;
+    out.reserve(256 << 10);
+    auto const day = start + static_cast<time_t>(points * 30);
+    auto const last_hour = bench_seconds([&] {
+        for (size_t q = 0; q < queries; ++q)
+        {
+            out.clear();
+            h.query(names[q % sensors], day + 23 * 3600, day + 86400, 0, out);
+        }
+    });
+    bench_report("history.query_hour_raw", "latency", last_hour * 1e6 / static_cast<double>(queries), "us/op");
+
+    auto const whole_day = bench_seconds([&] {
+        for (size_t q = 0; q < queries; ++q)
+        {
+            out.clear();
+            h.query(names[q % sensors], day, day + 86400, 900, out);
+        }
+    });
+    bench_report("history.query_day_15m", "latency", whole_day * 1e6 / static_cast<double>(queries), "us/op");
+
+    if (h.sensors() != sensors || h.size() != sensors * points || h.bytes() != sensors * points * 8)
+    {
+        fprintf(stderr, "history_bench: %zu sensors, %zu points, %zu bytes\n", h.sensors(), h.size(), h.bytes());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief the ring wraps, keeps sorted, ranges & steps are exact, the budget holds
+ */
+bool check_history()
+{
+    auto ok = true;
+    auto const expect = [&](const char * what, const std::string & got, const char * want) {
+        if (got != want)
+        {
+            fprintf(stderr, "history_bench: %s is %s, not %s\n", what, got.c_str(), want);
+            ok = false;
+        }
+    };
+
+    // two rings of 4 readings, the budget rounds down to whole rings
+    history h{ { 4, 4 * 8 * 2 + 7 } };
+    for (time_t t = 0; t < 6; ++t)
+        h.add("a", static_cast<double>(t), start + t * 10);
+    h.add("a", 99, start);                 // older than the last, ignored
+    h.add("b kitchen", 1.5, start);
+    h.add("c", 1, start);                  // no ring left
+
+    std::string out;
+    h.query("a", 0, start + 1000, 0, out);
+    expect("a raw", out, "{\"step\":0,\"points\":[[1700000020,2],[1700000030,3],[1700000040,4],[1700000050,5]]}\n");
+
+    out.clear();
+    h.query("a", start + 30, start + 40, 0, out);
+    expect("a range", out, "{\"step\":0,\"points\":[[1700000030,3],[1700000040,4]]}\n");
+
+    out.clear();
+    h.query("a", 0, start + 1000, 40, out);
+    expect("a 40 s", out, "{\"step\":40,\"points\":[[1700000000,2.5,2,3,2],[1700000040,4.5,4,5,2]]}\n");
+
+    out.clear();
+    expect("answer b", h.answer("name=b+kitchen&from=0&step=60", start + 60, out) ? out : "false",
+           "{\"step\":60,\"points\":[[1699999980,1.5,1.5,1.5,1]]}\n");
+
+    out.clear();
+    expect("answer b encoded", h.answer("name=b%20kitchen&to=1700000059", start + 3600, out) ? out : "false",
+           "{\"step\":0,\"points\":[[1700000000,1.5]]}\n");
+
+    out.clear();
+    expect("answer c", h.answer("name=c", start, out) ? "true" : "false", "false");
+    expect("answer no name", h.answer("from=0", start, out) ? "true" : "false", "false");
+    expect("answer bad step", h.answer("name=a&step=x", start, out) ? "true" : "false", "false");
+    expect("answer bad escape", h.answer("name=a%2", start, out) ? "true" : "false", "false");
+
+    if (h.capacity() != 2 || h.sensors() != 2 || h.size() != 5)
+    {
+        fprintf(stderr, "history_bench: capacity %zu, %zu sensors, %zu points\n", h.capacity(), h.sensors(), h.size());
+        ok = false;
+    }
+    return ok;
+}
+
+/**
+ * @brief GET /history on the metrics server, over its Unix socket
+ */
+bool check_endpoint()
+{
+    history h{ { 16, 1024 } };
+    h.add("kitchen", 21.5, start);
+
+    auto const path = "/tmp/w1_therm_history_bench." + std::to_string(getpid());
+    event_loop loop;
+    metrics_server server{ loop, path, [](std::string & out) { out.append("up 1\n"); } };
+    server.handle("/history", "application/json", [&](std::string_view query, std::string & out)
+    {
+        return h.answer(query, start + 60, out);
+    });
+
+    auto const get = [&](const char * target) {
+        std::string answer;
+        std::atomic<bool> done{ false };
+        std::thread client{ [&] {
+            auto const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_un un{ };
+            un.sun_family = AF_UNIX;
+            strncpy(un.sun_path, path.c_str(), sizeof un.sun_path - 1);
+            if (connect(fd, reinterpret_cast<sockaddr *>(&un), sizeof un) == 0)
+            {
+                auto const request = std::string{ "GET " } + target + " HTTP/1.1\r\nHost: x\r\n\r\n";
+                if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size()))
+                {
+                    char buf[4096];
+                    for (ssize_t n; (n = read(fd, buf, sizeof buf)) > 0; )
+                        answer.append(buf, static_cast<size_t>(n));
+                }
+            }
+            close(fd);
+            done = true;
+        } };
+        while (!done)
+            loop.run_once(10);
+        client.join();
+        return answer;
+    };
+
+    auto ok = true;
+    auto const found = get("/history?name=kitchen");
+    if (!found.starts_with("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n") ||
+        !found.ends_with("\r\n\r\n{\"step\":0,\"points\":[[1700000000,21.5]]}\n"))
+    {
+        fprintf(stderr, "history_bench: GET /history answered %s\n", found.c_str());
+        ok = false;
+    }
+    auto const missing = get("/history?name=attic");
+    if (!missing.starts_with("HTTP/1.1 404 Not Found\r\n"))
+    {
+        fprintf(stderr, "history_bench: GET /history of an unknown sensor answered %s\n", missing.c_str());
+        ok = false;
+    }
+    auto const metrics = get("/metrics");
+    if (!metrics.ends_with("\r\n\r\nup 1\n"))
+    {
+        fprintf(stderr, "history_bench: GET /metrics answered %s\n", metrics.c_str());
+        ok = false;
+    }
+    return ok;
+}
+
+} // namespace
+
+/**
+ * @brief the in-memory history & its endpoint
+ */
+int main(int argc, char ** argv)
+{
+    auto const queries = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000ul;
+
+    auto ok = check_history();
+    ok = check_endpoint() && ok;
+    ok = bench_query(queries) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief stand-in for influxdb on 127.0.0.1
+ *
+ * Speaks just enough HTTP/1.1 with keep-alive: every request to
+ * /api/v2/write is answered with 204, /api/v2/buckets lists the requested
+ * bucket.
+ */
+class http_stub
+{
+public:
+    http_stub()
+    {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0)
+            throw std::runtime_error{ "socket failed" };
+
+        int const on = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+
+        sockaddr_in addr{ };
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof addr;
+        if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), len) != 0 ||
+            listen(listen_fd_, 64) != 0 ||
+            getsockname(listen_fd_, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+        {
+            close(listen_fd_);
+            throw std::runtime_error{ "cannot listen" };
+        }
+
+        host_ = "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+        acceptor_ = std::thread{ [this] { accept_run(); } };
+    }
+
+    http_stub(const http_stub &) = delete;
+
+    ~http_stub()
+    {
+        shutdown(listen_fd_, SHUT_RDWR);
+        acceptor_.join();
+        close(listen_fd_);
+
+        {
+            std::lock_guard<std::mutex> lock{ mutex_ };
+            for (auto const fd : clients_) shutdown(fd, SHUT_RDWR);
+        }
+
+        for (auto & t : workers_) t.join();
+    }
+
+    http_stub & operator=(const http_stub &) = delete;
+
+    const std::string & host() const { return host_; }
+
+    size_t requests() const { return requests_.load(); }
+
+    size_t connections() const { return connections_.load(); }
+
+private:
+    void accept_run()
+    {
+        for (int fd; (fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC)) >= 0; )
+        {
+            ++connections_;
+            std::lock_guard<std::mutex> lock{ mutex_ };
+            clients_.push_back(fd);
+            workers_.emplace_back([this, fd] { serve(fd); });
+        }
+    }
+
+    void serve(int fd)
+    {
+        std::string buf;
+        char tmp[16384];
+
+        for (;;)
+        {
+            auto const head_end = buf.find("\r\n\r\n");
+            if (head_end == std::string::npos)
+            {
+                auto const n = read(fd, tmp, sizeof tmp);
+                if (n <= 0) break;
+                buf.append(tmp, static_cast<size_t>(n));
+                continue;
+            }
+
+            // a copy, reading the body may move buf
+            std::string const head{ buf.data(), head_end };
+            size_t body_len = 0;
+            for (size_t pos = 0; (pos = head.find("\r\n", pos)) != std::string::npos; )
+            {
+                pos += 2;
+                if (strncasecmp(head.c_str() + pos, "content-length:", 15) == 0)
+                    body_len = strtoul(head.data() + pos + 15, nullptr, 10);
+            }
+
+            auto const total = head_end + 4 + body_len;
+            while (buf.size() < total)
+            {
+                auto const n = read(fd, tmp, sizeof tmp);
+                if (n <= 0) goto done;
+                buf.append(tmp, static_cast<size_t>(n));
+            }
+
+            ++requests_;
+            if (!respond(fd, head)) break;
+            buf.erase(0, total);
+        }
+
+    done:
+        close(fd);
+    }
+
+    static bool respond(int fd, std::string_view head)
+    {
+        std::string rsp;
+        if (head.starts_with("GET /api/v2/buckets"))
+        {
+            auto const bgn = head.find("name=") + 5;
+            auto const end = head.find_first_of("& ", bgn);
+            std::string body = "{\"buckets\":[{\"name\":\"";
+            body.append(head.substr(bgn, end - bgn));
+            body += "\"}]}";
+            rsp = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+                + std::to_string(body.size()) + "\r\n\r\n" + body;
+        }
+        else
+        {
+            rsp = "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n";
+        }
+
+        return write(fd, rsp.data(), rsp.size()) == static_cast<ssize_t>(rsp.size());
+    }
+
+private:
+    int                      listen_fd_{ -1 };
+    std::string              host_{ };
+    std::thread              acceptor_{ };
+    std::mutex               mutex_{ };
+    std::vector<int>         clients_{ };
+    std::vector<std::thread> workers_{ };
+    std::atomic<size_t>      requests_{ 0 };
+    std::atomic<size_t>      connections_{ 0 };
+};
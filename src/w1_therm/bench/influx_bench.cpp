@@ -0,0 +1,62 @@
+#include <cstdlib>
+
+#include <algorithm>
+#include <string>
+
+#include "bench.h"
+#include "http_stub.h"
+#include "influx_storage.h"
+
+/**
+ * @brief writes per second to a local stand-in server, one connection per
+ *        write versus one kept-alive session
+ */
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000ul;
+    std::string const line = "home,name=bench temperature=23.125000 1700000000\n";
+
+    http_stub server;
+    auto const make = [&] {
+        return influx_storage{ server.host(), "org", "bucket", "token", "home", "temperature" };
+    };
+
+    // before: a fresh handle, headers and connection for every write
+    auto conns = server.connections();
+    auto const oneshot = bench_seconds([&] {
+        for (size_t i = 0; i < count; ++i) make().insert(line);
+    });
+    bench_report("influx.insert.oneshot", "throughput", count / oneshot, "writes/s");
+    bench_report("influx.insert.oneshot", "connections", double(server.connections() - conns), "count");
+
+    // after: one long-lived session per influx_storage
+    conns = server.connections();
+    auto influx = make();
+    auto const session = bench_seconds([&] {
+        for (size_t i = 0; i < count; ++i) influx.insert(line);
+    });
+    bench_report("influx.insert.session", "throughput", count / session, "writes/s");
+    bench_report("influx.insert.session", "connections", double(server.connections() - conns), "count");
+
+    // backlog batches of 200 points, plain and gzipped
+    line_encoder batch;
+    for (size_t i = 0; i < 200; ++i)
+        influx.prepare_data(batch, i % 2 ? "kitchen" : "living-room", 20 + i / 64.0, 1700000000 + i * 300);
+
+    for (auto const level : { 0, 1, 6 })
+    {
+        influx_storage::options opt;
+        opt.gzip_level_ = level;
+        influx_storage gz{ server.host(), "org", "bucket", "token", "home", "temperature", opt };
+        auto const batches = std::max<size_t>(count / 200, 1);
+        auto const t = bench_seconds([&] {
+            for (size_t i = 0; i < batches; ++i) gz.insert(batch.view());
+        });
+
+        auto const name = "influx.insert.batch.gzip" + std::to_string(level);
+        bench_report(name.c_str(), "throughput", batches * 200 / t, "points/s");
+        bench_report(name.c_str(), "wire", double(gz.bytes_sent()) / (batches * 200), "bytes/point");
+    }
+
+    return influx.is_bucket_exists() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
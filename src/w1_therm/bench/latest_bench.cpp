@@ -0,0 +1,160 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "latest_table.h"
+
+namespace
+{
+
+/**
+ * @brief cost of a publish by the sampler & of a read by a consumer
+ */
+bool bench_publish(const char * shm, size_t sensors, size_t rounds)
+{
+    latest_table table{ shm, sensors };
+    std::vector<std::string> names;
+    for (size_t i = 0; i < sensors; ++i)
+        names.push_back("28-00000" + std::to_string(100000 + i));
+
+    auto const publish = bench_seconds([&] {
+        for (size_t r = 0; r < rounds; ++r)
+            for (auto const & name : names)
+                table.publish(name.c_str(), static_cast<double>(r), static_cast<time_t>(r));
+    });
+    bench_report("latest.publish", "latency", publish * 1e9 / static_cast<double>(rounds * sensors), "ns/op");
+
+    latest_shm::reader reader{ shm };
+    latest_shm::reading r;
+    double sum = 0;
+    auto const read = bench_seconds([&] {
+        for (size_t n = 0; n < rounds; ++n)
+            for (size_t i = 0; i < sensors; ++i)
+                if (reader.read(i, r)) sum += r.value_;
+    });
+    bench_report("latest.read", "latency", read * 1e9 / static_cast<double>(rounds * sensors), "ns/op");
+
+    auto const expected = static_cast<double>(rounds - 1) * static_cast<double>(rounds * sensors);
+    if (reader.size() != sensors || table.size() != sensors || sum != expected)
+    {
+        fprintf(stderr, "latest_bench: %zu slots, read sum %f, expected %zu slots & %f\n",
+                reader.size(), sum, sensors, expected);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief readers spinning on the slots the writer updates never see a torn slot
+ *
+ * The writer keeps value and time equal, and growing; a failed read leaves
+ * the value one behind the time. A reader seeing anything else, or a value
+ * going back, saw half of a store.
+ */
+bool check_consistency(const char * shm, size_t readers, size_t updates)
+{
+    constexpr size_t sensors = 4;
+    latest_table table{ shm, sensors };
+    for (size_t i = 0; i < sensors; ++i)
+        table.publish(("s" + std::to_string(i)).c_str(), 0, 0);
+
+    std::atomic<bool> done{ false };
+    std::atomic<size_t> torn{ 0 };
+    std::atomic<size_t> reads{ 0 };
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < readers; ++t)
+        threads.emplace_back([&] {
+            latest_shm::reader reader{ shm };
+            double last[sensors]{ };
+            size_t n = 0;
+            latest_shm::reading r;
+            while (!done.load(std::memory_order_relaxed))
+            {
+                for (size_t i = 0; i < sensors; ++i, ++n)
+                {
+                    auto const read = reader.read(i, r);
+                    auto const behind = r.status_ == latest_shm::status::failed ? 1 : 0;
+                    if (!read || r.value_ != static_cast<double>(r.time_ - behind) || r.value_ < last[i])
+                        torn.fetch_add(1, std::memory_order_relaxed);
+                    last[i] = r.value_;
+                }
+            }
+            reads.fetch_add(n, std::memory_order_relaxed);
+        });
+
+    for (size_t u = 1; u <= updates; ++u)
+        for (size_t i = 0; i < sensors; ++i)
+        {
+            auto const name = "s" + std::to_string(i);
+            if (u % 7 == 0)
+                table.fail(name.c_str(), static_cast<time_t>(u));
+            else
+                table.publish(name.c_str(), static_cast<double>(u), static_cast<time_t>(u));
+        }
+    done = true;
+    for (auto & t : threads)
+        t.join();
+
+    bench_report("latest.concurrent_reads", "reads", static_cast<double>(reads.load()), "reads");
+    if (torn.load() != 0)
+    {
+        fprintf(stderr, "latest_bench: %zu torn reads of %zu\n", torn.load(), reads.load());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief a table full of sensors leaves the next ones out, a gone writer is seen by its readers
+ */
+bool check_limits(const char * shm)
+{
+    std::optional<latest_shm::reader> reader;
+    {
+        latest_table table{ shm, 2 };
+        table.publish("a", 1, 1);
+        table.fail("b", 2);
+        table.publish("c", 3, 3);
+
+        reader.emplace(shm);
+        latest_shm::reading r;
+        if (table.size() != 2 || reader->size() != 2 || !reader->live() || reader->find("c") ||
+            reader->find("b") != 1u || !reader->read(1, r) || r.status_ != latest_shm::status::failed ||
+            r.name_ != "b" || r.time_ != 2)
+        {
+            fprintf(stderr, "latest_bench: a full table is not as expected\n");
+            return false;
+        }
+    }
+
+    if (reader->live())
+    {
+        fprintf(stderr, "latest_bench: the table is live after its writer is gone\n");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+/**
+ * @brief the shared memory table of the latest readings
+ */
+int main(int argc, char ** argv)
+{
+    auto const updates = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000ul;
+    auto const shm = "/w1_therm_bench." + std::to_string(getpid());
+
+    auto ok = bench_publish(shm.c_str(), 64, 100000);
+    ok = check_consistency(shm.c_str(), 3, updates) && ok;
+    ok = check_limits(shm.c_str()) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
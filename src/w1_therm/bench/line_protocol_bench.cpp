@@ -0,0 +1,106 @@
+#include <cstdlib>
+
+#include <string>
+
+#include "alloc_counter.h"
+#include "bench.h"
+#include "influx_storage.h"
+#include "line_protocol.h"
+
+/**
+ * @brief influx_storage::prepare_data before the line_encoder
+ */
+static void legacy_prepare_data(std::string & data, const std::string & measurement,
+                                const std::string & field, const char * name, double value, time_t now)
+{
+    data += measurement;
+    data += ",name=";
+    data += name;
+    data += ' ';
+    data += field;
+    data += '=';
+    data += std::to_string(value);
+    data += ' ';
+    data += std::to_string(now);
+    data += '\n';
+}
+
+/**
+ * @brief encode points in batches of 200, as the backlog drain does, and one
+ *        at a time, as the single point insert does
+ */
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000ul;
+    constexpr size_t batch = 200;
+    std::string const measurement{ "home" };
+    std::string const field{ "temperature" };
+    auto const value = [](size_t i) { return 20 + static_cast<double>(i % 1000) / 64; };
+    auto const time = [](size_t i) { return static_cast<time_t>(1700000000 + i); };
+    size_t bytes = 0;
+
+    auto report = [&](const char * name, double seconds, size_t allocs) {
+        bench_report(name, "latency", seconds * 1e9 / count, "ns/point");
+        bench_report(name, "allocations", double(allocs) / count, "allocs/point");
+    };
+
+    // legacy, std::string reused between batches
+    {
+        std::string data;
+        auto const allocs = alloc_count();
+        auto const t = bench_seconds([&] {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (i % batch == 0) { bytes += data.size(); data.clear(); }
+                legacy_prepare_data(data, measurement, field, "kitchen", value(i), time(i));
+            }
+        });
+        report("prepare_data.legacy.batch", t, alloc_count() - allocs);
+    }
+
+    // legacy, a fresh std::string per point
+    {
+        auto const allocs = alloc_count();
+        auto const t = bench_seconds([&] {
+            for (size_t i = 0; i < count; ++i)
+            {
+                std::string data;
+                legacy_prepare_data(data, measurement, field, "kitchen", value(i), time(i));
+                bytes += data.size();
+            }
+        });
+        report("prepare_data.legacy.single", t, alloc_count() - allocs);
+    }
+
+    // line_encoder, buffer reused between batches
+    {
+        line_encoder enc;
+        auto const allocs = alloc_count();
+        auto const t = bench_seconds([&] {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (i % batch == 0) { bytes += enc.size(); enc.clear(); }
+                enc.begin(measurement).tag("name", "kitchen").field(field, value(i)).end(time(i));
+            }
+        });
+        report("line_encoder.batch", t, alloc_count() - allocs);
+    }
+
+    // influx_storage::prepare_data on top of the encoder
+    {
+        influx_storage influx{ "localhost", "org", "bucket", "token", measurement, field };
+        line_encoder enc;
+        auto const allocs = alloc_count();
+        auto const t = bench_seconds([&] {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (i % batch == 0) { bytes += enc.size(); enc.clear(); }
+                influx.prepare_data(enc, "kitchen", value(i), time(i));
+            }
+        });
+        report("prepare_data.batch", t, alloc_count() - allocs);
+    }
+
+    // keep the results observable
+    return bytes != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "metrics.h"
+
+/**
+ * @brief cost of the instrumentation on the hot path, alone and with
+ *        threads updating the same histogram, and of rendering a scrape
+ */
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000ul;
+
+    histogram h;
+    auto const observe = bench_seconds([&] {
+        for (size_t i = 0; i < count; ++i)
+            h.observe(std::chrono::microseconds{ static_cast<int64_t>(i & 0xfffff) });
+    });
+    bench_report("metrics.histogram.observe", "latency", observe / count * 1e9, "ns/op");
+
+    // what an instrumented call adds, two clock reads included
+    auto const timing = bench_seconds([&] {
+        for (size_t i = 0; i < count; ++i)
+            timed(h, [] { });
+    });
+    bench_report("metrics.histogram.timed", "latency", timing / count * 1e9, "ns/op");
+
+    counter c;
+    auto const add = bench_seconds([&] {
+        for (size_t i = 0; i < count; ++i) c.add();
+    });
+    bench_report("metrics.counter.add", "latency", add / count * 1e9, "ns/op");
+
+    // the sweep workers share nothing but the storage path histograms
+    unsigned const threads = 4;
+    histogram shared;
+    auto const contended = bench_seconds([&] {
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t)
+            workers.emplace_back([&] {
+                for (size_t i = 0; i < count / threads; ++i)
+                    shared.observe(std::chrono::microseconds{ 1000 });
+            });
+        for (auto & w : workers) w.join();
+    });
+    bench_report("metrics.histogram.observe_4_threads", "latency", contended / count * 1e9, "ns/op");
+
+    std::string out;
+    size_t const scrapes = 10000;
+    auto const render = bench_seconds([&] {
+        for (size_t i = 0; i < scrapes; ++i)
+        {
+            out.clear();
+            global_metrics().render(out);
+        }
+    });
+    bench_report("metrics.render", "latency", render / scrapes * 1e6, "us/scrape");
+    bench_report("metrics.render", "size", double(out.size()), "bytes");
+
+    // relaxed increments from several threads must not lose any
+    out.clear();
+    shared.render(out, "shared", { });
+    auto const expected = "shared_count " + std::to_string(count / threads * threads) + "\n";
+    if (c.get() != count || out.find(expected) == std::string::npos)
+    {
+        fprintf(stderr, "metrics_bench: increments were lost\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
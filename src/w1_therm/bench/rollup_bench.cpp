@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "influx_storage.h"
+#include "line_protocol.h"
+#include "rollup.h"
+
+namespace
+{
+
+struct emitted
+{
+    std::string name_;
+    double      value_;
+    time_t      start_;
+    uint32_t    series_;
+};
+
+/**
+ * @brief the statistics of two known windows, and a sensor that went away
+ */
+bool check_windows()
+{
+    std::vector<emitted> out;
+    rollup r{ { 60 }, [&](const char * name, double value, time_t start, uint32_t series) {
+        out.push_back({ name, value, start, series });
+    } };
+
+    // 60 s windows starting at 1200, readings every 10 s: 1..6 then 10, 20
+    for (int i = 0; i < 6; ++i)
+        r.add("kitchen", 1 + i, 1200 + i * 10);
+    r.add("cellar", 5, 1210);
+    r.add("kitchen", 10, 1260);
+    r.add("kitchen", 20, 1270);
+    r.add("kitchen", 0.0 / 0.0, 1280);
+    r.close_due(1290);
+    r.close_all();
+
+    auto const stat = [](rollup_stat s) { return rollup_series(60, s); };
+    std::vector<emitted> const expected{
+        { "kitchen", 1, 1200, stat(rollup_stat::min) },
+        { "kitchen", 6, 1200, stat(rollup_stat::max) },
+        { "kitchen", 3.5, 1200, stat(rollup_stat::mean) },
+        { "kitchen", 6, 1200, stat(rollup_stat::last) },
+        { "kitchen", 6, 1200, stat(rollup_stat::count) },
+        // cellar had no reading since, close_due closes it on time
+        { "cellar", 5, 1200, stat(rollup_stat::min) },
+        { "cellar", 5, 1200, stat(rollup_stat::max) },
+        { "cellar", 5, 1200, stat(rollup_stat::mean) },
+        { "cellar", 5, 1200, stat(rollup_stat::last) },
+        { "cellar", 1, 1200, stat(rollup_stat::count) },
+        // the partial window at shutdown, the NaN left out
+        { "kitchen", 10, 1260, stat(rollup_stat::min) },
+        { "kitchen", 20, 1260, stat(rollup_stat::max) },
+        { "kitchen", 15, 1260, stat(rollup_stat::mean) },
+        { "kitchen", 20, 1260, stat(rollup_stat::last) },
+        { "kitchen", 2, 1260, stat(rollup_stat::count) },
+    };
+
+    auto ok = out.size() == expected.size();
+    for (size_t i = 0; ok && i < out.size(); ++i)
+    {
+        ok = out[i].name_ == expected[i].name_ && out[i].value_ == expected[i].value_ &&
+             out[i].start_ == expected[i].start_ && out[i].series_ == expected[i].series_;
+    }
+    if (!ok)
+        fprintf(stderr, "rollup_bench: unexpected window statistics\n");
+    return ok;
+}
+
+/**
+ * @brief how a rollup is written in line protocol
+ */
+bool check_encoding(influx_storage & influx)
+{
+    line_encoder enc;
+    influx.prepare_data(enc, "kitchen", 21.5, 1200, rollup_series(900, rollup_stat::max));
+    influx.prepare_data(enc, "kitchen", 6, 1200, rollup_series(3600, rollup_stat::count));
+    influx.prepare_data(enc, "kitchen", 21.5, 1200, 0);
+    auto const ok = enc.view() ==
+        "home,name=kitchen,window=15m temperature_max=21.500000 1200\n"
+        "home,name=kitchen,window=1h temperature_count=6i 1200\n"
+        "home,name=kitchen temperature=21.500000 1200\n";
+    if (!ok)
+        fprintf(stderr, "rollup_bench: unexpected line protocol\n%.*s", static_cast<int>(enc.size()), enc.view().data());
+    return ok;
+}
+
+} // namespace
+
+/**
+ * @brief cost of a reading through the rollups, and the upload volume of a
+ *        day of 10 s sampling, raw against rollups only
+ */
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000ul;
+    auto ok = check_windows();
+
+    influx_storage influx{ "localhost", "org", "bucket", "token", "home", "temperature" };
+    ok = check_encoding(influx) && ok;
+
+    // ten sensors, three windows, nothing emitted leaves the engine
+    size_t const sensors = 10;
+    std::vector<std::string> names;
+    for (size_t i = 0; i < sensors; ++i)
+        names.push_back("sensor-" + std::to_string(i));
+    size_t points = 0;
+    {
+        rollup r{ { 60, 900, 3600 }, [&](const char *, double, time_t, uint32_t) { ++points; } };
+        auto const t = bench_seconds([&] {
+            for (size_t i = 0; i < count; ++i)
+                r.add(names[i % sensors].c_str(), 20 + static_cast<double>(i % 64) / 16,
+                      static_cast<time_t>(1700000000 + i / sensors));
+        });
+        bench_report("rollup.add", "latency", t / count * 1e9, "ns/reading");
+    }
+
+    // a day of readings every 10 s, encoded the way the drain posts them
+    time_t const day = 86400;
+    auto const encode = [&](std::vector<uint32_t> windows, bool raw) {
+        line_encoder enc;
+        size_t bytes = 0, n = 0;
+        auto const post = [&](const char * name, double value, time_t t, uint32_t series) {
+            influx.prepare_data(enc, name, value, t, series);
+            ++n;
+            if (enc.size() >= 64 << 10) { bytes += enc.size(); enc.clear(); }
+        };
+        rollup r{ std::move(windows), post };
+        for (time_t t = 1700000000 - 1700000000 % day; t < 1700000000 - 1700000000 % day + day; t += 10)
+        {
+            r.close_due(t);
+            for (size_t s = 0; s < sensors; ++s)
+            {
+                auto const value = 20 + static_cast<double>((t / 10 + s) % 64) / 16;
+                if (raw) post(names[s].c_str(), value, t, 0);
+                r.add(names[s].c_str(), value, t);
+            }
+        }
+        r.close_all();
+        return std::pair{ bytes + enc.size(), n };
+    };
+    auto const [raw_bytes, raw_points] = encode({ }, true);
+    auto const [rollup_bytes, rollup_points] = encode({ 900, 3600 }, false);
+    bench_report("rollup.day.raw", "points", double(raw_points), "points/day");
+    bench_report("rollup.day.raw", "size", double(raw_bytes), "bytes/day");
+    bench_report("rollup.day.15m_1h", "points", double(rollup_points), "points/day");
+    bench_report("rollup.day.15m_1h", "size", double(rollup_bytes), "bytes/day");
+    bench_report("rollup.day.15m_1h", "reduction", double(raw_bytes) / double(rollup_bytes), "x");
+    auto const [hourly_bytes, hourly_points] = encode({ 3600 }, false);
+    bench_report("rollup.day.1h", "points", double(hourly_points), "points/day");
+    bench_report("rollup.day.1h", "reduction", double(raw_bytes) / double(hourly_bytes), "x");
+
+    return ok && points != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,171 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "bench.h"
+#include "block_storage.h"
+#include "series.h"
+#include "spool_storage.h"
+#include "sqlite_storage.h"
+
+/**
+ * @brief append count records, then drain them a page at a time like the
+ *        backlog drain does, then cycle through both a page at a time
+ */
+template <typename Storage>
+static void run(const char * name, Storage & storage, size_t count)
+{
+    auto const append = bench_seconds([&] {
+        for (size_t i = 0; i < count; ++i)
+            storage.insert("kitchen", 20 + i / 64.0, static_cast<time_t>(1700000000 + i));
+        storage.flush();
+    });
+    bench_report(name, "append", count / append, "records/s");
+    bench_report(name, "size", double(storage.size_bytes()) / count, "bytes/record");
+
+    size_t drained = 0;
+    std::vector<backlog_record> rows;
+    auto const drain = bench_seconds([&] {
+        for (size_t n; (n = storage.select(0, 200, rows)) != 0; )
+        {
+            drained += n;
+            storage.delete_where_id_not_greater_than(rows.back().id_);
+        }
+    });
+    bench_report(name, "drain", drained / drain, "records/s");
+
+    // steady state while the server is down and up again in turns: a page
+    // spills in, the drain selects & deletes it
+    size_t constexpr page = 64;
+    auto const cycles = std::max<size_t>(count / page, 1);
+    auto const cycle = bench_seconds([&] {
+        for (size_t c = 0; c < cycles; ++c)
+        {
+            for (size_t i = 0; i < page; ++i)
+                storage.insert("kitchen", 20 + i / 64.0, static_cast<time_t>(1700000000 + c * page + i));
+            if (storage.select(0, page, rows) != page)
+                exit(EXIT_FAILURE);
+            storage.delete_where_id_not_greater_than(rows.back().id_);
+        }
+        storage.flush();
+    });
+    bench_report(name, "insert/select/delete cycle", cycles / cycle, "cycles/s");
+    bench_report(name, "insert/select/delete cycle", cycles * page / cycle, "records/s");
+}
+
+/**
+ * @brief raw readings & rollups interleaved come back with their series
+ *
+ * Blocks return a series at a time, so the records are compared in time order.
+ */
+template <typename Storage>
+static bool check_series(const char * name, Storage & storage)
+{
+    auto const series = [](size_t i) {
+        return i % 3 == 0 ? 0 : rollup_series(60 * static_cast<uint32_t>(i), static_cast<rollup_stat>(i % 6));
+    };
+    size_t constexpr count = 100;
+    for (size_t i = 0; i < count; ++i)
+        storage.insert(i % 2 ? "kitchen" : "cellar", static_cast<double>(i), static_cast<time_t>(i), series(i));
+    storage.flush();
+
+    std::vector<backlog_record> rows;
+    auto ok = storage.select(0, count, rows) == count;
+    auto const last = ok ? rows.back().id_ : 0;
+    std::sort(rows.begin(), rows.end(), [](auto const & a, auto const & b) { return a.time_ < b.time_; });
+    for (size_t i = 0; ok && i < count; ++i)
+    {
+        ok = rows[i].name_ == (i % 2 ? "kitchen" : "cellar") && rows[i].value_ == static_cast<double>(i) &&
+             rows[i].time_ == static_cast<time_t>(i) && rows[i].series_ == series(i);
+    }
+    if (!ok)
+        fprintf(stderr, "spool_bench: %s lost the series of its records\n", name);
+    else
+        storage.delete_where_id_not_greater_than(last);
+    return ok;
+}
+
+/**
+ * @brief a database written before rollups opens with its rows as raw readings
+ */
+static bool check_sqlite_migration(const std::filesystem::path & path)
+{
+    sqlite3 * db;
+    sqlite3_open(path.c_str(), &db);
+    auto const created = sqlite3_exec(db,
+        "create table tb_therm(id integer primary key autoincrement, name text(64) not null,"
+        " therm integer not null, time integer not null);"
+        "insert into tb_therm (name,therm,time) values ('kitchen',21.5,1700000000)", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+
+    sqlite_storage storage{ path.c_str() };
+    storage.insert("kitchen", 22, 1700000060, rollup_series(60, rollup_stat::max));
+    std::vector<backlog_record> rows;
+    auto const ok = created == SQLITE_OK && storage.select(0, 10, rows) == 2 &&
+                    rows[0].series_ == 0 && rows[0].value_ == 21.5 &&
+                    rows[1].series_ == rollup_series(60, rollup_stat::max);
+    if (!ok)
+        fprintf(stderr, "spool_bench: a database without series did not migrate\n");
+    return ok;
+}
+
+int main(int argc, char ** argv)
+{
+    auto const count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000ul;
+    std::filesystem::path const dir = argc > 2 ? argv[2] : "/tmp/w1_therm_bench";
+
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    auto ok = check_sqlite_migration(dir / "legacy.db");
+
+    {
+        sqlite_storage sqlite{ (dir / "bench.db").c_str() };
+        ok = check_series("sqlite_storage", sqlite) && ok;
+        run("sqlite_storage", sqlite, count);
+    }
+
+    {
+        spool_storage spool{ (dir / "spool").c_str() };
+        ok = check_series("spool_storage", spool) && ok;
+        run("spool_storage", spool, count);
+    }
+
+    {
+        block_storage blocks{ (dir / "blocks.db").c_str() };
+        ok = check_series("block_storage", blocks) && ok;
+        run("block_storage", blocks, count);
+    }
+
+    // rows of the row format move into blocks
+    {
+        {
+            sqlite_storage rows{ (dir / "migrate.db").c_str() };
+            for (size_t i = 0; i < 1000; ++i)
+                rows.insert(i % 2 ? "kitchen" : "cellar", static_cast<double>(i), static_cast<time_t>(i), i % 3);
+        }
+        block_storage blocks{ (dir / "migrate.db").c_str() };
+        std::vector<backlog_record> rows;
+        size_t n = 0, total = 0;
+        for (int64_t last = 0; (n = blocks.select(last, 64, rows)) != 0; last = rows.back().id_)
+        {
+            for (auto const & row : rows)
+                ok = ok && row.value_ == static_cast<double>(row.time_) && row.series_ == row.time_ % 3 &&
+                     row.name_ == (row.time_ % 2 ? "kitchen" : "cellar");
+            total += n;
+        }
+        if (total != 1000 || sqlite_storage{ (dir / "migrate.db").c_str() }.count() != 0)
+            ok = false;
+        if (!ok)
+            fprintf(stderr, "spool_bench: rows did not move into blocks\n");
+    }
+
+    std::filesystem::remove_all(dir);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
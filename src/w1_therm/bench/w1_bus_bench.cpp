@@ -0,0 +1,237 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <memory>
+#include <string>
+
+#include "bench.h"
+#include "fake_w1.h"
+#include "w1_bus.h"
+#include "w1_samples.h"
+
+/**
+ * @brief fail the run if cond does not hold
+ */
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); exit(EXIT_FAILURE); } } while (false)
+
+static const w1_sensor * find(const w1_bus & bus, const std::string & id)
+{
+    for (auto const & s : bus.sensors())
+        if (s.id_ == id) return &s;
+    return nullptr;
+}
+
+/**
+ * @brief scan & sweep against a fake sysfs tree
+ */
+static void check_scan(const char * root)
+{
+    fake_w1 w1{ root };
+    w1.set("28-000000000001", 21500);
+    w1.set("28-000000000002", -1250);
+    w1.set("28-000000000003", 30000, false);
+
+    w1_bus bus{ w1.root().string(), 2 };
+    bus.scan({ { "28-000000000001", "kitchen" } });
+    CHECK(bus.sensors().size() == 3);
+
+    bus.sweep();
+    CHECK(find(bus, "28-000000000001")->name_ == "kitchen");
+    CHECK(find(bus, "28-000000000001")->therm_ == 21500);
+    CHECK(find(bus, "28-000000000002")->name_ == "28-000000000002");
+    CHECK(find(bus, "28-000000000002")->therm_ == -1250);
+    CHECK(!find(bus, "28-000000000003")->therm_);
+
+    // vanished sensors are dropped, new ones are picked up
+    w1.remove("28-000000000002");
+    w1.set("28-000000000004", 18000);
+    bus.scan({ });
+    bus.sweep();
+    CHECK(bus.sensors().size() == 3);
+    CHECK(!find(bus, "28-000000000002"));
+    CHECK(find(bus, "28-000000000004")->therm_ == 18000);
+    CHECK(find(bus, "28-000000000001")->name_ == "28-000000000001");
+}
+
+/**
+ * @brief the reader keeps its fd across samples and prefers the temperature attribute
+ */
+static void check_reader(const char * root)
+{
+    fake_w1 w1{ root };
+    w1.set("28-000000000001", 21500);
+
+    w1_reader reader{ w1.slave_path("28-000000000001").string() };
+    CHECK(reader.read() == 21500);
+
+    // rewritten in place, the open fd sees the new dump
+    w1.set("28-000000000001", 22000);
+    CHECK(reader.read() == 22000);
+    w1.set("28-000000000001", 23000, false);
+    CHECK(!reader.read());
+
+    w1.set("28-000000000002", 10000);
+    w1.set_temperature("28-000000000002", 12345);
+    w1_reader newer{ w1.slave_path("28-000000000002").string() };
+    CHECK(newer.read() == 12345);
+    w1.set_temperature("28-000000000002", -500);
+    CHECK(newer.read() == -500);
+
+    CHECK(!w1_reader{ (w1.root() / "28-000000000003" / "w1_slave").string() }.read());
+}
+
+/**
+ * @brief bulk read triggers the master once per sweep, resolutions reach the sensors
+ */
+static void check_bulk(const char * root)
+{
+    fake_w1 w1{ root };
+    w1.set("28-000000000001", 21500);
+    w1.set("28-000000000002", 19000);
+
+    w1_bus bus{ w1.root().string(), 2 };
+    bus.set_bulk_read(true);
+    bus.set_resolutions({ { "28-000000000001", 9 } });
+    bus.scan({ });
+    CHECK(w1.attribute("28-000000000001", "resolution") == "9");
+    CHECK(w1.attribute("28-000000000002", "resolution") == "12\n");
+
+    // no therm_bulk_read on older kernels, every read converts on its own
+    bus.sweep();
+    CHECK(find(bus, "28-000000000001")->therm_ == 21500);
+
+    w1.enable_bulk_read();
+    w1.set("28-000000000003", 30000);
+    bus.scan({ });
+    bus.sweep();
+    CHECK(w1.attribute("", "therm_bulk_read").starts_with("trigger\n"));
+    CHECK(find(bus, "28-000000000002")->therm_ == 19000);
+    CHECK(find(bus, "28-000000000003")->therm_ == 30000);
+
+    // a sensor added by path is still known by its slave id
+    w1_bus single{ w1.root().string(), 0 };
+    single.set_resolutions({ { "28-000000000002", 10 } });
+    single.add("switch", "switch", w1.slave_path("28-000000000002").string());
+    CHECK(w1.attribute("28-000000000002", "resolution") == "10");
+    CHECK(single.sensors()[0].resolution_ == 10);
+}
+
+/**
+ * @brief the reader before persistent fds: fopen, fscanf & strtol per sample
+ */
+static std::optional<int> stdio_read(const char * path)
+{
+    auto const destroyer = [](FILE * fp) { fclose(fp); };
+    std::unique_ptr<FILE, decltype(destroyer)> const fp{ fopen(path, "r"), destroyer };
+    char buf[256];
+    int len;
+    if (!fp || fscanf(fp.get(), "%255[^\n]%n", buf, &len) != 1 || !std::string_view{ buf, size_t(len) }.ends_with("YES"))
+        return { };
+    fgetc(fp.get());
+    if (fscanf(fp.get(), "%255[^\n]%n", buf, &len) != 1)
+        return { };
+    auto const t = strstr(buf, "t=");
+    if (!t) return { };
+    return static_cast<int>(strtol(t + 2, nullptr, 10));
+}
+
+/**
+ * @brief cost of parsing a dump already in memory
+ */
+static void bench_parse()
+{
+    size_t constexpr rounds = 1000000;
+    auto const & sample = w1_slave_samples[0];
+    long sum = 0;
+    auto const seconds = bench_seconds([&] {
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            std::string_view text{ sample.text_ };
+            asm volatile("" : "+r"(text));
+            sum += w1_slave_parse(text).value_or(0);
+        }
+    });
+    CHECK(sum == static_cast<long>(rounds) * *sample.milli_);
+    bench_report("w1_slave.parse", "latency", seconds / rounds * 1e9, "ns/parse");
+}
+
+/**
+ * @brief cost of one sample: persistent fd, reopening per sample, the stdio reader
+ */
+static void bench_read(const char * root)
+{
+    fake_w1 w1{ root };
+    w1.set("28-000000000001", 21500);
+    auto const path = w1.slave_path("28-000000000001").string();
+
+    size_t constexpr rounds = 100000;
+    w1_reader reader{ path };
+    auto seconds = bench_seconds([&] {
+        for (size_t i = 0; i < rounds; ++i) CHECK(reader.read());
+    });
+    bench_report("w1_slave.read.persistent_fd", "latency", seconds / rounds * 1e6, "us/read");
+
+    seconds = bench_seconds([&] {
+        for (size_t i = 0; i < rounds; ++i) CHECK(w1_slave_read(path.c_str()));
+    });
+    bench_report("w1_slave.read.reopen", "latency", seconds / rounds * 1e6, "us/read");
+
+    seconds = bench_seconds([&] {
+        for (size_t i = 0; i < rounds; ++i) CHECK(stdio_read(path.c_str()));
+    });
+    bench_report("w1_slave.read.stdio", "latency", seconds / rounds * 1e6, "us/read");
+
+    w1.set_temperature("28-000000000001", 21500);
+    w1_reader newer{ path };
+    seconds = bench_seconds([&] {
+        for (size_t i = 0; i < rounds; ++i) CHECK(newer.read());
+    });
+    bench_report("temperature.read.persistent_fd", "latency", seconds / rounds * 1e6, "us/read");
+}
+
+/**
+ * @brief how long one sweep of count sensors takes
+ */
+static void bench_sweep(const char * root, size_t count, size_t workers, bool bulk_read)
+{
+    fake_w1 w1{ root };
+    w1.enable_bulk_read();
+    for (size_t i = 0; i < count; ++i)
+    {
+        char id[32];
+        snprintf(id, sizeof id, "28-%012zx", i);
+        w1.set(id, static_cast<int>(20000 + i));
+    }
+
+    w1_bus bus{ w1.root().string(), workers };
+    bus.set_bulk_read(bulk_read);
+    bus.scan({ });
+    CHECK(bus.sensors().size() == count);
+
+    size_t constexpr rounds = 200;
+    auto const seconds = bench_seconds([&] {
+        for (size_t i = 0; i < rounds; ++i) bus.sweep();
+    });
+    for (auto const & s : bus.sensors()) CHECK(s.therm_);
+
+    auto const name = "w1_bus.sweep." + std::to_string(workers) + "_workers" + (bulk_read ? ".bulk" : "");
+    bench_report(name.c_str(), "latency", seconds / rounds * 1e6, "us/sweep");
+    bench_report(name.c_str(), "max latency", static_cast<double>(bus.max_sweep().count()), "us/sweep");
+}
+
+int main(int argc, char ** argv)
+{
+    auto const root = argc > 1 ? argv[1] : "/tmp/w1_therm_bench_w1";
+
+    check_scan(root);
+    check_reader(root);
+    check_bulk(root);
+    bench_parse();
+    bench_read(root);
+    bench_sweep(root, 32, 0, false);
+    bench_sweep(root, 32, 4, false);
+    bench_sweep(root, 32, 4, true);
+    return EXIT_SUCCESS;
+}
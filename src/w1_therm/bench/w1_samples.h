@@ -0,0 +1,42 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+/**
+ * @brief a dump captured from a sensor and what the parser must make of it
+ */
+struct w1_sample
+{
+    std::string_view   text_;
+    std::optional<int> milli_;
+};
+
+/**
+ * @brief `w1_slave` dumps captured on a Raspberry Pi
+ */
+inline constexpr w1_sample w1_slave_samples[] = {
+    { "4b 01 4b 46 7f ff 05 10 e1 : crc=e1 YES\n4b 01 4b 46 7f ff 05 10 e1 t=20687\n", 20687 },
+    { "5e ff 4b 46 7f ff 02 10 56 : crc=56 YES\n5e ff 4b 46 7f ff 02 10 56 t=-10125\n", -10125 },
+    // power-on reset value, the conversion never ran
+    { "50 05 4b 46 7f ff 0c 10 1c : crc=1c YES\n50 05 4b 46 7f ff 0c 10 1c t=85000\n", 85000 },
+    // the bus read all zeros, the CRC of zeros is zero
+    { "00 00 00 00 00 00 00 00 00 : crc=00 YES\n00 00 00 00 00 00 00 00 00 t=0\n", 0 },
+    // disconnected sensor, data line pulled high
+    { "ff ff ff ff ff ff ff ff ff : crc=c9 NO\nff ff ff ff ff ff ff ff ff t=-62\n", { } },
+    { "72 01 4b 46 7f ff 0e 10 57 : crc=57 NO\n72 01 4b 46 7f ff 0e 10 57 t=23125\n", { } },
+    // the driver gave up before the second line
+    { "72 01 4b 46 7f ff 0e 10 57 : crc=57 YES\n", { } },
+    { "", { } },
+};
+
+/**
+ * @brief `temperature` attribute values captured on a Raspberry Pi
+ */
+inline constexpr w1_sample w1_temperature_samples[] = {
+    { "20687\n", 20687 },
+    { "-10125\n", -10125 },
+    { "0\n", 0 },
+    { "\n", { } },
+    { "", { } },
+};
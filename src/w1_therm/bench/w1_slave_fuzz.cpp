@@ -0,0 +1,154 @@
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "w1_bus.h"
+#include "w1_samples.h"
+
+/**
+ * Differential fuzzer of the w1_slave and temperature parsers.
+ *
+ * Built by `make bench` it mutates the captured samples with a seeded PRNG,
+ * `w1_slave_fuzz [iterations] [seed]`. Built with
+ * `clang++ -fsanitize=fuzzer,address -DW1_LIBFUZZER` it is a libFuzzer target.
+ */
+
+/**
+ * @brief fail the run if cond does not hold
+ */
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); exit(EXIT_FAILURE); } } while (false)
+
+/**
+ * @brief milli-celsius the way a reader of the format would spell it out
+ */
+static std::optional<int> reference_milli(std::string digits)
+{
+    size_t const sign = !digits.empty() && digits[0] == '-' ? 1 : 0;
+    if (digits.size() == sign || digits.find_first_not_of("0123456789", sign) != std::string::npos)
+        return { };
+
+    errno = 0;
+    auto const value = strtoll(digits.c_str(), nullptr, 10);
+    if (errno == ERANGE || value < INT_MIN || value > INT_MAX)
+        return { };
+    return static_cast<int>(value);
+}
+
+static std::optional<int> reference_slave(std::string_view text)
+{
+    std::string const s{ text };
+    auto const eol = s.find('\n');
+    if (eol == std::string::npos)
+        return { };
+
+    auto const first = s.substr(0, eol);
+    if (first.size() < 3 || first.compare(first.size() - 3, 3, "YES") != 0)
+        return { };
+
+    auto second = s.substr(eol + 1);
+    second = second.substr(0, second.find('\n'));
+    auto const pos = second.rfind("t=");
+    if (pos == std::string::npos)
+        return { };
+    return reference_milli(second.substr(pos + 2));
+}
+
+static std::optional<int> reference_temperature(std::string_view text)
+{
+    std::string const s{ text };
+    return reference_milli(s.substr(0, s.find('\n')));
+}
+
+static void check(std::string_view text)
+{
+    if (w1_slave_parse(text) != reference_slave(text) ||
+        w1_temperature_parse(text) != reference_temperature(text))
+    {
+        fprintf(stderr, "parsers disagree on %zu bytes:\n", text.size());
+        fwrite(text.data(), 1, text.size(), stderr);
+        fputc('\n', stderr);
+        exit(EXIT_FAILURE);
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    check({ reinterpret_cast<const char *>(data), size });
+    return 0;
+}
+
+#ifndef W1_LIBFUZZER
+
+/**
+ * @brief one random edit, biased to the bytes the parser looks at
+ */
+static void mutate(std::string & s, std::mt19937 & rng)
+{
+    static constexpr char alphabet[] = "0123456789-+ \nYESNOt=\xff";
+    auto const pick = [&](size_t n) { return std::uniform_int_distribution<size_t>{ 0, n }(rng); };
+    auto const byte = [&] { return pick(8) == 0 ? static_cast<char>(pick(255)) : alphabet[pick(sizeof alphabet - 1)]; };
+
+    switch (pick(4))
+    {
+    case 0:
+        if (!s.empty()) s[pick(s.size() - 1)] = byte();
+        break;
+    case 1:
+        s.insert(s.begin() + static_cast<std::ptrdiff_t>(pick(s.size())), byte());
+        break;
+    case 2:
+        if (!s.empty()) s.erase(pick(s.size() - 1), 1 + pick(3));
+        break;
+    case 3:
+        s.resize(pick(s.size()));
+        break;
+    default:
+        // digits long enough to overflow an int
+        s.insert(pick(s.size()), std::string(pick(12), static_cast<char>('0' + pick(9))));
+        break;
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    auto const iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000ULL;
+    auto const seed = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1UL;
+
+    for (auto const & sample : w1_slave_samples)
+    {
+        CHECK(w1_slave_parse(sample.text_) == sample.milli_);
+        check(sample.text_);
+    }
+    for (auto const & sample : w1_temperature_samples)
+    {
+        CHECK(w1_temperature_parse(sample.text_) == sample.milli_);
+        check(sample.text_);
+    }
+
+    std::mt19937 rng{ static_cast<std::mt19937::result_type>(seed) };
+    std::uniform_int_distribution<size_t> slave{ 0, std::size(w1_slave_samples) - 1 };
+    std::uniform_int_distribution<size_t> temperature{ 0, std::size(w1_temperature_samples) - 1 };
+    std::uniform_int_distribution<int> edits{ 1, 4 };
+
+    std::string input;
+    for (unsigned long long i = 0; i < iterations; ++i)
+    {
+        input = i % 4 == 0 ? w1_temperature_samples[temperature(rng)].text_ : w1_slave_samples[slave(rng)].text_;
+        for (int n = edits(rng); n > 0; --n)
+            mutate(input, rng);
+        check(input);
+    }
+
+    fprintf(stderr, "w1_slave_fuzz: %llu inputs, seed %lu, no disagreement\n", iterations, seed);
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,381 @@
+#include <cassert>
+#include <cstring>
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _DEBUG_
+#include <iostream>
+#endif
+
+#include "block_storage.h"
+#include "metrics.h"
+
+#ifndef unlikely
+# define unlikely(x) (__builtin_expect(!!(x), 0))
+#endif
+
+namespace
+{
+
+// a point id is the rowid of its block, then its index in the block
+constexpr unsigned index_bits = 16;
+constexpr int64_t index_mask = (int64_t{ 1 } << index_bits) - 1;
+
+constexpr int64_t point_id(int64_t block, size_t index)
+{
+    return block << index_bits | static_cast<int64_t>(index);
+}
+
+} // namespace
+
+block_storage::block_storage(const char * path)
+    : block_storage{ path, options{ } }
+{ }
+
+block_storage::block_storage(const char * path, options opt)
+    : options_{ std::move(opt) }
+{
+    assert(path);
+
+    auto const & sync = options_.sqlite_.synchronous_;
+    if (sync != "OFF" && sync != "NORMAL" && sync != "FULL" && sync != "EXTRA")
+        throw std::invalid_argument{ "invalid synchronous: " + sync };
+    if (options_.block_points_ == 0 || options_.block_points_ > static_cast<size_t>(index_mask))
+        throw std::invalid_argument{ "invalid block size" };
+
+    sqlite3 * handle{ nullptr };
+    if (sqlite3_open(path, &handle) != SQLITE_OK)
+    {
+        sqlite3_close(handle);
+        throw runtime_error{ "Cannot initialize SQLite" };
+    }
+    db_.reset(handle);
+    sqlite3_busy_timeout(handle, static_cast<int>(options_.sqlite_.busy_timeout_.count()));
+
+    exec("pragma journal_mode=WAL");
+    exec(("pragma synchronous=" + sync).c_str());
+
+    // autoincrement, a block id is never reused, so point ids only grow
+    auto const sql =
+        "create table if not exists tb_therm_block("
+            "id     integer  primary key autoincrement,"
+            "name   text(64) not null,"
+            "series integer  not null,"
+            "points integer  not null,"
+            "skip   integer  not null default 0,"
+            "data   blob     not null"
+        ")";
+    exec(sql);
+
+    insert_stmt_ = prepare("insert into tb_therm_block (name,series,points,data) values (?,?,?,?)");
+    update_stmt_ = prepare("update tb_therm_block set points = ?, data = ? where id = ?");
+    select_stmt_ = prepare("select id,name,series,points,skip,data from tb_therm_block where id >= ? order by id limit 1");
+    delete_stmt_ = prepare("delete from tb_therm_block where id < ? or (id = ? and points <= ?)");
+    skip_stmt_ = prepare("update tb_therm_block set skip = ? where id = ? and skip < ?");
+    count_stmt_ = prepare("select coalesce(sum(points - skip), 0) from tb_therm_block");
+    size_stmt_ = prepare("select (page_count - freelist_count) * page_size "
+                         "from pragma_page_count(), pragma_freelist_count(), pragma_page_size()");
+    begin_stmt_ = prepare("begin");
+    commit_stmt_ = prepare("commit");
+    rollback_stmt_ = prepare("rollback");
+
+    migrate_rows(path);
+}
+
+block_storage::~block_storage()
+{
+    if (!db_) return;
+
+    try
+    {
+        flush();
+    }
+    catch (runtime_error const &)
+    {
+        // nothing can be done here, the points of the open blocks are lost
+    }
+}
+
+block_storage::stmt_ptr block_storage::prepare(const char * sql) const
+{
+    sqlite3_stmt * stmt{ nullptr };
+    if (sqlite3_prepare_v3(db_.get(), sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK)
+        throw runtime_error{ "Cannot prepare statement: " + std::string{ sqlite3_errmsg(db_.get()) } };
+    return stmt_ptr{ stmt };
+}
+
+void block_storage::exec(const char * sql) const
+{
+    char * errmsg{ nullptr };
+    auto const err = sqlite3_exec(db_.get(), sql, nullptr, nullptr, &errmsg);
+    if unlikely(err != SQLITE_OK)
+    {
+        std::string msg{ errmsg ? errmsg : sqlite3_errstr(err) };
+        sqlite3_free(errmsg);
+        throw runtime_error{ "Cannot execute \"" + std::string{ sql } + "\": " + msg };
+    }
+}
+
+void block_storage::step_done(sqlite3_stmt * stmt, const char * what)
+{
+    auto const err = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if unlikely(err != SQLITE_DONE)
+    {
+        std::string msg{ std::string{ what } + ": " + sqlite3_errmsg(db_.get()) };
+
+        // a failed statement leaves the transaction open unless sqlite rolled it back
+        if (!sqlite3_get_autocommit(db_.get()))
+        {
+            sqlite3_step(rollback_stmt_.get());
+            sqlite3_reset(rollback_stmt_.get());
+        }
+        throw runtime_error{ msg };
+    }
+}
+
+int64_t block_storage::scalar(sqlite3_stmt * stmt, const char * what)
+{
+    auto const err = sqlite3_step(stmt);
+    auto const value = err == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+    sqlite3_reset(stmt);
+    if unlikely(err != SQLITE_ROW)
+        throw runtime_error{ std::string{ what } + ": " + sqlite3_errmsg(db_.get()) };
+    return value;
+}
+
+void block_storage::migrate_rows(const char * path)
+{
+    // opening the row format creates tb_therm if needed, empty it is left alone
+    sqlite_storage rows{ path, options_.sqlite_ };
+    if (rows.count() == 0) return;
+
+    std::vector<backlog_record> page;
+    int64_t last = 0;
+    while (rows.select(last, 256, page) != 0)
+    {
+        for (auto const & row : page)
+            insert(row.name_.c_str(), row.value_, row.time_, row.series_);
+        last = page.back().id_;
+    }
+
+    // a crash in between uploads the rows twice, never loses them
+    flush();
+    rows.delete_where_id_not_greater_than(last);
+}
+
+void block_storage::insert(const char * name, double value, time_t now, uint32_t series)
+{
+    assert(name);
+    auto const bgn = std::chrono::steady_clock::now();
+
+    auto it = std::find_if(open_.begin(), open_.end(),
+        [&](block const & b) { return b.series_ == series && b.name_ == name; });
+    if (it == open_.end())
+    {
+        open_.emplace_back();
+        it = open_.end() - 1;
+        it->name_.assign(name, strnlen(name, 255));
+        it->series_ = series;
+    }
+    it->points_.append(now, value);
+    it->dirty_ = true;
+
+    global_metrics().backlog_insert_.observe(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bgn));
+
+#ifdef _DEBUG_
+    std::cerr << "new point: " << name << ',' << value << ',' << now << ',' << series << std::endl;
+#endif
+
+    if (pending_++ == 0)
+        pending_since_ = std::chrono::steady_clock::now();
+
+    // a full block is written & closed right away, the next point opens another
+    if (it->points_.count() >= options_.block_points_ || pending_ >= options_.sqlite_.commit_count_)
+        flush();
+    else
+        flush_if_due();
+}
+
+void block_storage::flush_if_due()
+{
+    if (pending_ != 0 &&
+        std::chrono::steady_clock::now() - pending_since_ >= options_.sqlite_.commit_interval_)
+    {
+        flush();
+    }
+}
+
+void block_storage::flush()
+{
+    if (pending_ == 0) return;
+
+    timed(global_metrics().backlog_commit_, [&] {
+        step_done(begin_stmt_.get(), "Cannot begin transaction");
+
+        try
+        {
+            for (auto & b : open_)
+            {
+                if (!b.dirty_) continue;
+
+                auto const data = b.points_.data();
+                auto const points = static_cast<sqlite3_int64>(b.points_.count());
+                if (b.id_ == 0)
+                {
+                    auto const stmt = insert_stmt_.get();
+                    sqlite3_bind_text(stmt, 1, b.name_.c_str(), static_cast<int>(b.name_.size()), SQLITE_STATIC);
+                    sqlite3_bind_int64(stmt, 2, b.series_);
+                    sqlite3_bind_int64(stmt, 3, points);
+                    sqlite3_bind_blob(stmt, 4, data.data(), static_cast<int>(data.size()), SQLITE_STATIC);
+                    step_done(stmt, "Cannot insert block");
+                    sqlite3_clear_bindings(stmt);
+                    b.id_ = sqlite3_last_insert_rowid(db_.get());
+                }
+                else
+                {
+                    auto const stmt = update_stmt_.get();
+                    sqlite3_bind_int64(stmt, 1, points);
+                    sqlite3_bind_blob(stmt, 2, data.data(), static_cast<int>(data.size()), SQLITE_STATIC);
+                    sqlite3_bind_int64(stmt, 3, b.id_);
+                    step_done(stmt, "Cannot update block");
+                    sqlite3_clear_bindings(stmt);
+                }
+            }
+            step_done(commit_stmt_.get(), "Cannot commit transaction");
+        }
+        catch (runtime_error const &)
+        {
+            // the rows inserted by the rolled back transaction are gone, insert them again next time
+            for (auto & b : open_)
+            {
+                if (!b.stored_) b.id_ = 0;
+            }
+            throw;
+        }
+    });
+
+    for (auto & b : open_)
+    {
+        b.dirty_ = false;
+        b.stored_ = true;
+    }
+    pending_ = 0;
+
+    // full blocks are closed
+    std::erase_if(open_, [&](block const & b) { return b.points_.count() >= options_.block_points_; });
+}
+
+bool block_storage::load_block(int64_t from)
+{
+    auto const stmt = select_stmt_.get();
+    sqlite3_bind_int64(stmt, 1, from);
+
+    auto const err = sqlite3_step(stmt);
+    if (err == SQLITE_ROW)
+    {
+        scan_block_ = sqlite3_column_int64(stmt, 0);
+        scan_name_.assign(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)),
+                          static_cast<size_t>(sqlite3_column_bytes(stmt, 1)));
+        scan_series_ = static_cast<uint32_t>(sqlite3_column_int64(stmt, 2));
+        auto const points = static_cast<size_t>(sqlite3_column_int64(stmt, 3));
+        scan_index_ = 0;
+        auto const data = static_cast<const char *>(sqlite3_column_blob(stmt, 5));
+        scan_data_.assign(data, data + sqlite3_column_bytes(stmt, 5));
+        scan_ = gorilla_decoder{ { scan_data_.data(), scan_data_.size() }, points };
+
+        // uploaded points of a block only partly deleted
+        auto const skip = static_cast<size_t>(sqlite3_column_int64(stmt, 4));
+        time_t time;
+        double value;
+        while (scan_index_ < skip && scan_.next(time, value))
+            ++scan_index_;
+    }
+
+    sqlite3_reset(stmt);
+    if unlikely(err != SQLITE_ROW && err != SQLITE_DONE)
+        throw runtime_error{ "Cannot select blocks: " + std::string{ sqlite3_errmsg(db_.get()) } };
+    if (err == SQLITE_DONE) scan_block_ = 0;
+    return err == SQLITE_ROW;
+}
+
+size_t block_storage::select(int64_t after_id, size_t count, std::vector<record> & rows)
+{
+    // close the open blocks, points appended from now on go to blocks with higher ids
+    flush();
+    open_.clear();
+
+    // resume right after the previous page, otherwise find the block of after_id
+    if (after_id != scan_id_ || scan_block_ == 0)
+    {
+        if (!load_block(std::max<int64_t>(after_id >> index_bits, 0)))
+        {
+            rows.clear();
+            return 0;
+        }
+    }
+
+    size_t n = 0;
+    while (n < count)
+    {
+        time_t time;
+        double value;
+        if (!scan_.next(time, value))
+        {
+            if (!load_block(scan_block_ + 1)) break;
+            continue;
+        }
+
+        auto const id = point_id(scan_block_, scan_index_++);
+        if (id <= after_id) continue;
+
+        if (rows.size() <= n) rows.emplace_back();
+        auto & row = rows[n++];
+        row.id_ = id;
+        row.name_ = scan_name_;
+        row.value_ = value;
+        row.time_ = time;
+        row.series_ = scan_series_;
+    }
+
+    rows.resize(n);
+    if (n != 0) scan_id_ = rows.back().id_;
+    return n;
+}
+
+void block_storage::delete_where_id_not_greater_than(int64_t id)
+{
+    auto const block = id >> index_bits;
+    auto const uploaded = (id & index_mask) + 1;
+
+    step_done(begin_stmt_.get(), "Cannot begin transaction");
+
+    // the blocks before & the block itself if it is done, else skip its uploaded points
+    auto stmt = delete_stmt_.get();
+    sqlite3_bind_int64(stmt, 1, block);
+    sqlite3_bind_int64(stmt, 2, block);
+    sqlite3_bind_int64(stmt, 3, uploaded);
+    step_done(stmt, "Cannot delete blocks");
+
+    stmt = skip_stmt_.get();
+    sqlite3_bind_int64(stmt, 1, uploaded);
+    sqlite3_bind_int64(stmt, 2, block);
+    sqlite3_bind_int64(stmt, 3, uploaded);
+    step_done(stmt, "Cannot skip points");
+
+    // uploaded points must not come back after a crash
+    step_done(commit_stmt_.get(), "Cannot commit transaction");
+}
+
+size_t block_storage::count()
+{
+    flush();
+    return static_cast<size_t>(scalar(count_stmt_.get(), "Cannot count points"));
+}
+
+size_t block_storage::size_bytes()
+{
+    return static_cast<size_t>(scalar(size_stmt_.get(), "Cannot size the database"));
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "backlog.h"
+#include "gorilla.h"
+#include "sqlite_storage.h"
+
+/**
+ * @brief offline buffer of Gorilla compressed blocks, one series per block
+ *
+ * Points are appended to an open block of their sensor & series in memory,
+ * a commit writes the blocks that grew as rows of tb_therm_block, replacing
+ * the previous version of the block. A block is closed when it is full or
+ * when the backlog is read, so points never join a block the drain has seen.
+ * A block takes about 2 bytes a point plus one row, against a row of 40 and
+ * more bytes a point in tb_therm.
+ *
+ * The id of a point is `block << 16 | index`, it grows with insertion order
+ * within a series. select() streams the points out of the blocks, deleting
+ * part of a block only moves its skip count. Rows left in tb_therm by the
+ * row format are moved into blocks on open.
+ */
+class block_storage
+{
+public:
+    struct runtime_error;
+
+    using record = backlog_record;
+
+    struct options
+    {
+        sqlite_storage::options sqlite_{ };      ///< synchronous & group commit
+        size_t                  block_points_{ 1024 }; ///< points per block, at most 65535
+    };
+
+private:
+    struct deleter
+    {
+        void operator()(sqlite3 * db) const { sqlite3_close_v2(db); }
+    };
+
+    struct stmt_deleter
+    {
+        void operator()(sqlite3_stmt * stmt) const { sqlite3_finalize(stmt); }
+    };
+
+    using sqlite3_ptr = std::unique_ptr<sqlite3, deleter>;
+    using stmt_ptr = std::unique_ptr<sqlite3_stmt, stmt_deleter>;
+
+    /**
+     * @brief the block a series is appended to
+     */
+    struct block
+    {
+        std::string     name_{ };
+        uint32_t        series_{ 0 };
+        int64_t         id_{ 0 };         ///< rowid, 0 until first written
+        bool            stored_{ false }; ///< id_ was committed
+        bool            dirty_{ false };  ///< has points not written yet
+        gorilla_encoder points_{ };
+    };
+
+public:
+    explicit block_storage(const char * path);
+
+    block_storage(const char * path, options opt);
+
+    block_storage(const block_storage &) = delete;
+
+    block_storage(block_storage &&) noexcept = default;
+
+    ~block_storage();
+
+    block_storage & operator=(const block_storage &) = delete;
+
+    block_storage & operator=(block_storage &&) noexcept = default;
+
+    /**
+     * @brief append a point to the open block of its series, series 0 is a raw reading
+     */
+    void insert(const char * name, double value, time_t now, uint32_t series = 0);
+
+    /**
+     * @brief decode at most count points with id greater than after_id, in id order
+     *
+     * Closes the open blocks first.
+     *
+     * @return number of records stored in rows
+     */
+    size_t select(int64_t after_id, size_t count, std::vector<record> & rows);
+
+    void delete_where_id_not_greater_than(int64_t id);
+
+    /**
+     * @brief number of buffered points, the open blocks are written first
+     */
+    size_t count();
+
+    /**
+     * @brief bytes of the pages holding blocks, free pages left by deletes excluded
+     */
+    size_t size_bytes();
+
+    /**
+     * @brief write the grown blocks if the oldest unwritten point is old enough
+     */
+    void flush_if_due();
+
+    /**
+     * @brief write the grown blocks now
+     */
+    void flush();
+
+    /**
+     * @brief when flush_if_due will write, nothing if every point is written
+     */
+    std::optional<std::chrono::steady_clock::time_point> flush_deadline() const
+    {
+        if (pending_ == 0) return std::nullopt;
+        return pending_since_ + options_.sqlite_.commit_interval_;
+    }
+
+private:
+    stmt_ptr prepare(const char * sql) const;
+
+    void exec(const char * sql) const;
+
+    void step_done(sqlite3_stmt * stmt, const char * what);
+
+    int64_t scalar(sqlite3_stmt * stmt, const char * what);
+
+    /**
+     * @brief move the rows of the row format into blocks
+     */
+    void migrate_rows(const char * path);
+
+    /**
+     * @brief load the first block with id at least from into the scan, false if there is none
+     */
+    bool load_block(int64_t from);
+
+private:
+    sqlite3_ptr        db_{ };
+    stmt_ptr           insert_stmt_{ };
+    stmt_ptr           update_stmt_{ };
+    stmt_ptr           select_stmt_{ };
+    stmt_ptr           delete_stmt_{ };
+    stmt_ptr           skip_stmt_{ };
+    stmt_ptr           count_stmt_{ };
+    stmt_ptr           size_stmt_{ };
+    stmt_ptr           begin_stmt_{ };
+    stmt_ptr           commit_stmt_{ };
+    stmt_ptr           rollback_stmt_{ };
+    options            options_{ };
+    std::vector<block> open_{ };          ///< a handful, one per series being appended
+    size_t             pending_{ 0 };     ///< points appended since the last write
+    std::chrono::steady_clock::time_point pending_since_{ };
+
+    // where select stopped, the next page continues from there
+    int64_t            scan_id_{ -1 };    ///< last id returned by select
+    int64_t            scan_block_{ 0 };  ///< rowid of the block being decoded, 0 if none
+    std::string        scan_name_{ };
+    uint32_t           scan_series_{ 0 };
+    std::vector<char>  scan_data_{ };     ///< not a string, a short one moves its chars
+    size_t             scan_index_{ 0 };  ///< index of the next point of the block
+    gorilla_decoder    scan_{ };
+};
+
+struct block_storage::runtime_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
@@ -0,0 +1,54 @@
+#include <cmath>
+
+#include <stdexcept>
+
+#include "deadband.h"
+
+deadband::deadband(options opt, delta_map deltas)
+    : options_{ opt }
+    , deltas_{ std::move(deltas) }
+{
+    if (!(options_.delta_ >= 0) || options_.heartbeat_.count() <= 0)
+        throw std::invalid_argument{ "invalid deadband" };
+    for (auto const & [id, delta] : deltas_)
+    {
+        if (!(delta >= 0))
+            throw std::invalid_argument{ "invalid deadband of " + id };
+    }
+}
+
+bool deadband::pass(std::string_view id, double value, time_t now)
+{
+    readings_.add();
+
+    sensor * s = nullptr;
+    for (auto & candidate : sensors_)
+    {
+        if (candidate.id_ == id)
+        {
+            s = &candidate;
+            break;
+        }
+    }
+
+    if (s == nullptr)
+    {
+        auto const it = deltas_.find(std::string{ id });
+        auto const delta = it == deltas_.end() ? options_.delta_ : it->second;
+        sensors_.push_back({ std::string{ id }, delta, value, now });
+        return true;
+    }
+
+    // NaN never compares within the band, a clock stepping back restarts the heartbeat
+    auto const within = std::fabs(value - s->value_) <= s->delta_;
+    auto const fresh = now >= s->time_ && now - s->time_ < options_.heartbeat_.count();
+    if (within && fresh)
+    {
+        suppressed_.add();
+        return false;
+    }
+
+    s->value_ = value;
+    s->time_ = now;
+    return true;
+}
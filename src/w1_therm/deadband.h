@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "metrics.h"
+
+/**
+ * @brief change-based reporting: drop readings that moved less than a delta
+ *
+ * A reading passes when it is the first of its sensor, when it is more than
+ * delta away from the last reading that passed, or when the last one that
+ * passed is a heartbeat old, so dashboards never show a gap longer than the
+ * heartbeat. Comparing against the last reading that passed, and not the
+ * previous reading, lets a slow drift through once it adds up to delta.
+ */
+class deadband
+{
+public:
+    struct options
+    {
+        double               delta_{ 0.1 };     ///< celsius, a reading must move more than this
+        std::chrono::seconds heartbeat_{ 900 }; ///< a reading passes at least this often
+    };
+
+    /**
+     * @brief delta of a sensor, by slave id, overriding options::delta_
+     */
+    using delta_map = std::map<std::string, double>;
+
+    explicit deadband(options opt, delta_map deltas = { });
+
+    deadband(const deadband &) = delete;
+
+    deadband & operator=(const deadband &) = delete;
+
+    /**
+     * @brief whether the reading of sensor id is to be stored
+     */
+    bool pass(std::string_view id, double value, time_t now);
+
+    uint64_t readings() const { return readings_.get(); }
+
+    uint64_t suppressed() const { return suppressed_.get(); }
+
+    /**
+     * @brief suppressed readings over all readings, 0 before the first
+     */
+    double ratio() const
+    {
+        auto const n = readings();
+        return n == 0 ? 0 : static_cast<double>(suppressed()) / static_cast<double>(n);
+    }
+
+private:
+    struct sensor
+    {
+        std::string id_;
+        double      delta_;
+        double      value_;  ///< last reading that passed
+        time_t      time_;   ///< when it was taken
+    };
+
+private:
+    options             options_;
+    delta_map           deltas_;
+    std::vector<sensor> sensors_{ }; ///< a handful, in discovery order
+    counter             readings_{ };
+    counter             suppressed_{ };
+};
@@ -0,0 +1,163 @@
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <stdexcept>
+#include <string>
+
+#include "event_loop.h"
+
+namespace
+{
+
+std::runtime_error errno_error(const char * what)
+{
+    return std::runtime_error{ std::string{ what } + ": " + strerror(errno) };
+}
+
+} // namespace
+
+event_loop::event_loop()
+    : epoll_{ epoll_create1(EPOLL_CLOEXEC) }
+{
+    if (!epoll_)
+        throw errno_error("epoll_create1");
+}
+
+void event_loop::add(int fd, uint32_t events, handler h)
+{
+    epoll_event ev{ };
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_.get(), EPOLL_CTL_ADD, fd, &ev) != 0)
+        throw errno_error("epoll_ctl add");
+
+    entries_[fd] = entry{ std::move(h), true };
+}
+
+void event_loop::modify(int fd, uint32_t events)
+{
+    epoll_event ev{ };
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_.get(), EPOLL_CTL_MOD, fd, &ev) != 0)
+        throw errno_error("epoll_ctl mod");
+}
+
+void event_loop::remove(int fd)
+{
+    auto const it = entries_.find(fd);
+    if (it == entries_.end() || !it->second.alive_) return;
+
+    // the fd may be closed already, which removed it from the epoll set
+    epoll_ctl(epoll_.get(), EPOLL_CTL_DEL, fd, nullptr);
+
+    // the handler may be running, destroy it after the dispatch
+    it->second.alive_ = false;
+    removed_.push_back(fd);
+}
+
+bool event_loop::contains(int fd) const
+{
+    auto const it = entries_.find(fd);
+    return it != entries_.end() && it->second.alive_;
+}
+
+void event_loop::run()
+{
+    running_ = true;
+    while (running_) run_once(-1);
+}
+
+size_t event_loop::run_once(int timeout_ms)
+{
+    epoll_event events[16];
+    auto const n = epoll_wait(epoll_.get(), events, 16, timeout_ms);
+    if (n < 0)
+    {
+        if (errno == EINTR) return 0;
+        throw errno_error("epoll_wait");
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        auto const it = entries_.find(events[i].data.fd);
+        if (it != entries_.end() && it->second.alive_)
+            it->second.handler_(events[i].events);
+    }
+
+    // the entry stays for the next add of the fd, e.g. curl's sockets come & go per request
+    for (auto const fd : removed_)
+    {
+        auto const it = entries_.find(fd);
+        if (it != entries_.end() && !it->second.alive_) it->second.handler_ = nullptr;
+    }
+    removed_.clear();
+
+    return static_cast<size_t>(n);
+}
+
+unique_fd make_timer_fd()
+{
+    unique_fd fd{ timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC) };
+    if (!fd)
+        throw errno_error("timerfd_create");
+    return fd;
+}
+
+void arm_timer(int fd, std::chrono::nanoseconds first, std::chrono::nanoseconds interval)
+{
+    auto const to_timespec = [](std::chrono::nanoseconds ns) {
+        timespec ts;
+        ts.tv_sec = static_cast<time_t>(ns.count() / 1000000000);
+        ts.tv_nsec = static_cast<long>(ns.count() % 1000000000);
+        return ts;
+    };
+
+    itimerspec spec{ };
+    spec.it_value = to_timespec(first);
+    spec.it_interval = to_timespec(interval);
+    if (timerfd_settime(fd, 0, &spec, nullptr) != 0)
+        throw errno_error("timerfd_settime");
+}
+
+unique_fd make_event_fd()
+{
+    unique_fd fd{ eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) };
+    if (!fd)
+        throw errno_error("eventfd");
+    return fd;
+}
+
+void notify_event_fd(int fd)
+{
+    uint64_t const one = 1;
+    // EAGAIN means the counter is saturated, the reader wakes up anyway
+    (void)!write(fd, &one, sizeof one);
+}
+
+uint64_t read_counter(int fd)
+{
+    uint64_t value = 0;
+    if (read(fd, &value, sizeof value) != sizeof value) return 0;
+    return value;
+}
+
+unique_fd make_signal_fd(std::initializer_list<int> signals)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (auto const sig : signals) sigaddset(&mask, sig);
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0)
+        throw std::runtime_error{ "pthread_sigmask failed" };
+
+    unique_fd fd{ signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC) };
+    if (!fd)
+        throw errno_error("signalfd");
+    return fd;
+}
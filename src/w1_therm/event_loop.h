@@ -0,0 +1,107 @@
+#pragma once
+
+#include <sys/epoll.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <unordered_map>
+#include <vector>
+
+#include "unique_fd.h"
+
+/**
+ * @brief epoll based loop dispatching ready fds to their handlers
+ *
+ * The thread sleeps in epoll_wait until a registered fd is ready, timers and
+ * signals are fds too (see make_timer_fd and make_signal_fd).
+ */
+class event_loop
+{
+public:
+    using handler = std::function<void(uint32_t events)>;
+
+    event_loop();
+
+    event_loop(const event_loop &) = delete;
+
+    event_loop & operator=(const event_loop &) = delete;
+
+    /**
+     * @brief call h with the epoll events whenever fd is ready
+     */
+    void add(int fd, uint32_t events, handler h);
+
+    void modify(int fd, uint32_t events);
+
+    /**
+     * @brief stop watching fd, safe from within any handler
+     */
+    void remove(int fd);
+
+    bool contains(int fd) const;
+
+    /**
+     * @brief dispatch until stop() is called
+     */
+    void run();
+
+    /**
+     * @brief wait at most timeout_ms (-1 forever) and dispatch what is ready
+     *
+     * @return number of dispatched events
+     */
+    size_t run_once(int timeout_ms);
+
+    void stop() { running_ = false; }
+
+    /**
+     * @brief the epoll fd, readable when any registered fd is ready
+     */
+    int fd() const { return epoll_.get(); }
+
+private:
+    struct entry
+    {
+        handler handler_;
+        bool    alive_;
+    };
+
+    unique_fd                         epoll_;
+    std::unordered_map<int, entry>    entries_{ }; ///< never erased, an fd added again reuses its node
+    std::vector<int>                  removed_{ }; ///< erased after the current dispatch
+    bool                              running_{ false };
+};
+
+/**
+ * @brief a non-blocking CLOCK_MONOTONIC timerfd
+ */
+unique_fd make_timer_fd();
+
+/**
+ * @brief arm a timerfd, a zero interval makes it one-shot, a zero first disarms it
+ */
+void arm_timer(int fd, std::chrono::nanoseconds first, std::chrono::nanoseconds interval = { });
+
+/**
+ * @brief a non-blocking eventfd
+ */
+unique_fd make_event_fd();
+
+/**
+ * @brief wake up whoever waits on the eventfd
+ */
+void notify_event_fd(int fd);
+
+/**
+ * @brief read the counter of a timerfd or eventfd, 0 if it was not ready
+ */
+uint64_t read_counter(int fd);
+
+/**
+ * @brief block signals in the calling thread and return a signalfd for them
+ *
+ * Call before spawning threads, they inherit the mask.
+ */
+unique_fd make_signal_fd(std::initializer_list<int> signals);
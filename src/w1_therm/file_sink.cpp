@@ -0,0 +1,105 @@
+#include <fcntl.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+
+#include "file_sink.h"
+
+file_sink::file_sink(const char * path, options opt)
+    : path_{ path }
+    , options_{ opt }
+{
+    assert(path);
+
+    if (options_.batch_lines_ == 0)
+        throw std::invalid_argument{ "invalid batch size" };
+
+    fd_.reset(::open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644));
+    if (!fd_)
+        throw runtime_error{ "Cannot open " + path_ + ": " + strerror(errno) };
+}
+
+void file_sink::write(const sample & s)
+{
+    // NaN and unknown rollups encode to nothing
+    auto const size = batch_.size();
+    format_.encode(batch_, s.name_, s.value_, s.time_, s.series_);
+    if (batch_.size() == size) return;
+
+    auto const now = std::chrono::steady_clock::now();
+    if (lines_++ == 0)
+        since_ = now;
+
+    if (lines_ >= options_.batch_lines_ && now >= retry_)
+        write_batch();
+
+    // a disk that stays full must not grow the batch without bound
+    if (batch_.size() > options_.max_bytes_)
+    {
+        syslog(LOG_USER | LOG_WARNING, "file sink: dropping %zu lines not written to %s\n", lines_, path_.c_str());
+        dropped_.add(lines_);
+        torn_ = torn_ || written_ != 0;
+        batch_.clear();
+        lines_ = 0;
+        written_ = 0;
+    }
+}
+
+void file_sink::tick()
+{
+    auto const now = std::chrono::steady_clock::now();
+    if (lines_ != 0 && now >= since_ + options_.batch_interval_ && now >= retry_)
+        write_batch();
+}
+
+std::optional<std::chrono::steady_clock::time_point> file_sink::deadline()
+{
+    if (lines_ == 0) return std::nullopt;
+    return std::max(since_ + options_.batch_interval_, retry_);
+}
+
+void file_sink::flush()
+{
+    if (lines_ != 0)
+        write_batch();
+}
+
+bool file_sink::write_batch()
+{
+    // the line cut short by a dropped batch is ended, the next ones stay readable
+    if (torn_)
+    {
+        if (::write(fd_.get(), "\n", 1) != 1)
+        {
+            retry_ = std::chrono::steady_clock::now() + options_.retry_interval_;
+            return false;
+        }
+        torn_ = false;
+    }
+
+    auto const data = batch_.view();
+    while (written_ < data.size())
+    {
+        auto const n = ::write(fd_.get(), data.data() + written_, data.size() - written_);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+
+            syslog(LOG_USER | LOG_ERR, "file sink: cannot write %s: %s\n", path_.c_str(), strerror(errno));
+            retry_ = std::chrono::steady_clock::now() + options_.retry_interval_;
+            return false;
+        }
+        written_ += static_cast<size_t>(n);
+    }
+
+    sent_.add(lines_);
+    batch_.clear();
+    lines_ = 0;
+    written_ = 0;
+    return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "line_protocol.h"
+#include "metrics.h"
+#include "sink.h"
+#include "unique_fd.h"
+
+/**
+ * @brief appends the samples to a local file in line protocol
+ *
+ * Lines are batched in memory and written with one write() once enough
+ * of them are buffered or the oldest is old enough. A failed write, e.g. a
+ * full disk, keeps the batch and is retried later; a batch outgrowing its
+ * bound meanwhile is dropped.
+ */
+class file_sink : public sink
+{
+public:
+    struct runtime_error;
+
+    struct options
+    {
+        size_t                    batch_lines_{ 64 };         ///< write once this many lines are buffered
+        std::chrono::milliseconds batch_interval_{ 1000 };    ///< or once the oldest is this old
+        std::chrono::milliseconds retry_interval_{ 5000 };    ///< wait after a failed write
+        size_t                    max_bytes_{ 1 << 20 };      ///< bound of a batch waiting for a retry
+    };
+
+    file_sink(const char * path, options opt);
+
+    const char * name() const override { return "file"; }
+
+    void write(const sample & s) override;
+
+    void tick() override;
+
+    std::optional<std::chrono::steady_clock::time_point> deadline() override;
+
+    void flush() override;
+
+    /**
+     * @brief lines written to the file
+     */
+    uint64_t sent() const override { return sent_.get(); }
+
+    /**
+     * @brief lines dropped because their batch could not be written in time
+     */
+    uint64_t dropped() const override { return dropped_.get(); }
+
+private:
+    /**
+     * @brief write the batch, false if it is kept for a retry
+     */
+    bool write_batch();
+
+private:
+    std::string                           path_;
+    options                               options_;
+    unique_fd                             fd_{ };
+    point_format                          format_{ "home", "temperature" };
+    line_encoder                          batch_{ };
+    size_t                                lines_{ 0 };      ///< lines in batch_
+    size_t                                written_{ 0 };    ///< bytes of batch_ already in the file
+    counter                               sent_{ };
+    counter                               dropped_{ };
+    bool                                  torn_{ false };   ///< a dropped batch left a partial line in the file
+    std::chrono::steady_clock::time_point since_{ };        ///< when the oldest line was buffered
+    std::chrono::steady_clock::time_point retry_{ };        ///< no write before, after a failure
+};
+
+struct file_sink::runtime_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
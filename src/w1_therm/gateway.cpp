@@ -0,0 +1,225 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "gateway.h"
+
+namespace
+{
+
+constexpr size_t read_bytes = 64 << 10;
+constexpr size_t batch_points = 1024;
+
+} // namespace
+
+gateway::gateway(const std::string & address, options opt, deliver_fn deliver)
+    : listen_{ listen_on(address) }
+    , options_{ opt }
+    , deliver_{ std::move(deliver) }
+{
+    if (options_.workers_ == 0 || options_.max_clients_ == 0 || options_.max_line_ == 0)
+        throw std::invalid_argument{ "invalid gateway options" };
+
+    sockaddr_in addr{ };
+    socklen_t len = sizeof addr;
+    if (getsockname(listen_.get(), reinterpret_cast<sockaddr *>(&addr), &len) == 0)
+        port_ = ntohs(addr.sin_port);
+
+    for (size_t i = 0; i < options_.workers_; ++i)
+    {
+        auto & w = *workers_.emplace_back(std::make_unique<worker>());
+        w.index_ = i;
+        w.batch_.reserve(batch_points);
+        w.buf_ = std::make_unique<char[]>(read_bytes);
+
+        // one worker wakes per connection, the kernel spreads them over the idle ones
+        w.loop_.add(listen_.get(), EPOLLIN | EPOLLEXCLUSIVE, [this, &w](uint32_t) { on_accept(w); });
+        w.loop_.add(w.wake_.get(), EPOLLIN, [&w](uint32_t) { w.loop_.stop(); });
+    }
+
+    for (auto & w : workers_)
+        w->thread_ = std::thread{ [this, &w = *w] { run(w); } };
+}
+
+gateway::~gateway()
+{
+    for (auto const & w : workers_)
+        notify_event_fd(w->wake_.get());
+    for (auto const & w : workers_)
+        w->thread_.join();
+}
+
+unique_fd gateway::listen_on(const std::string & address)
+{
+    // host:port, an empty host listens on all interfaces
+    sockaddr_in in{ };
+    in.sin_family = AF_INET;
+    auto const sep = address.rfind(':');
+    char * end = nullptr;
+    auto const port = sep == std::string::npos ? 65536 : strtoul(address.c_str() + sep + 1, &end, 10);
+    auto const host = sep == std::string::npos ? std::string{ } : address.substr(0, sep);
+    if (port > 65535 || end == address.c_str() + sep + 1 || *end != 0 ||
+        (!host.empty() && inet_pton(AF_INET, host.c_str(), &in.sin_addr) != 1))
+        throw runtime_error{ "invalid gateway address: " + address };
+    if (host.empty())
+        in.sin_addr.s_addr = htonl(INADDR_ANY);
+    in.sin_port = htons(static_cast<uint16_t>(port));
+
+    unique_fd fd{ socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) };
+    int const on = 1;
+    if (fd) setsockopt(fd.get(), SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+
+    if (!fd || bind(fd.get(), reinterpret_cast<sockaddr *>(&in), sizeof in) != 0 || listen(fd.get(), SOMAXCONN) != 0)
+        throw runtime_error{ "Cannot listen on " + address + ": " + strerror(errno) };
+    return fd;
+}
+
+void gateway::run(worker & w)
+{
+    w.loop_.run();
+
+    for (auto const & [fd, c] : w.clients_)
+        w.loop_.remove(fd);
+    clients_.fetch_sub(w.clients_.size(), std::memory_order_relaxed);
+    w.clients_.clear();
+}
+
+void gateway::on_accept(worker & w)
+{
+    for (int fd; (fd = accept4(listen_.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0; )
+    {
+        accepted_.add();
+
+        // the node's tcp sink drops its points until a later packet connects again, it has no backlog
+        if (clients_.fetch_add(1, std::memory_order_relaxed) >= options_.max_clients_)
+        {
+            clients_.fetch_sub(1, std::memory_order_relaxed);
+            close(fd);
+            continue;
+        }
+
+        w.clients_[fd].fd_.reset(fd);
+        w.loop_.add(fd, EPOLLIN, [this, &w, fd](uint32_t) { on_ready(w, fd); });
+    }
+}
+
+void gateway::on_ready(worker & w, int fd)
+{
+    auto const it = w.clients_.find(fd);
+    if (it == w.clients_.end()) return;
+    auto & c = it->second;
+
+    // one read per wake up, the other connections of the worker get their turn
+    auto const n = read(fd, w.buf_.get(), read_bytes);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+
+    // a closed or failed connection ends what it had cut, see parse
+    auto const eof = n <= 0;
+    w.stalled_ = false;
+    auto const ok = parse(w, c, { w.buf_.get(), eof ? 0 : static_cast<size_t>(n) }, eof);
+    deliver(w);
+
+    if (!ok)
+    {
+        syslog(LOG_USER | LOG_WARNING, "gateway: dropping a client sending a line longer than %zu bytes\n",
+               options_.max_line_);
+        drop(w, fd);
+    }
+    else if (w.stalled_)
+    {
+        syslog(LOG_USER | LOG_WARNING, "gateway: the rings stayed full, dropping a client\n");
+        drop(w, fd);
+    }
+    else if (eof)
+        drop(w, fd);
+}
+
+bool gateway::parse(worker & w, client & c, std::string_view data, bool eof)
+{
+    // the line cut by the previous read first
+    if (!c.partial_.empty())
+    {
+        auto const nl = data.find('\n');
+        auto const head = data.substr(0, nl);
+        if (c.partial_.size() + head.size() > options_.max_line_)
+        {
+            rejected_.add();
+            return false;
+        }
+        c.partial_.append(head);
+        if (nl == std::string_view::npos)
+        {
+            if (eof) reject_tail(c.partial_);
+            return true;
+        }
+
+        parse_line(w, c.partial_);
+        c.partial_.clear();
+        data.remove_prefix(nl + 1);
+    }
+
+    for (size_t nl; (nl = data.find('\n')) != std::string_view::npos; data.remove_prefix(nl + 1))
+        parse_line(w, data.substr(0, nl));
+
+    if (data.size() > options_.max_line_)
+    {
+        rejected_.add();
+        return false;
+    }
+    if (eof)
+        reject_tail(data);
+    else
+        c.partial_.assign(data);
+    return true;
+}
+
+void gateway::reject_tail(std::string_view tail)
+{
+    // nodes end every line, an unended one was cut by a reset, e.g. inside its value or time
+    if (tail.empty()) return;
+    rejected_.add();
+}
+
+void gateway::parse_line(worker & w, std::string_view line)
+{
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (line.empty() || line.front() == '#') return;
+
+    w.batch_.emplace_back();
+    if (!format_.decode(line, w.batch_.back()))
+    {
+        w.batch_.pop_back();
+        rejected_.add();
+        return;
+    }
+
+    if (w.batch_.size() == batch_points)
+        deliver(w);
+}
+
+void gateway::deliver(worker & w)
+{
+    if (w.batch_.empty()) return;
+
+    // once deliver gave up, the rest of the read goes with its connection
+    if (!w.stalled_ && deliver_(w.index_, w.batch_.data(), w.batch_.size()))
+        points_.add(w.batch_.size());
+    else
+    {
+        w.stalled_ = true;
+        dropped_.add(w.batch_.size());
+    }
+    w.batch_.clear();
+}
+
+void gateway::drop(worker & w, int fd)
+{
+    w.loop_.remove(fd);
+    w.clients_.erase(fd);
+    clients_.fetch_sub(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "event_loop.h"
+#include "line_protocol.h"
+#include "metrics.h"
+#include "sample.h"
+#include "unique_fd.h"
+
+/**
+ * @brief accepts line protocol from other w1_therm instances over TCP
+ *
+ * Each worker thread waits in an epoll of its own on the shared listening
+ * socket (EPOLLEXCLUSIVE, so a connection wakes one worker) and serves the
+ * connections it accepted. The points of a read are parsed into samples and
+ * handed to deliver in one call, from the worker's thread; deliver merges
+ * them into the local sinks, which batch them upstream. A worker whose
+ * deliver gives up drops the rest of the read and its connection.
+ *
+ * Only the format of point_format is understood, a line that is not a point
+ * of it is counted and skipped, as is a line the connection ended without
+ * its newline. A line longer than max_line_ drops its connection.
+ */
+class gateway
+{
+public:
+    struct runtime_error;
+
+    struct options
+    {
+        size_t workers_{ 2 };        ///< threads accepting & reading
+        size_t max_clients_{ 1024 }; ///< connections open at once, more are closed right away
+        size_t max_line_{ 4096 };    ///< longest line, in bytes
+    };
+
+    /**
+     * @brief called by the workers, concurrently, with the points of one read
+     *
+     * worker is the index of the calling worker, below options::workers_;
+     * false means the points could not be taken.
+     */
+    using deliver_fn = std::function<bool(size_t worker, const sample * samples, size_t n)>;
+
+    /**
+     * @param address `host:port`, an empty host listens on all interfaces, port 0 picks one
+     */
+    gateway(const std::string & address, options opt, deliver_fn deliver);
+
+    gateway(const gateway &) = delete;
+
+    /**
+     * @brief close the connections and join the workers
+     */
+    ~gateway();
+
+    gateway & operator=(const gateway &) = delete;
+
+    /**
+     * @brief the port listened on, the one picked for port 0
+     */
+    uint16_t port() const { return port_; }
+
+    /**
+     * @brief points parsed and delivered
+     */
+    uint64_t points() const { return points_.get(); }
+
+    /**
+     * @brief points parsed but not taken by deliver
+     */
+    uint64_t dropped() const { return dropped_.get(); }
+
+    /**
+     * @brief lines that are not points, and lines too long
+     */
+    uint64_t rejected() const { return rejected_.get(); }
+
+    /**
+     * @brief connections accepted so far
+     */
+    uint64_t accepted() const { return accepted_.get(); }
+
+    /**
+     * @brief connections open now
+     */
+    size_t clients() const { return clients_.load(std::memory_order_relaxed); }
+
+private:
+    struct client
+    {
+        unique_fd   fd_{ };
+        std::string partial_{ }; ///< a line cut by the end of a read
+    };
+
+    struct worker
+    {
+        event_loop                          loop_{ };
+        unique_fd                           wake_{ make_event_fd() };  ///< written by the destructor
+        std::unordered_map<int, client>     clients_{ };
+        std::vector<sample>                 batch_{ };   ///< points of the current read
+        std::unique_ptr<char[]>             buf_{ };     ///< reused by every read
+        size_t                              index_{ 0 };
+        bool                                stalled_{ false }; ///< deliver gave up during the current read
+        std::thread                         thread_{ };
+    };
+
+    static unique_fd listen_on(const std::string & address);
+
+    void run(worker & w);
+
+    void on_accept(worker & w);
+
+    void on_ready(worker & w, int fd);
+
+    /**
+     * @brief parse the complete lines of data, keep the last partial one in c
+     *
+     * At eof the partial line is dropped as rejected, never decoded.
+     *
+     * @return false if a line is too long
+     */
+    bool parse(worker & w, client & c, std::string_view data, bool eof);
+
+    void reject_tail(std::string_view tail);
+
+    void parse_line(worker & w, std::string_view line);
+
+    void deliver(worker & w);
+
+    void drop(worker & w, int fd);
+
+private:
+    unique_fd                            listen_;
+    uint16_t                             port_{ 0 };
+    options                              options_;
+    deliver_fn                           deliver_;
+    point_format                         format_{ "home", "temperature" };
+    std::vector<std::unique_ptr<worker>> workers_{ };
+    std::atomic<size_t>                  clients_{ 0 };
+    counter                              points_{ };
+    counter                              rejected_{ };
+    counter                              dropped_{ };
+    counter                              accepted_{ };
+};
+
+struct gateway::runtime_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
@@ -0,0 +1,225 @@
+#include <cstring>
+
+#include <algorithm>
+#include <bit>
+
+#include "gorilla.h"
+
+namespace
+{
+
+/**
+ * @brief the delta-of-delta buckets: prefix, its length and the value bits
+ *
+ * '0' for an unchanged interval, then 7, 9 & 12 bits of two's complement,
+ * and the full 64 bits for a clock step.
+ */
+struct bucket
+{
+    uint64_t prefix_;
+    unsigned prefix_bits_;
+    unsigned bits_;
+};
+
+constexpr bucket buckets[] = {
+    { 0b10, 2, 7 },
+    { 0b110, 3, 9 },
+    { 0b1110, 4, 12 },
+    { 0b1111, 4, 64 },
+};
+
+constexpr bool fits(int64_t v, unsigned bits)
+{
+    return bits == 64 || (v >= -(int64_t{ 1 } << (bits - 1)) && v < (int64_t{ 1 } << (bits - 1)));
+}
+
+constexpr uint64_t mask(unsigned bits)
+{
+    return bits == 64 ? ~uint64_t{ 0 } : (uint64_t{ 1 } << bits) - 1;
+}
+
+/**
+ * @brief sign-extend the low bits of v
+ */
+constexpr int64_t extend(uint64_t v, unsigned bits)
+{
+    if (bits == 64) return static_cast<int64_t>(v);
+    auto const sign = uint64_t{ 1 } << (bits - 1);
+    return static_cast<int64_t>((v ^ sign) - sign);
+}
+
+} // namespace
+
+void gorilla_encoder::clear()
+{
+    buf_.clear();
+    free_ = 0;
+    count_ = 0;
+    leading_ = 64;
+    trailing_ = 0;
+}
+
+void gorilla_encoder::put(uint64_t bits, unsigned n)
+{
+    bits &= mask(n);
+    while (n != 0)
+    {
+        if (free_ == 0)
+        {
+            buf_.push_back(0);
+            free_ = 8;
+        }
+
+        auto const take = n < free_ ? n : free_;
+        auto const chunk = static_cast<unsigned char>(bits >> (n - take) & mask(take));
+        buf_.back() = static_cast<char>(static_cast<unsigned char>(buf_.back()) | chunk << (free_ - take));
+        free_ -= take;
+        n -= take;
+    }
+}
+
+void gorilla_encoder::append(time_t time, double value)
+{
+    auto const t = static_cast<int64_t>(time);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+
+    if (count_++ == 0)
+    {
+        put(static_cast<uint64_t>(t), 64);
+        put(bits, 64);
+        time_ = t;
+        delta_ = 0;
+        value_ = bits;
+        return;
+    }
+
+    // wraps instead of overflowing on absurd clocks, the decoder wraps back
+    auto const delta = static_cast<int64_t>(static_cast<uint64_t>(t) - static_cast<uint64_t>(time_));
+    auto const dod = static_cast<int64_t>(static_cast<uint64_t>(delta) - static_cast<uint64_t>(delta_));
+    if (dod == 0)
+    {
+        put(0, 1);
+    }
+    else
+    {
+        for (auto const & b : buckets)
+        {
+            if (fits(dod, b.bits_))
+            {
+                put(b.prefix_, b.prefix_bits_);
+                put(static_cast<uint64_t>(dod), b.bits_);
+                break;
+            }
+        }
+    }
+    time_ = t;
+    delta_ = delta;
+
+    auto const x = bits ^ value_;
+    value_ = bits;
+    if (x == 0)
+    {
+        put(0, 1);
+        return;
+    }
+
+    // 5 bits hold the leading zeros, more than 31 are written as 31
+    auto const leading = std::min(static_cast<unsigned>(std::countl_zero(x)), 31u);
+    auto const trailing = static_cast<unsigned>(std::countr_zero(x));
+    if (leading_ != 64 && leading >= leading_ && trailing >= trailing_)
+    {
+        put(0b10, 2);
+        put(x >> trailing_, 64 - leading_ - trailing_);
+        return;
+    }
+
+    auto const meaningful = 64 - leading - trailing;
+    put(0b11, 2);
+    put(leading, 5);
+    put(meaningful - 1, 6);
+    put(x >> trailing, meaningful);
+    leading_ = leading;
+    trailing_ = trailing;
+}
+
+bool gorilla_decoder::get(unsigned n, uint64_t & bits)
+{
+    if (bit_ + n > data_.size() * 8) return false;
+
+    bits = 0;
+    while (n != 0)
+    {
+        auto const byte = static_cast<unsigned char>(data_[bit_ / 8]);
+        auto const avail = 8 - static_cast<unsigned>(bit_ % 8);
+        auto const take = n < avail ? n : avail;
+        bits = bits << take | ((byte >> (avail - take)) & mask(take));
+        bit_ += take;
+        n -= take;
+    }
+    return true;
+}
+
+bool gorilla_decoder::get_bit(bool & bit)
+{
+    uint64_t b;
+    if (!get(1, b)) return false;
+    bit = b != 0;
+    return true;
+}
+
+bool gorilla_decoder::next(time_t & time, double & value)
+{
+    if (left_ == 0) return false;
+
+    if (first_)
+    {
+        uint64_t t;
+        if (!get(64, t) || !get(64, value_)) return truncated();
+        time_ = static_cast<int64_t>(t);
+        first_ = false;
+    }
+    else
+    {
+        // the number of leading ones picks the bucket
+        unsigned ones = 0;
+        for (bool bit; ones < 4; ++ones)
+        {
+            if (!get_bit(bit)) return truncated();
+            if (!bit) break;
+        }
+
+        int64_t dod = 0;
+        if (ones != 0)
+        {
+            auto const & b = buckets[ones - 1];
+            uint64_t v;
+            if (!get(b.bits_, v)) return truncated();
+            dod = extend(v, b.bits_);
+        }
+        delta_ = static_cast<int64_t>(static_cast<uint64_t>(delta_) + static_cast<uint64_t>(dod));
+        time_ = static_cast<int64_t>(static_cast<uint64_t>(time_) + static_cast<uint64_t>(delta_));
+
+        bool changed, fresh = false;
+        if (!get_bit(changed) || (changed && !get_bit(fresh))) return truncated();
+        if (changed)
+        {
+            if (fresh)
+            {
+                uint64_t leading, meaningful;
+                if (!get(5, leading) || !get(6, meaningful) || leading + meaningful + 1 > 64) return truncated();
+                leading_ = static_cast<unsigned>(leading);
+                trailing_ = 64 - leading_ - static_cast<unsigned>(meaningful + 1);
+            }
+
+            uint64_t x;
+            if (!get(64 - leading_ - trailing_, x)) return truncated();
+            value_ ^= x << trailing_;
+        }
+    }
+
+    --left_;
+    time = static_cast<time_t>(time_);
+    memcpy(&value, &value_, sizeof value);
+    return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Gorilla compression of one series: delta-of-delta times, XOR values
+ *
+ * The first point is stored in full. A time is then the change of the
+ * interval since the previous point, in 1 bit when the sampling timer is
+ * steady. A value is the XOR with the previous one, in 1 bit when it did not
+ * change and in its meaningful bits only otherwise, often reusing the
+ * leading/trailing zero window of the previous XOR. A DS18B20 room sensor
+ * takes about 2 bytes a point instead of the 16 of a time & a double.
+ *
+ * The stream is a plain byte string, the number of points is kept next to
+ * it, there is no end marker.
+ */
+class gorilla_encoder
+{
+public:
+    void append(time_t time, double value);
+
+    size_t count() const { return count_; }
+
+    /**
+     * @brief the encoded points, the last byte padded with zero bits
+     */
+    std::string_view data() const { return buf_; }
+
+    /**
+     * @brief start a new series, keep the buffer
+     */
+    void clear();
+
+private:
+    /**
+     * @brief append the low n bits of bits, most significant first
+     */
+    void put(uint64_t bits, unsigned n);
+
+private:
+    std::string buf_{ };
+    unsigned    free_{ 0 };      ///< unused low bits of the last byte
+    size_t      count_{ 0 };
+    int64_t     time_{ 0 };
+    int64_t     delta_{ 0 };
+    uint64_t    value_{ 0 };     ///< bits of the previous value
+    unsigned    leading_{ 64 };  ///< zero window of the previous XOR, 64 if none
+    unsigned    trailing_{ 0 };
+};
+
+/**
+ * @brief streams the points back out of a gorilla_encoder's data
+ */
+class gorilla_decoder
+{
+public:
+    gorilla_decoder() = default;
+
+    gorilla_decoder(std::string_view data, size_t count) : data_{ data }, left_{ count } { }
+
+    /**
+     * @brief the next point
+     *
+     * @return false past the last point, or if the data is truncated or corrupt
+     */
+    bool next(time_t & time, double & value);
+
+    /**
+     * @brief points not decoded yet
+     */
+    size_t left() const { return left_; }
+
+private:
+    bool get(unsigned n, uint64_t & bits);
+
+    bool get_bit(bool & bit);
+
+    /**
+     * @brief stop at a truncated or corrupt stream
+     */
+    bool truncated() { left_ = 0; return false; }
+
+private:
+    std::string_view data_{ };
+    size_t           bit_{ 0 };      ///< next bit to read
+    size_t           left_{ 0 };
+    bool             first_{ true };
+    int64_t          time_{ 0 };
+    int64_t          delta_{ 0 };
+    uint64_t         value_{ 0 };
+    unsigned         leading_{ 0 };
+    unsigned         trailing_{ 0 };
+};
@@ -0,0 +1,231 @@
+#include <syslog.h>
+
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "history.h"
+
+namespace
+{
+
+constexpr time_t default_range = 86400;
+
+/**
+ * @brief append a JSON number, null for NaN
+ */
+void append_number(std::string & out, double value)
+{
+    if (!std::isfinite(value))
+    {
+        out.append("null");
+        return;
+    }
+
+    char buf[32];
+    auto const [end, ec] = std::to_chars(buf, buf + sizeof buf, value);
+    out.append(buf, ec == std::errc{ } ? end : buf);
+}
+
+void append_integer(std::string & out, int64_t value)
+{
+    char buf[24];
+    auto const [end, ec] = std::to_chars(buf, buf + sizeof buf, value);
+    out.append(buf, ec == std::errc{ } ? end : buf);
+}
+
+/**
+ * @brief decode %XX & + of a query parameter, false if malformed
+ */
+bool url_decode(std::string_view in, std::string & out)
+{
+    out.clear();
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        if (in[i] == '+')
+            out.push_back(' ');
+        else if (in[i] != '%')
+            out.push_back(in[i]);
+        else
+        {
+            unsigned char c = 0;
+            if (i + 2 >= in.size() || std::from_chars(in.data() + i + 1, in.data() + i + 3, c, 16).ptr != in.data() + i + 3)
+                return false;
+            out.push_back(static_cast<char>(c));
+            i += 2;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+bool parse_integer(std::string_view in, T & out)
+{
+    return !in.empty() && std::from_chars(in.data(), in.data() + in.size(), out).ptr == in.data() + in.size();
+}
+
+} // namespace
+
+history::history(options opt)
+    : options_{ opt }
+{
+    if (options_.points_ == 0 || options_.budget_bytes_ < options_.points_ * sizeof(point))
+        throw std::invalid_argument{ "invalid history budget" };
+
+    // whole rings only, the budget rounds down
+    points_.resize(options_.budget_bytes_ / sizeof(point) / options_.points_ * options_.points_);
+    rings_.reserve(capacity());
+    index_.reserve(capacity());
+}
+
+void history::add(const char * name, double value, time_t time)
+{
+    ring * r;
+    if (auto const it = index_.find(std::string_view{ name }); it != index_.end())
+        r = &rings_[it->second];
+    else if (rings_.size() < capacity())
+    {
+        index_.emplace(name, rings_.size());
+        r = &rings_.emplace_back(ring{ rings_.size() * options_.points_ });
+    }
+    else
+    {
+        if (!full_)
+            syslog(LOG_USER | LOG_WARNING, "history is full, %s and later sensors have none\n", name);
+        full_ = true;
+        return;
+    }
+
+    // the rings stay sorted by time, a clock stepping back waits until it catches up
+    if (time < 0 || time > std::numeric_limits<uint32_t>::max() ||
+        (r->size_ != 0 && static_cast<uint32_t>(time) < at(*r, r->size_ - 1).time_))
+        return;
+
+    points_[r->begin_ + r->head_] = { static_cast<uint32_t>(time), static_cast<float>(value) };
+    r->head_ = r->head_ + 1 == options_.points_ ? 0 : r->head_ + 1;
+    if (r->size_ < options_.points_) ++r->size_;
+}
+
+const history::point & history::at(const ring & r, size_t i) const
+{
+    auto const slot = r.head_ + options_.points_ - r.size_ + i;
+    return points_[r.begin_ + slot % options_.points_];
+}
+
+bool history::query(std::string_view name, time_t from, time_t to, uint32_t step, std::string & out) const
+{
+    auto const it = index_.find(name);
+    if (it == index_.end()) return false;
+    auto const & r = rings_[it->second];
+
+    // first reading not before from
+    size_t lo = 0, hi = r.size_;
+    while (lo < hi)
+    {
+        auto const mid = lo + (hi - lo) / 2;
+        if (static_cast<time_t>(at(r, mid).time_) < from) lo = mid + 1;
+        else hi = mid;
+    }
+
+    out.append("{\"step\":");
+    append_integer(out, step);
+    out.append(",\"points\":[");
+
+    auto first = true;
+    auto const open = [&] {
+        if (!first) out.push_back(',');
+        first = false;
+        out.push_back('[');
+    };
+
+    if (step == 0)
+    {
+        for (auto i = lo; i < r.size_ && static_cast<time_t>(at(r, i).time_) <= to; ++i)
+        {
+            open();
+            append_integer(out, at(r, i).time_);
+            out.push_back(',');
+            append_number(out, at(r, i).value_);
+            out.push_back(']');
+        }
+    }
+    else
+    {
+        for (auto i = lo; i < r.size_ && static_cast<time_t>(at(r, i).time_) <= to; )
+        {
+            // a step with readings, the empty ones are left out
+            auto const start = at(r, i).time_ / step * step;
+            double sum = 0, min = at(r, i).value_, max = min;
+            size_t n = 0;
+            for (; i < r.size_ && at(r, i).time_ / step * step == start && static_cast<time_t>(at(r, i).time_) <= to; ++i, ++n)
+            {
+                double const v = at(r, i).value_;
+                sum += v;
+                min = std::fmin(min, v);
+                max = std::fmax(max, v);
+            }
+
+            open();
+            append_integer(out, start);
+            out.push_back(',');
+            append_number(out, sum / static_cast<double>(n));
+            out.push_back(',');
+            append_number(out, min);
+            out.push_back(',');
+            append_number(out, max);
+            out.push_back(',');
+            append_integer(out, static_cast<int64_t>(n));
+            out.push_back(']');
+        }
+    }
+
+    out.append("]}\n");
+    return true;
+}
+
+bool history::answer(std::string_view query, time_t now, std::string & out) const
+{
+    std::string name;
+    auto has_name = false, has_from = false;
+    time_t from = 0, to = now;
+    uint32_t step = 0;
+
+    while (!query.empty())
+    {
+        auto const amp = query.find('&');
+        auto const param = query.substr(0, amp);
+        query.remove_prefix(amp == std::string_view::npos ? query.size() : amp + 1);
+
+        auto const eq = param.find('=');
+        auto const key = param.substr(0, eq);
+        auto const value = eq == std::string_view::npos ? std::string_view{ } : param.substr(eq + 1);
+        if (key == "name")
+            has_name = url_decode(value, name);
+        else if (key == "from")
+        {
+            if (!parse_integer(value, from)) return false;
+            has_from = true;
+        }
+        else if (key == "to")
+        {
+            if (!parse_integer(value, to)) return false;
+        }
+        else if (key == "step")
+        {
+            if (!parse_integer(value, step)) return false;
+        }
+    }
+
+    if (!has_name) return false;
+    if (!has_from) from = to - default_range;
+    return this->query(name, from, to, step, out);
+}
+
+size_t history::size() const
+{
+    size_t n = 0;
+    for (auto const & r : rings_)
+        n += r.size_;
+    return n;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief the recent readings of each sensor in memory, for local dashboards
+ *
+ * Every sensor gets a ring of points_ readings carved out of one buffer
+ * allocated up front, so the memory never exceeds budget_bytes_ however many
+ * sensors show up; once the buffer is shared out new sensors get no history.
+ * A reading is 8 bytes, 2880 of them keep a day of 30 second sweeps.
+ *
+ * query() answers a time range of a sensor as JSON, the raw readings or
+ * their mean, min & max per step seconds, from memory only. Used from a
+ * single thread: the sweeps add, the metrics server queries in between.
+ */
+class history
+{
+public:
+    struct options
+    {
+        size_t points_{ 2880 };            ///< readings kept per sensor
+        size_t budget_bytes_{ 4 << 20 };   ///< memory of all the rings
+    };
+
+    explicit history(options opt);
+
+    history(const history &) = delete;
+
+    history & operator=(const history &) = delete;
+
+    /**
+     * @brief append a reading, one older than the last of its sensor is ignored
+     */
+    void add(const char * name, double value, time_t time);
+
+    /**
+     * @brief append the readings of name in [from, to] as JSON to out
+     *
+     * With step 0 each reading is `[time,value]`, else each step with
+     * readings, aligned on the epoch, is `[start,mean,min,max,count]`.
+     *
+     * @return false if name has no history
+     */
+    bool query(std::string_view name, time_t from, time_t to, uint32_t step, std::string & out) const;
+
+    /**
+     * @brief answer `name=...&from=...&to=...&step=...` of an HTTP request
+     *
+     * from defaults to a day before to, to to now, step to 0.
+     *
+     * @return false if the query is invalid or name has no history
+     */
+    bool answer(std::string_view query, time_t now, std::string & out) const;
+
+    /**
+     * @brief sensors with a ring
+     */
+    size_t sensors() const { return index_.size(); }
+
+    /**
+     * @brief sensors the budget has room for
+     */
+    size_t capacity() const { return points_.size() / options_.points_; }
+
+    /**
+     * @brief readings held, over all sensors
+     */
+    size_t size() const;
+
+    /**
+     * @brief bytes of the rings, allocated up front
+     */
+    size_t bytes() const { return points_.size() * sizeof(point); }
+
+private:
+    struct point
+    {
+        uint32_t time_;   ///< unix time, good until 2106
+        float    value_;  ///< celsius, the sensors resolve 1/16
+    };
+
+    struct ring
+    {
+        size_t begin_;    ///< first point of the ring in points_
+        size_t head_{ 0 }; ///< next point written, relative to begin_
+        size_t size_{ 0 };
+    };
+
+    struct name_hash
+    {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{ }(s); }
+    };
+
+    /**
+     * @brief the i-th oldest point of r
+     */
+    const point & at(const ring & r, size_t i) const;
+
+private:
+    options                                                           options_;
+    std::vector<point>                                                points_;
+    std::vector<ring>                                                 rings_{ };
+    std::unordered_map<std::string, size_t, name_hash, std::equal_to<>> index_{ };
+    bool                                                              full_{ false };  ///< a sensor was left out, logged once
+};
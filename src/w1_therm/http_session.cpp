@@ -0,0 +1,180 @@
+#include <syslog.h>
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <tuple>
+
+#include "http_session.h"
+
+void http_session::multi_deleter::operator()(CURLM * multi) const
+{
+    curl_multi_cleanup(multi);
+}
+
+http_session::http_session()
+    : timer_{ make_timer_fd() }
+    , multi_{ curl_multi_init() }
+{
+    if (!multi_)
+        throw std::runtime_error{ "curl_multi_init failed" };
+
+    curl_multi_setopt(multi_.get(), CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(multi_.get(), CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi_.get(), CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(multi_.get(), CURLMOPT_TIMERDATA, this);
+
+    done_.reserve(16);
+
+    loop_.add(timer_.get(), EPOLLIN, [this](uint32_t)
+    {
+        read_counter(timer_.get());
+        socket_action(CURL_SOCKET_TIMEOUT, 0);
+    });
+}
+
+http_session::~http_session() = default;
+
+bool http_session::start(CURL * easy)
+{
+    // adding the handle sets a zero timeout, the timer starts the transfer
+    if (curl_multi_add_handle(multi_.get(), easy) != CURLM_OK)
+        return false;
+
+    ++in_flight_;
+    return true;
+}
+
+void http_session::dispatch()
+{
+    loop_.run_once(0);
+    collect();
+}
+
+void http_session::collect()
+{
+    CURLMsg * msg;
+    int left;
+    while ((msg = curl_multi_info_read(multi_.get(), &left)))
+    {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        auto const easy = msg->easy_handle;
+        auto const result = msg->data.result;
+        curl_multi_remove_handle(multi_.get(), easy);
+        done_.emplace_back(easy, result);
+    }
+}
+
+bool http_session::pop_done(CURL *& easy, CURLcode & result)
+{
+    if (done_.empty()) return false;
+
+    std::tie(easy, result) = done_.front();
+    done_.erase(done_.begin());
+    --in_flight_;
+    return true;
+}
+
+void http_session::cancel(CURL * easy)
+{
+    auto const it = std::find_if(done_.begin(), done_.end(),
+        [easy](auto const & d) { return d.first == easy; });
+    if (it != done_.end())
+        done_.erase(it);
+    else
+        curl_multi_remove_handle(multi_.get(), easy);
+    --in_flight_;
+}
+
+CURLcode http_session::perform(CURL * easy)
+{
+    if (!start(easy))
+        return CURLE_FAILED_INIT;
+
+    for (;;)
+    {
+        loop_.run_once(-1);
+        collect();
+
+        auto const it = std::find_if(done_.begin(), done_.end(),
+            [easy](auto const & d) { return d.first == easy; });
+        if (it == done_.end()) continue;
+
+        auto const result = it->second;
+        done_.erase(it);
+        --in_flight_;
+
+        // transfers finished meanwhile left no I/O behind, wake the owner to pop them
+        if (!done_.empty())
+            arm_timer(timer_.get(), std::chrono::nanoseconds{ 1 });
+        return result;
+    }
+}
+
+void http_session::socket_action(curl_socket_t s, int mask)
+{
+    curl_multi_socket_action(multi_.get(), s, mask, &running_);
+}
+
+int http_session::socket_callback(CURL *, curl_socket_t s, int what, void * userp, void *)
+{
+    auto & self = *static_cast<http_session *>(userp);
+
+    try
+    {
+        if (what == CURL_POLL_REMOVE)
+        {
+            self.loop_.remove(s);
+            return 0;
+        }
+
+        uint32_t events = 0;
+        if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) events |= EPOLLIN;
+        if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) events |= EPOLLOUT;
+
+        if (self.loop_.contains(s))
+        {
+            self.loop_.modify(s, events);
+            return 0;
+        }
+
+        self.loop_.add(s, events, [&self, s](uint32_t ready)
+        {
+            int mask = 0;
+            if (ready & EPOLLIN) mask |= CURL_CSELECT_IN;
+            if (ready & EPOLLOUT) mask |= CURL_CSELECT_OUT;
+            if (ready & (EPOLLERR | EPOLLHUP)) mask |= CURL_CSELECT_ERR;
+            self.socket_action(s, mask);
+        });
+        return 0;
+    }
+    catch (std::exception const & e)
+    {
+        // never unwind through curl, failing the callback fails the transfer
+        syslog(LOG_USER | LOG_ERR, "cannot watch socket %d: %s\n", s, e.what());
+        return -1;
+    }
+}
+
+int http_session::timer_callback(CURLM *, long timeout_ms, void * userp)
+{
+    auto & self = *static_cast<http_session *>(userp);
+
+    try
+    {
+        // -1 deletes the timer, 0 asks to be called as soon as possible
+        if (timeout_ms < 0)
+            arm_timer(self.timer_.get(), { });
+        else if (timeout_ms == 0)
+            arm_timer(self.timer_.get(), std::chrono::nanoseconds{ 1 });
+        else
+            arm_timer(self.timer_.get(), std::chrono::milliseconds{ timeout_ms });
+        return 0;
+    }
+    catch (std::exception const & e)
+    {
+        syslog(LOG_USER | LOG_ERR, "cannot arm the curl timer: %s\n", e.what());
+        return -1;
+    }
+}
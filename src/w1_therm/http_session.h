@@ -0,0 +1,95 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "event_loop.h"
+#include "unique_fd.h"
+
+/**
+ * @brief drives curl transfers with curl-multi on an event_loop of its own
+ *
+ * curl reports the sockets and the timeout it waits for, they are watched in
+ * epoll, so a transfer costs no wakeups besides its own I/O. Transfers are
+ * started with start(), the owner nests fd() in its event_loop and calls
+ * dispatch() when it is readable, then collects the finished transfers with
+ * pop_done(). The connection cache lives in the multi handle, kept-alive
+ * connections are reused across transfers.
+ *
+ * curl keeps pointers to the session, it is neither copyable nor movable.
+ */
+class http_session
+{
+public:
+    http_session();
+
+    http_session(const http_session &) = delete;
+
+    ~http_session();
+
+    http_session & operator=(const http_session &) = delete;
+
+    /**
+     * @brief start the transfer set up on easy, pop_done() reports its end
+     */
+    bool start(CURL * easy);
+
+    /**
+     * @brief progress the transfers whose sockets or timer are ready, never waits
+     */
+    void dispatch();
+
+    /**
+     * @brief take a finished transfer
+     */
+    bool pop_done(CURL *& easy, CURLcode & result);
+
+    /**
+     * @brief run the transfer set up on easy to completion, blocking
+     *
+     * Other transfers progress meanwhile, they are reported by pop_done().
+     */
+    CURLcode perform(CURL * easy);
+
+    /**
+     * @brief abort a started transfer, it is not reported by pop_done
+     */
+    void cancel(CURL * easy);
+
+    size_t in_flight() const { return in_flight_; }
+
+    /**
+     * @brief the epoll fd of the session, readable when a transfer can progress
+     */
+    int fd() const { return loop_.fd(); }
+
+private:
+    struct multi_deleter
+    {
+        void operator()(CURLM * multi) const;
+    };
+
+    using multi_ptr = std::unique_ptr<CURLM, multi_deleter>;
+
+    static int socket_callback(CURL * easy, curl_socket_t s, int what, void * userp, void * socketp);
+
+    static int timer_callback(CURLM * multi, long timeout_ms, void * userp);
+
+    void socket_action(curl_socket_t s, int mask);
+
+    /**
+     * @brief move finished transfers from curl to done_
+     */
+    void collect();
+
+private:
+    event_loop loop_{ };
+    unique_fd  timer_{ };      ///< fires when curl wants to be called without I/O
+    int        running_{ 0 };  ///< transfers curl still runs
+    size_t     in_flight_{ 0 }; ///< started transfers not taken by pop_done yet
+    std::vector<std::pair<CURL *, CURLcode>> done_{ };
+    multi_ptr  multi_{ };      ///< destroyed first, its cleanup calls back into loop_
+};
@@ -1,5 +1,7 @@
 #include <cassert>
 #include <cstddef>
+#include <algorithm>
+#include <optional>
 #include <stdexcept>
 
 #ifdef _DEBUG_
@@ -10,29 +12,51 @@
 #include <rapidjson/document.h>
 
 #include "influx_storage.h"
+#include "metrics.h"
 
-inline void influx_storage::curl_deleter::operator()(CURL * curl) const
+void influx_storage::curl_deleter::operator()(CURL * curl) const
 {
     curl_easy_cleanup(curl);
 }
 
-inline void influx_storage::curl_list_deleter::operator()(curl_slist * list) const
+influx_storage::write_request::write_request() = default;
+
+influx_storage::write_request::~write_request() = default;
+
+void influx_storage::curl_list_deleter::operator()(curl_slist * list) const
 {
     curl_slist_free_all(list);
 }
 
+void influx_storage::deflate_deleter::operator()(z_stream * zs) const
+{
+    deflateEnd(zs);
+    delete zs;
+}
+
 influx_storage::influx_storage(std::string host,
                                std::string org,
                                std::string bucket,
                                std::string token,
                                std::string measurement,
                                std::string field)
+    : influx_storage{ std::move(host), std::move(org), std::move(bucket), std::move(token),
+                      std::move(measurement), std::move(field), options{ } }
+{ }
+
+influx_storage::influx_storage(std::string host,
+                               std::string org,
+                               std::string bucket,
+                               std::string token,
+                               std::string measurement,
+                               std::string field,
+                               options opt)
     : host_{ std::move(host) }
     , org_{ std::move(org) }
     , bucket_{ std::move(bucket) }
     , token_{ std::move(token) }
-    , measurement_{ std::move(measurement) }
-    , field_{ std::move(field) }
+    , format_{ std::move(measurement), std::move(field) }
+    , options_{ opt }
 {
     if (host_.empty())
         throw std::invalid_argument{ "host is empty" };
@@ -42,119 +66,451 @@ influx_storage::influx_storage(std::string host,
         throw std::invalid_argument{ "bucket is empty" };
     if (token_.empty())
         throw std::invalid_argument{ "token is empty" };
-    if (measurement_.empty())
-        throw std::invalid_argument{ "measurement is empty" };
-    if (field_.empty())
-        throw std::invalid_argument{ "field is empty" };
+    if (options_.max_in_flight_ == 0)
+        throw std::invalid_argument{ "no write in flight" };
+    write_url_ = "http://" + host_ + "/api/v2/write?bucket=" + bucket_ + "&org=" + org_ + "&precision=s";
+    buckets_url_ = "http://" + host_ + "/api/v2/buckets?name=" + bucket_;
+    ping_url_ = "http://" + host_ + "/ping";
+
+    std::string const auth = "Authorization: Token " + token_;
+    curl_slist * headers = nullptr;
+    headers = curl_slist_append(headers, auth.c_str());
+    headers = curl_slist_append(headers, "Accept: application/json");
+    headers = curl_slist_append(headers, "Content-Type: text/plain; charset=utf-8");
+    // curl holds back large bodies for up to a second waiting for 100 Continue
+    headers = curl_slist_append(headers, "Expect:");
+    write_headers_.reset(headers);
+
+    headers = nullptr;
+    headers = curl_slist_append(headers, auth.c_str());
+    headers = curl_slist_append(headers, "Accept: application/json");
+    headers = curl_slist_append(headers, "Content-Type: text/plain; charset=utf-8");
+    headers = curl_slist_append(headers, "Content-Encoding: gzip");
+    headers = curl_slist_append(headers, "Expect:");
+    gzip_headers_.reset(headers);
+
+    headers = nullptr;
+    headers = curl_slist_append(headers, auth.c_str());
+    headers = curl_slist_append(headers, "Accept: application/json");
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    json_headers_.reset(headers);
+
+    if (!write_headers_ || !gzip_headers_ || !json_headers_)
+        throw runtime_error{ "curl_slist_append failed" };
+
+    if (options_.gzip_level_ < 0 || options_.gzip_level_ > 9)
+        throw std::invalid_argument{ "gzip level must be 0-9" };
+
+    if (options_.gzip_level_ > 0)
+    {
+        deflate_.reset(new z_stream{ });
+        // 15 + 16: largest window, gzip wrapper instead of zlib
+        if (deflateInit2(deflate_.get(), options_.gzip_level_, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            delete deflate_.release();
+            throw runtime_error{ "deflateInit2 failed" };
+        }
+    }
+
+    open_session();
 }
 
-void influx_storage::prepare_data(std::string & data, const char * name, double value, time_t now)
+influx_storage::~influx_storage()
 {
-    // construct influx line protocol
-    data += measurement_;
-    data += ",name=";
-    data += name;
-    data += ' ';
-    data += field_;
-    data += '=';
-    data += std::to_string(value);
-    data += ' ';
-    data += std::to_string(now);
-    data += '\n';
+    // handles must leave the multi handle before they are cleaned up
+    for (auto const & req : requests_)
+        if (req->busy_) session_->cancel(req->curl_.get());
 }
 
-void influx_storage::insert(const std::string & data)
+size_t influx_storage::in_flight() const
 {
-    // init curl
-    curl_ptr curl{curl_easy_init()};
-    if (!curl)
-        throw runtime_error{"curl_easy_init failed"};
+    return static_cast<size_t>(std::count_if(requests_.begin(), requests_.end(),
+        [](auto const & req) { return req->busy_; }));
+}
 
-    // set url
-    std::string url = "http://" + host_ + "/api/v2/write?bucket=" + bucket_ + "&org=" + org_ + "&precision=s";
-    curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
+void influx_storage::setup_handle(CURL * curl) const
+{
+    // options shared by all requests, the connection is kept alive and reused
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 60L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 30L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
 
-    // set request method to POST
-    curl_easy_setopt(curl.get(), CURLOPT_POST, 1L);
+    // a dead endpoint must not hold the uploader for curl's default timeouts
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(options_.connect_timeout_.count()));
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(options_.timeout_.count()));
+}
 
-    // set headers
-    curl_slist * headers = nullptr;
-    std::string auth = "Authorization: Token " + token_;
-    headers = curl_slist_append(headers, auth.c_str());
-    headers = curl_slist_append(headers, "Accept: application/json");
-    headers = curl_slist_append(headers, "Content-Type: text/plain; charset=utf-8");
-    curl_list_ptr guard{ headers };
-    curl_easy_setopt(curl.get(), CURLOPT_HTTPHEADER, headers);
+void influx_storage::open_session()
+{
+    if (!session_)
+        session_ = std::make_unique<http_session>();
 
-    // set body
-    curl_easy_setopt(curl.get(), CURLOPT_POSTFIELDS, data.c_str());
-    curl_easy_setopt(curl.get(), CURLOPT_POSTFIELDSIZE, data.size());
+    curl_.reset(curl_easy_init());
+    if (!curl_)
+        throw runtime_error{ "curl_easy_init failed" };
+    setup_handle(curl_.get());
 
-    // set callback
-    std::string response_body;
-    curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &response_body);
+    // write requests keep their url, headers & buffers, only the body changes
+    requests_.clear();
+    for (size_t i = 0; i < options_.max_in_flight_; ++i)
+    {
+        auto req = std::make_unique<write_request>();
+        req->curl_.reset(curl_easy_init());
+        if (!req->curl_)
+            throw runtime_error{ "curl_easy_init failed" };
+
+        auto const curl = req->curl_.get();
+        setup_handle(curl);
+        curl_easy_setopt(curl, CURLOPT_URL, write_url_.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, deflate_ ? gzip_headers_.get() : write_headers_.get());
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &req->response_);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, req.get());
+        req->index_ = i;
+        requests_.push_back(std::move(req));
+    }
+}
+
+bool influx_storage::allows_request() const
+{
+    return state_ != health::open || clock::now() >= retry_at_;
+}
+
+bool influx_storage::admit()
+{
+    if (state_ != health::open) return true;
+    if (clock::now() < retry_at_) return false;
+
+    state_ = health::half_open;
+    return true;
+}
+
+void influx_storage::record_success()
+{
+    state_ = health::closed;
+    failures_ = 0;
+    backoff_ = { };
+}
+
+void influx_storage::record_failure(clock::duration retry_after)
+{
+    ++failures_;
+    // a server naming its retry time is open right away, probing it earlier only adds load
+    if (retry_after == clock::duration{ } && state_ != health::half_open && failures_ < options_.failure_threshold_)
+        return;
+
+    // exponential backoff with jitter in [backoff / 2, backoff]
+    clock::duration const min = options_.backoff_min_;
+    clock::duration const max = options_.backoff_max_;
+    backoff_ = backoff_ == clock::duration{ } ? min : std::min(backoff_ * 2, max);
+    std::uniform_int_distribution<clock::rep> jitter{ backoff_.count() / 2, backoff_.count() };
+    retry_at_ = clock::now() + std::max(clock::duration{ jitter(rng_) }, retry_after);
+    state_ = health::open;
+}
+
+CURLcode influx_storage::perform()
+{
+    response_body_.clear();
+    curl_easy_setopt(curl_.get(), CURLOPT_WRITEDATA, &response_body_);
+
+    auto res = session_->perform(curl_.get());
+    switch (res)
+    {
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    {
+        // the server closed the kept-alive connection, retry once on a fresh handle
+        curl_ptr old{ curl_easy_duphandle(curl_.get()) };
+        if (!old) break;
+        curl_.swap(old);
+        response_body_.clear();
+        curl_easy_setopt(curl_.get(), CURLOPT_WRITEDATA, &response_body_);
+        res = session_->perform(curl_.get());
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return res;
+}
+
+void influx_storage::prepare_data(line_encoder & data, const char * name, double value, time_t now, uint32_t series)
+{
+    format_.encode(data, name, value, now, series);
+}
+
+std::string_view influx_storage::compress(std::string_view data, std::unique_ptr<char[]> & buf, size_t & capacity)
+{
+    auto const zs = deflate_.get();
+    if (deflateReset(zs) != Z_OK)
+        throw runtime_error{ "deflateReset failed" };
+
+    auto const bound = deflateBound(zs, static_cast<uLong>(data.size()));
+    if (bound > capacity)
+    {
+        buf = std::make_unique<char[]>(bound);
+        capacity = bound;
+    }
+
+    zs->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    zs->avail_in = static_cast<uInt>(data.size());
+    zs->next_out = reinterpret_cast<Bytef *>(buf.get());
+    zs->avail_out = static_cast<uInt>(capacity);
+    if (deflate(zs, Z_FINISH) != Z_STREAM_END)
+        throw runtime_error{ "deflate failed" };
+
+    return { buf.get(), static_cast<size_t>(zs->total_out) };
+}
+
+void influx_storage::account(clock::time_point start, long response_code)
+{
+    auto & m = global_metrics();
+    m.influx_write_.observe(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start));
+    m.influx_responses_[response_code >= 100 && response_code < 600 ? static_cast<size_t>(response_code / 100) : 0].add();
+}
+
+influx_storage::write_status influx_storage::record_response(CURL * curl, long response_code)
+{
+    if (response_code / 100 == 2)
+    {
+        record_success();
+        return write_status::ok;
+    }
+
+    // only an overloaded or broken server feeds the breaker
+    if (response_code == 429 || response_code / 100 == 5)
+    {
+        // the server may say when to come back, e.g. 429 or 503 with Retry-After
+        curl_off_t retry_after = 0;
+        curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after);
+        record_failure(std::chrono::seconds{ retry_after });
+    }
+    else
+        record_success();
+    if (response_code == 404)
+        bucket_checked_ = { };
+    if (response_code == 400 || response_code == 422)
+        return write_status::rejected;
+    return write_status::failed;
+}
+
+void influx_storage::insert(std::string_view data)
+{
+    if (!admit())
+        throw runtime_error{ "circuit open" };
+
+    if (!curl_)
+        open_session();
+
+    // line protocol repeats names on every line, it compresses very well
+    auto const body = deflate_ ? compress(data, gzip_buf_, gzip_capacity_) : data;
+
+    // set url & headers
+    curl_easy_setopt(curl_.get(), CURLOPT_URL, write_url_.c_str());
+    curl_easy_setopt(curl_.get(), CURLOPT_HTTPHEADER, deflate_ ? gzip_headers_.get() : write_headers_.get());
+
+    // set request method to POST & body
+    curl_easy_setopt(curl_.get(), CURLOPT_POST, 1L);
+    curl_easy_setopt(curl_.get(), CURLOPT_POSTFIELDS, body.data());
+    curl_easy_setopt(curl_.get(), CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));
 
     // perform request
-    CURLcode res = curl_easy_perform(curl.get());
+    auto const bgn = clock::now();
+    CURLcode res = perform();
     if (res != CURLE_OK)
-        throw runtime_error{curl_easy_strerror(res)};
+    {
+        account(bgn, 0);
+        record_failure();
+        throw transport_error{curl_easy_strerror(res)};
+    }
 
     // check response code
     long response_code = 0;
-    curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &response_code);
-    if (response_code / 100 != 2)
+    curl_easy_getinfo(curl_.get(), CURLINFO_RESPONSE_CODE, &response_code);
+    account(bgn, response_code);
+    switch (record_response(curl_.get(), response_code))
+    {
+    case write_status::ok:
+        break;
+
+    case write_status::rejected:
+        throw rejected_error{"influxdb response code: " + std::to_string(response_code) + ": " + response_body_};
+
+    case write_status::failed:
         throw runtime_error{"influxdb response code: " + std::to_string(response_code)};
+    }
+
+    last_latency_ = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - bgn);
+    bytes_written_ += data.size();
+    bytes_sent_ += body.size();
+    global_metrics().uploaded(data.size(), body.size());
 #ifdef _DEBUG_
     std::cerr << "new record: \n" << data << std::endl;
 #endif
 }
 
-bool influx_storage::is_bucket_exists() const
+influx_storage::write_request * influx_storage::acquire_write()
+{
+    if (!curl_)
+        open_session();
+
+    for (auto const & req : requests_)
+    {
+        if (!req->busy_)
+        {
+            req->body_.clear();
+            return req.get();
+        }
+    }
+    return nullptr;
+}
+
+void influx_storage::submit(write_request & req)
+{
+    assert(!req.busy_);
+
+    if (!admit())
+        throw runtime_error{ "circuit open" };
+
+    auto const data = req.body_.view();
+    auto const body = deflate_ ? compress(data, req.gzip_buf_, req.gzip_capacity_) : data;
+    auto const curl = req.curl_.get();
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.data());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));
+
+    req.response_.clear();
+    req.error_.clear();
+    req.sent_ = body.size();
+    req.retried_ = false;
+    req.start_ = clock::now();
+    if (!session_->start(curl))
+        throw runtime_error{ "cannot start request" };
+    req.busy_ = true;
+}
+
+bool influx_storage::finish(write_request & req, CURLcode res)
+{
+    switch (res)
+    {
+    case CURLE_OK:
+        break;
+
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+        // the server closed the kept-alive connection, retry once on a new one
+        if (!req.retried_ && session_->start(req.curl_.get()))
+        {
+            req.retried_ = true;
+            return false;
+        }
+        [[fallthrough]];
+
+    default:
+        account(req.start_, 0);
+        record_failure();
+        req.status_ = write_status::failed;
+        req.error_ = curl_easy_strerror(res);
+        req.transport_failed_ = true;
+        return true;
+    }
+
+    long response_code = 0;
+    curl_easy_getinfo(req.curl_.get(), CURLINFO_RESPONSE_CODE, &response_code);
+    account(req.start_, response_code);
+    req.status_ = record_response(req.curl_.get(), response_code);
+    req.transport_failed_ = false;
+    if (req.status_ != write_status::ok)
+    {
+        req.error_ = "influxdb response code: " + std::to_string(response_code);
+        if (req.status_ == write_status::rejected)
+            req.error_ += ": " + req.response_;
+        return true;
+    }
+
+    last_latency_ = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - req.start_);
+    bytes_written_ += req.body_.size();
+    bytes_sent_ += req.sent_;
+    global_metrics().uploaded(req.body_.size(), req.sent_);
+#ifdef _DEBUG_
+    std::cerr << "new record: \n" << req.body_.view() << std::endl;
+#endif
+    return true;
+}
+
+bool influx_storage::is_bucket_exists()
+{
+    if (!admit())
+        return false;
+
+    // a healthy /ping says nothing about writes, only a write closes the breaker
+    if (!ping())
+    {
+        record_failure();
+        return false;
+    }
+
+    auto const now = clock::now();
+    if (bucket_checked_ == clock::time_point{ } || now - bucket_checked_ >= options_.bucket_ttl_)
+    {
+        // only a definite answer is cached
+        auto const exists = list_bucket();
+        if (!exists) return false;
+        bucket_exists_ = *exists;
+        bucket_checked_ = now;
+    }
+
+    return bucket_exists_;
+}
+
+bool influx_storage::ping()
+{
+    if (!curl_)
+        open_session();
+
+    curl_easy_setopt(curl_.get(), CURLOPT_URL, ping_url_.c_str());
+    curl_easy_setopt(curl_.get(), CURLOPT_HTTPHEADER, nullptr);
+    curl_easy_setopt(curl_.get(), CURLOPT_HTTPGET, 1L);
+
+    if (perform() != CURLE_OK) return false;
+
+    long response_code = 0;
+    curl_easy_getinfo(curl_.get(), CURLINFO_RESPONSE_CODE, &response_code);
+    return response_code / 100 == 2;
+}
+
+std::optional<bool> influx_storage::list_bucket()
 {
     assert(!host_.empty());
     assert(!bucket_.empty());
     assert(!org_.empty());
     assert(!token_.empty());
 
-    // init curl
-    curl_ptr curl{ curl_easy_init() };
-    if (!curl) return false;
-
-    // set url
-    std::string url = "http://" + host_ + "/api/v2/buckets?name=" + bucket_;
-    curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
+    // set url & headers
+    curl_easy_setopt(curl_.get(), CURLOPT_URL, buckets_url_.c_str());
+    curl_easy_setopt(curl_.get(), CURLOPT_HTTPHEADER, json_headers_.get());
 
     // set request method to GET
-    curl_easy_setopt(curl.get(), CURLOPT_HTTPGET, 1L);
-
-    // set headers
-    curl_slist * headers = nullptr;
-    std::string auth = "Authorization: Token " + token_;
-    headers = curl_slist_append(headers, auth.c_str());
-    headers = curl_slist_append(headers, "Accept: application/json");
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    curl_list_ptr guard{ headers };
-    curl_easy_setopt(curl.get(), CURLOPT_HTTPHEADER, headers);
-
-    // set write callback & userdata
-    std::string response_body;
-    curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &response_body);
+    curl_easy_setopt(curl_.get(), CURLOPT_HTTPGET, 1L);
 
     // execute request
-    CURLcode res = curl_easy_perform(curl.get());
-    if (res != CURLE_OK) return false;
+    CURLcode res = perform();
+    if (res != CURLE_OK) return std::nullopt;
 
     // get response code
     long response_code = 0;
-    curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &response_code);
-    if (response_code != 200) return false;
+    curl_easy_getinfo(curl_.get(), CURLINFO_RESPONSE_CODE, &response_code);
+    if (response_code != 200) return std::nullopt;
 
     // parse response body
     rapidjson::Document doc;
-    doc.Parse(response_body.c_str());
-    if (doc.HasParseError()) return false;
+    doc.Parse(response_body_.c_str());
+    if (doc.HasParseError()) return std::nullopt;
 
     // check if bucket exists
     auto const & buckets = doc["buckets"];
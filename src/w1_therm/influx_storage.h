@@ -1,17 +1,70 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <memory>
+#include <optional>
+#include <random>
 #include <string>
+#include <string_view>
 #include <stdexcept>
+#include <vector>
 
 #include <curl/curl.h>
+#include <zlib.h>
+
+#include "http_session.h"
+#include "line_protocol.h"
 
 class influx_storage
 {
 public:
     struct runtime_error;
 
+    struct rejected_error;
+
+    struct transport_error;
+
+    /**
+     * @brief state of the circuit breaker guarding the server
+     */
+    enum class health
+    {
+        closed,    ///< requests flow normally
+        open,      ///< requests fail fast until the backoff has elapsed
+        half_open, ///< one trial request decides between closed and open
+    };
+
+    /**
+     * @brief outcome of an asynchronous write
+     */
+    enum class write_status
+    {
+        ok,
+        failed,   ///< not written, worth retrying later
+        rejected, ///< the server refuses the data itself, retrying cannot succeed
+    };
+
+    class write_request;
+
+    /**
+     * @brief timeouts & circuit breaker settings
+     */
+    struct options
+    {
+        std::chrono::milliseconds connect_timeout_{ 3000 };  ///< curl connect timeout
+        std::chrono::milliseconds timeout_{ 10000 };         ///< curl timeout of a whole request
+        size_t                    failure_threshold_{ 3 };   ///< consecutive failures opening the breaker
+        std::chrono::milliseconds backoff_min_{ 1000 };      ///< first backoff once open
+        std::chrono::milliseconds backoff_max_{ 300000 };    ///< backoff doubles up to this
+        std::chrono::seconds      bucket_ttl_{ 600 };        ///< how long the bucket lookup is trusted
+        int                       gzip_level_{ 0 };          ///< gzip request bodies if 1-9
+        size_t                    max_in_flight_{ 4 };       ///< writes posted at once, each on a connection of its own
+    };
+
 private:
+    using clock = std::chrono::steady_clock;
+
     struct curl_deleter
     {
         void operator()(CURL * curl) const;
@@ -22,8 +75,14 @@ private:
         void operator()(curl_slist * list) const;
     };
 
+    struct deflate_deleter
+    {
+        void operator()(z_stream * zs) const;
+    };
+
     using curl_ptr = std::unique_ptr<CURL, curl_deleter>;
     using curl_list_ptr = std::unique_ptr<curl_slist, curl_list_deleter>;
+    using deflate_ptr = std::unique_ptr<z_stream, deflate_deleter>;
 
 public:
     influx_storage(std::string host,
@@ -33,11 +92,19 @@ public:
                    std::string measurement,
                    std::string field);
 
+    influx_storage(std::string host,
+                   std::string org,
+                   std::string bucket,
+                   std::string token,
+                   std::string measurement,
+                   std::string field,
+                   options opt);
+
     influx_storage(const influx_storage &) = delete;
 
     influx_storage(influx_storage &&) noexcept = default;
 
-    ~influx_storage() = default;
+    ~influx_storage();
 
     influx_storage & operator=(const influx_storage &) = delete;
 
@@ -45,33 +112,278 @@ public:
 
     void insert(const char * name, double value, time_t now);
 
-    void prepare_data(std::string & data, const char * name, double value, time_t now);
+    /**
+     * @brief append one point in line protocol to data, see point_format
+     */
+    void prepare_data(line_encoder & data, const char * name, double value, time_t now, uint32_t series = 0);
+
+    /**
+     * @brief write line protocol, fails fast while the breaker is open
+     *
+     * Throws rejected_error if the server refuses the data itself, retrying
+     * the same data can never succeed.
+     */
+    void insert(std::string_view data);
+
+    /**
+     * @brief a write request not in flight, nothing while all of them are
+     *
+     * Encode the points into its body() and submit() it.
+     */
+    write_request * acquire_write();
+
+    /**
+     * @brief post the body of req without waiting, fails fast while the breaker is open
+     */
+    void submit(write_request & req);
+
+    /**
+     * @brief progress the writes in flight, call done(write_request &) for each finished one
+     *
+     * The request is free again when done is called, status() tells the outcome.
+     */
+    template <typename F>
+    void poll(F && done);
+
+    /**
+     * @brief readable when a write in flight can progress, nest it in an event_loop
+     */
+    int fd() const { return session_->fd(); }
+
+    /**
+     * @brief writes submitted and not reported by poll yet
+     */
+    size_t in_flight() const;
 
-    void insert(const std::string & data);
+    /**
+     * @brief whether the server is up and the bucket exists
+     *
+     * Honors the breaker, probes `/ping` instead of listing buckets, and only
+     * lists buckets again once the cached answer is older than bucket_ttl_.
+     */
+    bool is_bucket_exists();
 
-    bool is_bucket_exists() const;
+    /**
+     * @brief whether the breaker lets a request through now
+     */
+    bool allows_request() const;
+
+    health state() const { return state_; }
+
+    /**
+     * @brief how long the last successful write took
+     */
+    std::chrono::microseconds last_latency() const { return last_latency_; }
+
+    /**
+     * @brief line protocol bytes written so far, before compression
+     */
+    size_t bytes_written() const { return bytes_written_; }
+
+    /**
+     * @brief request body bytes sent so far, after compression
+     */
+    size_t bytes_sent() const { return bytes_sent_; }
 
 protected:
     static size_t write_callback(
         char * ptr, size_t size, size_t nmemb, void * userdata);
 
+private:
+    /**
+     * @brief options shared by every handle
+     */
+    void setup_handle(CURL * curl) const;
+
+    /**
+     * @brief create the long-lived curl handles & the write requests
+     */
+    void open_session();
+
+    /**
+     * @brief latency & status class of a finished write, 0 if it got no answer
+     */
+    void account(clock::time_point start, long response_code);
+
+    /**
+     * @brief breaker bookkeeping of a write answered with response_code
+     */
+    write_status record_response(CURL * curl, long response_code);
+
+    /**
+     * @brief account for a finished write
+     *
+     * @return false if it was started again on a new connection
+     */
+    bool finish(write_request & req, CURLcode res);
+
+    /**
+     * @brief perform the request prepared on curl_, reconnect once if the
+     *        kept-alive connection went bad
+     */
+    CURLcode perform();
+
+    /**
+     * @brief GET /ping
+     */
+    bool ping();
+
+    /**
+     * @brief gzip data into buf, growing it as needed
+     */
+    std::string_view compress(std::string_view data, std::unique_ptr<char[]> & buf, size_t & capacity);
+
+    /**
+     * @brief GET /api/v2/buckets and look for bucket_
+     */
+    std::optional<bool> list_bucket();
+
+    /**
+     * @brief move to half-open if the backoff has elapsed, false while open
+     */
+    bool admit();
+
+    void record_success();
+
+    /**
+     * @brief count a failure, retry_after keeps the breaker open at least that long
+     */
+    void record_failure(clock::duration retry_after = { });
+
 private:
     std::string host_;
     std::string org_;
     std::string bucket_;
     std::string token_;
-    std::string measurement_;
-    std::string field_;
+    point_format format_;
+
+    std::string   write_url_{ };     ///< prebuilt url of /api/v2/write
+    std::string   buckets_url_{ };   ///< prebuilt url of /api/v2/buckets
+    std::string   ping_url_{ };      ///< prebuilt url of /ping
+    curl_list_ptr write_headers_{ }; ///< prebuilt headers of write requests
+    curl_list_ptr gzip_headers_{ };  ///< prebuilt headers of gzipped write requests
+    curl_list_ptr json_headers_{ };  ///< prebuilt headers of json requests
+    std::string   response_body_{ }; ///< reused response buffer
+    line_encoder  point_{ 256 };     ///< reused by the single point insert
+    deflate_ptr   deflate_{ };       ///< reset per request instead of reallocated
+    std::unique_ptr<char[]> gzip_buf_{ };  ///< reused compressed body
+    size_t        gzip_capacity_{ 0 };
+    curl_ptr      curl_{ };          ///< handle reused by all requests
+    std::unique_ptr<http_session> session_{ }; ///< drives all handles, keeps the connections alive
+    std::vector<std::unique_ptr<write_request>> requests_{ }; ///< asynchronous writes, options_.max_in_flight_ of them
+
+    options           options_{ };
+    health            state_{ health::closed };
+    size_t            failures_{ 0 };        ///< consecutive failures
+    clock::duration   backoff_{ };           ///< current backoff, before jitter
+    clock::time_point retry_at_{ };          ///< when an open breaker lets a trial through
+    bool              bucket_exists_{ false };
+    clock::time_point bucket_checked_{ };    ///< when bucket_exists_ was looked up, default if never
+    std::minstd_rand  rng_{ std::random_device{ }() };
+
+    std::chrono::microseconds last_latency_{ };
+    size_t            bytes_written_{ 0 };
+    size_t            bytes_sent_{ 0 };
+};
+
+/**
+ * @brief an asynchronous write, owning its handle & buffers for reuse
+ */
+class influx_storage::write_request
+{
+public:
+    write_request();
+
+    write_request(const write_request &) = delete;
+
+    ~write_request();
+
+    write_request & operator=(const write_request &) = delete;
+
+    /**
+     * @brief line protocol to post
+     */
+    line_encoder & body() { return body_; }
+
+    /**
+     * @brief position in the pool, lets the owner keep context per request
+     */
+    size_t index() const { return index_; }
+
+    write_status status() const { return status_; }
+
+    /**
+     * @brief the write failed without an answer, e.g. timed out
+     */
+    bool transport_failed() const { return transport_failed_; }
+
+    /**
+     * @brief why the write failed
+     */
+    const std::string & error() const { return error_; }
+
+private:
+    friend class influx_storage;
+
+    curl_ptr                curl_{ };
+    line_encoder            body_{ 16384 };
+    std::unique_ptr<char[]> gzip_buf_{ };
+    size_t                  gzip_capacity_{ 0 };
+    std::string             response_{ };
+    std::string             error_{ };
+    clock::time_point       start_{ };
+    size_t                  sent_{ 0 };        ///< body bytes on the wire
+    size_t                  index_{ 0 };
+    write_status            status_{ write_status::ok };
+    bool                    transport_failed_{ false };
+    bool                    retried_{ false }; ///< already restarted on a new connection
+    bool                    busy_{ false };
 };
 
+template <typename F>
+void influx_storage::poll(F && done)
+{
+    session_->dispatch();
+
+    CURL * easy;
+    CURLcode res;
+    while (session_->pop_done(easy, res))
+    {
+        // the blocking requests on curl_ never show up here
+        char * priv = nullptr;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, &priv);
+        auto & req = *reinterpret_cast<write_request *>(priv);
+        if (!finish(req, res)) continue;
+
+        req.busy_ = false;
+        done(req);
+    }
+}
+
 struct influx_storage::runtime_error : public std::runtime_error
 {
     using std::runtime_error::runtime_error;
 };
 
+/**
+ * @brief the request did not complete: timeout, reset, unreachable
+ */
+struct influx_storage::transport_error : public influx_storage::runtime_error
+{
+    using influx_storage::runtime_error::runtime_error;
+};
+
+/**
+ * @brief 400 or 422, the line protocol itself is refused
+ */
+struct influx_storage::rejected_error : public influx_storage::runtime_error
+{
+    using influx_storage::runtime_error::runtime_error;
+};
+
 inline void influx_storage::insert(const char * name, double value, time_t now)
 {
-    std::string data;
-    prepare_data(data, name, value, now);
-    insert(data);
+    point_.clear();
+    prepare_data(point_, name, value, now);
+    insert(point_.view());
 }
@@ -0,0 +1,197 @@
+#pragma once
+
+/**
+ * @file
+ * @brief layout of the latest-value table in POSIX shared memory, and its reader
+ *
+ * w1_therm publishes the last reading of each sensor in a segment named by
+ * the `shm` setting, e.g. /w1_therm. This header has no other dependency, a
+ * local consumer (a fan controller, a display) copies it and links nothing:
+ *
+ *   latest_shm::reader table{ "/w1_therm" };
+ *   latest_shm::reading r;
+ *   if (auto const i = table.find("kitchen"); i && table.read(*i, r))
+ *       printf("%s %.3f at %lld\n", r.name_.data(), r.value_, static_cast<long long>(r.time_));
+ *
+ * Each slot is guarded by a seqlock: the writer makes the sequence odd,
+ * stores the fields and makes it even again; a reader retries while it saw
+ * an odd sequence or the sequence changed under it. Readers never take a
+ * lock nor make a syscall once the segment is mapped, and never hold the
+ * writer back.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace latest_shm
+{
+
+constexpr uint32_t magic = 0x57315448;    ///< "W1TH"
+constexpr uint32_t version = 1;
+constexpr size_t   name_capacity = 64;     ///< NUL included
+
+/**
+ * @brief what the last sweep said about a sensor
+ */
+enum class status : uint32_t
+{
+    none = 0,   ///< no reading yet
+    ok,         ///< value_ was read at time_
+    failed,     ///< the read at time_ failed, value_ is the last good one
+};
+
+/**
+ * @brief one sensor; the name is set once before the slot is counted, the rest under seq_
+ */
+struct alignas(64) slot
+{
+    std::atomic<uint32_t> seq_;        ///< odd while the writer is storing
+    std::atomic<uint32_t> status_;
+    std::atomic<int64_t>  time_;       ///< unix time of the last sweep of the sensor
+    std::atomic<double>   value_;      ///< celsius
+    char                  name_[name_capacity];
+};
+
+/**
+ * @brief the start of the segment, the slots follow it
+ */
+struct alignas(64) header
+{
+    uint32_t              magic_;
+    uint32_t              version_;
+    uint32_t              slot_size_;  ///< sizeof(slot) of the writer
+    uint32_t              capacity_;   ///< slots in the segment
+    std::atomic<uint32_t> count_;      ///< slots in use, they never move nor go away
+    std::atomic<uint32_t> live_;       ///< 0 once the writer is gone, a new one makes a new segment
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(std::atomic<int64_t>::is_always_lock_free);
+static_assert(std::atomic<double>::is_always_lock_free);
+
+inline size_t segment_bytes(size_t capacity)
+{
+    return sizeof(header) + capacity * sizeof(slot);
+}
+
+inline const slot * slots(const header * h)
+{
+    return reinterpret_cast<const slot *>(h + 1);
+}
+
+inline slot * slots(header * h)
+{
+    return reinterpret_cast<slot *>(h + 1);
+}
+
+/**
+ * @brief a consistent copy of a slot
+ */
+struct reading
+{
+    std::string_view name_{ };
+    double           value_{ 0 };
+    time_t           time_{ 0 };
+    status           status_{ status::none };
+};
+
+/**
+ * @brief maps the table read-only
+ */
+class reader
+{
+public:
+    explicit reader(const char * name)
+    {
+        auto const fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0)
+            throw std::runtime_error{ std::string{ "Cannot open shared memory " } + name + ": " + strerror(errno) };
+
+        struct stat st{ };
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(header))
+        {
+            bytes_ = static_cast<size_t>(st.st_size);
+            auto const p = mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) header_ = static_cast<const header *>(p);
+        }
+        close(fd);
+
+        if (header_ == nullptr || header_->magic_ != magic || header_->version_ != version ||
+            header_->slot_size_ != sizeof(slot) || bytes_ < segment_bytes(header_->capacity_))
+        {
+            if (header_ != nullptr) munmap(const_cast<header *>(header_), bytes_);
+            throw std::runtime_error{ std::string{ "Not a w1_therm table: " } + name };
+        }
+    }
+
+    reader(const reader &) = delete;
+
+    ~reader() { munmap(const_cast<header *>(header_), bytes_); }
+
+    reader & operator=(const reader &) = delete;
+
+    /**
+     * @brief sensors in the table, each stays at its index
+     */
+    size_t size() const { return header_->count_.load(std::memory_order_acquire); }
+
+    /**
+     * @brief false once the writer stopped, open the table again to follow its successor
+     */
+    bool live() const { return header_->live_.load(std::memory_order_acquire) != 0; }
+
+    /**
+     * @brief copy slot i, false if it has no reading yet
+     */
+    bool read(size_t i, reading & out) const
+    {
+        if (i >= size()) return false;
+        auto const & s = slots(header_)[i];
+
+        for (;;)
+        {
+            auto const before = s.seq_.load(std::memory_order_acquire);
+            if (before & 1) continue;
+
+            out.status_ = static_cast<status>(s.status_.load(std::memory_order_relaxed));
+            out.time_ = static_cast<time_t>(s.time_.load(std::memory_order_relaxed));
+            out.value_ = s.value_.load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq_.load(std::memory_order_relaxed) == before) break;
+        }
+
+        out.name_ = std::string_view{ s.name_, strnlen(s.name_, name_capacity) };
+        return out.status_ != status::none;
+    }
+
+    /**
+     * @brief index of a sensor by name, a linear scan, keep the index
+     */
+    std::optional<size_t> find(std::string_view name) const
+    {
+        auto const n = size();
+        for (size_t i = 0; i < n; ++i)
+            if (std::string_view{ slots(header_)[i].name_, strnlen(slots(header_)[i].name_, name_capacity) } == name)
+                return i;
+        return std::nullopt;
+    }
+
+private:
+    const header * header_{ nullptr };
+    size_t         bytes_{ 0 };
+};
+
+} // namespace latest_shm
@@ -0,0 +1,108 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include "latest_table.h"
+#include "unique_fd.h"
+
+latest_table::latest_table(const char * name, size_t capacity)
+    : name_{ name }
+    , bytes_{ latest_shm::segment_bytes(capacity) }
+{
+    assert(name);
+
+    if (capacity == 0 || capacity > UINT32_MAX)
+        throw std::invalid_argument{ "invalid table capacity" };
+
+    // readers of a previous run keep their mapping, a fresh segment never shrinks under them
+    shm_unlink(name);
+    unique_fd fd{ shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644) };
+    if (!fd || ftruncate(fd.get(), static_cast<off_t>(bytes_)) != 0)
+    {
+        auto const error = std::string{ strerror(errno) };
+        if (fd) shm_unlink(name);
+        throw runtime_error{ "Cannot create shared memory " + name_ + ": " + error };
+    }
+
+    auto const p = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+    if (p == MAP_FAILED)
+    {
+        auto const error = std::string{ strerror(errno) };
+        shm_unlink(name);
+        throw runtime_error{ "Cannot map shared memory " + name_ + ": " + error };
+    }
+
+    // ftruncate zeroed the segment: every count and sequence starts at 0
+    header_ = static_cast<latest_shm::header *>(p);
+    header_->version_ = latest_shm::version;
+    header_->slot_size_ = sizeof(latest_shm::slot);
+    header_->capacity_ = static_cast<uint32_t>(capacity);
+    header_->live_.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic_ = latest_shm::magic;
+
+    index_.reserve(capacity);
+}
+
+latest_table::~latest_table()
+{
+    header_->live_.store(0, std::memory_order_release);
+    munmap(header_, bytes_);
+    shm_unlink(name_.c_str());
+}
+
+void latest_table::publish(const char * name, double value, time_t time)
+{
+    if (auto const s = slot(name))
+        store(*s, latest_shm::status::ok, value, time);
+}
+
+void latest_table::fail(const char * name, time_t time)
+{
+    if (auto const s = slot(name))
+        store(*s, latest_shm::status::failed, s->value_.load(std::memory_order_relaxed), time);
+}
+
+latest_shm::slot * latest_table::slot(const char * name)
+{
+    auto const slots = latest_shm::slots(header_);
+    if (auto const it = index_.find(std::string_view{ name }); it != index_.end())
+        return &slots[it->second];
+
+    auto const i = index_.size();
+    if (i == header_->capacity_)
+    {
+        if (!full_)
+            syslog(LOG_USER | LOG_WARNING, "shared memory %s is full, %s and later sensors are left out\n",
+                   name_.c_str(), name);
+        full_ = true;
+        return nullptr;
+    }
+
+    // the name is in place before the count makes the slot visible, it never changes after
+    auto & s = slots[i];
+    strncpy(s.name_, name, latest_shm::name_capacity - 1);
+    index_.emplace(name, i);
+    header_->count_.store(static_cast<uint32_t>(i + 1), std::memory_order_release);
+    return &s;
+}
+
+void latest_table::store(latest_shm::slot & s, latest_shm::status status, double value, time_t time)
+{
+    // odd while storing; the fence keeps the stores after it, the release of the
+    // even sequence keeps them before it
+    auto const seq = s.seq_.load(std::memory_order_relaxed);
+    s.seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s.status_.store(static_cast<uint32_t>(status), std::memory_order_relaxed);
+    s.time_.store(static_cast<int64_t>(time), std::memory_order_relaxed);
+    s.value_.store(value, std::memory_order_relaxed);
+
+    s.seq_.store(seq + 2, std::memory_order_release);
+}
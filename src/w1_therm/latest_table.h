@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <ctime>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "latest_shm.h"
+
+/**
+ * @brief publishes the last reading of each sensor in shared memory
+ *
+ * The segment has the layout of latest_shm.h, readers map it with
+ * latest_shm::reader. A sensor gets a slot the first time it is published
+ * and keeps it; once the segment is full new sensors are left out. A
+ * publish is a hash lookup and a seqlock write, no syscall and no
+ * allocation once the sensor has its slot.
+ *
+ * One thread publishes; the segment is unlinked by the destructor, readers
+ * see live() turn false.
+ */
+class latest_table
+{
+public:
+    struct runtime_error;
+
+    /**
+     * @param name of the segment, e.g. /w1_therm, one left by a previous run is replaced
+     * @param capacity sensors in the table
+     */
+    latest_table(const char * name, size_t capacity);
+
+    latest_table(const latest_table &) = delete;
+
+    ~latest_table();
+
+    latest_table & operator=(const latest_table &) = delete;
+
+    /**
+     * @brief a good reading of name at time
+     */
+    void publish(const char * name, double value, time_t time);
+
+    /**
+     * @brief a failed read of name at time, its last value stays
+     */
+    void fail(const char * name, time_t time);
+
+    /**
+     * @brief sensors in the table
+     */
+    size_t size() const { return index_.size(); }
+
+private:
+    struct name_hash
+    {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{ }(s); }
+    };
+
+    /**
+     * @brief the slot of name, a new one for a new sensor, nullptr once the table is full
+     */
+    latest_shm::slot * slot(const char * name);
+
+    void store(latest_shm::slot & s, latest_shm::status status, double value, time_t time);
+
+private:
+    std::string                                                    name_;
+    size_t                                                         bytes_;
+    latest_shm::header *                                           header_{ nullptr };
+    std::unordered_map<std::string, size_t, name_hash, std::equal_to<>> index_{ };
+    bool                                                           full_{ false };  ///< a sensor was left out, logged once
+};
+
+struct latest_table::runtime_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
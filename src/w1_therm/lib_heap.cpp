@@ -0,0 +1,178 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <mutex>
+
+#include <curl/curl.h>
+#include <sqlite3.h>
+
+#include "lib_heap.h"
+
+namespace
+{
+
+/**
+ * @brief in front of every block, keeps the payload 16-byte aligned
+ */
+struct alignas(16) header
+{
+    size_t size_;  ///< usable bytes
+    size_t class_; ///< free list of the block, no_class if it is malloc's own
+};
+
+/**
+ * @brief a block on a free list, its payload links to the next one
+ */
+struct free_block
+{
+    free_block * next_;
+};
+
+constexpr size_t no_class = ~size_t{ 0 };
+
+// 16-byte steps up to small_limit, then four classes per doubling up to max_pooled
+constexpr size_t small_limit = 256;
+constexpr size_t small_classes = small_limit / 16;
+constexpr size_t class_count =
+    small_classes + 4 * (std::bit_width(lib_heap::max_pooled - 1) - std::bit_width(small_limit - 1));
+
+size_t class_of(size_t size)
+{
+    size = std::max<size_t>(size, 1);
+    if (size <= small_limit) return (size + 15) / 16 - 1;
+
+    // size is in (2^(bits-1), 2^bits], cut in quarters
+    auto const bits = static_cast<size_t>(std::bit_width(size - 1));
+    auto const lower = size_t{ 1 } << (bits - 1);
+    return small_classes + (bits - std::bit_width(small_limit)) * 4 + (size - 1 - lower) / (lower / 4);
+}
+
+size_t class_size(size_t c)
+{
+    if (c < small_classes) return (c + 1) * 16;
+
+    auto const lower = small_limit << ((c - small_classes) / 4);
+    return lower + ((c - small_classes) % 4 + 1) * (lower / 4);
+}
+
+header * header_of(const void * p)
+{
+    return const_cast<header *>(static_cast<const header *>(p) - 1);
+}
+
+std::mutex                            free_mutex;
+std::array<free_block *, class_count> free_lists{ };
+
+} // namespace
+
+void * lib_heap::allocate(size_t size)
+{
+    if (size > max_pooled)
+    {
+        auto const h = static_cast<header *>(malloc(sizeof(header) + size));
+        if (h == nullptr) return nullptr;
+        *h = { size, no_class };
+        return h + 1;
+    }
+
+    auto const c = class_of(size);
+    {
+        std::lock_guard<std::mutex> lock{ free_mutex };
+        if (auto const block = free_lists[c])
+        {
+            free_lists[c] = block->next_;
+            return block;
+        }
+    }
+
+    // the first block of its kind, or more of them in use than ever before
+    auto const h = static_cast<header *>(malloc(sizeof(header) + class_size(c)));
+    if (h == nullptr) return nullptr;
+    *h = { class_size(c), c };
+    return h + 1;
+}
+
+void lib_heap::release(void * p)
+{
+    if (p == nullptr) return;
+
+    auto const h = header_of(p);
+    if (h->class_ == no_class)
+    {
+        free(h);
+        return;
+    }
+
+    auto const block = static_cast<free_block *>(p);
+    std::lock_guard<std::mutex> lock{ free_mutex };
+    block->next_ = free_lists[h->class_];
+    free_lists[h->class_] = block;
+}
+
+void * lib_heap::reallocate(void * p, size_t size)
+{
+    if (p == nullptr) return allocate(size);
+    if (size == 0)
+    {
+        release(p);
+        return nullptr;
+    }
+    if (size <= usable(p)) return p;
+
+    auto const grown = allocate(size);
+    if (grown == nullptr) return nullptr;
+    memcpy(grown, p, usable(p));
+    release(p);
+    return grown;
+}
+
+size_t lib_heap::usable(const void * p)
+{
+    return header_of(p)->size_;
+}
+
+size_t lib_heap::round_up(size_t size)
+{
+    return size > max_pooled ? size : class_size(class_of(size));
+}
+
+void lib_heap::install()
+{
+    static sqlite3_mem_methods const methods{
+        [](int n) { return allocate(static_cast<size_t>(n)); },
+        [](void * p) { release(p); },
+        [](void * p, int n) { return reallocate(p, static_cast<size_t>(n)); },
+        [](void * p) { return static_cast<int>(usable(p)); },
+        [](int n) { return static_cast<int>(round_up(static_cast<size_t>(n))); },
+        [](void *) { return SQLITE_OK; },
+        [](void *) { },
+        nullptr,
+    };
+    if (sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) != SQLITE_OK)
+        throw runtime_error{ "Cannot set the heap of sqlite" };
+
+    auto const status = curl_global_init_mem(CURL_GLOBAL_DEFAULT,
+        [](size_t n) { return allocate(n); },
+        [](void * p) { release(p); },
+        [](void * p, size_t n) { return reallocate(p, n); },
+        [](const char * s)
+        {
+            auto const n = strlen(s) + 1;
+            auto const copy = static_cast<char *>(allocate(n));
+            if (copy != nullptr) memcpy(copy, s, n);
+            return copy;
+        },
+        [](size_t n, size_t size) -> void *
+        {
+            if (size != 0 && n > SIZE_MAX / size) return nullptr;
+            auto const p = allocate(n * size);
+            if (p != nullptr) memset(p, 0, n * size);
+            return p;
+        });
+    if (status != CURLE_OK)
+        throw runtime_error{ "Cannot set the heap of libcurl" };
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+
+/**
+ * @brief the heap of libcurl & sqlite, keeping what they free for their next allocation
+ *
+ * Both allocate & free their transfer, statement & page buffers over and
+ * over at the same few sizes. A freed block goes to the free list of its
+ * size class and comes back on the next allocation of that class, so once
+ * each class reached its peak no call reaches malloc. Nothing is given back
+ * to the system; blocks larger than max_pooled go to malloc & free directly.
+ */
+class lib_heap
+{
+public:
+    struct runtime_error;
+
+    static constexpr size_t max_pooled = 1 << 20; ///< largest block kept for reuse
+
+    /**
+     * @brief route the allocations of sqlite & libcurl here, before either is used
+     */
+    static void install();
+
+    static void * allocate(size_t size);
+
+    static void release(void * p);
+
+    static void * reallocate(void * p, size_t size);
+
+    /**
+     * @brief usable bytes of a block, at least what was asked for
+     */
+    static size_t usable(const void * p);
+
+    /**
+     * @brief the usable bytes a block of size gets
+     */
+    static size_t round_up(size_t size);
+};
+
+struct lib_heap::runtime_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
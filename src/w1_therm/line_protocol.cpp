@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include "line_protocol.h"
+#include "series.h"
+
+/**
+ * @brief chars needing a backslash, plus the newline line protocol cannot carry
+ */
+struct escape_table
+{
+    constexpr explicit escape_table(std::string_view specials)
+    {
+        for (auto const c : specials) escape_[static_cast<unsigned char>(c)] = true;
+    }
+
+    constexpr bool escape(char c) const { return escape_[static_cast<unsigned char>(c)]; }
+
+    constexpr bool special(char c) const { return c == '\n' || escape(c); }
+
+    bool escape_[256]{ };
+};
+
+namespace
+{
+
+// https://docs.influxdata.com/influxdb/v2/reference/syntax/line-protocol/#special-characters
+constexpr escape_table measurement_specials{ ", " };
+constexpr escape_table key_specials{ ",= " };
+constexpr escape_table string_specials{ "\"\\" };
+
+/**
+ * @brief where the token starting s ends: the first unescaped char of stops
+ */
+size_t token_end(std::string_view s, std::string_view stops)
+{
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '\\' && i + 1 < s.size()) { ++i; continue; }
+        if (stops.find(s[i]) != std::string_view::npos) return i;
+    }
+    return s.size();
+}
+
+/**
+ * @brief copy token into out without the backslashes encode added, false if it does not fit
+ */
+template <size_t N>
+bool unescape(std::string_view token, char (&out)[N], size_t & len)
+{
+    len = 0;
+    for (size_t i = 0; i < token.size(); ++i)
+    {
+        if (token[i] == '\\' && i + 1 < token.size() && key_specials.escape(token[i + 1])) ++i;
+        if (len + 1 >= N) return false;
+        out[len++] = token[i];
+    }
+    out[len] = 0;
+    return true;
+}
+
+/**
+ * @brief a window the way format_window spells it, 0 if it is not one
+ */
+uint32_t parse_window(std::string_view s)
+{
+    if (s.size() < 2) return 0;
+
+    uint32_t n = 0;
+    auto const r = std::from_chars(s.data(), s.data() + s.size() - 1, n);
+    if (r.ec != std::errc{ } || r.ptr != s.data() + s.size() - 1) return 0;
+
+    uint64_t scale = 0;
+    switch (s.back())
+    {
+    case 's': scale = 1; break;
+    case 'm': scale = 60; break;
+    case 'h': scale = 3600; break;
+    case 'd': scale = 86400; break;
+    }
+    auto const seconds = uint64_t{ n } * scale;
+    return seconds <= max_rollup_window ? static_cast<uint32_t>(seconds) : 0;
+}
+
+constexpr long long pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+// values scaled by pow10[precision] stay below this to fit in a long long
+constexpr double max_scaled = 1e18;
+
+// sign, 18 integer digits of a scaled value below 1e18, dot and fraction
+constexpr size_t max_fixed_len = 1 + 18 + 1 + 8;
+
+} // namespace
+
+line_encoder::line_encoder(size_t capacity, int precision)
+    : buf_{ std::make_unique<char[]>(capacity) }
+    , capacity_{ capacity }
+    , precision_{ precision }
+{
+    assert(capacity > 0);
+    assert(0 <= precision && precision < static_cast<int>(std::size(pow10)));
+}
+
+char * line_encoder::reserve(size_t n)
+{
+    if (size_ + n > capacity_)
+    {
+        auto capacity = capacity_ * 2;
+        while (capacity < size_ + n) capacity *= 2;
+
+        auto buf = std::make_unique<char[]>(capacity);
+        memcpy(buf.get(), buf_.get(), size_);
+        buf_ = std::move(buf);
+        capacity_ = capacity;
+    }
+
+    return buf_.get() + size_;
+}
+
+void line_encoder::put(std::string_view s)
+{
+    memcpy(reserve(s.size()), s.data(), s.size());
+    size_ += s.size();
+}
+
+void line_encoder::put_escaped(std::string_view s, const escape_table & specials)
+{
+    // names rarely need escaping, copy them in one go
+    if (std::none_of(s.begin(), s.end(), [&](char c) { return specials.special(c); }))
+    {
+        put(s);
+        return;
+    }
+
+    // worst case every char is escaped
+    auto const bgn = reserve(s.size() * 2);
+    auto out = bgn;
+    for (auto const c : s)
+    {
+        if (c == '\n')
+        {
+            // line protocol cannot carry a newline, it becomes a space, escaped where spaces are
+            if (specials.escape(' ')) *out++ = '\\';
+            *out++ = ' ';
+            continue;
+        }
+
+        if (specials.escape(c)) *out++ = '\\';
+        *out++ = c;
+    }
+
+    size_ += static_cast<size_t>(out - bgn);
+}
+
+line_encoder & line_encoder::begin(std::string_view measurement)
+{
+    line_ = size_;
+    fields_ = 0;
+    put_escaped(measurement, measurement_specials);
+    return *this;
+}
+
+line_encoder & line_encoder::tag(std::string_view key, std::string_view value)
+{
+    assert(fields_ == 0);
+
+    // influxdb refuses empty tag keys & values, a missing tag means the same
+    if (key.empty() || value.empty()) return *this;
+
+    put(',');
+    put_escaped(key, key_specials);
+    put('=');
+    put_escaped(value, key_specials);
+    return *this;
+}
+
+line_encoder & line_encoder::field(std::string_view key, double value)
+{
+    if (!std::isfinite(value)) return *this;
+
+    put(fields_++ == 0 ? ' ' : ',');
+    put_escaped(key, key_specials);
+    put('=');
+
+    // temperatures fit in an integer once scaled, which is much cheaper than
+    // the exact conversion of to_chars
+    auto const scale = pow10[precision_];
+    if (std::fabs(value) < max_scaled / static_cast<double>(scale))
+    {
+        auto scaled = std::llround(value * static_cast<double>(scale));
+        auto const out = reserve(max_fixed_len);
+        auto p = out;
+        if (scaled < 0) { *p++ = '-'; scaled = -scaled; }
+
+        p = std::to_chars(p, out + max_fixed_len, scaled / scale).ptr;
+        if (precision_ > 0)
+        {
+            *p++ = '.';
+            auto frac = scaled % scale;
+            for (auto i = precision_; i-- > 0; frac /= 10) p[i] = static_cast<char>('0' + frac % 10);
+            p += precision_;
+        }
+
+        size_ += static_cast<size_t>(p - out);
+        return *this;
+    }
+
+    // 1e308 in fixed notation takes 309 digits plus the fraction
+    constexpr size_t max_len = 320;
+    auto const out = reserve(max_len + static_cast<size_t>(precision_));
+    auto const r = std::to_chars(out, out + max_len + precision_, value, std::chars_format::fixed, precision_);
+    assert(r.ec == std::errc{ });
+    size_ += static_cast<size_t>(r.ptr - out);
+    return *this;
+}
+
+line_encoder & line_encoder::field(std::string_view key, int64_t value)
+{
+    put(fields_++ == 0 ? ' ' : ',');
+    put_escaped(key, key_specials);
+    put('=');
+
+    constexpr size_t max_len = 21;
+    auto const out = reserve(max_len);
+    auto const r = std::to_chars(out, out + max_len, value);
+    size_ += static_cast<size_t>(r.ptr - out);
+    put('i');
+    return *this;
+}
+
+line_encoder & line_encoder::field(std::string_view key, std::string_view value)
+{
+    put(fields_++ == 0 ? ' ' : ',');
+    put_escaped(key, key_specials);
+    put('=');
+    put('"');
+    put_escaped(value, string_specials);
+    put('"');
+    return *this;
+}
+
+void line_encoder::end(time_t time)
+{
+    if (fields_ == 0)
+    {
+        size_ = line_;
+        return;
+    }
+
+    put(' ');
+    constexpr size_t max_len = 21;
+    auto const out = reserve(max_len);
+    auto const r = std::to_chars(out, out + max_len, static_cast<int64_t>(time));
+    size_ += static_cast<size_t>(r.ptr - out);
+    put('\n');
+}
+
+point_format::point_format(std::string measurement, std::string field)
+    : measurement_{ std::move(measurement) }
+    , field_{ std::move(field) }
+{
+    if (measurement_.empty())
+        throw std::invalid_argument{ "measurement is empty" };
+    if (field_.empty())
+        throw std::invalid_argument{ "field is empty" };
+
+    for (size_t i = 0; i < stat_fields_.size(); ++i)
+        stat_fields_[i] = field_ + std::string{ stat_suffix(static_cast<rollup_stat>(i)) };
+}
+
+void point_format::encode(line_encoder & enc, const char * name, double value, time_t time, uint32_t series) const
+{
+    if (series == 0)
+    {
+        enc.begin(measurement_).tag("name", name).field(field_, value).end(time);
+        return;
+    }
+
+    auto const stat = static_cast<size_t>(series_stat(series));
+    if (stat == 0 || stat >= stat_fields_.size()) return;
+
+    char window[16];
+    enc.begin(measurement_).tag("name", name).tag("window", format_window(series_window(series), window));
+    if (series_stat(series) == rollup_stat::count)
+        enc.field(stat_fields_[stat], static_cast<int64_t>(value));
+    else
+        enc.field(stat_fields_[stat], value);
+    enc.end(time);
+}
+
+bool point_format::decode(std::string_view line, sample & out) const
+{
+    char key[256];
+    size_t len;
+
+    // measurement
+    auto end = token_end(line, ", ");
+    if (!unescape(line.substr(0, end), key, len) || std::string_view{ key, len } != measurement_) return false;
+    line.remove_prefix(end);
+
+    // tags: the name, and the window of a rollup
+    auto named = false;
+    uint32_t window = 0;
+    while (!line.empty() && line.front() == ',')
+    {
+        line.remove_prefix(1);
+        end = token_end(line, "=, ");
+        if (end == line.size() || line[end] != '=') return false;
+        auto const tag = line.substr(0, end);
+        line.remove_prefix(end + 1);
+        end = token_end(line, ", ");
+        auto const value = line.substr(0, end);
+        line.remove_prefix(end);
+
+        if (tag == "name")
+        {
+            if (!unescape(value, out.name_, len) || len == 0) return false;
+            named = true;
+        }
+        else if (tag == "window")
+        {
+            if ((window = parse_window(value)) == 0) return false;
+        }
+        else
+            return false;
+    }
+    if (!named || line.empty() || line.front() != ' ') return false;
+    line.remove_prefix(1);
+
+    // the one field, its key tells the statistic
+    end = token_end(line, "=, ");
+    if (end == line.size() || line[end] != '=' || !unescape(line.substr(0, end), key, len)) return false;
+    auto const field = std::string_view{ key, len };
+    auto const stat = static_cast<size_t>(std::find(stat_fields_.begin(), stat_fields_.end(), field) - stat_fields_.begin());
+    if (stat == stat_fields_.size() || (stat == 0) != (window == 0)) return false;
+    line.remove_prefix(end + 1);
+
+    end = line.find(' ');
+    if (end == std::string_view::npos) return false;
+    auto value = line.substr(0, end);
+    if (static_cast<rollup_stat>(stat) == rollup_stat::count)
+    {
+        if (value.empty() || value.back() != 'i') return false;
+        value.remove_suffix(1);
+    }
+    auto const v = std::from_chars(value.data(), value.data() + value.size(), out.value_);
+    if (v.ec != std::errc{ } || v.ptr != value.data() + value.size() || !std::isfinite(out.value_)) return false;
+    line.remove_prefix(end + 1);
+
+    // the timestamp, in seconds like the writes
+    int64_t time = 0;
+    auto const t = std::from_chars(line.data(), line.data() + line.size(), time);
+    if (t.ec != std::errc{ } || t.ptr != line.data() + line.size()) return false;
+
+    out.time_ = static_cast<time_t>(time);
+    out.series_ = stat == 0 ? 0 : rollup_series(window, static_cast<rollup_stat>(stat));
+    return true;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "sample.h"
+
+struct escape_table;
+
+/**
+ * @brief influxdb line protocol encoder writing into a reusable buffer
+ *
+ * The buffer only grows, so once it has seen the largest batch encoding does
+ * not allocate any more. Floats are written with std::to_chars in fixed
+ * precision.
+ *
+ * usage:
+ *   enc.begin("home").tag("name", "kitchen").field("temperature", 23.5).end(now);
+ */
+class line_encoder
+{
+public:
+    explicit line_encoder(size_t capacity = 4096, int precision = 6);
+
+    line_encoder(const line_encoder &) = delete;
+
+    line_encoder(line_encoder &&) noexcept = default;
+
+    line_encoder & operator=(const line_encoder &) = delete;
+
+    line_encoder & operator=(line_encoder &&) noexcept = default;
+
+    /**
+     * @brief start a point
+     */
+    line_encoder & begin(std::string_view measurement);
+
+    /**
+     * @brief a tag, skipped if the key or the value is empty
+     */
+    line_encoder & tag(std::string_view key, std::string_view value);
+
+    /**
+     * @brief a float field, NaN and infinities are skipped
+     */
+    line_encoder & field(std::string_view key, double value);
+
+    line_encoder & field(std::string_view key, int64_t value);
+
+    line_encoder & field(std::string_view key, std::string_view value);
+
+    /**
+     * @brief finish the point, a point without fields is discarded
+     */
+    void end(time_t time);
+
+    /**
+     * @brief drop all points, keep the buffer
+     */
+    void clear() { size_ = 0; }
+
+    bool empty() const { return size_ == 0; }
+
+    size_t size() const { return size_; }
+
+    std::string_view view() const { return { buf_.get(), size_ }; }
+
+private:
+    /**
+     * @brief make room for n more bytes and return where they go
+     */
+    char * reserve(size_t n);
+
+    void put(char c) { *reserve(1) = c; ++size_; }
+
+    void put(std::string_view s);
+
+    /**
+     * @brief append s, prefixing every char in specials with a backslash
+     */
+    void put_escaped(std::string_view s, const escape_table & specials);
+
+private:
+    std::unique_ptr<char[]> buf_;
+    size_t                  size_{ 0 };
+    size_t                  capacity_;
+    size_t                  line_{ 0 };      ///< where the current point starts
+    size_t                  fields_{ 0 };    ///< fields in the current point
+    int                     precision_;
+};
+
+/**
+ * @brief how a sample is written as a point, shared by the sinks writing line protocol
+ *
+ * A raw reading is `measurement,name=kitchen field=21.5 time`. A rollup
+ * statistic goes to a field of its own, e.g. `temperature_max`, tagged with
+ * its window, so the statistics of a window merge into one point in influxdb.
+ */
+class point_format
+{
+public:
+    point_format(std::string measurement, std::string field);
+
+    /**
+     * @brief append one point, series 0 is a raw reading, else see rollup_series
+     *
+     * A rollup statistic this build does not know encodes to nothing.
+     */
+    void encode(line_encoder & enc, const char * name, double value, time_t time, uint32_t series = 0) const;
+
+    /**
+     * @brief parse one point written by encode, without its newline
+     *
+     * Only this format is understood: another measurement, an unknown tag or
+     * field, several fields, a missing timestamp or a name too long for a
+     * sample make the point invalid.
+     *
+     * @return false if the line is not a point of this format, out is then unspecified
+     */
+    bool decode(std::string_view line, sample & out) const;
+
+private:
+    std::string                measurement_;
+    std::string                field_;
+    std::array<std::string, 6> stat_fields_{ }; ///< field of each rollup_stat
+};
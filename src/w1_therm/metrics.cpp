@@ -0,0 +1,154 @@
+#include <cstdio>
+
+#include <algorithm>
+
+#include "metrics.h"
+
+namespace
+{
+
+int64_t steady_micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void append_labels(std::string & out, std::string_view labels, std::string_view extra = { })
+{
+    if (labels.empty() && extra.empty()) return;
+
+    out += '{';
+    out.append(labels);
+    if (!labels.empty() && !extra.empty()) out += ',';
+    out.append(extra);
+    out += '}';
+}
+
+} // namespace
+
+void histogram::observe(std::chrono::microseconds latency)
+{
+    auto const us = latency.count();
+    auto const it = std::lower_bound(bounds.begin(), bounds.end(), us);
+    buckets_[static_cast<size_t>(it - bounds.begin())].add();
+    sum_.add(static_cast<uint64_t>(std::max<int64_t>(us, 0)));
+}
+
+void histogram::render(std::string & out, std::string_view name, std::string_view labels) const
+{
+    // the buckets are cumulative in the text format
+    uint64_t total = 0;
+    char le[32];
+    for (size_t i = 0; i < buckets_.size(); ++i)
+    {
+        total += buckets_[i].get();
+        if (i < bounds.size())
+            snprintf(le, sizeof le, "le=\"%g\"", static_cast<double>(bounds[i]) / 1e6);
+        else
+            snprintf(le, sizeof le, "le=\"+Inf\"");
+
+        out.append(name).append("_bucket");
+        append_labels(out, labels, le);
+        out += ' ' + std::to_string(total) + '\n';
+    }
+
+    out.append(name).append("_sum");
+    append_labels(out, labels);
+    char sum[32];
+    snprintf(sum, sizeof sum, " %.6f\n", static_cast<double>(sum_.get()) / 1e6);
+    out.append(sum);
+
+    out.append(name).append("_count");
+    append_labels(out, labels);
+    out += ' ' + std::to_string(total) + '\n';
+}
+
+process_metrics::process_metrics()
+{
+    // until the first upload, the time since the start
+    last_upload_.set(steady_micros());
+}
+
+void process_metrics::uploaded(size_t bytes, size_t sent)
+{
+    bytes_uploaded_.add(bytes);
+    bytes_sent_.add(sent);
+    last_upload_.set(steady_micros());
+}
+
+void process_metrics::render(std::string & out) const
+{
+    render_family(out, "w1_therm_backlog_insert_seconds", "histogram", "sqlite insert or spool append");
+    backlog_insert_.render(out, "w1_therm_backlog_insert_seconds", { });
+    render_family(out, "w1_therm_backlog_commit_seconds", "histogram", "sqlite commit or spool msync");
+    backlog_commit_.render(out, "w1_therm_backlog_commit_seconds", { });
+    render_family(out, "w1_therm_backlog_rows", "gauge", "samples buffered while influxdb is unreachable");
+    render_value(out, "w1_therm_backlog_rows", { }, static_cast<double>(backlog_rows_.get()));
+    render_family(out, "w1_therm_backlog_bytes", "gauge", "disk used by the buffered samples");
+    render_value(out, "w1_therm_backlog_bytes", { }, static_cast<double>(backlog_bytes_.get()));
+    render_family(out, "w1_therm_backlog_max_bytes", "gauge", "bound of the backlog on disk, 0 if unbounded");
+    render_value(out, "w1_therm_backlog_max_bytes", { }, static_cast<double>(backlog_max_bytes_.get()));
+    render_family(out, "w1_therm_backlog_compacted_total", "counter", "raw rows compacted into min, max & mean");
+    render_value(out, "w1_therm_backlog_compacted_total", { }, static_cast<double>(backlog_compacted_.get()));
+    render_family(out, "w1_therm_backlog_evicted_total", "counter", "oldest rows dropped by a full backlog");
+    render_value(out, "w1_therm_backlog_evicted_total", { }, static_cast<double>(backlog_evicted_.get()));
+
+    render_family(out, "w1_therm_influx_write_seconds", "histogram", "influxdb writes from submit to answer");
+    influx_write_.render(out, "w1_therm_influx_write_seconds", { });
+    render_family(out, "w1_therm_influx_responses_total", "counter", "influxdb writes by status class");
+    static constexpr const char * classes[] = { "none", "1xx", "2xx", "3xx", "4xx", "5xx" };
+    for (size_t i = 0; i < influx_responses_.size(); ++i)
+    {
+        std::string labels;
+        append_label(labels, "code", classes[i]);
+        render_value(out, "w1_therm_influx_responses_total", labels, static_cast<double>(influx_responses_[i].get()));
+    }
+
+    render_family(out, "w1_therm_uploaded_points_total", "counter", "points accepted by influxdb");
+    render_value(out, "w1_therm_uploaded_points_total", { }, static_cast<double>(points_uploaded_.get()));
+    render_family(out, "w1_therm_uploaded_bytes_total", "counter", "line protocol accepted by influxdb");
+    render_value(out, "w1_therm_uploaded_bytes_total", { }, static_cast<double>(bytes_uploaded_.get()));
+    render_family(out, "w1_therm_sent_bytes_total", "counter", "request bodies of the accepted writes, after gzip");
+    render_value(out, "w1_therm_sent_bytes_total", { }, static_cast<double>(bytes_sent_.get()));
+    render_family(out, "w1_therm_seconds_since_upload", "gauge", "since the last accepted write, or the start");
+    render_value(out, "w1_therm_seconds_since_upload", { },
+                 static_cast<double>(steady_micros() - last_upload_.get()) / 1e6);
+}
+
+process_metrics & global_metrics()
+{
+    static process_metrics metrics;
+    return metrics;
+}
+
+void render_family(std::string & out, std::string_view name, std::string_view type, std::string_view help)
+{
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void render_value(std::string & out, std::string_view name, std::string_view labels, double value)
+{
+    out.append(name);
+    append_labels(out, labels);
+    char buf[32];
+    snprintf(buf, sizeof buf, " %.15g\n", value);
+    out.append(buf);
+}
+
+void append_label(std::string & labels, std::string_view key, std::string_view value)
+{
+    if (!labels.empty()) labels += ',';
+    labels.append(key).append("=\"");
+    for (auto const c : value)
+    {
+        switch (c)
+        {
+        case '\\': labels += "\\\\"; break;
+        case '"':  labels += "\\\""; break;
+        case '\n': labels += "\\n"; break;
+        default:   labels += c; break;
+        }
+    }
+    labels += '"';
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief a monotonic count, updated without locks from any thread
+ *
+ * Copies take a relaxed snapshot, so objects holding counters stay copyable
+ * and movable, copy them only while no other thread updates them.
+ */
+class counter
+{
+public:
+    counter() = default;
+
+    counter(const counter & other) : value_{ other.get() } { }
+
+    counter & operator=(const counter & other)
+    {
+        value_.store(other.get(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+
+    uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{ 0 };
+};
+
+/**
+ * @brief a value going up and down, e.g. the depth of the backlog
+ */
+class gauge
+{
+public:
+    void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+
+    void set(int64_t n) { value_.store(n, std::memory_order_relaxed); }
+
+    int64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{ 0 };
+};
+
+/**
+ * @brief latency histogram with fixed buckets from 100 µs to 10 s
+ *
+ * observe() is a bucket search and two relaxed increments, the buckets are
+ * summed up only when rendered.
+ */
+class histogram
+{
+public:
+    /**
+     * @brief inclusive upper bounds of the buckets, in microseconds, +Inf follows
+     */
+    static constexpr std::array<int64_t, 16> bounds{
+        100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+        100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000 };
+
+    void observe(std::chrono::microseconds latency);
+
+    /**
+     * @brief append the _bucket, _sum & _count series in the Prometheus text format
+     *
+     * @param labels e.g. `sensor="kitchen"`, empty for none
+     */
+    void render(std::string & out, std::string_view name, std::string_view labels) const;
+
+private:
+    std::array<counter, bounds.size() + 1> buckets_{ };
+    counter                                sum_{ };     ///< of the observations, in microseconds
+};
+
+/**
+ * @brief time f and record it in h
+ */
+template <typename F>
+inline decltype(auto) timed(histogram & h, F && f)
+{
+    struct scope
+    {
+        histogram &                           h_;
+        std::chrono::steady_clock::time_point bgn_{ std::chrono::steady_clock::now() };
+
+        ~scope()
+        {
+            h_.observe(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bgn_));
+        }
+    } const s{ h };
+    return f();
+}
+
+/**
+ * @brief the metrics of the storage path, shared by all threads
+ *
+ * The sensors keep their own, see w1_sensor.
+ */
+struct process_metrics
+{
+    histogram backlog_insert_{ };   ///< sqlite insert or spool append
+    histogram backlog_commit_{ };   ///< sqlite commit or spool msync
+    histogram influx_write_{ };     ///< a write from submit to its answer
+    std::array<counter, 6> influx_responses_{ }; ///< by status class, [0] without an answer
+    counter   points_uploaded_{ };
+    counter   bytes_uploaded_{ };   ///< line protocol accepted by influxdb
+    counter   bytes_sent_{ };       ///< the same on the wire, after gzip
+    gauge     backlog_rows_{ };     ///< rows buffered while influxdb is unreachable
+    gauge     backlog_bytes_{ };    ///< disk used by them
+    gauge     backlog_max_bytes_{ }; ///< the bound of backlog_bytes_, 0 if unbounded
+    counter   backlog_compacted_{ }; ///< raw rows replaced by their min, max & mean
+    counter   backlog_evicted_{ };   ///< rows dropped by a full backlog
+    gauge     last_upload_{ };      ///< steady clock of the last accepted write, in microseconds
+
+    process_metrics();
+
+    /**
+     * @brief the write was accepted just now
+     */
+    void uploaded(size_t bytes, size_t sent);
+
+    /**
+     * @brief append everything in the Prometheus text format
+     */
+    void render(std::string & out) const;
+};
+
+/**
+ * @brief the metrics of this process
+ */
+process_metrics & global_metrics();
+
+/**
+ * @brief append the # HELP and # TYPE lines of a metric
+ */
+void render_family(std::string & out, std::string_view name, std::string_view type, std::string_view help);
+
+/**
+ * @brief append one sample, labels as in histogram::render
+ */
+void render_value(std::string & out, std::string_view name, std::string_view labels, double value);
+
+/**
+ * @brief append `key="value"` to labels, escaping value
+ */
+void append_label(std::string & labels, std::string_view key, std::string_view value);
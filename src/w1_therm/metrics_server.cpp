@@ -0,0 +1,202 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <string_view>
+
+#include "metrics_server.h"
+
+namespace
+{
+
+constexpr size_t max_clients = 8;
+constexpr size_t max_request = 4096;
+
+} // namespace
+
+metrics_server::metrics_server(event_loop & loop, const std::string & address, render_fn render)
+    : loop_{ loop }
+    , listen_{ listen_on(address) }
+    , render_{ std::move(render) }
+{
+    if (address.starts_with('/'))
+        unix_path_ = address;
+
+    loop_.add(listen_.get(), EPOLLIN, [this](uint32_t) { on_accept(); });
+}
+
+metrics_server::~metrics_server()
+{
+    for (auto const & [fd, c] : clients_)
+        loop_.remove(fd);
+    loop_.remove(listen_.get());
+
+    if (!unix_path_.empty())
+        unlink(unix_path_.c_str());
+}
+
+unique_fd metrics_server::listen_on(const std::string & address)
+{
+    sockaddr_storage addr{ };
+    socklen_t len;
+    unique_fd fd;
+
+    if (address.starts_with('/'))
+    {
+        auto & un = reinterpret_cast<sockaddr_un &>(addr);
+        if (address.size() >= sizeof un.sun_path)
+            throw runtime_error{ "metrics socket path is too long: " + address };
+        un.sun_family = AF_UNIX;
+        memcpy(un.sun_path, address.c_str(), address.size() + 1);
+        len = sizeof un;
+
+        // a socket left by a previous run refuses the bind
+        unlink(address.c_str());
+        fd.reset(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    }
+    else
+    {
+        // host:port, an empty host listens on all interfaces
+        auto const sep = address.rfind(':');
+        auto & in = reinterpret_cast<sockaddr_in &>(addr);
+        in.sin_family = AF_INET;
+        char * end;
+        auto const port = sep == std::string::npos ? 0 : strtoul(address.c_str() + sep + 1, &end, 10);
+        auto const host = sep == std::string::npos ? std::string{ } : address.substr(0, sep);
+        if (port == 0 || port > 65535 || *end != 0 ||
+            (!host.empty() && inet_pton(AF_INET, host.c_str(), &in.sin_addr) != 1))
+            throw runtime_error{ "invalid metrics address: " + address };
+        if (host.empty())
+            in.sin_addr.s_addr = htonl(INADDR_ANY);
+        in.sin_port = htons(static_cast<uint16_t>(port));
+        len = sizeof in;
+
+        fd.reset(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        int const on = 1;
+        if (fd) setsockopt(fd.get(), SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    }
+
+    if (!fd || bind(fd.get(), reinterpret_cast<sockaddr *>(&addr), len) != 0 || listen(fd.get(), 8) != 0)
+        throw runtime_error{ "Cannot listen on " + address + ": " + strerror(errno) };
+    return fd;
+}
+
+void metrics_server::handle(std::string path, std::string content_type, handler_fn handler)
+{
+    routes_[std::move(path)] = { std::move(content_type), std::move(handler) };
+}
+
+void metrics_server::on_accept()
+{
+    for (int fd; (fd = accept4(listen_.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0; )
+    {
+        if (clients_.size() >= max_clients)
+        {
+            auto const oldest = std::min_element(clients_.begin(), clients_.end(),
+                [](auto const & a, auto const & b) { return a.second.since_ < b.second.since_; });
+            drop(oldest->first);
+        }
+
+        auto & c = clients_[fd];
+        c.fd_.reset(fd);
+        c.since_ = std::chrono::steady_clock::now();
+        loop_.add(fd, EPOLLIN, [this, fd](uint32_t events) { on_ready(fd, events); });
+    }
+}
+
+void metrics_server::on_ready(int fd, uint32_t events)
+{
+    auto const it = clients_.find(fd);
+    if (it == clients_.end()) return;
+    auto & c = it->second;
+
+    if (events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLIN))
+    {
+        drop(fd);
+        return;
+    }
+
+    if (!c.answering_)
+    {
+        char buf[1024];
+        auto const n = read(fd, buf, sizeof buf);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+        {
+            drop(fd);
+            return;
+        }
+        if (n > 0) c.buf_.append(buf, static_cast<size_t>(n));
+
+        // the headers are not looked at, the request line is all it takes
+        if (c.buf_.find("\r\n\r\n") == std::string::npos && c.buf_.find("\n\n") == std::string::npos)
+        {
+            if (c.buf_.size() > max_request) drop(fd);
+            return;
+        }
+
+        answer(c);
+        c.answering_ = true;
+    }
+
+    auto const n = send(fd, c.buf_.data(), c.buf_.size(), MSG_NOSIGNAL);
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        drop(fd);
+        return;
+    }
+    if (n > 0) c.buf_.erase(0, static_cast<size_t>(n));
+
+    if (c.buf_.empty())
+        drop(fd);
+    else
+        loop_.modify(fd, EPOLLOUT);
+}
+
+void metrics_server::answer(client & c)
+{
+    std::string_view const request{ c.buf_ };
+    auto const target = request.substr(0, request.find_first_of("\r\n"));
+
+    char const * status = "200 OK";
+    std::string_view content_type = "text/plain; version=0.0.4";
+    body_.clear();
+    if (target.starts_with("GET /metrics ") || target.starts_with("GET / "))
+        render_(body_);
+    else if (!target.starts_with("GET "))
+        status = "405 Method Not Allowed";
+    else
+    {
+        // GET /path?query HTTP/1.1
+        auto uri = target.substr(4);
+        uri = uri.substr(0, uri.find(' '));
+        auto const mark = uri.find('?');
+        auto const query = mark == std::string_view::npos ? std::string_view{ } : uri.substr(mark + 1);
+        auto const it = routes_.find(uri.substr(0, mark));
+        if (it == routes_.end() || !it->second.handler_(query, body_))
+        {
+            status = "404 Not Found";
+            body_.clear();
+        }
+        else
+            content_type = it->second.content_type_;
+    }
+
+    c.buf_ = "HTTP/1.1 ";
+    c.buf_.append(status);
+    c.buf_.append("\r\nContent-Type: ").append(content_type);
+    c.buf_.append("\r\nConnection: close\r\nContent-Length: ");
+    c.buf_.append(std::to_string(body_.size())).append("\r\n\r\n").append(body_);
+}
+
+void metrics_server::drop(int fd)
+{
+    loop_.remove(fd);
+    clients_.erase(fd);
+}
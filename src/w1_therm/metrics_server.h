@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "event_loop.h"
+#include "unique_fd.h"
+
+/**
+ * @brief serves the metrics in the Prometheus text format on an event_loop
+ *
+ * Listens on `host:port` or on a Unix socket when the address is a path.
+ * `GET /metrics` is answered with what render appends, other paths with
+ * their handler, then the connection is closed. Nothing blocks: a client
+ * that is slow to send its request or to read the answer only holds its
+ * own fd, the oldest one is dropped when too many are open.
+ */
+class metrics_server
+{
+public:
+    struct runtime_error;
+
+    using render_fn = std::function<void(std::string & out)>;
+
+    /**
+     * @brief answers the query string of a GET, false answers 404
+     */
+    using handler_fn = std::function<bool(std::string_view query, std::string & out)>;
+
+    metrics_server(event_loop & loop, const std::string & address, render_fn render);
+
+    metrics_server(const metrics_server &) = delete;
+
+    ~metrics_server();
+
+    metrics_server & operator=(const metrics_server &) = delete;
+
+    /**
+     * @brief answer GET path, with or without a query string, with handler
+     */
+    void handle(std::string path, std::string content_type, handler_fn handler);
+
+private:
+    struct client
+    {
+        unique_fd   fd_{ };
+        std::string buf_{ };      ///< the request, then the unsent part of the answer
+        bool        answering_{ false };
+        std::chrono::steady_clock::time_point since_{ };
+    };
+
+    struct route
+    {
+        std::string content_type_;
+        handler_fn  handler_;
+    };
+
+    static unique_fd listen_on(const std::string & address);
+
+    void on_accept();
+
+    void on_ready(int fd, uint32_t events);
+
+    /**
+     * @brief render the answer to the request in c.buf_
+     */
+    void answer(client & c);
+
+    void drop(int fd);
+
+private:
+    event_loop &          loop_;
+    unique_fd             listen_;
+    std::string           unix_path_{ }; ///< unlinked on destruction
+    render_fn             render_;
+    std::map<int, client> clients_{ };
+    std::map<std::string, route, std::less<>> routes_{ };
+    std::string           body_{ };      ///< reused across scrapes
+};
+
+struct metrics_server::runtime_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
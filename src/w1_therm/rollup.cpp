@@ -0,0 +1,92 @@
+#include <cassert>
+#include <cmath>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "rollup.h"
+
+rollup::rollup(std::vector<uint32_t> windows, emit_fn emit)
+    : lengths_{ std::move(windows) }
+    , emit_{ std::move(emit) }
+{
+    std::sort(lengths_.begin(), lengths_.end());
+    if (std::adjacent_find(lengths_.begin(), lengths_.end()) != lengths_.end())
+        throw std::invalid_argument{ "duplicate rollup window" };
+    for (auto const length : lengths_)
+    {
+        if (length == 0 || length > max_rollup_window)
+            throw std::invalid_argument{ "invalid rollup window " + std::to_string(length) };
+    }
+    assert(emit_ || lengths_.empty());
+}
+
+rollup::sensor & rollup::find(const char * name)
+{
+    for (auto & s : sensors_)
+    {
+        if (s.name_ == name) return s;
+    }
+    return sensors_.emplace_back(sensor{ name, std::vector<window>(lengths_.size()) });
+}
+
+void rollup::add(const char * name, double value, time_t now)
+{
+    if (lengths_.empty() || !std::isfinite(value)) return;
+
+    auto & s = find(name);
+    for (size_t i = 0; i < lengths_.size(); ++i)
+    {
+        auto & w = s.windows_[i];
+        auto const start = now - now % lengths_[i];
+        if (w.count_ != 0 && w.start_ != start)
+            close(s, w, lengths_[i]);
+
+        if (w.count_++ == 0)
+        {
+            w.start_ = start;
+            w.min_ = w.max_ = value;
+            w.sum_ = 0;
+        }
+        w.min_ = std::min(w.min_, value);
+        w.max_ = std::max(w.max_, value);
+        w.sum_ += value;
+        w.last_ = value;
+    }
+}
+
+void rollup::close_due(time_t now)
+{
+    for (auto & s : sensors_)
+    {
+        for (size_t i = 0; i < lengths_.size(); ++i)
+        {
+            auto & w = s.windows_[i];
+            if (w.count_ != 0 && now >= w.start_ + lengths_[i])
+                close(s, w, lengths_[i]);
+        }
+    }
+}
+
+void rollup::close_all()
+{
+    for (auto & s : sensors_)
+    {
+        for (size_t i = 0; i < lengths_.size(); ++i)
+        {
+            if (s.windows_[i].count_ != 0)
+                close(s, s.windows_[i], lengths_[i]);
+        }
+    }
+}
+
+void rollup::close(const sensor & s, window & w, uint32_t length)
+{
+    auto const name = s.name_.c_str();
+    emit_(name, w.min_, w.start_, rollup_series(length, rollup_stat::min));
+    emit_(name, w.max_, w.start_, rollup_series(length, rollup_stat::max));
+    emit_(name, w.sum_ / static_cast<double>(w.count_), w.start_, rollup_series(length, rollup_stat::mean));
+    emit_(name, w.last_, w.start_, rollup_series(length, rollup_stat::last));
+    emit_(name, static_cast<double>(w.count_), w.start_, rollup_series(length, rollup_stat::count));
+    w.count_ = 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "series.h"
+
+/**
+ * @brief streaming min/max/mean/last/count of every sensor over fixed windows
+ *
+ * Windows are aligned to multiples of their length since the epoch, so a
+ * 60 s window is a wall-clock minute whatever the sampling interval. A window
+ * keeps running statistics only, its memory does not grow with the samples it
+ * sees. It closes on the first reading past its end, or on close_due() for a
+ * sensor that stopped answering, and emits one value per statistic stamped
+ * with the start of the window.
+ */
+class rollup
+{
+public:
+    /**
+     * @brief receives a closed window, one call per statistic
+     */
+    using emit_fn = std::function<void(const char * name, double value, time_t start, uint32_t series)>;
+
+    /**
+     * @param windows lengths in seconds, none disables the rollups
+     */
+    rollup(std::vector<uint32_t> windows, emit_fn emit);
+
+    rollup(const rollup &) = delete;
+
+    rollup & operator=(const rollup &) = delete;
+
+    bool enabled() const { return !lengths_.empty(); }
+
+    /**
+     * @brief account for a reading, closing the windows it is past first
+     *
+     * NaN and infinities are skipped, they would poison every statistic.
+     */
+    void add(const char * name, double value, time_t now);
+
+    /**
+     * @brief close the windows that ended before now, whether or not readings came
+     */
+    void close_due(time_t now);
+
+    /**
+     * @brief emit the open windows as they are, e.g. on shutdown
+     */
+    void close_all();
+
+private:
+    struct window
+    {
+        time_t   start_{ 0 };
+        double   min_{ 0 };
+        double   max_{ 0 };
+        double   sum_{ 0 };
+        double   last_{ 0 };
+        uint64_t count_{ 0 };     ///< 0 while the window is empty
+    };
+
+    struct sensor
+    {
+        std::string         name_;
+        std::vector<window> windows_; ///< one per length, in the same order
+    };
+
+    sensor & find(const char * name);
+
+    /**
+     * @brief emit w and empty it
+     */
+    void close(const sensor & s, window & w, uint32_t length);
+
+private:
+    std::vector<uint32_t> lengths_;
+    emit_fn               emit_;
+    std::vector<sensor>   sensors_{ }; ///< a handful, in discovery order
+};
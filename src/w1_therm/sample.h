@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+/**
+ * @brief one reading of a sensor, trivially copyable so it can live in a ring
+ */
+struct sample
+{
+    static constexpr size_t name_capacity = 64;
+
+    char   name_[name_capacity]{ }; ///< NUL-terminated sensor name
+    double value_{ 0 };             ///< temperature in celsius
+    time_t time_{ 0 };              ///< unix time of the reading
+    uint32_t series_{ 0 };          ///< 0 for a raw reading, else see rollup_series
+};
+
+inline sample make_sample(const char * name, double value, time_t now, uint32_t series = 0)
+{
+    sample s;
+    strncpy(s.name_, name, sample::name_capacity - 1);
+    s.value_ = value;
+    s.time_ = now;
+    s.series_ = series;
+    return s;
+}
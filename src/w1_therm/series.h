@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+
+/**
+ * @brief the statistics a rollup window emits, raw is a reading as sampled
+ */
+enum class rollup_stat : uint32_t
+{
+    raw = 0,
+    min,
+    max,
+    mean,
+    last,
+    count,
+};
+
+/**
+ * @brief what a sink is given once rollups are on: raw readings, rollups or both
+ */
+enum class rollup_output
+{
+    raw,
+    rollup,
+    both,
+};
+
+/**
+ * @brief true if a sink set to output takes a sample of series
+ */
+constexpr bool rollup_output_takes(rollup_output output, uint32_t series)
+{
+    return output == rollup_output::both || (output == rollup_output::raw) == (series == 0);
+}
+
+/**
+ * @brief the series of a rollup statistic, 0 is the raw series
+ *
+ * The window length is part of the id, so rollups buffered offline keep
+ * their meaning when the configured windows change.
+ */
+constexpr uint32_t rollup_series(uint32_t window_seconds, rollup_stat stat)
+{
+    return window_seconds << 3 | static_cast<uint32_t>(stat);
+}
+
+/**
+ * @brief the longest window a series id can hold
+ */
+constexpr uint32_t max_rollup_window = UINT32_MAX >> 3;
+
+constexpr uint32_t series_window(uint32_t series) { return series >> 3; }
+
+constexpr rollup_stat series_stat(uint32_t series) { return static_cast<rollup_stat>(series & 7); }
+
+/**
+ * @brief suffix of the field holding stat, e.g. `_mean`, nothing for an unknown stat
+ */
+inline std::string_view stat_suffix(rollup_stat stat)
+{
+    switch (stat)
+    {
+    case rollup_stat::raw:   return "";
+    case rollup_stat::min:   return "_min";
+    case rollup_stat::max:   return "_max";
+    case rollup_stat::mean:  return "_mean";
+    case rollup_stat::last:  return "_last";
+    case rollup_stat::count: return "_count";
+    }
+    return { };
+}
+
+/**
+ * @brief a window length the way a dashboard spells it: 30s, 15m, 1h, 1d
+ */
+template <size_t N>
+inline std::string_view format_window(uint32_t seconds, char (&buf)[N])
+{
+    static_assert(N >= 12);
+
+    auto unit = 's';
+    if (seconds != 0 && seconds % 86400 == 0)     { seconds /= 86400; unit = 'd'; }
+    else if (seconds != 0 && seconds % 3600 == 0) { seconds /= 3600; unit = 'h'; }
+    else if (seconds != 0 && seconds % 60 == 0)   { seconds /= 60; unit = 'm'; }
+
+    auto const n = snprintf(buf, N, "%u%c", seconds, unit);
+    return { buf, static_cast<size_t>(n) };
+}
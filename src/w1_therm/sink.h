@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "sample.h"
+
+/**
+ * @brief where the samples end up: influxdb, a local file, ...
+ *
+ * Each sink is driven by an uploader of its own, on a thread of its own, so
+ * a slow sink only fills its own queue. Every call but the constructor is
+ * made on that thread.
+ */
+class sink
+{
+public:
+    virtual ~sink() = default;
+
+    /**
+     * @brief short name used in logs & metric labels, e.g. "influx"
+     */
+    virtual const char * name() const = 0;
+
+    virtual void write(const sample & s) = 0;
+
+    /**
+     * @brief readable when on_ready() has work to do, -1 if the sink never waits on a fd
+     */
+    virtual int fd() const { return -1; }
+
+    virtual void on_ready() { }
+
+    /**
+     * @brief do the batched work that is due, e.g. a commit
+     */
+    virtual void tick() { }
+
+    /**
+     * @brief when tick() has work to do, nothing if it has none
+     */
+    virtual std::optional<std::chrono::steady_clock::time_point> deadline() { return std::nullopt; }
+
+    /**
+     * @brief finish everything pending, called once the queue is drained for good
+     */
+    virtual void flush() { }
+
+    /**
+     * @brief n samples reached the sink's backlog behind its back, see overflow_policy::spill
+     */
+    virtual void spilled(size_t /* n */) { }
+
+    /**
+     * @brief points delivered so far, read from any thread
+     */
+    virtual uint64_t sent() const { return 0; }
+
+    /**
+     * @brief points given up after leaving the ring so far, read from any thread
+     */
+    virtual uint64_t dropped() const { return 0; }
+};
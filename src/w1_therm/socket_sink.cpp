@@ -0,0 +1,158 @@
+#include <netdb.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <syslog.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "socket_sink.h"
+
+socket_sink::socket_sink(mode m, const std::string & address, options opt)
+    : mode_{ m }
+    , address_{ address }
+    , options_{ opt }
+{
+    if (options_.packet_bytes_ == 0)
+        throw std::invalid_argument{ "invalid packet size" };
+
+    if (mode_ == mode::udp || mode_ == mode::tcp)
+    {
+        // host:port, resolved once, the agent is expected at a fixed address
+        auto const sep = address.rfind(':');
+        if (sep == std::string::npos || sep == 0 || sep + 1 == address.size())
+            throw runtime_error{ std::string{ "invalid " } + name() + " address: " + address };
+
+        addrinfo hints{ };
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = mode_ == mode::udp ? SOCK_DGRAM : SOCK_STREAM;
+        addrinfo * res{ nullptr };
+        auto const host = address.substr(0, sep);
+        if (getaddrinfo(host.c_str(), address.c_str() + sep + 1, &hints, &res) != 0 || res == nullptr)
+            throw runtime_error{ std::string{ "cannot resolve " } + name() + " address: " + address };
+        memcpy(&peer_, res->ai_addr, res->ai_addrlen);
+        peer_len_ = res->ai_addrlen;
+        freeaddrinfo(res);
+    }
+    else
+    {
+        auto & un = reinterpret_cast<sockaddr_un &>(peer_);
+        if (address.empty() || address.size() >= sizeof un.sun_path)
+            throw runtime_error{ "invalid socket path: " + address };
+        un.sun_family = AF_UNIX;
+        memcpy(un.sun_path, address.c_str(), address.size() + 1);
+        peer_len_ = sizeof un;
+    }
+
+    packet_.reserve(options_.packet_bytes_);
+
+    // the agent may start later, the first packet connects again
+    connect();
+}
+
+const char * socket_sink::name() const
+{
+    switch (mode_)
+    {
+    case mode::udp:
+        return "udp";
+    case mode::tcp:
+        return "tcp";
+    case mode::unix_stream:
+        return "unix";
+    case mode::unix_dgram:
+        return "unixgram";
+    }
+    return "socket";
+}
+
+bool socket_sink::connect()
+{
+    auto const type = mode_ == mode::unix_stream || mode_ == mode::tcp ? SOCK_STREAM : SOCK_DGRAM;
+    fd_.reset(::socket(peer_.ss_family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    if (!fd_)
+        return false;
+
+    if (::connect(fd_.get(), reinterpret_cast<const sockaddr *>(&peer_), peer_len_) == 0)
+        return true;
+
+    // the handshake of a remote peer goes on in the background
+    pollfd p{ fd_.get(), POLLOUT, 0 };
+    int err = 0;
+    socklen_t len = sizeof err;
+    if (errno == EINPROGRESS && poll(&p, 1, static_cast<int>(options_.packet_interval_.count())) == 1 &&
+        getsockopt(fd_.get(), SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+        return true;
+
+    fd_.reset();
+    return false;
+}
+
+void socket_sink::write(const sample & s)
+{
+    // NaN and unknown rollups encode to nothing
+    line_.clear();
+    format_.encode(line_, s.name_, s.value_, s.time_, s.series_);
+    if (line_.empty()) return;
+
+    auto const line = line_.view();
+    if (lines_ != 0 && packet_.size() + line.size() > options_.packet_bytes_)
+        send_packet();
+
+    if (lines_++ == 0)
+        since_ = std::chrono::steady_clock::now();
+    packet_.append(line);
+
+    // a line longer than a packet goes alone
+    if (packet_.size() >= options_.packet_bytes_)
+        send_packet();
+}
+
+void socket_sink::tick()
+{
+    if (lines_ != 0 && std::chrono::steady_clock::now() >= since_ + options_.packet_interval_)
+        send_packet();
+}
+
+std::optional<std::chrono::steady_clock::time_point> socket_sink::deadline()
+{
+    if (lines_ == 0) return std::nullopt;
+    return since_ + options_.packet_interval_;
+}
+
+void socket_sink::flush()
+{
+    send_packet();
+}
+
+void socket_sink::send_packet()
+{
+    if (lines_ == 0) return;
+
+    ssize_t n = -1;
+    if (fd_ || connect())
+        n = ::send(fd_.get(), packet_.data(), packet_.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (n == static_cast<ssize_t>(packet_.size()))
+    {
+        sent_.add(lines_);
+        packets_.add();
+    }
+    else
+    {
+        auto const err = n < 0 ? errno : EAGAIN;
+        dropped_.add(lines_);
+
+        // a stream cut short, a peer gone or restarted: connect again for the next packet
+        if (n > 0 || (n < 0 && err != EAGAIN && err != EWOULDBLOCK && mode_ != mode::udp))
+            fd_.reset();
+
+        // only the first drop is logged, the counter tells the rest while the agent is away
+        if (dropped_.get() == lines_)
+            syslog(LOG_USER | LOG_WARNING, "%s sink: dropping packets to %s: %s\n", name(), address_.c_str(),
+                   fd_ ? strerror(err) : "not connected");
+    }
+
+    packet_.clear();
+    lines_ = 0;
+}
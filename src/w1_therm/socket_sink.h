@@ -0,0 +1,101 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "line_protocol.h"
+#include "metrics.h"
+#include "sink.h"
+#include "unique_fd.h"
+
+/**
+ * @brief sends the samples in line protocol to a local agent, e.g. Telegraf's socket_listener
+ *
+ * Lines are packed into packets of at most packet_bytes_, a packet is sent
+ * once the next line would not fit or the oldest line is old enough. Sends
+ * never block the sink: a datagram the kernel will not take right away, or
+ * nobody listens to, is dropped and counted. A stream socket that fails is
+ * closed, dropping its packet, and connected again on the next packet, so a
+ * packet cut short never glues to the next one. A tcp handshake is waited
+ * for at most a packet interval, on the sink's own thread.
+ */
+class socket_sink : public sink
+{
+public:
+    struct runtime_error;
+
+    enum class mode
+    {
+        udp,         ///< host:port, one datagram per packet
+        tcp,         ///< host:port, e.g. a w1_therm gateway
+        unix_stream, ///< path of a SOCK_STREAM socket
+        unix_dgram,  ///< path of a SOCK_DGRAM socket, one datagram per packet
+    };
+
+    struct options
+    {
+        size_t                    packet_bytes_{ 1400 };      ///< largest packet, below the MTU for udp
+        std::chrono::milliseconds packet_interval_{ 1000 };   ///< send a partial packet once its oldest line is this old
+    };
+
+    socket_sink(mode m, const std::string & address, options opt);
+
+    const char * name() const override;
+
+    void write(const sample & s) override;
+
+    void tick() override;
+
+    std::optional<std::chrono::steady_clock::time_point> deadline() override;
+
+    void flush() override;
+
+    /**
+     * @brief lines the kernel took
+     */
+    uint64_t sent() const override { return sent_.get(); }
+
+    /**
+     * @brief lines of the packets the kernel did not take
+     */
+    uint64_t dropped() const override { return dropped_.get(); }
+
+    /**
+     * @brief packets the kernel took
+     */
+    uint64_t packets() const { return packets_.get(); }
+
+private:
+    /**
+     * @brief resolve & connect fd_, false if the peer is not there yet
+     */
+    bool connect();
+
+    void send_packet();
+
+private:
+    mode                                  mode_;
+    std::string                           address_;
+    options                               options_;
+    sockaddr_storage                      peer_{ };
+    socklen_t                             peer_len_{ 0 };
+    unique_fd                             fd_{ };
+    point_format                          format_{ "home", "temperature" };
+    line_encoder                          line_{ 256 };     ///< the sample being packed
+    std::string                           packet_{ };       ///< reserved to packet_bytes_ once
+    size_t                                lines_{ 0 };      ///< lines in packet_
+    std::chrono::steady_clock::time_point since_{ };        ///< when the oldest line was packed
+    counter                               sent_{ };
+    counter                               dropped_{ };
+    counter                               packets_{ };
+};
+
+struct socket_sink::runtime_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
@@ -0,0 +1,483 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <filesystem>
+#include <utility>
+
+#include <zlib.h>
+
+#ifdef _DEBUG_
+#include <iostream>
+#endif
+
+#include "metrics.h"
+#include "spool_storage.h"
+
+namespace
+{
+
+// [u32 len][u32 crc][i64 time][f64 value][u32 series][name], len counts the payload
+// after crc, series is only there for a rollup, flagged in len, so raw records keep
+// the size & the layout of the spools written before rollups
+constexpr size_t header_size = 8;
+constexpr size_t fixed_payload = 16;
+constexpr size_t series_size = 4;
+constexpr size_t max_name = 255;
+constexpr uint32_t series_flag = 0x80000000u;
+
+/**
+ * @brief bytes before the name in a payload whose length field is len
+ */
+constexpr size_t name_offset(uint32_t len)
+{
+    return fixed_payload + (len & series_flag ? series_size : 0);
+}
+
+/**
+ * @brief crc of the payload, seeded with the segment sequence number
+ */
+uint32_t record_crc(uint32_t seq, const char * payload, size_t len)
+{
+    auto crc = crc32(0L, reinterpret_cast<const Bytef *>(&seq), sizeof seq);
+    return static_cast<uint32_t>(crc32(crc, reinterpret_cast<const Bytef *>(payload), static_cast<uInt>(len)));
+}
+
+/**
+ * @brief persisted read cursor
+ */
+struct cursor_data
+{
+    uint32_t seq_;
+    uint32_t off_;
+    uint32_t crc_;
+};
+
+std::string errno_message(const char * what, const std::string & path)
+{
+    return std::string{ what } + " " + path + ": " + strerror(errno);
+}
+
+/**
+ * @brief make creations & renames in dir durable
+ */
+void sync_dir(const std::string & dir)
+{
+    unique_fd const fd{ open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+    if (!fd || fsync(fd.get()) != 0)
+        throw spool_storage::runtime_error{ errno_message("Cannot sync", dir) };
+}
+
+} // namespace
+
+spool_storage::segment::segment(const std::string & path, uint32_t seq, size_t size, bool create)
+    : seq_{ seq }
+    , size_{ size }
+{
+    unique_fd const fd{ open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644) };
+    if (!fd)
+        throw runtime_error{ errno_message("Cannot open", path) };
+
+    // a fresh file reads as zeros, which never validates as a record
+    struct stat st;
+    if (fstat(fd.get(), &st) != 0)
+        throw runtime_error{ errno_message("Cannot stat", path) };
+    if (static_cast<size_t>(st.st_size) != size && ftruncate(fd.get(), static_cast<off_t>(size)) != 0)
+        throw runtime_error{ errno_message("Cannot size", path) };
+
+    // allocate the blocks now, a full disk must fail here and not as SIGBUS on a store
+    if (auto const err = posix_fallocate(fd.get(), 0, static_cast<off_t>(size)); err != 0)
+    {
+        errno = err;
+        throw runtime_error{ errno_message("Cannot allocate", path) };
+    }
+
+    auto const addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+    if (addr == MAP_FAILED)
+        throw runtime_error{ errno_message("Cannot map", path) };
+    data_ = static_cast<char *>(addr);
+}
+
+spool_storage::segment::segment(segment && other) noexcept
+    : seq_{ other.seq_ }
+    , data_{ std::exchange(other.data_, nullptr) }
+    , size_{ other.size_ }
+{ }
+
+spool_storage::segment::~segment()
+{
+    if (data_) munmap(data_, size_);
+}
+
+spool_storage::segment & spool_storage::segment::operator=(segment && other) noexcept
+{
+    if (this != &other)
+    {
+        if (data_) munmap(data_, size_);
+        seq_ = other.seq_;
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = other.size_;
+    }
+    return *this;
+}
+
+spool_storage::spool_storage(const char * dir)
+    : spool_storage{ dir, options{ } }
+{ }
+
+spool_storage::spool_storage(const char * dir, options opt)
+    : dir_{ dir }
+    , options_{ opt }
+{
+    assert(dir);
+
+    if (options_.segment_size_ < header_size + fixed_payload + series_size + max_name ||
+        options_.segment_size_ > UINT32_MAX)
+        throw std::invalid_argument{ "invalid segment size" };
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    if (ec)
+        throw runtime_error{ "Cannot create " + dir_ + ": " + ec.message() };
+
+    // find the segments & spares left by the previous run
+    std::vector<uint32_t> seqs;
+    for (auto const & entry : std::filesystem::directory_iterator{ dir_, ec })
+    {
+        auto const name = entry.path().filename().string();
+        unsigned seq;
+        char tail;
+        if (sscanf(name.c_str(), "seg-%8x%c", &seq, &tail) == 1 && seq != 0)
+            seqs.push_back(seq);
+        else if (name.starts_with("spare-"))
+            spares_.push_back(entry.path().string());
+    }
+    if (ec)
+        throw runtime_error{ "Cannot list " + dir_ + ": " + ec.message() };
+    std::sort(seqs.begin(), seqs.end());
+
+    cursor_fd_.reset(open((dir_ + "/cursor").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+    if (!cursor_fd_)
+        throw runtime_error{ errno_message("Cannot open", dir_ + "/cursor") };
+    load_cursor();
+
+    // segments behind the cursor were uploaded already
+    for (auto const seq : seqs)
+    {
+        if (seq < cursor_.seq_)
+        {
+            auto spare = spare_path(seq);
+            if (std::rename(segment_path(seq).c_str(), spare.c_str()) == 0)
+                spares_.push_back(std::move(spare));
+        }
+        else
+        {
+            live_.push_back(seq);
+        }
+    }
+
+    if (live_.empty())
+    {
+        auto const seq = std::max<uint32_t>(cursor_.seq_, 1);
+        live_.push_back(seq);
+        write_ = segment{ segment_path(seq), seq, options_.segment_size_, true };
+        write_off_ = 0;
+        if (cursor_.seq_ != seq) cursor_ = { seq, 0 };
+    }
+    else
+    {
+        // the write position is the first record failing its check
+        auto const seq = live_.back();
+        write_ = segment{ segment_path(seq), seq, options_.segment_size_, false };
+        write_off_ = seq == cursor_.seq_ ? cursor_.off_ : 0;
+        for (size_t len; (len = valid_record(write_, write_off_)) != 0; )
+            write_off_ += len;
+        if (cursor_.seq_ < live_.front()) cursor_ = { live_.front(), 0 };
+    }
+
+    synced_off_ = write_off_;
+
+    // the segment files & the cursor file may be new
+    sync_dir(dir_);
+}
+
+spool_storage::~spool_storage()
+{
+    if (!write_) return;
+
+    try
+    {
+        flush();
+    }
+    catch (runtime_error const &)
+    {
+        // nothing can be done here, the kernel still writes the pages back
+    }
+}
+
+std::string spool_storage::segment_path(uint32_t seq) const
+{
+    char name[16];
+    snprintf(name, sizeof name, "seg-%08x", seq);
+    return dir_ + '/' + name;
+}
+
+std::string spool_storage::spare_path(uint32_t seq) const
+{
+    char name[16];
+    snprintf(name, sizeof name, "spare-%08x", seq);
+    return dir_ + '/' + name;
+}
+
+size_t spool_storage::valid_record(const segment & seg, size_t off)
+{
+    if (off + header_size + fixed_payload > seg.size()) return 0;
+
+    uint32_t len, crc;
+    memcpy(&len, seg.data() + off, sizeof len);
+    memcpy(&crc, seg.data() + off + 4, sizeof crc);
+    auto const fixed = name_offset(len);
+    len &= ~series_flag;
+    if (len < fixed || len > fixed + max_name) return 0;
+    if (off + header_size + len > seg.size()) return 0;
+
+    if (record_crc(seg.seq(), seg.data() + off + header_size, len) != crc) return 0;
+    return header_size + len;
+}
+
+const spool_storage::segment & spool_storage::map(uint32_t seq)
+{
+    if (seq == write_.seq()) return write_;
+    if (read_ && read_.seq() == seq) return read_;
+
+    read_ = segment{ segment_path(seq), seq, options_.segment_size_, false };
+    return read_;
+}
+
+bool spool_storage::seek(position & pos)
+{
+    for (;;)
+    {
+        if (valid_record(map(pos.seq_), pos.off_) != 0) return true;
+
+        // the rest of a segment is unused once a record did not fit
+        auto const it = std::upper_bound(live_.begin(), live_.end(), pos.seq_);
+        if (it == live_.end()) return false;
+        pos = { *it, 0 };
+    }
+}
+
+void spool_storage::roll()
+{
+    flush();
+
+    auto const seq = write_.seq() + 1;
+    auto const path = segment_path(seq);
+
+    // reuse a consumed segment, its stale records fail the crc of the new seq
+    auto create = true;
+    if (!spares_.empty())
+    {
+        if (std::rename(spares_.back().c_str(), path.c_str()) == 0) create = false;
+        spares_.pop_back();
+    }
+
+    write_ = segment{ path, seq, options_.segment_size_, create };
+    write_off_ = 0;
+    synced_off_ = 0;
+    live_.push_back(seq);
+
+    // records synced into the segment must not vanish with its directory entry
+    sync_dir(dir_);
+}
+
+void spool_storage::insert(const char * name, const double value, time_t now, uint32_t series)
+{
+    assert(name);
+    auto const bgn = std::chrono::steady_clock::now();
+
+    auto const name_len = std::min(strlen(name), max_name);
+    auto const fixed = fixed_payload + (series != 0 ? series_size : 0);
+    auto const len = fixed + name_len;
+    if (write_off_ + header_size + len > write_.size())
+        roll();
+
+    auto const rec = write_.data() + write_off_;
+    auto const payload = rec + header_size;
+    int64_t const time = now;
+    memcpy(payload, &time, sizeof time);
+    memcpy(payload + 8, &value, sizeof value);
+    if (series != 0) memcpy(payload + fixed_payload, &series, sizeof series);
+    memcpy(payload + fixed, name, name_len);
+
+    // the header goes last, a torn record fails the crc
+    auto const len32 = static_cast<uint32_t>(len) | (series != 0 ? series_flag : 0);
+    auto const crc = record_crc(write_.seq(), payload, len);
+    memcpy(rec, &len32, sizeof len32);
+    memcpy(rec + 4, &crc, sizeof crc);
+    write_off_ += header_size + len;
+
+    // the append alone, a sync it triggers is a commit
+    global_metrics().backlog_insert_.observe(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bgn));
+
+#ifdef _DEBUG_
+    std::cerr << "new record: " << name << ',' << value << ',' << now << ',' << series << std::endl;
+#endif
+
+    if (pending_++ == 0)
+        pending_since_ = std::chrono::steady_clock::now();
+
+    if (pending_ >= options_.sync_count_)
+        flush();
+    else
+        flush_if_due();
+}
+
+size_t spool_storage::select(int64_t after_id, size_t count, std::vector<record> & rows)
+{
+    // resume right after the previous page, otherwise walk from the cursor
+    position pos = cursor_;
+    if (after_id == scan_id_)
+    {
+        pos = scan_next_;
+    }
+    else
+    {
+        while (pos.id() <= after_id && seek(pos))
+            pos.off_ += static_cast<uint32_t>(valid_record(map(pos.seq_), pos.off_));
+    }
+
+    size_t n = 0;
+    while (n < count && seek(pos))
+    {
+        auto const & seg = map(pos.seq_);
+        auto const len = valid_record(seg, pos.off_);
+        auto const payload = seg.data() + pos.off_ + header_size;
+        uint32_t len32;
+        memcpy(&len32, payload - header_size, sizeof len32);
+        auto const fixed = name_offset(len32);
+
+        if (rows.size() <= n) rows.emplace_back();
+        auto & row = rows[n++];
+        int64_t time;
+        memcpy(&time, payload, sizeof time);
+        memcpy(&row.value_, payload + 8, sizeof row.value_);
+        row.time_ = static_cast<time_t>(time);
+        row.series_ = 0;
+        if (fixed != fixed_payload) memcpy(&row.series_, payload + fixed_payload, sizeof row.series_);
+        row.name_.assign(payload + fixed, len - header_size - fixed);
+        row.id_ = pos.id();
+        pos.off_ += static_cast<uint32_t>(len);
+    }
+
+    rows.resize(n);
+    if (n != 0)
+    {
+        scan_id_ = rows.back().id_;
+        scan_next_ = pos;
+    }
+    return n;
+}
+
+void spool_storage::delete_where_id_not_greater_than(int64_t id)
+{
+    if (id < cursor_.id()) return;
+
+    position pos{ static_cast<uint32_t>(id >> 32), static_cast<uint32_t>(id) };
+    auto const len = valid_record(map(pos.seq_), pos.off_);
+    if (len == 0)
+        throw runtime_error{ "Cannot delete records: no record " + std::to_string(id) };
+    pos.off_ += static_cast<uint32_t>(len);
+
+    // step over exhausted segments so they can be recycled now
+    if (!seek(pos) && pos.seq_ != write_.seq())
+        pos = { write_.seq(), static_cast<uint32_t>(write_off_) };
+    cursor_ = pos;
+    save_cursor();
+
+    auto const recycled = live_.front() < cursor_.seq_;
+    while (live_.front() < cursor_.seq_)
+    {
+        auto const seq = live_.front();
+        live_.pop_front();
+        if (read_ && read_.seq() == seq) read_ = segment{ };
+
+        auto const path = segment_path(seq);
+        if (spares_.size() < options_.spare_segments_)
+        {
+            auto spare = spare_path(seq);
+            if (std::rename(path.c_str(), spare.c_str()) == 0)
+            {
+                spares_.push_back(std::move(spare));
+                continue;
+            }
+        }
+        unlink(path.c_str());
+    }
+
+    // persist the renames before roll() may rename a spare back into a segment
+    if (recycled) sync_dir(dir_);
+}
+
+size_t spool_storage::count()
+{
+    size_t n = 0;
+    for (position pos = cursor_; seek(pos); ++n)
+        pos.off_ += static_cast<uint32_t>(valid_record(map(pos.seq_), pos.off_));
+    return n;
+}
+
+void spool_storage::flush_if_due()
+{
+    if (pending_ != 0 &&
+        std::chrono::steady_clock::now() - pending_since_ >= options_.sync_interval_)
+    {
+        flush();
+    }
+}
+
+void spool_storage::flush()
+{
+    if (pending_ == 0) return;
+
+    // msync needs a page aligned start
+    auto const page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    auto const bgn = synced_off_ / page * page;
+    auto const synced = timed(global_metrics().backlog_commit_,
+        [&] { return msync(write_.data() + bgn, write_off_ - bgn, MS_SYNC); });
+    if (synced != 0)
+        throw runtime_error{ errno_message("Cannot sync", segment_path(write_.seq())) };
+
+    synced_off_ = write_off_;
+    pending_ = 0;
+}
+
+void spool_storage::load_cursor()
+{
+    cursor_data data{ };
+    auto const n = pread(cursor_fd_.get(), &data, sizeof data, 0);
+    auto const crc = crc32(0L, reinterpret_cast<const Bytef *>(&data), offsetof(cursor_data, crc_));
+    if (n == sizeof data && data.crc_ == crc)
+        cursor_ = { data.seq_, data.off_ };
+}
+
+void spool_storage::save_cursor()
+{
+    cursor_data data{ cursor_.seq_, cursor_.off_, 0 };
+    data.crc_ = static_cast<uint32_t>(
+        crc32(0L, reinterpret_cast<const Bytef *>(&data), offsetof(cursor_data, crc_)));
+
+    // uploaded records must not come back after a crash
+    if (pwrite(cursor_fd_.get(), &data, sizeof data, 0) != sizeof data ||
+        fdatasync(cursor_fd_.get()) != 0)
+        throw runtime_error{ errno_message("Cannot save", dir_ + "/cursor") };
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "backlog.h"
+#include "unique_fd.h"
+
+/**
+ * @brief append-only offline buffer in memory-mapped segment files
+ *
+ * Records are appended to fixed-size segments as `[len][crc][time value series name]`,
+ * where the CRC also covers the segment sequence number, so stale data left in
+ * a recycled segment never validates. The read cursor is persisted in a file
+ * of its own and segments behind it are recycled. After a power loss the
+ * write position is found again at the first record failing its CRC, so at
+ * most the records appended since the last sync are lost.
+ *
+ * The id of a record is `seq << 32 | offset`, it grows with insertion order
+ * like the sqlite rowid, so both backends drain the same way.
+ */
+class spool_storage
+{
+public:
+    struct runtime_error;
+
+    using record = backlog_record;
+
+    struct options
+    {
+        size_t                    segment_size_{ 1 << 20 }; ///< bytes per segment file
+        size_t                    sync_count_{ 32 };        ///< msync after this many appends
+        std::chrono::milliseconds sync_interval_{ 5000 };   ///< or when unsynced data is this old
+        size_t                    spare_segments_{ 2 };     ///< consumed segments kept for reuse
+    };
+
+private:
+    /**
+     * @brief an mmapped segment file
+     */
+    class segment
+    {
+    public:
+        segment() = default;
+
+        segment(const std::string & path, uint32_t seq, size_t size, bool create);
+
+        segment(const segment &) = delete;
+
+        segment(segment && other) noexcept;
+
+        ~segment();
+
+        segment & operator=(const segment &) = delete;
+
+        segment & operator=(segment && other) noexcept;
+
+        explicit operator bool() const { return data_ != nullptr; }
+
+        uint32_t seq() const { return seq_; }
+
+        char * data() const { return data_; }
+
+        size_t size() const { return size_; }
+
+    private:
+        uint32_t seq_{ 0 };
+        char *   data_{ nullptr };
+        size_t   size_{ 0 };
+    };
+
+public:
+    explicit spool_storage(const char * dir);
+
+    spool_storage(const char * dir, options opt);
+
+    spool_storage(const spool_storage &) = delete;
+
+    spool_storage(spool_storage &&) noexcept = default;
+
+    ~spool_storage();
+
+    spool_storage & operator=(const spool_storage &) = delete;
+
+    spool_storage & operator=(spool_storage &&) noexcept = default;
+
+    /**
+     * @brief append a record, series 0 is a raw reading
+     */
+    void insert(const char * name, double value, time_t now, uint32_t series = 0);
+
+    /**
+     * @brief read at most count records with id greater than after_id, in id order
+     *
+     * @return number of records stored in rows
+     */
+    size_t select(int64_t after_id, size_t count, std::vector<record> & rows);
+
+    /**
+     * @brief move the read cursor past id and recycle the consumed segments
+     */
+    void delete_where_id_not_greater_than(int64_t id);
+
+    /**
+     * @brief msync the appended records if they are old enough
+     */
+    void flush_if_due();
+
+    /**
+     * @brief msync the appended records now
+     */
+    void flush();
+
+    /**
+     * @brief when flush_if_due will sync, nothing if all records are synced
+     */
+    std::optional<std::chrono::steady_clock::time_point> flush_deadline() const
+    {
+        if (pending_ == 0) return std::nullopt;
+        return pending_since_ + options_.sync_interval_;
+    }
+
+    /**
+     * @brief number of records not consumed yet, walks all of them
+     */
+    size_t count();
+
+    /**
+     * @brief bytes held by live segments
+     */
+    size_t size_bytes() const { return live_.size() * options_.segment_size_; }
+
+private:
+    struct position
+    {
+        uint32_t seq_{ 0 };
+        uint32_t off_{ 0 };
+
+        int64_t id() const { return static_cast<int64_t>(seq_) << 32 | off_; }
+    };
+
+    std::string segment_path(uint32_t seq) const;
+
+    std::string spare_path(uint32_t seq) const;
+
+    /**
+     * @brief the mapping of seq, the read mapping is replaced if needed
+     */
+    const segment & map(uint32_t seq);
+
+    /**
+     * @brief length of the valid record at off, 0 if there is none
+     */
+    static size_t valid_record(const segment & seg, size_t off);
+
+    /**
+     * @brief pos itself if a record is there, else the start of the next segment
+     *
+     * @return false at the end of the data
+     */
+    bool seek(position & pos);
+
+    void roll();
+
+    void save_cursor();
+
+    void load_cursor();
+
+private:
+    std::string             dir_;
+    options                 options_;
+    unique_fd               cursor_fd_{ };
+    std::deque<uint32_t>    live_{ };        ///< segments not consumed yet, in order
+    std::vector<std::string> spares_{ };     ///< consumed segment files ready for reuse
+    segment                 write_{ };       ///< the segment appended to
+    size_t                  write_off_{ 0 };
+    size_t                  synced_off_{ 0 };  ///< write_ is synced up to here
+    size_t                  pending_{ 0 };     ///< appends since the last sync
+    std::chrono::steady_clock::time_point pending_since_{ };
+    segment                 read_{ };        ///< the segment read by select, unless it is write_
+    position                cursor_{ };      ///< next record to upload
+    int64_t                 scan_id_{ -1 };  ///< last id returned by select
+    position                scan_next_{ };   ///< the record after scan_id_
+};
+
+struct spool_storage::runtime_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+/**
+ * @brief bounded lock-free ring for one producer and one consumer
+ *
+ * The consumer copies a slot before claiming it with a CAS on the head, so
+ * the producer may also claim the head to drop the oldest element when the
+ * ring is full. A consumer whose CAS fails just discards its copy. That copy
+ * may overlap the producer rewriting the slot, so slots are made of relaxed
+ * atomic words: a torn copy is possible, a data race is not.
+ */
+template <typename T>
+class spsc_queue
+{
+    static_assert(std::is_trivially_copyable_v<T>, "slots are copied optimistically");
+
+public:
+    /**
+     * @param capacity rounded up to a power of two
+     */
+    explicit spsc_queue(size_t capacity)
+        : capacity_{ round_up(capacity) }
+        , mask_{ capacity_ - 1 }
+        , slots_{ std::make_unique<slot[]>(capacity_) }
+    { }
+
+    spsc_queue(const spsc_queue &) = delete;
+
+    spsc_queue & operator=(const spsc_queue &) = delete;
+
+    /**
+     * @brief producer: append v, fail if the ring is full
+     */
+    bool try_push(const T & v)
+    {
+        // head_cache_ lags behind the drops of push_overwrite, so it may
+        // claim more than a full ring
+        auto const tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ >= capacity_)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == capacity_) return false;
+        }
+
+        publish(tail, v);
+        return true;
+    }
+
+    /**
+     * @brief producer: append v, drop the oldest element if the ring is full
+     *
+     * @return true if an element was dropped
+     */
+    bool push_overwrite(const T & v)
+    {
+        auto const tail = tail_.load(std::memory_order_relaxed);
+        auto head = head_.load(std::memory_order_acquire);
+
+        // a failed CAS means the consumer took the oldest element meanwhile
+        auto const dropped = tail - head == capacity_ &&
+            head_.compare_exchange_strong(head, head + 1, std::memory_order_acq_rel);
+
+        publish(tail, v);
+        return dropped;
+    }
+
+    /**
+     * @brief consumer: take the oldest element
+     */
+    bool try_pop(T & v)
+    {
+        auto head = head_.load(std::memory_order_acquire);
+        for (;;)
+        {
+            if (head == tail_.load(std::memory_order_acquire)) return false;
+
+            slots_[head & mask_].load(v);
+            if (head_.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel))
+                return true;
+        }
+    }
+
+    size_t size() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return capacity_; }
+
+    /**
+     * @brief the largest size ever observed by the producer
+     */
+    size_t high_water() const { return high_water_.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * @brief a T stored as relaxed atomic words
+     */
+    struct slot
+    {
+        static constexpr size_t words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        void store(const T & v)
+        {
+            uint64_t tmp[words]{ };
+            memcpy(tmp, &v, sizeof v);
+            for (size_t i = 0; i < words; ++i) words_[i].store(tmp[i], std::memory_order_relaxed);
+        }
+
+        void load(T & v) const
+        {
+            uint64_t tmp[words];
+            for (size_t i = 0; i < words; ++i) tmp[i] = words_[i].load(std::memory_order_relaxed);
+            memcpy(&v, tmp, sizeof v);
+        }
+
+        std::atomic<uint64_t> words_[words]{ };
+    };
+
+    void publish(size_t tail, const T & v)
+    {
+        slots_[tail & mask_].store(v);
+        tail_.store(tail + 1, std::memory_order_release);
+
+        auto const depth = tail + 1 - head_.load(std::memory_order_relaxed);
+        if (depth > high_water_.load(std::memory_order_relaxed))
+            high_water_.store(depth, std::memory_order_relaxed);
+    }
+
+    static size_t round_up(size_t n)
+    {
+        size_t r = 1;
+        while (r < n) r <<= 1;
+        return r;
+    }
+
+private:
+    static constexpr size_t cache_line = 64;
+
+    size_t const               capacity_;
+    size_t const               mask_;
+    std::unique_ptr<slot[]> const slots_;
+
+    alignas(cache_line) std::atomic<size_t> head_{ 0 }; ///< next slot to pop
+    alignas(cache_line) std::atomic<size_t> tail_{ 0 }; ///< next slot to push
+    size_t                                  head_cache_{ 0 }; ///< producer's view of head_
+    std::atomic<size_t>                     high_water_{ 0 };
+};
@@ -1,4 +1,7 @@
+#include <sys/stat.h>
+
 #include <cassert>
+#include <cstring>
 
 #include <stdexcept>
 
@@ -6,6 +9,8 @@
 #include <iostream>
 #endif
 
+#include "metrics.h"
+#include "series.h"
 #include "sqlite_storage.h"
 
 #ifndef likely
@@ -17,91 +22,313 @@
 #endif
 
 sqlite_storage::sqlite_storage(const char * path)
+    : sqlite_storage{ path, options{ } }
+{ }
+
+sqlite_storage::sqlite_storage(const char * path, options opt)
+    : options_{ std::move(opt) }
 {
     assert(path);
 
+    auto const & sync = options_.synchronous_;
+    if (sync != "OFF" && sync != "NORMAL" && sync != "FULL" && sync != "EXTRA")
+        throw std::invalid_argument{ "invalid synchronous: " + sync };
+
     sqlite3 * handle{ nullptr };
     if (sqlite3_open(path, &handle) != SQLITE_OK)
     {
         sqlite3_close(handle);
         throw runtime_error{ "Cannot initialize SQLite" };
     }
+    db_.reset(handle);
+    sqlite3_busy_timeout(handle, static_cast<int>(options_.busy_timeout_.count()));
+
+    // WAL turns every commit into a sequential append instead of a journal rewrite
+    exec("pragma journal_mode=WAL");
+    exec(("pragma synchronous=" + sync).c_str());
 
     auto const sql =
         "create table if not exists tb_therm("
             "id    integer  primary key autoincrement,"
             "name  text(64) not null,"
             "therm integer  not null,"
-            "time  integer  not null"
+            "time  integer  not null,"
+            "series integer not null default 0"
         ")";
+    exec(sql);
 
-    char * errmsg{ nullptr };
-    auto const err = sqlite3_exec(handle, sql, nullptr, nullptr, &errmsg);
-    if (err != SQLITE_OK)
-    {
-        sqlite3_close(handle);
-        throw runtime_error{ "Cannot create SQLite table" };
-    }
+    // databases created before rollups have no series, all their rows are raw
+    auto const has_series = prepare("select count(*) from pragma_table_info('tb_therm') where name = 'series'");
+    if (scalar(has_series.get(), "Cannot inspect tb_therm") == 0)
+        exec("alter table tb_therm add column series integer not null default 0");
 
-    db_.reset(handle);
+    insert_stmt_ = prepare("insert into tb_therm (name,therm,time,series) values (?,?,?,?)");
+    select_stmt_ = prepare("select id,name,therm,time,series from tb_therm where id > ? order by id limit ?");
+    delete_stmt_ = prepare("delete from tb_therm where id <= ?");
+    count_stmt_ = prepare("select count(*) from tb_therm");
+    size_stmt_ = prepare("select (page_count - freelist_count) * page_size "
+                         "from pragma_page_count(), pragma_freelist_count(), pragma_page_size()");
+    oldest_raw_stmt_ = prepare("select id,time from tb_therm where id >= ? and series = 0 order by id limit 1");
+    newest_time_stmt_ = prepare("select time from tb_therm where series = 0 order by id desc limit 1");
+
+    // aggregates of an earlier step on the same window are found by their time, raw rows never are
+    exec("create index if not exists tb_therm_aggregate on tb_therm(time) where series != 0");
+
+    // ?1-?2 bound the ids looked at, ?3-?4 the window, ?5-?8 the series of min, max, mean & count;
+    // a window split over steps folds its earlier aggregates in, influxdb keeps one point per window
+    auto const window_rows = " from tb_therm where id >= ?1 and id < ?2 and series = 0 and time >= ?3 and time < ?4";
+    auto const aggregates = " from tb_therm where time = ?3 and series != 0 and series in (?5,?6,?7,?8)";
+    compact_insert_stmt_ = prepare((std::string{ "with parts as (" }
+        + "select name,min(therm) lo,max(therm) hi,sum(therm) total,count(*) n" + window_rows + " group by name"
+        + " union all select name,"
+          "min(case series when ?5 then therm end),max(case series when ?6 then therm end),"
+          "sum(case series when ?7 then therm end) * sum(case series when ?8 then therm end),"
+          "sum(case series when ?8 then therm end)" + aggregates + " group by name), "
+        "w as (select name,min(lo) lo,max(hi) hi,sum(total) / cast(sum(n) as real) mean,sum(n) n from parts group by name) "
+        "insert into tb_therm (name,therm,time,series) "
+        "select name,lo,?3,?5 from w union all select name,hi,?3,?6 from w union all "
+        "select name,mean,?3,?7 from w union all select name,n,?3,?8 from w").c_str());
+    // ?9 is the last id before the insert, the folded aggregates are older
+    compact_fold_stmt_ = prepare((std::string{ "delete" } + aggregates + " and id <= ?9").c_str());
+    compact_delete_stmt_ = prepare((std::string{ "delete" } + window_rows).c_str());
+    last_id_stmt_ = prepare("select coalesce(max(id), 0) from tb_therm");
+    checkpoint_stmt_ = prepare("pragma wal_checkpoint(TRUNCATE)");
+    begin_stmt_ = prepare("begin");
+    commit_stmt_ = prepare("commit");
 }
 
 sqlite_storage::~sqlite_storage()
 {
-    sqlite3_close(db_.release());
+    if (!db_) return;
+
+    try
+    {
+        flush();
+    }
+    catch (runtime_error const &)
+    {
+        // nothing can be done here, the open transaction is rolled back by close
+    }
 }
 
-void sqlite_storage::insert(const char * name, const double value, time_t now)
+sqlite_storage::stmt_ptr sqlite_storage::prepare(const char * sql) const
 {
-    char sql[256];
-    auto const len = snprintf(sql, sizeof sql,
-        "insert into tb_therm (name,therm,time) values ('%s',%f,%lu)", name, value, now);
-    assert(len > 0 && static_cast<size_t>(len) < sizeof sql);
-    (void)len;
+    sqlite3_stmt * stmt{ nullptr };
+    if (sqlite3_prepare_v3(db_.get(), sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK)
+        throw runtime_error{ "Cannot prepare statement: " + std::string{ sqlite3_errmsg(db_.get()) } };
+    return stmt_ptr{ stmt };
+}
 
-    char * errmsg;
+void sqlite_storage::exec(const char * sql) const
+{
+    char * errmsg{ nullptr };
     auto const err = sqlite3_exec(db_.get(), sql, nullptr, nullptr, &errmsg);
     if unlikely(err != SQLITE_OK)
     {
-        throw runtime_error{ "Cannot insert record: " + std::string{ errmsg } };
+        std::string msg{ errmsg ? errmsg : sqlite3_errstr(err) };
         sqlite3_free(errmsg);
+        throw runtime_error{ "Cannot execute \"" + std::string{ sql } + "\": " + msg };
     }
-    else
+}
+
+void sqlite_storage::step_done(sqlite3_stmt * stmt, const char * what)
+{
+    auto const err = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if unlikely(err != SQLITE_DONE)
     {
-#ifdef _DEBUG_
-        std::cerr << "new record: " << name << ',' << value << ',' << now << std::endl;
-#endif
+        std::string msg{ std::string{ what } + ": " + sqlite3_errmsg(db_.get()) };
+        if (sync_transaction())
+            msg += ", the open transaction was rolled back";
+        throw runtime_error{ msg };
     }
 }
 
-void sqlite_storage::select(size_t count, int (*callback)(void*,int,char**,char**), void * user)
+bool sqlite_storage::sync_transaction()
 {
-    char sql[256];
-    auto const len = snprintf(sql, sizeof sql, "select * from tb_therm limit %zu", count);
-    assert(len > 0 && static_cast<size_t>(len) < sizeof sql);
-    (void)len;
+    // SQLITE_FULL, SQLITE_IOERR and friends roll the transaction back by themselves
+    if (!in_transaction_ || !sqlite3_get_autocommit(db_.get())) return false;
 
-    char * errmsg;
-    auto const err = sqlite3_exec(db_.get(), sql, callback, user, &errmsg);
-    if unlikely(err != SQLITE_OK)
+    in_transaction_ = false;
+    pending_ = 0;
+    return true;
+}
+
+void sqlite_storage::begin()
+{
+    sync_transaction();
+    if (in_transaction_) return;
+
+    step_done(begin_stmt_.get(), "Cannot begin transaction");
+    in_transaction_ = true;
+    transaction_begin_ = std::chrono::steady_clock::now();
+}
+
+void sqlite_storage::flush()
+{
+    sync_transaction();
+    if (!in_transaction_) return;
+
+    timed(global_metrics().backlog_commit_, [&] { step_done(commit_stmt_.get(), "Cannot commit transaction"); });
+    in_transaction_ = false;
+    pending_ = 0;
+}
+
+void sqlite_storage::flush_if_due()
+{
+    if (in_transaction_ &&
+        std::chrono::steady_clock::now() - transaction_begin_ >= options_.commit_interval_)
     {
-        throw runtime_error{ "Cannot select records: " + std::string{ errmsg } };
-        sqlite3_free(errmsg);
+        flush();
     }
 }
 
-void sqlite_storage::delete_where_id_not_greater_than(size_t id)
+void sqlite_storage::insert(const char * name, const double value, time_t now, uint32_t series)
 {
-    char sql[256];
-    auto const len = snprintf(sql, sizeof sql, "delete from tb_therm where id <= %zu", id);
-    assert(len > 0 && static_cast<size_t>(len) < sizeof sql);
-    (void)len;
+    begin();
 
-    char * errmsg;
-    auto const err = sqlite3_exec(db_.get(), sql, nullptr, nullptr, &errmsg);
-    if unlikely(err != SQLITE_OK)
+    auto const stmt = insert_stmt_.get();
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, 2, value);
+    sqlite3_bind_int64(stmt, 3, now);
+    sqlite3_bind_int64(stmt, 4, series);
+    timed(global_metrics().backlog_insert_, [&] { step_done(stmt, "Cannot insert record"); });
+    sqlite3_clear_bindings(stmt);
+
+#ifdef _DEBUG_
+    std::cerr << "new record: " << name << ',' << value << ',' << now << ',' << series << std::endl;
+#endif
+
+    if (++pending_ >= options_.commit_count_)
+        flush();
+    else
+        flush_if_due();
+}
+
+size_t sqlite_storage::select(int64_t after_id, size_t count, std::vector<record> & rows)
+{
+    auto const stmt = select_stmt_.get();
+    sqlite3_bind_int64(stmt, 1, after_id);
+    sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(count));
+
+    size_t n = 0;
+    int err;
+    while ((err = sqlite3_step(stmt)) == SQLITE_ROW)
     {
-        throw runtime_error{ "Cannot delete records: " + std::string{ errmsg } };
-        sqlite3_free(errmsg);
+        // reuse the strings already held by rows
+        if (rows.size() <= n) rows.emplace_back();
+        auto & row = rows[n++];
+        row.id_ = sqlite3_column_int64(stmt, 0);
+        row.name_.assign(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)),
+                         static_cast<size_t>(sqlite3_column_bytes(stmt, 1)));
+        row.value_ = sqlite3_column_double(stmt, 2);
+        row.time_ = static_cast<time_t>(sqlite3_column_int64(stmt, 3));
+        row.series_ = static_cast<uint32_t>(sqlite3_column_int64(stmt, 4));
     }
+
+    sqlite3_reset(stmt);
+    if unlikely(err != SQLITE_DONE)
+        throw runtime_error{ "Cannot select records: " + std::string{ sqlite3_errmsg(db_.get()) } };
+
+    rows.resize(n);
+    return n;
+}
+
+void sqlite_storage::delete_where_id_not_greater_than(int64_t id)
+{
+    auto const stmt = delete_stmt_.get();
+    sqlite3_bind_int64(stmt, 1, id);
+    step_done(stmt, "Cannot delete records");
+
+    // uploaded rows must not come back after a crash
+    flush();
+}
+
+size_t sqlite_storage::count()
+{
+    return static_cast<size_t>(scalar(count_stmt_.get(), "Cannot count records"));
+}
+
+size_t sqlite_storage::size_bytes()
+{
+    // the log holds the last commits until a checkpoint copies them back
+    struct stat st{ };
+    auto const wal = sqlite3_filename_wal(sqlite3_db_filename(db_.get(), "main"));
+    auto const log = wal != nullptr && ::stat(wal, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+    return static_cast<size_t>(scalar(size_stmt_.get(), "Cannot size the database")) + log;
+}
+
+sqlite_storage::compaction sqlite_storage::compact(uint32_t window, size_t rows)
+{
+    assert(window != 0 && rows != 0);
+
+    auto const oldest = oldest_raw_stmt_.get();
+    sqlite3_bind_int64(oldest, 1, raw_from_);
+    auto const err = sqlite3_step(oldest);
+    auto const first_id = err == SQLITE_ROW ? sqlite3_column_int64(oldest, 0) : 0;
+    auto const first_time = err == SQLITE_ROW ? sqlite3_column_int64(oldest, 1) : 0;
+    sqlite3_reset(oldest);
+    if unlikely(err != SQLITE_ROW && err != SQLITE_DONE)
+        throw runtime_error{ "Cannot find raw records: " + std::string{ sqlite3_errmsg(db_.get()) } };
+    if (err == SQLITE_DONE)
+        return { };
+    raw_from_ = first_id;
+
+    // windows aligned on the epoch, like the rollups; the window still filling stays raw,
+    // its later readings would make a second min, max & mean overwriting the first
+    auto const start = first_time - ((first_time % window) + window) % window;
+    if (scalar(newest_time_stmt_.get(), "Cannot find the newest raw record") < start + window)
+        return { };
+    auto const bind = [&](sqlite3_stmt * stmt) {
+        sqlite3_bind_int64(stmt, 1, first_id);
+        sqlite3_bind_int64(stmt, 2, first_id + static_cast<int64_t>(rows));
+        sqlite3_bind_int64(stmt, 3, start);
+        sqlite3_bind_int64(stmt, 4, start + window);
+        sqlite3_bind_int64(stmt, 5, rollup_series(window, rollup_stat::min));
+        sqlite3_bind_int64(stmt, 6, rollup_series(window, rollup_stat::max));
+        sqlite3_bind_int64(stmt, 7, rollup_series(window, rollup_stat::mean));
+        sqlite3_bind_int64(stmt, 8, rollup_series(window, rollup_stat::count));
+    };
+
+    // the group transaction goes first, the step is a transaction of its own
+    flush();
+    begin();
+
+    compaction done;
+    auto const last_id = scalar(last_id_stmt_.get(), "Cannot find the last record");
+    auto const insert = compact_insert_stmt_.get();
+    bind(insert);
+    step_done(insert, "Cannot compact records");
+    auto const added = static_cast<size_t>(sqlite3_changes(db_.get()));
+
+    auto const fold = compact_fold_stmt_.get();
+    bind(fold);
+    sqlite3_bind_int64(fold, 9, last_id);
+    step_done(fold, "Cannot fold compacted records");
+    done.aggregates_ = added - static_cast<size_t>(sqlite3_changes(db_.get()));
+
+    auto const remove = compact_delete_stmt_.get();
+    bind(remove);
+    step_done(remove, "Cannot delete compacted records");
+    done.raw_ = static_cast<size_t>(sqlite3_changes(db_.get()));
+
+    flush();
+    return done;
+}
+
+void sqlite_storage::checkpoint()
+{
+    flush();
+    // the row tells whether a reader held the log back, the next checkpoint tries again
+    scalar(checkpoint_stmt_.get(), "Cannot checkpoint the database");
+}
+
+int64_t sqlite_storage::scalar(sqlite3_stmt * stmt, const char * what)
+{
+    auto const err = sqlite3_step(stmt);
+    auto const value = err == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+    sqlite3_reset(stmt);
+    if unlikely(err != SQLITE_ROW)
+        throw runtime_error{ std::string{ what } + ": " + sqlite3_errmsg(db_.get()) };
+    return value;
 }
@@ -1,25 +1,67 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <ctime>
 #include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <sqlite3.h>
 
+#include "backlog.h"
+
 class sqlite_storage
 {
 public:
     struct runtime_error;
 
+    /**
+     * @brief a row of tb_therm
+     */
+    using record = backlog_record;
+
+    /**
+     * @brief tuning of durability versus SD card writes
+     */
+    struct options
+    {
+        std::string               synchronous_{ "NORMAL" }; ///< OFF, NORMAL, FULL or EXTRA
+        size_t                    commit_count_{ 32 };      ///< commit after this many inserts
+        std::chrono::milliseconds commit_interval_{ 5000 }; ///< or after a transaction is this old
+        std::chrono::milliseconds busy_timeout_{ 1000 };    ///< wait for other connections' locks
+    };
+
+    /**
+     * @brief what a compact() step did
+     */
+    struct compaction
+    {
+        size_t raw_{ 0 };        ///< raw rows removed
+        size_t aggregates_{ 0 }; ///< min, max & mean rows added for them
+    };
+
 private:
     struct deleter
     {
         void operator()(sqlite3 * db) const;
     };
 
+    struct stmt_deleter
+    {
+        void operator()(sqlite3_stmt * stmt) const;
+    };
+
     using sqlite3_ptr = std::unique_ptr<sqlite3, deleter>;
+    using stmt_ptr = std::unique_ptr<sqlite3_stmt, stmt_deleter>;
 
 public:
     explicit sqlite_storage(const char * path);
 
+    sqlite_storage(const char * path, options opt);
+
     sqlite_storage(const sqlite_storage &) = delete;
 
     sqlite_storage(sqlite_storage &&) noexcept = default;
@@ -30,14 +72,113 @@ public:
 
     sqlite_storage & operator=(sqlite_storage &&) noexcept = default;
 
-    void insert(const char * name, double value, time_t now);
+    /**
+     * @brief insert a record in the current group transaction, series 0 is a raw reading
+     */
+    void insert(const char * name, double value, time_t now, uint32_t series = 0);
+
+    /**
+     * @brief select at most count records with id greater than after_id, in id order
+     *
+     * @return number of records stored in rows
+     */
+    size_t select(int64_t after_id, size_t count, std::vector<record> & rows);
+
+    void delete_where_id_not_greater_than(int64_t id);
+
+    /**
+     * @brief number of buffered records, a full scan of the table
+     */
+    size_t count();
+
+    /**
+     * @brief bytes of the pages holding records & of the write-ahead log, free pages left by deletes excluded
+     */
+    size_t size_bytes();
+
+    /**
+     * @brief replace the raw rows of the oldest window holding one by their min, max, mean & count
+     *
+     * The window must be over, i.e. the newest raw row must be past it.
+     * One transaction of its own, looking at most rows rows past the oldest
+     * raw one, so a step takes about as long as a group commit. A window
+     * holding more raw rows takes several steps, each folding the
+     * aggregates of the last one in, so the window ends with one min, max,
+     * mean & count per sensor. The aggregates are rollup series of window
+     * seconds, appended at the end.
+     *
+     * @return nothing removed once no raw row is left
+     */
+    compaction compact(uint32_t window, size_t rows);
+
+    /**
+     * @brief commit, copy the write-ahead log into the database & truncate it
+     *
+     * Best effort, a reader on another connection keeps the log as it is.
+     */
+    void checkpoint();
+
+    /**
+     * @brief commit the group transaction if it is old enough
+     */
+    void flush_if_due();
+
+    /**
+     * @brief commit the group transaction now
+     */
+    void flush();
+
+    /**
+     * @brief when flush_if_due will commit, nothing without an open transaction
+     */
+    std::optional<std::chrono::steady_clock::time_point> flush_deadline() const
+    {
+        if (!in_transaction_) return std::nullopt;
+        return transaction_begin_ + options_.commit_interval_;
+    }
+
+private:
+    stmt_ptr prepare(const char * sql) const;
+
+    void exec(const char * sql) const;
+
+    void step_done(sqlite3_stmt * stmt, const char * what);
+
+    /**
+     * @brief the single value a statement selects
+     */
+    int64_t scalar(sqlite3_stmt * stmt, const char * what);
 
-    void select(size_t count, int (*callback)(void*,int,char**,char**), void * user);
+    /**
+     * @brief forget the open transaction if sqlite rolled it back on an error
+     *
+     * @return true if it was rolled back
+     */
+    bool sync_transaction();
 
-    void delete_where_id_not_greater_than(size_t id);
+    void begin();
 
 private:
     sqlite3_ptr db_{ };
+    stmt_ptr    insert_stmt_{ };
+    stmt_ptr    select_stmt_{ };
+    stmt_ptr    delete_stmt_{ };
+    stmt_ptr    count_stmt_{ };
+    stmt_ptr    size_stmt_{ };
+    stmt_ptr    oldest_raw_stmt_{ };
+    stmt_ptr    newest_time_stmt_{ };
+    stmt_ptr    compact_insert_stmt_{ };
+    stmt_ptr    compact_fold_stmt_{ };
+    stmt_ptr    compact_delete_stmt_{ };
+    stmt_ptr    last_id_stmt_{ };
+    stmt_ptr    checkpoint_stmt_{ };
+    stmt_ptr    begin_stmt_{ };
+    stmt_ptr    commit_stmt_{ };
+    options     options_{ };
+    size_t      pending_{ 0 };         ///< inserts in the open transaction
+    bool        in_transaction_{ false };
+    int64_t     raw_from_{ 0 };        ///< no raw row before this id, compact() looks from here
+    std::chrono::steady_clock::time_point transaction_begin_{ };
 };
 
 struct sqlite_storage::runtime_error : std::runtime_error
@@ -47,5 +188,11 @@ struct sqlite_storage::runtime_error : std::runtime_error
 
 inline void sqlite_storage::deleter::operator()(sqlite3 * db) const
 {
-    sqlite3_close(db);
-}
\ No newline at end of file
+    // close_v2 defers the close until the last statement is finalized
+    sqlite3_close_v2(db);
+}
+
+inline void sqlite_storage::stmt_deleter::operator()(sqlite3_stmt * stmt) const
+{
+    sqlite3_finalize(stmt);
+}
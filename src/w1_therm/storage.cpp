@@ -0,0 +1,388 @@
+#include <poll.h>
+#include <syslog.h>
+
+#include <cerrno>
+#include <cstddef>
+
+#include <algorithm>
+#include <exception>
+#include <string>
+#include <utility>
+
+#include "storage.h"
+
+namespace
+{
+
+/**
+ * @brief run f, logging the storage errors instead of letting them reach the event loop
+ */
+template <typename F>
+void log_errors(F && f)
+{
+    try
+    {
+        f();
+    }
+    catch (influx_storage::runtime_error const & e)
+    {
+        syslog(LOG_USER | LOG_ERR, "influx error: %s\n", e.what());
+    }
+    catch (sqlite_storage::runtime_error const & e)
+    {
+        syslog(LOG_USER | LOG_ERR, "sqlite error: %s\n", e.what());
+    }
+    catch (spool_storage::runtime_error const & e)
+    {
+        syslog(LOG_USER | LOG_ERR, "spool error: %s\n", e.what());
+    }
+    catch (block_storage::runtime_error const & e)
+    {
+        syslog(LOG_USER | LOG_ERR, "block error: %s\n", e.what());
+    }
+    catch (std::exception const & e)
+    {
+        syslog(LOG_USER | LOG_ERR, "Unknown error: %s\n", e.what());
+    }
+}
+
+} // namespace
+
+void storage_t::insert(const char * name, double value, time_t now, uint32_t series)
+{
+    log_errors([&] {
+        if (!backlogged_ && influx_.allows_request())
+        {
+            live_.push_back(make_sample(name, value, now, series));
+            post_live();
+            return;
+        }
+
+        // the live points are older than this one, they go first
+        spill_live();
+        backlogged_ = true;
+        backlog([&](auto & b) { b.insert(name, value, now, series); });
+        buffered(1);
+        drain();
+    });
+}
+
+void storage_t::post_live()
+{
+    while (!live_.empty() && influx_.allows_request())
+    {
+        auto const req = influx_.acquire_write();
+        if (req == nullptr)
+        {
+            // every write is in flight, the points go with the next free one
+            break;
+        }
+
+        if (pending_.size() <= req->index())
+            pending_.resize(req->index() + 1);
+        auto & p = pending_[req->index()];
+        p.batch_ = false;
+        p.points_.clear();
+
+        try
+        {
+            auto & body = req->body();
+            for (auto const & s : live_)
+            {
+                if (body.size() >= budget_.bytes()) break;
+                influx_.prepare_data(body, s.name_, s.value_, s.time_, s.series_);
+                p.points_.push_back(s);
+            }
+
+            // points encoding to nothing, e.g. NaN, are not posted
+            if (!body.empty())
+                influx_.submit(*req);
+        }
+        catch (influx_storage::runtime_error const & e)
+        {
+            // keep the points in the backlog instead of losing them
+            syslog(LOG_USER | LOG_ERR, "influx error: %s\n", e.what());
+            spill_live();
+            return;
+        }
+        live_.erase(live_.begin(), live_.begin() + static_cast<ptrdiff_t>(p.points_.size()));
+    }
+
+    if (live_.size() >= live_points)
+        spill_live();
+}
+
+void storage_t::spill_live()
+{
+    if (live_.empty()) return;
+
+    backlogged_ = true;
+    backlog([&](auto & b)
+    {
+        for (auto const & s : live_)
+            b.insert(s.name_, s.value_, s.time_, s.series_);
+    });
+    buffered(static_cast<int64_t>(live_.size()));
+    live_.clear();
+}
+
+void storage_t::on_ready()
+{
+    log_errors([&] {
+        influx_.poll([this](auto & req) { log_errors([&] { complete(req); }); });
+        post_live();
+        if (draining_)
+            drain();
+    });
+}
+
+void storage_t::drain()
+{
+    // the breaker in influx_storage decides how often the server is probed
+    while (backlogged_ && influx_.allows_request())
+    {
+        if (!draining_)
+        {
+            // a window cut short by a failure settles before the backlog is read from its start again
+            if (!window_.empty())
+            {
+                return;
+            }
+
+            // never hold the sqlite write lock over a request, the sampler may spill
+            backlog([](auto & b) { b.flush(); });
+
+            if (!influx_.is_bucket_exists())
+            {
+                return;
+            }
+            drain_id_ = 0;
+            draining_ = true;
+        }
+
+        auto const req = influx_.acquire_write();
+        if (req == nullptr)
+        {
+            // the window is full, the drain continues on a completion
+            return;
+        }
+
+        // fill the batch up to the byte budget, a page of rows at a time
+        auto & body = req->body();
+        int64_t batch_id = drain_id_;
+        size_t batch_rows = 0;
+        auto const select = [&](auto & b) { return b.select(batch_id, 64, rows_); };
+        while (body.size() < budget_.bytes() && backlog(select) != 0)
+        {
+            for (auto const & row : rows_)
+            {
+                influx_.prepare_data(body, row.name_.c_str(), row.value_, row.time_, row.series_);
+                batch_id = row.id_;
+                ++batch_rows;
+                if (body.size() >= budget_.bytes()) break;
+            }
+        }
+
+        if (batch_rows == 0)
+        {
+            // everything is posted, a batch still in flight buffers itself again if it fails
+            draining_ = false;
+            backlogged_ = false;
+            return;
+        }
+        drain_id_ = batch_id;
+        window_.push_back({ ++window_seq_, batch_id, batch_rows, false, false });
+
+        // rows encoding to nothing, e.g. NaN, are acknowledged right away
+        if (body.empty())
+        {
+            window_.back().done_ = true;
+            settle();
+            continue;
+        }
+
+        if (pending_.size() <= req->index())
+            pending_.resize(req->index() + 1);
+        pending_[req->index()] = { true, window_seq_, { } };
+        influx_.submit(*req);
+    }
+}
+
+void storage_t::complete(influx_storage::write_request & req)
+{
+    auto const & p = pending_[req.index()];
+    if (!p.batch_)
+    {
+        switch (req.status())
+        {
+        case influx_storage::write_status::ok:
+            global_metrics().points_uploaded_.add(p.points_.size());
+            break;
+        case influx_storage::write_status::rejected:
+            // the server will never take these points, buffering them only blocks the backlog
+            syslog(LOG_USER | LOG_ERR, "influx rejected %zu points from %s on, dropping them: %s\n",
+                   p.points_.size(), p.points_.front().name_, req.error().c_str());
+            break;
+        case influx_storage::write_status::failed:
+            // keep the samples in sqlite instead of losing them, the points waiting behind them follow
+            syslog(LOG_USER | LOG_ERR, "influx error: %s\n", req.error().c_str());
+            backlogged_ = true;
+            backlog([&](auto & b)
+            {
+                for (auto const & s : p.points_)
+                    b.insert(s.name_, s.value_, s.time_, s.series_);
+            });
+            buffered(static_cast<int64_t>(p.points_.size()));
+            spill_live();
+            break;
+        }
+        return;
+    }
+
+    auto const entry = std::find_if(window_.begin(), window_.end(), [&](auto const & e) { return e.seq_ == p.seq_; });
+    if (entry == window_.end())
+        return;
+    entry->done_ = true;
+
+    switch (req.status())
+    {
+    case influx_storage::write_status::ok:
+        budget_.observe(influx_.last_latency());
+        global_metrics().points_uploaded_.add(entry->rows_);
+        break;
+    case influx_storage::write_status::rejected:
+        // posting the batch again would be rejected again and block the backlog
+        syslog(LOG_USER | LOG_ERR, "influx rejected %zu rows, dropping them: %s\n", entry->rows_, req.error().c_str());
+        break;
+    case influx_storage::write_status::failed:
+        // a batch timing out on a slow uplink would time out again at the same size
+        if (req.transport_failed())
+            budget_.shrink();
+        syslog(LOG_USER | LOG_ERR, "influx error: %s\n", req.error().c_str());
+
+        // the rows stay, the next insert restarts the drain once the window settled & the breaker allows
+        entry->failed_ = true;
+        draining_ = false;
+        backlogged_ = true;
+        break;
+    }
+    settle();
+}
+
+void storage_t::settle()
+{
+    // one delete covers every batch answered in a row, deleting again is harmless
+    int64_t last_id = -1;
+    size_t rows = 0;
+    while (!window_.empty() && window_.front().done_)
+    {
+        auto const & e = window_.front();
+        window_failed_ = window_failed_ || e.failed_;
+        if (!window_failed_)
+        {
+            last_id = e.last_id_;
+            rows += e.rows_;
+        }
+        window_.pop_front();
+    }
+
+    // the batches after a failure are posted again with it, influxdb overwrites the same points
+    if (window_.empty())
+        window_failed_ = false;
+
+    if (last_id >= 0)
+    {
+        backlog([&](auto & b) { b.delete_where_id_not_greater_than(last_id); });
+        buffered(-static_cast<int64_t>(rows));
+    }
+}
+
+void storage_t::tick()
+{
+    log_errors([&] {
+        backlog([](auto & b) { b.flush_if_due(); });
+        if (backlog_resized_ || shrinking_)
+        {
+            auto bytes = backlog([](auto & b) { return b.size_bytes(); });
+
+            // the write-ahead log keeps its size after a checkpoint, only a truncating one gives it back
+            if (limits_.max_bytes_ != 0 && bytes >= limits_.max_bytes_)
+                bytes = backlog([](auto & b)
+                {
+                    if constexpr (requires { b.checkpoint(); })
+                        b.checkpoint();
+                    return b.size_bytes();
+                });
+            global_metrics().backlog_bytes_.set(static_cast<int64_t>(bytes));
+            backlog_resized_ = false;
+
+            // a failing step stops here, the next resize tries again
+            auto const was_shrinking = std::exchange(shrinking_, false);
+            shrinking_ = limits_.max_bytes_ != 0 && shrink(bytes, was_shrinking);
+        }
+    });
+}
+
+bool storage_t::shrink(size_t bytes, bool was_shrinking)
+{
+    if (bytes < limits_.max_bytes_ / 100 * limits_.high_water_percent_)
+    {
+        if (was_shrinking)
+            syslog(LOG_USER | LOG_INFO, "backlog back under its high water, %zu bytes\n", bytes);
+        return false;
+    }
+    if (!was_shrinking)
+        syslog(LOG_USER | LOG_WARNING, "backlog over its high water, %zu of %zu bytes, compacting\n",
+               bytes, limits_.max_bytes_);
+
+    // the oldest raw readings first, they become a few rows per window
+    auto const compacted = backlog([&](auto & b)
+    {
+        if constexpr (requires { b.compact(limits_.compact_window_, compact_rows); })
+            return b.compact(limits_.compact_window_, compact_rows);
+        else
+            return sqlite_storage::compaction{ };
+    });
+    if (compacted.raw_ != 0)
+    {
+        global_metrics().backlog_compacted_.add(compacted.raw_);
+        buffered(static_cast<int64_t>(compacted.aggregates_) - static_cast<int64_t>(compacted.raw_));
+        return true;
+    }
+
+    // the last resort, once the budget is spent & nothing is left to compact
+    if (bytes < limits_.max_bytes_)
+        return false;
+
+    auto const dropped = backlog([&](auto & b)
+    {
+        if (b.select(0, drop_rows, rows_) == 0) return size_t{ 0 };
+        b.delete_where_id_not_greater_than(rows_.back().id_);
+        return rows_.size();
+    });
+    if (dropped == 0)
+        return false;
+
+    syslog(LOG_USER | LOG_WARNING, "backlog full, dropped its %zu oldest rows\n", dropped);
+    global_metrics().backlog_evicted_.add(dropped);
+    buffered(-static_cast<int64_t>(dropped));
+    return true;
+}
+
+void storage_t::flush()
+{
+    log_errors([&] {
+        // a write in flight may still fail and land in the backlog, the live points go as writes free up
+        post_live();
+        while (influx_.in_flight() != 0)
+        {
+            pollfd pfd{ influx_.fd(), POLLIN, 0 };
+            if (::poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                break;
+            influx_.poll([this](auto & req) { log_errors([&] { complete(req); }); });
+            post_live();
+        }
+        spill_live();
+        backlog([](auto & b) { b.flush(); });
+    });
+}
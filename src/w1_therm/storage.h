@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <optional>
+#include <variant>
+#include <vector>
+
+#include "influx_storage.h"
+#include "line_protocol.h"
+#include "metrics.h"
+#include "block_storage.h"
+#include "sample.h"
+#include "sink.h"
+#include "spool_storage.h"
+#include "sqlite_storage.h"
+
+/**
+ * @brief bounds of the backlog batches posted to influxdb
+ */
+struct batch_options
+{
+    size_t                    min_bytes_{ 4096 };         ///< smallest batch, in line protocol bytes
+    size_t                    max_bytes_{ 1 << 20 };      ///< largest batch, in line protocol bytes
+    std::chrono::milliseconds target_latency_{ 1000 };    ///< grow while posts are faster than this
+};
+
+/**
+ * @brief bound of the backlog on disk
+ *
+ * Past high_water_percent_ of max_bytes_ the oldest raw readings are
+ * compacted into their min, max & mean over compact_window_ seconds, a
+ * window per step; only a full backlog with nothing raw left loses its
+ * oldest rows. Compaction needs the sqlite rows, the spool log & the blocks
+ * only lose their oldest rows.
+ */
+struct backlog_limits
+{
+    size_t   max_bytes_{ 0 };             ///< 0 leaves the backlog unbounded
+    size_t   high_water_percent_{ 80 };   ///< compaction starts past this share of max_bytes_
+    uint32_t compact_window_{ 900 };      ///< seconds of raw readings a compacted row stands for
+};
+
+/**
+ * @brief byte budget of the next backlog batch, adapting to server latency
+ *
+ * The budget doubles while posts take less than half the target latency and
+ * halves when they take longer than the target or time out.
+ */
+class batch_budget
+{
+public:
+    explicit batch_budget(const batch_options & opt)
+        : options_{ opt }
+        , bytes_{ std::clamp<size_t>(64 << 10, opt.min_bytes_, opt.max_bytes_) }
+    { }
+
+    size_t bytes() const { return bytes_; }
+
+    void observe(std::chrono::microseconds latency)
+    {
+        if (latency * 2 < options_.target_latency_)
+            bytes_ = std::min(bytes_ * 2, options_.max_bytes_);
+        else if (latency > options_.target_latency_)
+            bytes_ = std::max(bytes_ / 2, options_.min_bytes_);
+    }
+
+    /**
+     * @brief a post failed without an answer, e.g. timed out, try a smaller batch
+     */
+    void shrink() { bytes_ = std::max(bytes_ / 2, options_.min_bytes_); }
+
+private:
+    batch_options options_;
+    size_t        bytes_;
+};
+
+/**
+ * @brief the offline buffer: sqlite rows, the spool log or compressed blocks in sqlite
+ */
+using backlog_storage = std::variant<sqlite_storage, spool_storage, block_storage>;
+
+/**
+ * @brief the influxdb sink: writes to influxdb, buffers in the backlog while it is unreachable
+ *
+ * Writes are posted without waiting, nest fd() in the caller's event_loop and
+ * call on_ready() when it is readable to complete them and drain the backlog.
+ */
+struct storage_t : sink
+{
+    static constexpr size_t compact_rows = 4096;   ///< rows a compaction step looks at
+    static constexpr size_t drop_rows = 1024;      ///< oldest rows dropped per step, as a last resort
+    static constexpr std::chrono::milliseconds shrink_pause{ 10 }; ///< between two steps
+    static constexpr size_t live_points = 65536;   ///< points waiting for a write, about 5 MB, the backlog takes the rest
+
+
+    storage_t(backlog_storage && backlog, influx_storage && influx, const batch_options & batch = { },
+              const backlog_limits & limits = { })
+        : backlog_{ std::move(backlog) }
+        , influx_{ std::move(influx) }
+        , budget_{ batch }
+        , limits_{ limits }
+    {
+        global_metrics().backlog_max_bytes_.set(static_cast<int64_t>(limits_.max_bytes_));
+        auto const rows = std::visit([](auto & b) { return b.count(); }, backlog_);
+        global_metrics().backlog_rows_.set(static_cast<int64_t>(rows));
+        backlogged_ = rows != 0;
+    }
+
+    const char * name() const override { return "influx"; }
+
+    /**
+     * @brief write a value, series 0 is a raw reading, else see rollup_series
+     */
+    void insert(const char * name, double value, time_t now, uint32_t series = 0);
+
+    void write(const sample & s) override { insert(s.name_, s.value_, s.time_, s.series_); }
+
+    /**
+     * @brief readable when a write in flight can progress
+     */
+    int fd() const override { return influx_.fd(); }
+
+    /**
+     * @brief complete the finished writes and post the next backlog batch
+     */
+    void on_ready() override;
+
+    /**
+     * @brief commit or sync the backlog once it is due
+     */
+    void tick() override;
+
+    /**
+     * @brief wait for the writes in flight, then commit or sync the backlog now
+     */
+    void flush() override;
+
+    /**
+     * @brief when tick() has work to do, nothing if the backlog is synced
+     */
+    std::optional<std::chrono::steady_clock::time_point> deadline() override
+    {
+        // the next compaction step once the writes queued meanwhile went through
+        if (shrinking_)
+            return std::chrono::steady_clock::now() + shrink_pause;
+        return std::visit([](auto const & b) { return b.flush_deadline(); }, backlog_);
+    }
+
+    /**
+     * @brief records were written to the backlog behind our back, drain them later
+     */
+    void spilled(size_t n) override
+    {
+        buffered(static_cast<int64_t>(n));
+        backlogged_ = true;
+    }
+
+    /**
+     * @brief points influxdb accepted, see process_metrics::points_uploaded_
+     */
+    uint64_t sent() const override { return global_metrics().points_uploaded_.get(); }
+
+    /**
+     * @brief the backlog may hold rows not posted yet
+     */
+    bool backlogged() const { return backlogged_; }
+
+    /**
+     * @brief account for rows added to the backlog, negative if removed
+     */
+    void buffered(int64_t rows)
+    {
+        global_metrics().backlog_rows_.add(rows);
+        backlog_resized_ = true;
+    }
+
+    /**
+     * @brief call f with the backlog backend in use
+     */
+    template <typename F>
+    decltype(auto) backlog(F && f) { return std::visit(std::forward<F>(f), backlog_); }
+
+    /**
+     * @brief what a write in flight carries, indexed by write_request::index()
+     */
+    struct pending_write
+    {
+        bool                batch_{ false }; ///< a backlog batch, else live points
+        uint64_t            seq_{ 0 };       ///< the batch's window_entry
+        std::vector<sample> points_{ };      ///< the live points, buffered if their write fails
+    };
+
+    /**
+     * @brief a backlog batch posted by the drain, in drain order
+     */
+    struct window_entry
+    {
+        uint64_t seq_{ 0 };
+        int64_t  last_id_{ 0 };    ///< last backlog row of the batch
+        size_t   rows_{ 0 };       ///< backlog rows in the batch
+        bool     done_{ false };   ///< answered, its rows go once every batch before is answered
+        bool     failed_{ false }; ///< not written, its rows & the rows after it stay
+    };
+
+    /**
+     * @brief post the live points, a batch per free write up to the byte budget
+     *
+     * Points arriving while every write is in flight wait in live_ and go
+     * together once one completes, so a busy uplink gets fewer, larger
+     * posts; past live_points they join the backlog instead.
+     */
+    void post_live();
+
+    /**
+     * @brief move the live points not posted yet to the backlog, behind its rows
+     */
+    void spill_live();
+
+    /**
+     * @brief post the next backlog batch unless one is in flight or the server is down
+     */
+    void drain();
+
+    /**
+     * @brief settle a finished write: acknowledge the posted batch or buffer the point
+     */
+    void complete(influx_storage::write_request & req);
+
+    /**
+     * @brief one step towards the limits: compact a window, else drop the oldest rows
+     *
+     * @return true if the step did something and the backlog may still be over
+     */
+    bool shrink(size_t bytes, bool was_shrinking);
+
+    /**
+     * @brief delete the rows of the answered batches at the front of the window
+     *
+     * Deletion goes in drain order and never past a batch in flight or a
+     * failed one, so a crash re-sends at most the window, never loses a row.
+     */
+    void settle();
+
+    backlog_storage backlog_;
+    influx_storage influx_;
+    std::vector<backlog_record> rows_{ };         ///< reused by the backlog drain
+    std::vector<pending_write> pending_{ };       ///< context of the writes in flight
+    std::vector<sample> live_{ };                 ///< points waiting for a free write, oldest first, grows with the load
+    std::deque<window_entry> window_{ };          ///< batches posted & not settled, oldest first
+    uint64_t window_seq_{ 0 };                    ///< of the last batch posted
+    bool window_failed_{ false };                 ///< a batch of the window failed, keep the rest
+    int64_t drain_id_{ 0 };                       ///< last backlog row posted by the running drain
+    bool draining_{ false };                      ///< a drain is running, continue it on completion
+    batch_budget budget_;                         ///< size of the next backlog batch
+    bool backlog_resized_{ true };                ///< the backlog bytes gauge is stale
+    backlog_limits limits_;                       ///< bound of the backlog on disk
+    bool shrinking_{ false };                     ///< over the high water, a step at a time
+    bool backlogged_{ false };                    ///< samples join the backlog behind its rows, keeping their order
+};
@@ -0,0 +1,167 @@
+#include <syslog.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "event_loop.h"
+#include "uploader.h"
+
+namespace
+{
+
+int64_t steady_nanos(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+} // namespace
+
+uploader::uploader(sink & target, size_t capacity, overflow_policy policy, const char * spill_path,
+                   rollup_output output, size_t feeds)
+    : sink_{ target }
+    , queue_{ capacity }
+    , policy_{ policy }
+    , output_{ output }
+    , wake_{ make_event_fd() }
+{
+    for (size_t i = 0; i < feeds; ++i)
+        feeds_.push_back(std::make_unique<spsc_queue<queued>>(capacity));
+
+    if (policy_ == overflow_policy::spill)
+    {
+        // never make the sampler wait for the uploader's transaction
+        sqlite_storage::options opt;
+        opt.commit_count_ = 1;
+        opt.busy_timeout_ = std::chrono::milliseconds{ 0 };
+        spill_.emplace(spill_path, std::move(opt));
+    }
+
+    thread_ = std::thread{ [this] { run(); } };
+}
+
+uploader::~uploader()
+{
+    stopping_.store(true, std::memory_order_release);
+    notify_event_fd(wake_.get());
+    thread_.join();
+
+    log_stats();
+}
+
+void uploader::log_stats() const
+{
+    syslog(LOG_USER | LOG_INFO, "%s queue: depth %zu, capacity %zu, high-water %zu, dropped %zu, spilled %zu, written %llu\n",
+           name(), depth(), capacity(), high_water(), dropped(), spilled(),
+           static_cast<unsigned long long>(written()));
+}
+
+void uploader::push(const sample & s, std::chrono::steady_clock::time_point now)
+{
+    if (!rollup_output_takes(output_, s.series_)) return;
+
+    queued const q{ s, steady_nanos(now) };
+
+    if (!queue_.try_push(q))
+    {
+        if (policy_ == overflow_policy::spill && spill(s))
+        {
+            spilled_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (policy_ == overflow_policy::drop_newest)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            if (queue_.push_overwrite(q)) dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    notify_event_fd(wake_.get());
+}
+
+size_t uploader::feed(size_t i, const sample * samples, size_t n, std::chrono::steady_clock::time_point now)
+{
+    auto & ring = *feeds_[i];
+    size_t pushed = 0, queued_n = 0;
+    for (; pushed < n; ++pushed)
+    {
+        // the samples the sink does not take count as pushed
+        if (!rollup_output_takes(output_, samples[pushed].series_)) continue;
+        if (!ring.try_push({ samples[pushed], steady_nanos(now) })) break;
+        ++queued_n;
+    }
+
+    if (queued_n != 0)
+        notify_event_fd(wake_.get());
+    return pushed;
+}
+
+bool uploader::spill(const sample & s)
+{
+    try
+    {
+        spill_->insert(s.name_, s.value_, s.time_, s.series_);
+        return true;
+    }
+    catch (sqlite_storage::runtime_error const & e)
+    {
+        syslog(LOG_USER | LOG_WARNING, "cannot spill, dropping the oldest sample: %s\n", e.what());
+        return false;
+    }
+}
+
+void uploader::run()
+{
+    event_loop loop;
+    auto const timer = make_timer_fd();
+    loop.add(wake_.get(), EPOLLIN, [this](uint32_t) { read_counter(wake_.get()); });
+    loop.add(timer.get(), EPOLLIN, [&timer](uint32_t) { read_counter(timer.get()); });
+    // e.g. writes to influxdb complete here, never blocking the loop
+    if (sink_.fd() >= 0)
+        loop.add(sink_.fd(), EPOLLIN, [this](uint32_t) { sink_.on_ready(); });
+
+    size_t spilled = 0;
+    queued q;
+
+    for (;;)
+    {
+        while (queue_.try_pop(q))
+            write(q);
+        for (auto const & f : feeds_)
+            while (f->try_pop(q))
+                write(q);
+
+        // spilled samples are in sqlite already, let the sink drain them
+        auto const n = spilled_.load(std::memory_order_relaxed);
+        if (n != spilled)
+        {
+            sink_.spilled(n - spilled);
+            spilled = n;
+        }
+
+        sink_.tick();
+
+        // the eventfd is read before the ring, a push after this check wakes us
+        if (stopping_.load(std::memory_order_acquire) && depth() == 0) break;
+
+        // sleep until a push, or until the sink is due
+        std::chrono::nanoseconds delay{ };
+        if (auto const deadline = sink_.deadline())
+            delay = std::max<std::chrono::nanoseconds>(*deadline - std::chrono::steady_clock::now(),
+                                                       std::chrono::nanoseconds{ 1 });
+        arm_timer(timer.get(), delay);
+        loop.run_once(-1);
+    }
+
+    sink_.flush();
+}
+
+void uploader::write(const queued & q)
+{
+    sink_.write(q.sample_);
+    written_.add();
+    lag_.observe(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::nanoseconds{ steady_nanos(std::chrono::steady_clock::now()) - q.pushed_ }));
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+#include "sample.h"
+#include "series.h"
+#include "sink.h"
+#include "spsc_queue.h"
+#include "sqlite_storage.h"
+#include "unique_fd.h"
+
+/**
+ * @brief what the sampler does when the ring of a sink is full
+ */
+enum class overflow_policy
+{
+    spill,       ///< write to sqlite on a connection of its own, drop the oldest if sqlite is busy
+    drop_oldest, ///< drop the oldest sample in the ring
+    drop_newest, ///< drop the sample being pushed, the ring keeps the older ones
+};
+
+/**
+ * @brief moves samples from the sampler thread to one sink on a thread of its own
+ *
+ * A slow or unreachable sink only fills its ring, the sampler never waits
+ * for it. The thread sleeps in epoll until a sample arrives, the sink's fd is
+ * readable or the sink is due for a tick.
+ */
+class uploader
+{
+public:
+    /**
+     * @param spill_path sqlite database used by overflow_policy::spill
+     * @param output     the samples the sink takes, the others never reach its ring
+     * @param feeds      producers besides the sampler, e.g. the gateway's workers, each gets a ring of its own
+     */
+    uploader(sink & target, size_t capacity, overflow_policy policy, const char * spill_path,
+             rollup_output output = rollup_output::both, size_t feeds = 0);
+
+    uploader(const uploader &) = delete;
+
+    /**
+     * @brief drain the ring into the sink and join the thread
+     */
+    ~uploader();
+
+    uploader & operator=(const uploader &) = delete;
+
+    /**
+     * @brief called by the sampler thread only
+     *
+     * @param now when the sample was pushed, the lag is measured from there
+     */
+    void push(const sample & s, std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief called by producer i of the feeds only, pushes what fits in its ring, never drops
+     *
+     * @return samples pushed, from the first
+     */
+    size_t feed(size_t i, const sample * samples, size_t n, std::chrono::steady_clock::time_point now);
+
+    const char * name() const { return sink_.name(); }
+
+    const sink & target() const { return sink_; }
+
+    rollup_output output() const { return output_; }
+
+    /**
+     * @brief samples waiting in the sampler's ring & in the feeds
+     */
+    size_t depth() const
+    {
+        auto n = queue_.size();
+        for (auto const & f : feeds_)
+            n += f->size();
+        return n;
+    }
+
+    size_t high_water() const { return queue_.high_water(); }
+
+    size_t capacity() const { return queue_.capacity(); }
+
+    size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    size_t spilled() const { return spilled_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief samples handed to the sink
+     */
+    uint64_t written() const { return written_.get(); }
+
+    /**
+     * @brief time from push to the sink, per sample
+     */
+    const histogram & lag() const { return lag_; }
+
+    /**
+     * @brief log depth, high-water mark & losses of the ring
+     */
+    void log_stats() const;
+
+private:
+    /**
+     * @brief a sample in the ring, stamped with the steady clock of its push
+     */
+    struct queued
+    {
+        sample  sample_{ };
+        int64_t pushed_{ 0 }; ///< nanoseconds of the steady clock
+    };
+
+    void run();
+
+    void write(const queued & q);
+
+    bool spill(const sample & s);
+
+private:
+    sink &                          sink_;
+    spsc_queue<queued>              queue_;             ///< the sampler's
+    std::vector<std::unique_ptr<spsc_queue<queued>>> feeds_{ }; ///< one per other producer
+    overflow_policy const           policy_;
+    rollup_output const             output_;
+    std::optional<sqlite_storage>   spill_{ };          ///< the sampler's own connection
+    std::atomic<size_t>             dropped_{ 0 };
+    std::atomic<size_t>             spilled_{ 0 };
+    counter                         written_{ };
+    histogram                       lag_{ };
+    std::atomic<bool>               stopping_{ false };
+    unique_fd                       wake_{ };           ///< eventfd written by push and the destructor
+    std::thread                     thread_{ };
+};
+
+/**
+ * @brief hands every sample to the uploader of each sink
+ *
+ * The sinks must outlive the fan-out, its destructor drains the rings into
+ * them. The sampler pushes into a ring per sink without a lock; each other
+ * producer, e.g. a gateway worker, feeds rings of its own, so none of them
+ * ever waits for another.
+ */
+class fanout
+{
+public:
+    /**
+     * @param feeds producers besides the sampler, numbered from 0
+     */
+    explicit fanout(size_t feeds = 0) : feeds_{ feeds } { }
+
+    void add(sink & target, size_t capacity, overflow_policy policy, const char * spill_path = nullptr,
+             rollup_output output = rollup_output::both)
+    {
+        uploaders_.push_back(std::make_unique<uploader>(target, capacity, policy, spill_path, output, feeds_));
+    }
+
+    /**
+     * @brief true if a sink takes raw readings, the sampler need not push them otherwise
+     */
+    bool takes_raw() const
+    {
+        return std::any_of(uploaders_.begin(), uploaders_.end(),
+                           [](auto const & u) { return rollup_output_takes(u->output(), 0); });
+    }
+
+    /**
+     * @brief called by the sampler thread only
+     */
+    void push(const char * name, double value, time_t now, uint32_t series = 0)
+    {
+        auto const s = make_sample(name, value, now, series);
+        auto const pushed = std::chrono::steady_clock::now();
+        for (auto const & u : uploaders_)
+            u->push(s, pushed);
+    }
+
+    /**
+     * @brief called by producer i of the feeds only, waits for room in its rings
+     *
+     * A bulk producer, the gateway, holds back here instead of overflowing
+     * the rings; the sampler never waits.
+     *
+     * @return false if a ring stayed full until the timeout, the samples not in it yet are dropped
+     */
+    bool feed(size_t i, const sample * samples, size_t n, std::chrono::milliseconds timeout)
+    {
+        auto const pushed = std::chrono::steady_clock::now();
+        auto const deadline = pushed + timeout;
+        for (auto const & u : uploaders_)
+        {
+            for (size_t done = 0; (done += u->feed(i, samples + done, n - done, pushed)) < n; )
+            {
+                if (std::chrono::steady_clock::now() >= deadline) return false;
+                std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+            }
+        }
+        return true;
+    }
+
+    const std::vector<std::unique_ptr<uploader>> & uploaders() const { return uploaders_; }
+
+    void log_stats() const
+    {
+        for (auto const & u : uploaders_)
+            u->log_stats();
+    }
+
+private:
+    size_t                                 feeds_;
+    std::vector<std::unique_ptr<uploader>> uploaders_{ };
+};
@@ -0,0 +1,355 @@
+#include <fcntl.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <thread>
+
+#include "w1_bus.h"
+
+w1_bus::w1_bus(std::string root, size_t workers)
+    : root_{ std::move(root) }
+{
+    workers_.reserve(workers);
+    for (size_t i = 0; i < workers; ++i)
+        workers_.emplace_back([this] { worker_run(); });
+}
+
+w1_bus::~w1_bus()
+{
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        stopping_ = true;
+    }
+    start_cond_.notify_all();
+
+    for (auto & worker : workers_)
+        worker.join();
+}
+
+void w1_bus::add(std::string id, std::string name, std::string path)
+{
+    auto const it = std::find_if(sensors_.begin(), sensors_.end(),
+        [&](w1_sensor const & s) { return s.id_ == id; });
+    if (it != sensors_.end())
+    {
+        it->name_ = std::move(name);
+        if (it->path_ != path)
+        {
+            it->reader_ = w1_reader{ path };
+            it->path_ = std::move(path);
+        }
+        return;
+    }
+
+    w1_reader reader{ path };
+    sensors_.push_back({ std::move(id), std::move(name), std::move(path), { }, std::move(reader) });
+    apply_resolution(sensors_.back());
+    index_masters();
+}
+
+void w1_bus::set_resolutions(resolution_map resolutions)
+{
+    resolutions_ = std::move(resolutions);
+    for (auto & sensor : sensors_)
+        apply_resolution(sensor);
+}
+
+void w1_bus::apply_resolution(w1_sensor & sensor)
+{
+    // keyed by the slave id, also when the sensor was added by path under another name
+    auto const dir = std::filesystem::path{ sensor.path_ }.parent_path();
+    auto const it = resolutions_.find(dir.filename().string());
+    if (it == resolutions_.end() || it->second == sensor.resolution_)
+        return;
+
+    auto const path = dir / "resolution";
+    auto const text = std::to_string(it->second);
+    unique_fd const fd{ ::open(path.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC) };
+    if (!fd || write(fd.get(), text.data(), text.size()) != static_cast<ssize_t>(text.size()))
+    {
+        syslog(LOG_USER | LOG_ERR, "Cannot set resolution of %s: %s\n", sensor.id_.c_str(), strerror(errno));
+        return;
+    }
+    sensor.resolution_ = it->second;
+}
+
+void w1_bus::index_masters()
+{
+    // sysfs links each slave into the directory of its master
+    std::vector<w1_master> masters;
+    for (auto const & sensor : sensors_)
+    {
+        std::error_code ec;
+        auto const dir = std::filesystem::canonical(std::filesystem::path{ sensor.path_ }.parent_path(), ec);
+        if (ec) continue;
+
+        auto path = (dir.parent_path() / "therm_bulk_read").string();
+        auto const known = [&](w1_master const & m) { return m.path_ == path; };
+        if (std::any_of(masters.begin(), masters.end(), known) || !std::filesystem::exists(path, ec))
+            continue;
+
+        auto const open = std::find_if(masters_.begin(), masters_.end(), known);
+        masters.push_back(open != masters_.end() ? std::move(*open) : w1_master{ std::move(path) });
+    }
+    masters_ = std::move(masters);
+}
+
+void w1_bus::scan(const name_map & names)
+{
+    if (root_dir_)
+        rewinddir(root_dir_.get());
+    else
+        root_dir_.reset(opendir(root_.c_str()));
+    if (!root_dir_)
+    {
+        syslog(LOG_USER | LOG_ERR, "Cannot scan %s: %s\n", root_.c_str(), strerror(errno));
+        return;
+    }
+
+    for (auto & sensor : sensors_)
+        sensor.seen_ = false;
+
+    size_t found = 0;
+    while (auto const entry = readdir(root_dir_.get()))
+    {
+        std::string_view const id{ entry->d_name };
+        if (!id.starts_with("28-")) continue;
+        ++found;
+
+        auto const mapped = names.find(id);
+        std::string_view const name = mapped != names.end() ? std::string_view{ mapped->second } : id;
+
+        slave_path_.assign(root_);
+        if (!slave_path_.ends_with('/')) slave_path_ += '/';
+        slave_path_.append(id).append("/w1_slave");
+
+        auto const known = std::find_if(sensors_.begin(), sensors_.end(),
+            [&](w1_sensor const & s) { return s.id_ == id; });
+        if (known != sensors_.end() && known->name_ == name && known->path_ == slave_path_)
+        {
+            known->seen_ = true;
+            continue;
+        }
+
+        add(std::string{ id }, std::string{ name }, slave_path_);
+        auto const added = std::find_if(sensors_.begin(), sensors_.end(),
+            [&](w1_sensor const & s) { return s.id_ == id; });
+        added->seen_ = true;
+    }
+
+    // the root may have been removed & made again, e.g. by reloading the master's module
+    if (found == 0)
+        root_dir_.reset();
+
+    auto const gone = std::erase_if(sensors_, [&](w1_sensor const & s)
+    {
+        if (!s.seen_) syslog(LOG_USER | LOG_WARNING, "sensor %s is gone\n", s.id_.c_str());
+        return !s.seen_;
+    });
+    if (gone != 0)
+        index_masters();
+}
+
+void w1_bus::sweep()
+{
+    auto const bgn = std::chrono::steady_clock::now();
+
+    if (bulk_read_)
+        convert_all();
+    read_all();
+
+    last_sweep_ = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bgn);
+    max_sweep_ = std::max(max_sweep_, last_sweep_);
+}
+
+bool w1_bus::convert_all()
+{
+    if (masters_.empty())
+        return false;
+
+    std::string_view const trigger{ "trigger\n" };
+    for (auto & master : masters_)
+    {
+        if (!master.fd_)
+            master.fd_.reset(::open(master.path_.c_str(), O_RDWR | O_CLOEXEC));
+        if (!master.fd_ ||
+            pwrite(master.fd_.get(), trigger.data(), trigger.size(), 0) != static_cast<ssize_t>(trigger.size()))
+        {
+            // the reads fall back to converting one sensor at a time
+            syslog(LOG_USER | LOG_ERR, "Cannot trigger %s: %s\n", master.path_.c_str(), strerror(errno));
+            master.fd_.reset();
+            return false;
+        }
+    }
+
+    // the slowest sensor sets the pace, 750 ms at 12 bits, halved by every bit less
+    int bits = 9;
+    for (auto const & sensor : sensors_)
+        bits = std::max(bits, sensor.resolution_ != 0 ? sensor.resolution_ : 12);
+    auto const conversion = std::chrono::microseconds{ 750000 >> (12 - bits) };
+    auto const deadline = std::chrono::steady_clock::now() + 2 * conversion;
+
+    // therm_bulk_read reads -1 while a sensor is still converting
+    for (auto const & master : masters_)
+    {
+        char buf[8];
+        for (;;)
+        {
+            auto const n = pread(master.fd_.get(), buf, sizeof buf, 0);
+            if (n <= 0 || !std::string_view{ buf, static_cast<size_t>(n) }.starts_with("-1") ||
+                std::chrono::steady_clock::now() >= deadline)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds{ 10 });
+        }
+    }
+    return true;
+}
+
+void w1_bus::read_all()
+{
+    if (workers_.empty() || sensors_.size() <= 1)
+    {
+        for (auto & sensor : sensors_)
+            read(sensor);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock{ mutex_ };
+    next_.store(0, std::memory_order_relaxed);
+    pending_ = workers_.size();
+    ++generation_;
+    start_cond_.notify_all();
+    done_cond_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void w1_bus::read(w1_sensor & sensor)
+{
+    sensor.therm_ = timed(sensor.read_latency_, [&] { return sensor.reader_.read(); });
+}
+
+void w1_bus::worker_run()
+{
+    size_t seen = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock{ mutex_ };
+            start_cond_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+            if (stopping_) return;
+            seen = generation_;
+        }
+
+        for (size_t i; (i = next_.fetch_add(1, std::memory_order_relaxed)) < sensors_.size(); )
+            read(sensors_[i]);
+
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        if (--pending_ == 0) done_cond_.notify_one();
+    }
+}
+
+bool w1_reader::open()
+{
+    // newer kernels export the converted value next to the scratchpad dump
+    std::string_view const slave{ "w1_slave" };
+    if (std::string_view{ path_ }.ends_with(slave))
+    {
+        auto const temperature = path_.substr(0, path_.size() - slave.size()) + "temperature";
+        fd_.reset(::open(temperature.c_str(), O_RDONLY | O_CLOEXEC));
+        temperature_ = static_cast<bool>(fd_);
+        if (fd_) return true;
+    }
+
+    fd_.reset(::open(path_.c_str(), O_RDONLY | O_CLOEXEC));
+    return static_cast<bool>(fd_);
+}
+
+std::optional<int> w1_reader::read()
+{
+    char buf[256];
+
+    if (!fd_ && !open())
+    {
+        syslog(LOG_USER | LOG_ERR, "Cannot open %s: %s\n", path_.c_str(), strerror(errno));
+        return { };
+    }
+
+    // one read at offset 0 renders the whole attribute, reading on would render it again
+    ssize_t n;
+    while ((n = pread(fd_.get(), buf, sizeof buf, 0)) < 0 && errno == EINTR) { }
+    if (n < 0)
+    {
+        // the temperature attribute fails with EIO when the CRC check fails
+        auto const err = errno;
+        syslog(LOG_USER | LOG_ERR, "Cannot read %s: %s\n", path_.c_str(), strerror(err));
+        if (err == EIO && temperature_)
+            crc_errors_.add();
+        if (err != EIO)
+            fd_.reset(); // the sensor may be gone, open it again next time
+        return { };
+    }
+    auto const len = static_cast<size_t>(n);
+
+    std::string_view const text{ buf, len };
+    auto const ret = temperature_ ? w1_temperature_parse(text) : w1_slave_parse(text);
+    if (!ret)
+    {
+        // a well formed dump with a NO verdict is a CRC failure, anything else is garbage
+        if (!temperature_ && text.substr(0, text.find('\n')).ends_with("NO"))
+            crc_errors_.add();
+        syslog(LOG_USER | LOG_ERR, "Cannot parse %s, data sample\n", path_.c_str());
+        syslog(LOG_USER | LOG_ERR, "%.*s\n", static_cast<int>(len), buf);
+    }
+    return ret;
+}
+
+std::optional<int> w1_slave_read(const char * path)
+{
+    return w1_reader{ path }.read();
+}
+
+namespace
+{
+
+/**
+ * @brief parse milli-celsius spanning all of text
+ */
+std::optional<int> parse_milli(std::string_view text)
+{
+    int value;
+    auto const [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc{ } || end != text.data() + text.size())
+        return { };
+    return value;
+}
+
+} // namespace
+
+std::optional<int> w1_slave_parse(std::string_view text)
+{
+    // 72 01 4b 46 7f ff 0e 10 57 : crc=57 YES
+    // 72 01 4b 46 7f ff 0e 10 57 t=23125
+    auto const eol = text.find('\n');
+    if (eol == std::string_view::npos || !text.substr(0, eol).ends_with("YES"))
+        return { };
+
+    auto line = text.substr(eol + 1);
+    line = line.substr(0, line.find('\n'));
+
+    std::string_view const flag{ "t=" };
+    auto const pos = line.rfind(flag);
+    if (pos == std::string_view::npos)
+        return { };
+    return parse_milli(line.substr(pos + flag.size()));
+}
+
+std::optional<int> w1_temperature_parse(std::string_view text)
+{
+    return parse_milli(text.substr(0, text.find('\n')));
+}
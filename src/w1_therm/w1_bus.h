@@ -0,0 +1,218 @@
+#pragma once
+
+#include <dirent.h>
+
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+#include "unique_fd.h"
+
+/**
+ * @brief reads one sensor through a descriptor kept open between samples
+ *
+ * sysfs renders an attribute again on every read at offset 0, so each sample
+ * is a single pread() into a fixed buffer. The `temperature` attribute of
+ * newer kernels is preferred over w1_slave when it exists next to it, it
+ * holds the milli-celsius value alone instead of the scratchpad dump.
+ */
+class w1_reader
+{
+public:
+    w1_reader() = default;
+
+    explicit w1_reader(std::string path) : path_{ std::move(path) } { }
+
+    /**
+     * @brief sample the sensor
+     *
+     * @return temperature in milli-celsius, or nothing if the CRC check failed
+     */
+    std::optional<int> read();
+
+    const std::string & path() const { return path_; }
+
+    /**
+     * @brief reads the sensor answered with a failed CRC check
+     */
+    uint64_t crc_errors() const { return crc_errors_.get(); }
+
+private:
+    bool open();
+
+private:
+    std::string path_{ };              ///< path to w1_slave
+    unique_fd   fd_{ };                ///< w1_slave or temperature, opened on first read
+    bool        temperature_{ false }; ///< fd_ is the temperature attribute
+    counter     crc_errors_{ };
+};
+
+/**
+ * @brief a DS18B20 sensor on the 1-Wire bus
+ */
+struct w1_sensor
+{
+    std::string        id_{ };           ///< slave id, e.g. 28-00000001acef
+    std::string        name_{ };         ///< name used for storage
+    std::string        path_{ };         ///< path to w1_slave
+    std::optional<int> therm_{ };        ///< result of the last sweep, in milli-celsius
+    w1_reader          reader_{ };       ///< keeps the sensor open between sweeps
+    int                resolution_{ 0 }; ///< bits written to the sensor, 0 if it keeps its own
+    histogram          read_latency_{ }; ///< of reader_.read(), the conversion included
+    bool               seen_{ false };   ///< listed by the running scan
+};
+
+/**
+ * @brief registry of the sensors on a 1-Wire bus
+ *
+ * Sensors are read in parallel on a small worker pool, so one sweep over N
+ * sensors takes about one conversion time instead of N. Sensors sharing a
+ * master still convert one after another unless bulk read is on: then one
+ * write to the master's `therm_bulk_read` converts all of them at once, and
+ * the reads only fetch the results.
+ */
+class w1_bus
+{
+public:
+    using name_map = std::map<std::string, std::string, std::less<>>;
+
+    using resolution_map = std::map<std::string, int>;
+
+    explicit w1_bus(std::string root, size_t workers = 4);
+
+    w1_bus(const w1_bus &) = delete;
+
+    ~w1_bus();
+
+    w1_bus & operator=(const w1_bus &) = delete;
+
+    /**
+     * @brief register a sensor by the path of its w1_slave
+     */
+    void add(std::string id, std::string name, std::string path);
+
+    /**
+     * @brief discover `<root>/28-*`, add new sensors and drop vanished ones
+     *
+     * The root stays open and is read again from its start, so a scan
+     * finding the sensors it knows allocates nothing; adding a sensor or
+     * renaming one does.
+     *
+     * @param names maps slave id to sensor name, unmapped sensors use the id
+     */
+    void scan(const name_map & names);
+
+    /**
+     * @brief read all registered sensors, results are left in `w1_sensor::therm_`
+     */
+    void sweep();
+
+    /**
+     * @brief resolution in bits, 9 to 12, by slave id
+     *
+     * A 12 bit conversion takes 750 ms, every bit less halves it down to
+     * about 94 ms at 9 bits. Sensors not in the map keep their own setting.
+     */
+    void set_resolutions(resolution_map resolutions);
+
+    /**
+     * @brief convert all sensors of a master at once through `therm_bulk_read`
+     */
+    void set_bulk_read(bool on) { bulk_read_ = on; }
+
+    const std::vector<w1_sensor> & sensors() const { return sensors_; }
+
+    /**
+     * @brief how long the last sweep took
+     */
+    std::chrono::microseconds last_sweep() const { return last_sweep_; }
+
+    /**
+     * @brief the slowest sweep so far
+     */
+    std::chrono::microseconds max_sweep() const { return max_sweep_; }
+
+private:
+    /**
+     * @brief the `therm_bulk_read` attribute of a bus master
+     */
+    struct w1_master
+    {
+        std::string path_{ };
+        unique_fd   fd_{ };
+    };
+
+    struct dir_closer
+    {
+        void operator()(DIR * dir) const { closedir(dir); }
+    };
+
+    void worker_run();
+
+    void read_all();
+
+    static void read(w1_sensor & sensor);
+
+    /**
+     * @brief start one conversion on every master and wait for it, false if none started
+     */
+    bool convert_all();
+
+    void apply_resolution(w1_sensor & sensor);
+
+    /**
+     * @brief find the masters of the sensors, keeping the open ones
+     */
+    void index_masters();
+
+private:
+    std::string             root_;
+    std::unique_ptr<DIR, dir_closer> root_dir_{ }; ///< kept open by scan, rewound each time
+    std::string             slave_path_{ };   ///< reused by scan
+    std::vector<w1_sensor>  sensors_{ };
+    std::vector<w1_master>  masters_{ };
+    resolution_map          resolutions_{ };
+    bool                    bulk_read_{ false };
+    std::chrono::microseconds last_sweep_{ };
+    std::chrono::microseconds max_sweep_{ };
+    std::vector<std::thread> workers_{ };
+    std::mutex              mutex_{ };
+    std::condition_variable start_cond_{ };
+    std::condition_variable done_cond_{ };
+    std::atomic<size_t>     next_{ 0 };       ///< next sensor to read in this sweep
+    size_t                  generation_{ 0 }; ///< incremented by each sweep
+    size_t                  pending_{ 0 };    ///< workers still busy in this sweep
+    bool                    stopping_{ false };
+};
+
+/**
+ * @brief read the temperature from w1_slave, opening it for this read only
+ *
+ * @return temperature in milli-celsius, or nothing if the CRC check failed
+ */
+std::optional<int> w1_slave_read(const char * path);
+
+/**
+ * @brief parse a w1_slave dump in one pass, without stdio
+ *
+ * The first line must end with the CRC verdict `YES`, the second one with
+ * `t=` and the temperature.
+ *
+ * @return temperature in milli-celsius, or nothing if the CRC check failed or the dump is malformed
+ */
+std::optional<int> w1_slave_parse(std::string_view text);
+
+/**
+ * @brief parse the `temperature` attribute, milli-celsius and a newline
+ */
+std::optional<int> w1_temperature_parse(std::string_view text);
@@ -2,6 +2,7 @@
 #include <syslog.h>
 #include <unistd.h>
 #include <wait.h>
+#include <sys/signalfd.h>
 
 #include <cassert>
 #include <csignal>
@@ -11,21 +12,35 @@
 #include <ctime>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <limits>
+#include <map>
 #include <memory>
 #include <thread>
 #include <optional>
 #include <stdexcept>
 #include <string_view>
 #include <type_traits>
+#include <vector>
 
-#include <boost/container/static_vector.hpp>
-#include <boost/static_string.hpp>
-
+#include "deadband.h"
+#include "event_loop.h"
+#include "file_sink.h"
+#include "gateway.h"
+#include "history.h"
 #include "influx_storage.h"
+#include "latest_table.h"
+#include "lib_heap.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "rollup.h"
+#include "socket_sink.h"
 #include "sqlite_storage.h"
+#include "storage.h"
+#include "uploader.h"
+#include "w1_bus.h"
 
 #ifndef likely
 # define likely(x) (__builtin_expect(!!(x), 1))
@@ -40,7 +55,18 @@
  */
 struct sqlite_config
 {
-    std::string path_{ }; ///< path to sqlite database
+    std::string             path_{ };    ///< path to sqlite database
+    sqlite_storage::options options_{ }; ///< synchronous & group commit
+    size_t                  block_points_{ 0 }; ///< points per compressed block, 0 stores rows
+};
+
+/**
+ * @brief config for the spool log, used instead of sqlite if dir_ is set
+ */
+struct spool_config
+{
+    std::string            dir_{ };     ///< directory of the segment files
+    spool_storage::options options_{ }; ///< segment size & sync
 };
 
 /**
@@ -52,195 +78,368 @@ struct influx_config
     std::string org_{ };    ///< organization of influxdb
     std::string bucket_{ }; ///< bucket of influxdb
     std::string token_{ };  ///< token of influxdb
+    influx_storage::options options_{ }; ///< timeouts & circuit breaker
+    std::optional<rollup_output> output_{ }; ///< what it takes once rollups are on, rollup_output if empty
 };
 
 /**
- * @brief global config
+ * @brief config for the file sink, off if path_ is empty
  */
-struct therm_config
+struct file_config
 {
-    std::string   w1_slave_path_{ };    ///< path to w1_slave
-    std::string   senor_name_{ };       ///< name of senor
-    bool          daemonlize_{ false }; ///< daemonlize if set
-    sqlite_config sqlite_db_{ };        ///< config for sqlite database
-    influx_config influx_db_{ };        ///< config for influx database
+    std::string        path_{ };     ///< line protocol file, appended to
+    file_sink::options options_{ };  ///< batching & retry
+    size_t             queue_capacity_{ 1024 }; ///< samples buffered between sampler and file
+    overflow_policy    queue_overflow_{ overflow_policy::drop_oldest }; ///< what to do when the queue is full
+    std::optional<rollup_output> output_{ }; ///< what it takes once rollups are on, rollup_output if empty
 };
 
-struct storage_t
+/**
+ * @brief config for a socket sink, off if address_ is empty
+ */
+struct socket_config
 {
-    storage_t(sqlite_storage && sqlite, influx_storage && influx)
-        : sqlite_{ std::move(sqlite) }
-        , influx_{ std::move(influx) }
-    { }
-
-    void insert(const char * name, double value, time_t now);
+    socket_sink::mode    mode_{ socket_sink::mode::udp };
+    std::string          address_{ };  ///< host:port for udp, else a socket path
+    socket_sink::options options_{ };  ///< packing of the lines
+    size_t               queue_capacity_{ 1024 }; ///< samples buffered between sampler and socket
+    overflow_policy      queue_overflow_{ overflow_policy::drop_oldest }; ///< what to do when the queue is full
+    std::optional<rollup_output> output_{ }; ///< what it takes once rollups are on, rollup_output if empty
+};
 
-    size_t sqlite_count_{0}; ///< 执行 sqlite 插入的次数，不代表 sqlite 中的记录数
-    sqlite_storage sqlite_;
-    influx_storage influx_;
+/**
+ * @brief global config
+ */
+struct therm_config
+{
+    std::string      w1_slave_path_{ };    ///< path to w1_slave, scan w1_root_ if empty
+    std::string      senor_name_{ };       ///< name of senor
+    std::string      w1_root_{ "/sys/bus/w1/devices" }; ///< where to discover sensors
+    w1_bus::name_map sensor_names_{ };     ///< slave id to sensor name
+    w1_bus::resolution_map sensor_resolutions_{ }; ///< slave id to resolution in bits
+    size_t           w1_workers_{ 4 };     ///< size of the worker pool reading sensors
+    bool             w1_bulk_read_{ false }; ///< convert all sensors of a master at once
+    bool             daemonlize_{ false }; ///< daemonlize if set
+    std::chrono::seconds interval_{ 300 }; ///< time between two sweeps
+    sqlite_config    sqlite_db_{ };        ///< config for sqlite database
+    spool_config     spool_{ };            ///< config for spool log
+    influx_config    influx_db_{ };        ///< config for influx database
+    batch_options    batch_{ };            ///< size of the backlog batches
+    backlog_limits   backlog_limits_{ };   ///< bound of the backlog on disk
+    file_config      file_{ };             ///< config for the file sink
+    socket_config    udp_{ };              ///< config for the udp sink
+    socket_config    tcp_{ socket_sink::mode::tcp }; ///< config for the tcp sink, e.g. to a gateway
+    socket_config    unix_{ socket_sink::mode::unix_stream }; ///< config for the unix socket sink
+    size_t           queue_capacity_{ 1024 }; ///< samples buffered between sampler and uploader
+    overflow_policy  queue_overflow_{ overflow_policy::spill }; ///< what to do when the queue is full
+    std::string      metrics_address_{ }; ///< host:port or unix socket path of the metrics endpoint, off if empty
+    std::string      gateway_address_{ }; ///< host:port accepting line protocol from other nodes, off if empty
+    gateway::options gateway_{ };         ///< workers & limits of the gateway
+    std::string      shm_name_{ };        ///< shared memory of the latest readings, off if empty
+    size_t           shm_slots_{ 256 };   ///< sensors the shared memory holds
+    std::optional<history::options> history_{ }; ///< recent readings served by the metrics endpoint, off if empty
+    std::vector<uint32_t> rollup_windows_{ }; ///< rollup window lengths in seconds, none disables rollups
+    rollup_output    rollup_output_{ rollup_output::both }; ///< what a sink takes once rollups are on, unless set per sink
+    std::optional<deadband::options> deadband_{ }; ///< change-based reporting of raw readings, off if empty
+    deadband::delta_map deadband_deltas_{ }; ///< slave id to deadband delta
 };
 
-static auto s_running = false;
+inline unique_fd init_signal_handle()
+{
+    // blocked in every thread, delivered through the fd only
+    return make_signal_fd({ SIGTERM, SIGINT, SIGUSR1 });
+}
 
-void storage_t::insert(const char * name, double value, time_t now)
+inline void render_metrics(std::string & out, const w1_bus & bus, const fanout & upload, const deadband * filter,
+                           const gateway * gw, const history * recent)
 {
-    try
+    // sensors first, one series each, then the queue & the storage path
+    render_family(out, "w1_therm_sensor_read_seconds", "histogram", "sensor reads, the conversion included");
+    std::string labels;
+    for (auto const & sensor : bus.sensors())
     {
-        if (sqlite_count_ == 0)
-        {
-            influx_.insert(name, value, now);
-            return;
-        }
+        labels.clear();
+        append_label(labels, "sensor", sensor.name_);
+        sensor.read_latency_.render(out, "w1_therm_sensor_read_seconds", labels);
+    }
+    render_family(out, "w1_therm_sensor_crc_errors_total", "counter", "sensor reads failing the CRC check");
+    for (auto const & sensor : bus.sensors())
+    {
+        labels.clear();
+        append_label(labels, "sensor", sensor.name_);
+        render_value(out, "w1_therm_sensor_crc_errors_total", labels, static_cast<double>(sensor.reader_.crc_errors()));
+    }
+    render_family(out, "w1_therm_sweep_seconds", "gauge", "duration of the last sweep over all sensors");
+    render_value(out, "w1_therm_sweep_seconds", { }, static_cast<double>(bus.last_sweep().count()) / 1e6);
+    render_family(out, "w1_therm_sweep_max_seconds", "gauge", "the slowest sweep so far");
+    render_value(out, "w1_therm_sweep_max_seconds", { }, static_cast<double>(bus.max_sweep().count()) / 1e6);
+
+    if (filter)
+    {
+        render_family(out, "w1_therm_deadband_readings_total", "counter", "raw readings through the deadband");
+        render_value(out, "w1_therm_deadband_readings_total", { }, static_cast<double>(filter->readings()));
+        render_family(out, "w1_therm_deadband_suppressed_total", "counter", "raw readings the deadband dropped");
+        render_value(out, "w1_therm_deadband_suppressed_total", { }, static_cast<double>(filter->suppressed()));
+    }
+
+    if (gw)
+    {
+        render_family(out, "w1_therm_gateway_points_total", "counter", "points received from other nodes");
+        render_value(out, "w1_therm_gateway_points_total", { }, static_cast<double>(gw->points()));
+        render_family(out, "w1_therm_gateway_dropped_total", "counter", "points from other nodes the rings had no room for");
+        render_value(out, "w1_therm_gateway_dropped_total", { }, static_cast<double>(gw->dropped()));
+        render_family(out, "w1_therm_gateway_rejected_total", "counter", "lines from other nodes that are not points");
+        render_value(out, "w1_therm_gateway_rejected_total", { }, static_cast<double>(gw->rejected()));
+        render_family(out, "w1_therm_gateway_connections_total", "counter", "connections accepted from other nodes");
+        render_value(out, "w1_therm_gateway_connections_total", { }, static_cast<double>(gw->accepted()));
+        render_family(out, "w1_therm_gateway_clients", "gauge", "connections open now");
+        render_value(out, "w1_therm_gateway_clients", { }, static_cast<double>(gw->clients()));
+    }
 
-        ++sqlite_count_;
-        sqlite_.insert(name, value, now);
+    if (recent)
+    {
+        render_family(out, "w1_therm_history_points", "gauge", "readings held in memory for /history");
+        render_value(out, "w1_therm_history_points", { }, static_cast<double>(recent->size()));
+        render_family(out, "w1_therm_history_sensors", "gauge", "sensors with a history ring");
+        render_value(out, "w1_therm_history_sensors", { }, static_cast<double>(recent->sensors()));
+        render_family(out, "w1_therm_history_bytes", "gauge", "memory of the history rings");
+        render_value(out, "w1_therm_history_bytes", { }, static_cast<double>(recent->bytes()));
+    }
 
-        if ((sqlite_count_ % 10) != 0 || !influx_.is_bucket_exists())
+    // one ring per sink, labeled with the sink's name
+    auto const per_sink = [&](const char * name, const char * type, const char * help, auto && value)
+    {
+        render_family(out, name, type, help);
+        for (auto const & u : upload.uploaders())
         {
-            return;
+            labels.clear();
+            append_label(labels, "sink", u->name());
+            render_value(out, name, labels, static_cast<double>(value(*u)));
         }
+    };
+    per_sink("w1_therm_queue_depth", "gauge", "samples between the sampler and the sink",
+             [](const uploader & u) { return u.depth(); });
+    per_sink("w1_therm_queue_high_water", "gauge", "the deepest the queue has been",
+             [](const uploader & u) { return u.high_water(); });
+    per_sink("w1_therm_queue_capacity", "gauge", "size of the queue",
+             [](const uploader & u) { return u.capacity(); });
+    per_sink("w1_therm_queue_dropped_total", "counter", "samples dropped by a full queue",
+             [](const uploader & u) { return u.dropped(); });
+    per_sink("w1_therm_queue_spilled_total", "counter", "samples a full queue wrote to sqlite",
+             [](const uploader & u) { return u.spilled(); });
+    per_sink("w1_therm_sink_written_total", "counter", "samples handed to the sink",
+             [](const uploader & u) { return u.written(); });
+    per_sink("w1_therm_sink_sent_total", "counter", "points the sink delivered",
+             [](const uploader & u) { return u.target().sent(); });
+    per_sink("w1_therm_sink_dropped_total", "counter", "points the sink gave up after taking them",
+             [](const uploader & u) { return u.target().dropped(); });
+    render_family(out, "w1_therm_sink_lag_seconds", "histogram", "time from the sampler to the sink");
+    for (auto const & u : upload.uploaders())
+    {
+        labels.clear();
+        append_label(labels, "sink", u->name());
+        u->lag().render(out, "w1_therm_sink_lag_seconds", labels);
+    }
 
-        for (std::string data; ; data.clear())
-        {
-            long id;
-            using user_data_t = std::tuple<influx_storage *, std::string *, long *>;
-            user_data_t user{ &influx_, &data, &id };
+    global_metrics().render(out);
+}
 
-            auto const callback = [](void * user, int argc, char ** argv, char ** col) -> int
-            {
-                assert(argc == 4);
-                assert(col[0] == std::string_view{ "id" });
-                assert(col[1] == std::string_view{ "name" });
-                assert(col[2] == std::string_view{ "therm" });
-                assert(col[3] == std::string_view{ "time" });
-                auto const id = std::atol(argv[0]);
-                auto const name = argv[1];
-                auto const value = std::atof(argv[2]);
-                auto const time = std::atol(argv[3]);
-                auto const [influx, data, pid] = *static_cast<user_data_t *>(user);
-                assert(*pid < id);
-                *pid = id;
-                influx->prepare_data(*data, name, value, time);
-                return 0;
-            };
-
-            sqlite_.select(200, callback, &user);
-            if (data.empty())
-            {
-                break;
-            }
+inline void w1_therm_run(fanout & upload, const therm_config & config, int signal_fd, history * recent)
+{
+    syslog(LOG_USER | LOG_INFO, "w1_therm is started!\n");
 
-            influx_.insert(data);
-            sqlite_.delete_where_id_not_greater_than(id);
-            sqlite_count_ = 0;
-        }
-    }
-    catch (influx_storage::runtime_error const & e)
+    auto const multi_sensor = config.w1_slave_path_.empty();
+    w1_bus bus{ config.w1_root_, multi_sensor ? config.w1_workers_ : 0 };
+    bus.set_bulk_read(config.w1_bulk_read_);
+    bus.set_resolutions(config.sensor_resolutions_);
+    if (!multi_sensor)
+        bus.add(config.senor_name_, config.senor_name_, config.w1_slave_path_);
+
+    // raw readings within the band of the last stored one are dropped here, before the ring
+    std::optional<deadband> filter;
+    if (config.deadband_)
+        filter.emplace(*config.deadband_, config.deadband_deltas_);
+    auto const log_deadband = [&] {
+        if (filter)
+            syslog(LOG_USER | LOG_INFO, "deadband: %llu readings, %llu suppressed (%.1f%%)\n",
+                static_cast<unsigned long long>(filter->readings()),
+                static_cast<unsigned long long>(filter->suppressed()), filter->ratio() * 100);
+    };
+
+    // points of other nodes join the local ones in the rings, the sinks batch them upstream
+    std::optional<gateway> gw;
+    if (!config.gateway_address_.empty())
     {
-        syslog(LOG_USER | LOG_ERR, "influx error: %s\n", e.what());
+        gw.emplace(config.gateway_address_, config.gateway_, [&](size_t worker, const sample * samples, size_t n)
+        {
+            // a worker waiting here stops reading, one waiting too long gives its connection up
+            return upload.feed(worker, samples, n, std::chrono::seconds{ 5 });
+        });
+        syslog(LOG_USER | LOG_INFO, "gateway listening on %s with %zu workers\n", config.gateway_address_.c_str(),
+               config.gateway_.workers_);
     }
-    catch (sqlite_storage::runtime_error const & e)
+    auto const log_gateway = [&] {
+        if (gw)
+            syslog(LOG_USER | LOG_INFO, "gateway: %llu points, %llu dropped, %llu rejected lines, %zu clients\n",
+                static_cast<unsigned long long>(gw->points()), static_cast<unsigned long long>(gw->dropped()),
+                static_cast<unsigned long long>(gw->rejected()), gw->clients());
+    };
+
+    // local readers get the last reading of each sensor without asking anyone
+    std::optional<latest_table> latest;
+    if (!config.shm_name_.empty())
     {
-        syslog(LOG_USER | LOG_ERR, "sqlite error: %s\n", e.what());
+        latest.emplace(config.shm_name_.c_str(), config.shm_slots_);
+        syslog(LOG_USER | LOG_INFO, "publishing the latest readings in %s\n", config.shm_name_.c_str());
     }
-    catch (std::exception const & e)
+
+    event_loop loop;
+
+    loop.add(signal_fd, EPOLLIN, [&](uint32_t)
     {
-        syslog(LOG_USER | LOG_ERR, "Unknown error: %s\n", e.what());
-    }
-}
+        signalfd_siginfo info;
+        if (read(signal_fd, &info, sizeof info) != sizeof info) return;
 
-inline void init_signal_handle()
-{
-    auto const handle = [](int){ s_running = false; };
-    std::signal(SIGTERM, handle);
-    std::signal(SIGINT, handle);
-}
+        // SIGUSR1 asks for the queue & sweep stats, to size the ring and the resolutions at runtime
+        if (info.ssi_signo == SIGUSR1)
+        {
+            upload.log_stats();
+            syslog(LOG_USER | LOG_INFO, "sweep: %zu sensors, last %lld ms, max %lld ms\n", bus.sensors().size(),
+                static_cast<long long>(bus.last_sweep().count() / 1000),
+                static_cast<long long>(bus.max_sweep().count() / 1000));
+            log_deadband();
+            log_gateway();
+            return;
+        }
 
-inline std::optional<int> w1_slave_read(const char * path)
-{
-    std::optional<int> ret;
-    char buf[256];
+        syslog(LOG_USER | LOG_INFO, "got signal %u\n", info.ssi_signo);
+        loop.stop();
+    });
+
+    // closed windows go the same way as the readings, through the ring
+    rollup rollups{ config.rollup_windows_, [&](const char * name, double value, time_t start, uint32_t series)
+    {
+        upload.push(name, value, start, series);
+    } };
+    // each sink takes what its output lets through, the sampler skips readings none takes
+    auto const push_raw = upload.takes_raw();
+
+    // scrapes are served between sweeps, on this thread, so the sensors need no lock
+    std::optional<metrics_server> metrics;
+    if (!config.metrics_address_.empty())
+    {
+        metrics.emplace(loop, config.metrics_address_, [&](std::string & out)
+        {
+            render_metrics(out, bus, upload, filter ? &*filter : nullptr, gw ? &*gw : nullptr, recent);
+        });
+        if (recent)
+        {
+            metrics->handle("/history", "application/json", [&](std::string_view query, std::string & out)
+            {
+                return recent->answer(query, time(nullptr), out);
+            });
+        }
+        syslog(LOG_USER | LOG_INFO, "serving metrics on %s\n", config.metrics_address_.c_str());
+    }
 
-    do
+    // the first sweep is right away, then on the interval schedule without drift
+    auto const timer = make_timer_fd();
+    arm_timer(timer.get(), std::chrono::nanoseconds{ 1 }, config.interval_);
+    loop.add(timer.get(), EPOLLIN, [&](uint32_t)
     {
-        auto const destroyer = [](FILE * fp) { fclose(fp); };
-        std::unique_ptr<FILE, decltype(destroyer)> const fp{ fopen(path, "r"), destroyer };
-        if (!fp) break;
+        // more than one expiration means sweeps were late, one sweep catches up
+        if (read_counter(timer.get()) == 0) return;
 
-        std::string_view line;
-        std::string_view const flag{ "t=" };
-        char *endptr;
-        int len;
+        if (multi_sensor)
+            bus.scan(config.sensor_names_);
 
-        if (fscanf(fp.get(), "%[^\n]%n", buf, &len) != 1) break;
+        auto const utc_now = time(nullptr);
+        bus.sweep();
 
-        line = std::string_view{ buf, static_cast<size_t>(len) };
-        if (!line.ends_with("YES")) break;
+        // windows of sensors that stopped answering close on time as well
+        rollups.close_due(utc_now);
+        for (auto const & sensor : bus.sensors())
+        {
+            if unlikely(!sensor.therm_)
+            {
+                if (latest) latest->fail(sensor.name_.c_str(), utc_now);
+                continue;
+            }
 
-        fgetc(fp.get()); // skip '\n'
+            auto const value = *sensor.therm_ / double(1000);
+            if (push_raw && (!filter || filter->pass(sensor.id_, value, utc_now)))
+                upload.push(sensor.name_.c_str(), value, utc_now);
+            rollups.add(sensor.name_.c_str(), value, utc_now);
+            if (latest) latest->publish(sensor.name_.c_str(), value, utc_now);
+            if (recent) recent->add(sensor.name_.c_str(), value, utc_now);
+        }
+    });
 
-        if (fscanf(fp.get(), "%[^\n]%n", buf, &len) != 1) break;
+    loop.run();
 
-        line = std::string_view{ buf, static_cast<size_t>(len) };
-        auto const pos = line.rfind(flag);
-        if (pos == std::string_view::npos) break;
+    // nothing arrives from other nodes once the sweeps stop
+    log_gateway();
+    gw.reset();
 
-        auto const t = line.substr(pos + flag.size());
-        auto const n = strtol(t.data(), &endptr, 10);
-        auto const ok =
-            endptr == t.end() &&
-            std::numeric_limits<int>::min() <= n &&
-            n <= std::numeric_limits<int>::max();
-        if (!ok) break;
-        ret = static_cast<int>(n);
-        return ret;
-    } while (false);
+    // the partial windows are better than a gap
+    rollups.close_all();
+    log_deadband();
 
-    syslog(LOG_USER | LOG_ERR, "Cannot parse w1_slave, data sample\n");
-    syslog(LOG_USER | LOG_ERR, "%s\n", buf);
-    return ret;
+    syslog(LOG_USER | LOG_INFO, "w1_therm is stopped!\n");
 }
 
-inline void w1_therm_run(storage_t & storage, const therm_config & config)
+inline backlog_storage init_backlog(const therm_config & config)
 {
-    syslog(LOG_USER | LOG_INFO, "w1_therm is started!\n");
+    if (!config.spool_.dir_.empty())
+    {
+        syslog(LOG_USER | LOG_INFO, "buffering in spool %s\n", config.spool_.dir_.c_str());
+        return spool_storage{ config.spool_.dir_.c_str(), config.spool_.options_ };
+    }
 
-    s_running = true;
+    if (config.sqlite_db_.block_points_ != 0)
+    {
+        syslog(LOG_USER | LOG_INFO, "buffering in compressed blocks of %zu points\n", config.sqlite_db_.block_points_);
+        return block_storage{ config.sqlite_db_.path_.c_str(), { config.sqlite_db_.options_, config.sqlite_db_.block_points_ } };
+    }
 
-    std::chrono::minutes constexpr interval{ 5 };
-    std::chrono::steady_clock::time_point next_read_time;
+    return sqlite_storage{ config.sqlite_db_.path_.c_str(), config.sqlite_db_.options_ };
+}
 
-    while (s_running)
+inline void warm_history(backlog_storage & backlog, history & recent)
+{
+    // the raw readings not uploaded yet, in insertion order
+    std::vector<backlog_record> rows;
+    int64_t after_id = 0;
+    size_t n = 0;
+    std::visit([&](auto & b)
     {
-        auto const now = std::chrono::steady_clock::now();
-        if (next_read_time <= now)
+        while (b.select(after_id, 4096, rows) != 0)
         {
-            next_read_time = now + interval;
-            auto const therm = w1_slave_read(config.w1_slave_path_.c_str());
-            if likely(therm)
+            for (auto const & row : rows)
             {
-                auto const utc_now = time(nullptr);
-                storage.insert(config.senor_name_.c_str(), *therm / double(1000), utc_now);
+                if (row.series_ == 0) recent.add(row.name_.c_str(), row.value_, row.time_);
             }
+            n += rows.size();
+            after_id = rows.back().id_;
         }
-
-        std::this_thread::sleep_for(std::chrono::milliseconds{ 250 });
-    }
-
-    syslog(LOG_USER | LOG_INFO, "w1_therm is stopped!\n");
+    }, backlog);
+    syslog(LOG_USER | LOG_INFO, "history warmed from %zu buffered points\n", n);
 }
 
-inline storage_t init_storage(const therm_config & config)
+inline storage_t init_storage(const therm_config & config, history * recent)
 {
-    sqlite_storage sqlite{config.sqlite_db_.path_.c_str()};
+    auto backlog = init_backlog(config);
+    if (recent)
+        warm_history(backlog, *recent);
     influx_storage influx{config.influx_db_.host_,
                           config.influx_db_.org_,
                           config.influx_db_.bucket_,
                           config.influx_db_.token_,
                           "home",
-                          "temperature"};
+                          "temperature",
+                          config.influx_db_.options_};
     syslog(LOG_USER | LOG_INFO, "sqlite3 and influxdb are initialized!\n");
-    return { std::move(sqlite), std::move(influx) };
+    return { std::move(backlog), std::move(influx), config.batch_, config.backlog_limits_ };
 }
 
 inline void init_influx_config(therm_config & config, const char * str)
@@ -276,11 +475,466 @@ inline void init_influx_config(therm_config & config, const char * str)
     config.influx_db_.token_.assign(bgn);
 }
 
+template <size_t N>
+inline void parse_numbers(const char * str, unsigned long (&out)[N], const char * what)
+{
+    // valid settings: N numbers separated by spaces
+    assert(str);
+
+    for (auto & n : out)
+    {
+        char * end;
+        n = strtoul(str, &end, 10);
+        if (end == str || (*end != ' ' && *end != 0))
+            throw std::runtime_error{ std::string{ "Invalid " } + what + " settings" };
+        str = end;
+    }
+
+    if (*str != 0)
+        throw std::runtime_error{ std::string{ "Invalid " } + what + " settings" };
+}
+
+inline void init_sqlite_commit(therm_config & config, const char * str)
+{
+    // valid settings: "count milliseconds"
+    unsigned long n[2];
+    parse_numbers(str, n, "sqlite_commit");
+    if (n[0] == 0)
+        throw std::runtime_error{ "Invalid sqlite_commit settings" };
+
+    config.sqlite_db_.options_.commit_count_ = n[0];
+    config.sqlite_db_.options_.commit_interval_ = std::chrono::milliseconds{ n[1] };
+}
+
+inline void init_sqlite_blocks(therm_config & config, const char * str)
+{
+    // valid settings: "points", 0 stores one row per sample
+    unsigned long n[1];
+    parse_numbers(str, n, "sqlite_blocks");
+    if (n[0] > 65535)
+        throw std::runtime_error{ "Invalid sqlite_blocks settings" };
+
+    config.sqlite_db_.block_points_ = n[0];
+}
+
+inline void init_spool_sync(therm_config & config, const char * str)
+{
+    // valid settings: "count milliseconds"
+    unsigned long n[2];
+    parse_numbers(str, n, "spool_sync");
+    if (n[0] == 0)
+        throw std::runtime_error{ "Invalid spool_sync settings" };
+
+    config.spool_.options_.sync_count_ = n[0];
+    config.spool_.options_.sync_interval_ = std::chrono::milliseconds{ n[1] };
+}
+
+inline void init_spool_segment(therm_config & config, const char * str)
+{
+    // valid settings: "bytes"
+    unsigned long n[1];
+    parse_numbers(str, n, "spool_segment");
+
+    config.spool_.options_.segment_size_ = n[0];
+}
+
+inline void init_influx_timeout(therm_config & config, const char * str)
+{
+    // valid settings: "connect_ms total_ms"
+    unsigned long n[2];
+    parse_numbers(str, n, "influx_timeout");
+
+    config.influx_db_.options_.connect_timeout_ = std::chrono::milliseconds{ n[0] };
+    config.influx_db_.options_.timeout_ = std::chrono::milliseconds{ n[1] };
+}
+
+inline void init_influx_backoff(therm_config & config, const char * str)
+{
+    // valid settings: "threshold min_ms max_ms"
+    unsigned long n[3];
+    parse_numbers(str, n, "influx_backoff");
+    if (n[0] == 0 || n[1] == 0 || n[2] < n[1])
+        throw std::runtime_error{ "Invalid influx_backoff settings" };
+
+    config.influx_db_.options_.failure_threshold_ = n[0];
+    config.influx_db_.options_.backoff_min_ = std::chrono::milliseconds{ n[1] };
+    config.influx_db_.options_.backoff_max_ = std::chrono::milliseconds{ n[2] };
+}
+
+inline void init_influx_bucket_ttl(therm_config & config, const char * str)
+{
+    // valid settings: "seconds"
+    unsigned long n[1];
+    parse_numbers(str, n, "influx_bucket_ttl");
+
+    config.influx_db_.options_.bucket_ttl_ = std::chrono::seconds{ n[0] };
+}
+
+inline void init_influx_gzip(therm_config & config, const char * str)
+{
+    // valid settings: "level", 0 disables compression
+    unsigned long n[1];
+    parse_numbers(str, n, "influx_gzip");
+    if (n[0] > 9)
+        throw std::runtime_error{ "Invalid influx_gzip settings" };
+
+    config.influx_db_.options_.gzip_level_ = static_cast<int>(n[0]);
+}
+
+inline void init_influx_window(therm_config & config, const char * str)
+{
+    // valid settings: "count", 1 posts the backlog one batch at a time
+    unsigned long n[1];
+    parse_numbers(str, n, "influx_window");
+    if (n[0] == 0 || n[0] > 64)
+        throw std::runtime_error{ "Invalid influx_window settings" };
+
+    config.influx_db_.options_.max_in_flight_ = n[0];
+}
+
+inline void init_batch_config(therm_config & config, const char * str)
+{
+    // valid settings: "min_bytes max_bytes target_ms"
+    unsigned long n[3];
+    parse_numbers(str, n, "batch");
+    if (n[0] == 0 || n[1] < n[0] || n[2] == 0)
+        throw std::runtime_error{ "Invalid batch settings" };
+
+    config.batch_.min_bytes_ = n[0];
+    config.batch_.max_bytes_ = n[1];
+    config.batch_.target_latency_ = std::chrono::milliseconds{ n[2] };
+}
+
+inline void init_backlog_budget(therm_config & config, const char * str)
+{
+    // valid settings: "bytes percent seconds", the bound, the high water & the compaction window
+    unsigned long n[3];
+    parse_numbers(str, n, "backlog_budget");
+    if (n[0] == 0 || n[1] == 0 || n[1] > 100 || n[2] == 0 || n[2] > max_rollup_window)
+        throw std::runtime_error{ "Invalid backlog_budget settings" };
+
+    config.backlog_limits_.max_bytes_ = n[0];
+    config.backlog_limits_.high_water_percent_ = n[1];
+    config.backlog_limits_.compact_window_ = static_cast<uint32_t>(n[2]);
+}
+
+inline overflow_policy parse_overflow_policy(std::string_view policy, bool spill, const char * what)
+{
+    if (policy == "spill" && spill)
+        return overflow_policy::spill;
+    if (policy == "drop_oldest")
+        return overflow_policy::drop_oldest;
+    if (policy == "drop_newest")
+        return overflow_policy::drop_newest;
+    throw std::runtime_error{ std::string{ "Invalid " } + what + " settings" };
+}
+
+inline void init_queue_config(therm_config & config, const char * str)
+{
+    // valid settings: "capacity spill|drop_oldest|drop_newest"
+    assert(str);
+
+    char * end;
+    auto const capacity = strtoul(str, &end, 10);
+    if (end == str || capacity == 0 || *end != ' ')
+        throw std::runtime_error{ "Invalid queue settings" };
+
+    config.queue_overflow_ = parse_overflow_policy(end + 1, true, "queue");
+    config.queue_capacity_ = capacity;
+}
+
+inline void parse_sink_queue(const char * str, size_t & capacity, overflow_policy & policy, const char * what)
+{
+    // valid settings: "capacity drop_oldest|drop_newest", only the influx backlog can take a spill
+    assert(str);
+
+    char * end;
+    auto const n = strtoul(str, &end, 10);
+    if (end == str || n == 0 || *end != ' ')
+        throw std::runtime_error{ std::string{ "Invalid " } + what + " settings" };
+
+    policy = parse_overflow_policy(end + 1, false, what);
+    capacity = n;
+}
+
+inline void init_file_queue(therm_config & config, const char * str)
+{
+    parse_sink_queue(str, config.file_.queue_capacity_, config.file_.queue_overflow_, "file_queue");
+}
+
+inline void init_file_batch(therm_config & config, const char * str)
+{
+    // valid settings: "lines milliseconds"
+    unsigned long n[2];
+    parse_numbers(str, n, "file_batch");
+    if (n[0] == 0)
+        throw std::runtime_error{ "Invalid file_batch settings" };
+
+    config.file_.options_.batch_lines_ = n[0];
+    config.file_.options_.batch_interval_ = std::chrono::milliseconds{ n[1] };
+}
+
+inline void init_file_retry(therm_config & config, const char * str)
+{
+    // valid settings: "milliseconds max_bytes"
+    unsigned long n[2];
+    parse_numbers(str, n, "file_retry");
+    if (n[1] == 0)
+        throw std::runtime_error{ "Invalid file_retry settings" };
+
+    config.file_.options_.retry_interval_ = std::chrono::milliseconds{ n[0] };
+    config.file_.options_.max_bytes_ = n[1];
+}
+
+inline void init_socket_packet(socket_config & config, const char * str, const char * what)
+{
+    // valid settings: "bytes milliseconds"
+    unsigned long n[2];
+    parse_numbers(str, n, what);
+    if (n[0] == 0)
+        throw std::runtime_error{ std::string{ "Invalid " } + what + " settings" };
+
+    config.options_.packet_bytes_ = n[0];
+    config.options_.packet_interval_ = std::chrono::milliseconds{ n[1] };
+}
+
+inline void init_unix_socket(therm_config & config, const char * str, socket_sink::mode mode)
+{
+    config.unix_.mode_ = mode;
+    config.unix_.address_.assign(str);
+}
+
+inline void init_gateway_workers(therm_config & config, const char * str)
+{
+    // valid settings: "threads max_clients"
+    unsigned long n[2];
+    parse_numbers(str, n, "gateway_workers");
+    if (n[0] == 0 || n[0] > 64 || n[1] == 0)
+        throw std::runtime_error{ "Invalid gateway_workers settings" };
+
+    config.gateway_.workers_ = n[0];
+    config.gateway_.max_clients_ = n[1];
+}
+
+inline void init_shm_slots(therm_config & config, const char * str)
+{
+    // valid settings: "sensors"
+    unsigned long n[1];
+    parse_numbers(str, n, "shm_slots");
+    if (n[0] == 0 || n[0] > 65536)
+        throw std::runtime_error{ "Invalid shm_slots settings" };
+
+    config.shm_slots_ = n[0];
+}
+
+inline void init_history(therm_config & config, const char * str)
+{
+    // valid settings: "points bytes", readings per sensor & memory of all sensors, 8 bytes a reading
+    unsigned long n[2];
+    parse_numbers(str, n, "history");
+    if (n[0] == 0 || n[1] < n[0] * 8)
+        throw std::runtime_error{ "Invalid history settings" };
+
+    config.history_ = history::options{ n[0], n[1] };
+}
+
+inline void init_w1_workers(therm_config & config, const char * str)
+{
+    // valid settings: "count", 0 reads the sensors on the sampling thread
+    unsigned long n[1];
+    parse_numbers(str, n, "w1_workers");
+
+    config.w1_workers_ = n[0];
+}
+
+inline void init_w1_bulk_read(therm_config & config, const char * str)
+{
+    // valid settings: "on|off"
+    assert(str);
+
+    std::string_view const value{ str };
+    if (value != "on" && value != "off")
+        throw std::runtime_error{ "Invalid w1_bulk_read settings" };
+
+    config.w1_bulk_read_ = value == "on";
+}
+
+inline void init_interval(therm_config & config, const char * str)
+{
+    // valid settings: "seconds"
+    unsigned long n[1];
+    parse_numbers(str, n, "interval");
+    if (n[0] == 0)
+        throw std::runtime_error{ "Invalid interval settings" };
+
+    config.interval_ = std::chrono::seconds{ n[0] };
+}
+
+inline void init_sensor_name(therm_config & config, const char * str)
+{
+    // valid settings: "id name"
+    assert(str);
+
+    auto const sep = strchr(str, ' ');
+    if (!sep || sep == str || sep[1] == 0 || strlen(sep + 1) >= sample::name_capacity)
+        throw std::runtime_error{ "Invalid sensor settings" };
+    config.sensor_names_[std::string{ str, sep }] = sep + 1;
+}
+
+inline void init_sensor_resolution(therm_config & config, const char * str)
+{
+    // valid settings: "id bits", 9 to 12 bits
+    assert(str);
+
+    auto const sep = strchr(str, ' ');
+    if (!sep || sep == str)
+        throw std::runtime_error{ "Invalid resolution settings" };
+
+    unsigned long n[1];
+    parse_numbers(sep + 1, n, "resolution");
+    if (n[0] < 9 || n[0] > 12)
+        throw std::runtime_error{ "Invalid resolution settings" };
+    config.sensor_resolutions_[std::string{ str, sep }] = static_cast<int>(n[0]);
+}
+
+inline void init_rollup(therm_config & config, const char * str)
+{
+    // valid settings: "seconds [seconds...]", up to 8 windows
+    assert(str);
+
+    config.rollup_windows_.clear();
+    while (*str != 0)
+    {
+        char * end;
+        auto const n = strtoul(str, &end, 10);
+        if (end == str || (*end != ' ' && *end != 0) || n == 0 || n > max_rollup_window ||
+            config.rollup_windows_.size() == 8 ||
+            std::find(config.rollup_windows_.begin(), config.rollup_windows_.end(), n) != config.rollup_windows_.end())
+            throw std::runtime_error{ "Invalid rollup settings" };
+        config.rollup_windows_.push_back(static_cast<uint32_t>(n));
+        str = end;
+    }
+
+    if (config.rollup_windows_.empty())
+        throw std::runtime_error{ "Invalid rollup settings" };
+}
+
+inline rollup_output parse_rollup_output(const char * str, const char * what)
+{
+    // valid settings: "raw|rollup|both"
+    assert(str);
+
+    std::string_view const value{ str };
+    if (value == "raw")
+        return rollup_output::raw;
+    if (value == "rollup")
+        return rollup_output::rollup;
+    if (value == "both")
+        return rollup_output::both;
+    throw std::runtime_error{ std::string{ "Invalid " } + what + " settings" };
+}
+
+inline void init_rollup_output(therm_config & config, const char * str)
+{
+    config.rollup_output_ = parse_rollup_output(str, "rollup_output");
+}
+
+/**
+ * @brief what a sink takes, everything without rollups, the gateway's rollups included
+ */
+inline rollup_output sink_output(const therm_config & config, const std::optional<rollup_output> & output)
+{
+    if (config.rollup_windows_.empty()) return rollup_output::both;
+    return output.value_or(config.rollup_output_);
+}
+
+inline void init_deadband(therm_config & config, const char * str)
+{
+    // valid settings: "celsius seconds", e.g. "0.1 900"
+    assert(str);
+
+    char * end;
+    auto const delta = strtod(str, &end);
+    if (end == str || *end != ' ' || !(delta >= 0))
+        throw std::runtime_error{ "Invalid deadband settings" };
+
+    unsigned long n[1];
+    parse_numbers(end + 1, n, "deadband");
+    if (n[0] == 0)
+        throw std::runtime_error{ "Invalid deadband settings" };
+
+    config.deadband_ = deadband::options{ delta, std::chrono::seconds{ n[0] } };
+}
+
+inline void init_deadband_sensor(therm_config & config, const char * str)
+{
+    // valid settings: "id celsius"
+    assert(str);
+
+    auto const sep = strchr(str, ' ');
+    if (!sep || sep == str)
+        throw std::runtime_error{ "Invalid deadband_sensor settings" };
+
+    char * end;
+    auto const delta = strtod(sep + 1, &end);
+    if (end == sep + 1 || *end != 0 || !(delta >= 0))
+        throw std::runtime_error{ "Invalid deadband_sensor settings" };
+    config.deadband_deltas_[std::string{ str, sep }] = delta;
+}
+
 inline void load_config_file(therm_config & config, const char * path)
 {
-    // demo config file:
+    // demo config file, lines starting with # are comments:
     // sqlite w1_therm.db
+    // sqlite_sync NORMAL
+    // sqlite_commit 32 5000
+    // sqlite_blocks 1024
+    // spool /var/lib/w1_therm/spool
+    // spool_sync 32 5000
+    // spool_segment 1048576
     // influx host/org/bucket/token
+    // influx_timeout 3000 10000
+    // influx_backoff 3 1000 300000
+    // influx_bucket_ttl 600
+    // influx_gzip 6
+    // influx_window 4
+    // batch 4096 1048576 1000
+    // backlog_budget 67108864 80 900
+    // queue 1024 spill
+    // file /var/log/w1_therm.lp
+    // file_queue 1024 drop_oldest
+    // file_batch 64 1000
+    // file_retry 5000 1048576
+    // udp 127.0.0.1:8094
+    // udp_queue 1024 drop_oldest
+    // udp_packet 1400 1000
+    // tcp gateway.lan:8186
+    // tcp_queue 4096 drop_oldest
+    // tcp_packet 16384 1000
+    // unix /run/telegraf/telegraf.sock
+    // unix_queue 1024 drop_oldest
+    // unix_packet 1400 1000
+    // interval 300
+    // w1_root /sys/bus/w1/devices
+    // w1_workers 4
+    // w1_bulk_read on
+    // sensor 28-00000001acef home-tplik-switch
+    // resolution 28-00000001acef 10
+    // metrics 127.0.0.1:9105
+    // gateway :8186
+    // gateway_workers 2 1024
+    // shm /w1_therm
+    // shm_slots 256
+    // history 2880 4194304
+    // rollup 60 900 3600
+    // rollup_output both
+    // influx_output rollup
+    // file_output raw
+    // udp_output both
+    // tcp_output raw
+    // unix_output both
+    // deadband 0.1 900
+    // deadband_sensor 28-00000001acef 0.5
 
     assert(path);
     auto const file_deleter = [](FILE * fp) { fclose(fp); };
@@ -296,13 +950,133 @@ inline void load_config_file(therm_config & config, const char * path)
             throw std::runtime_error{ "Invalid config file" };
         buf[len - 1] = 0;
 
+        // blank lines & comments
+        if (buf[0] == 0 || buf[0] == '#')
+            continue;
+
         if (strncmp(buf, "sqlite ", 7) == 0)
             config.sqlite_db_.path_.assign(buf + 7);
+        else if (strncmp(buf, "sqlite_sync ", 12) == 0)
+            config.sqlite_db_.options_.synchronous_.assign(buf + 12);
+        else if (strncmp(buf, "sqlite_commit ", 14) == 0)
+            init_sqlite_commit(config, buf + 14);
+        else if (strncmp(buf, "sqlite_blocks ", 14) == 0)
+            init_sqlite_blocks(config, buf + 14);
+        else if (strncmp(buf, "spool ", 6) == 0)
+            config.spool_.dir_.assign(buf + 6);
+        else if (strncmp(buf, "spool_sync ", 11) == 0)
+            init_spool_sync(config, buf + 11);
+        else if (strncmp(buf, "spool_segment ", 14) == 0)
+            init_spool_segment(config, buf + 14);
         else if (strncmp(buf, "influx ", 7) == 0)
             init_influx_config(config, buf + 7);
+        else if (strncmp(buf, "influx_timeout ", 15) == 0)
+            init_influx_timeout(config, buf + 15);
+        else if (strncmp(buf, "influx_backoff ", 15) == 0)
+            init_influx_backoff(config, buf + 15);
+        else if (strncmp(buf, "influx_bucket_ttl ", 18) == 0)
+            init_influx_bucket_ttl(config, buf + 18);
+        else if (strncmp(buf, "influx_gzip ", 12) == 0)
+            init_influx_gzip(config, buf + 12);
+        else if (strncmp(buf, "influx_window ", 14) == 0)
+            init_influx_window(config, buf + 14);
+        else if (strncmp(buf, "influx_output ", 14) == 0)
+            config.influx_db_.output_ = parse_rollup_output(buf + 14, "influx_output");
+        else if (strncmp(buf, "batch ", 6) == 0)
+            init_batch_config(config, buf + 6);
+        else if (strncmp(buf, "backlog_budget ", 15) == 0)
+            init_backlog_budget(config, buf + 15);
+        else if (strncmp(buf, "queue ", 6) == 0)
+            init_queue_config(config, buf + 6);
+        else if (strncmp(buf, "file ", 5) == 0)
+            config.file_.path_.assign(buf + 5);
+        else if (strncmp(buf, "file_queue ", 11) == 0)
+            init_file_queue(config, buf + 11);
+        else if (strncmp(buf, "file_batch ", 11) == 0)
+            init_file_batch(config, buf + 11);
+        else if (strncmp(buf, "file_retry ", 11) == 0)
+            init_file_retry(config, buf + 11);
+        else if (strncmp(buf, "file_output ", 12) == 0)
+            config.file_.output_ = parse_rollup_output(buf + 12, "file_output");
+        else if (strncmp(buf, "udp ", 4) == 0)
+            config.udp_.address_.assign(buf + 4);
+        else if (strncmp(buf, "udp_queue ", 10) == 0)
+            parse_sink_queue(buf + 10, config.udp_.queue_capacity_, config.udp_.queue_overflow_, "udp_queue");
+        else if (strncmp(buf, "udp_packet ", 11) == 0)
+            init_socket_packet(config.udp_, buf + 11, "udp_packet");
+        else if (strncmp(buf, "udp_output ", 11) == 0)
+            config.udp_.output_ = parse_rollup_output(buf + 11, "udp_output");
+        else if (strncmp(buf, "tcp ", 4) == 0)
+            config.tcp_.address_.assign(buf + 4);
+        else if (strncmp(buf, "tcp_queue ", 10) == 0)
+            parse_sink_queue(buf + 10, config.tcp_.queue_capacity_, config.tcp_.queue_overflow_, "tcp_queue");
+        else if (strncmp(buf, "tcp_packet ", 11) == 0)
+            init_socket_packet(config.tcp_, buf + 11, "tcp_packet");
+        else if (strncmp(buf, "tcp_output ", 11) == 0)
+            config.tcp_.output_ = parse_rollup_output(buf + 11, "tcp_output");
+        else if (strncmp(buf, "unix ", 5) == 0)
+            init_unix_socket(config, buf + 5, socket_sink::mode::unix_stream);
+        else if (strncmp(buf, "unixgram ", 9) == 0)
+            init_unix_socket(config, buf + 9, socket_sink::mode::unix_dgram);
+        else if (strncmp(buf, "unix_queue ", 11) == 0)
+            parse_sink_queue(buf + 11, config.unix_.queue_capacity_, config.unix_.queue_overflow_, "unix_queue");
+        else if (strncmp(buf, "unix_packet ", 12) == 0)
+            init_socket_packet(config.unix_, buf + 12, "unix_packet");
+        else if (strncmp(buf, "unix_output ", 12) == 0)
+            config.unix_.output_ = parse_rollup_output(buf + 12, "unix_output");
+        else if (strncmp(buf, "interval ", 9) == 0)
+            init_interval(config, buf + 9);
+        else if (strncmp(buf, "w1_root ", 8) == 0)
+            config.w1_root_.assign(buf + 8);
+        else if (strncmp(buf, "w1_workers ", 11) == 0)
+            init_w1_workers(config, buf + 11);
+        else if (strncmp(buf, "w1_bulk_read ", 13) == 0)
+            init_w1_bulk_read(config, buf + 13);
+        else if (strncmp(buf, "sensor ", 7) == 0)
+            init_sensor_name(config, buf + 7);
+        else if (strncmp(buf, "resolution ", 11) == 0)
+            init_sensor_resolution(config, buf + 11);
+        else if (strncmp(buf, "metrics ", 8) == 0)
+            config.metrics_address_.assign(buf + 8);
+        else if (strncmp(buf, "gateway ", 8) == 0)
+            config.gateway_address_.assign(buf + 8);
+        else if (strncmp(buf, "gateway_workers ", 16) == 0)
+            init_gateway_workers(config, buf + 16);
+        else if (strncmp(buf, "shm ", 4) == 0)
+            config.shm_name_.assign(buf + 4);
+        else if (strncmp(buf, "shm_slots ", 10) == 0)
+            init_shm_slots(config, buf + 10);
+        else if (strncmp(buf, "history ", 8) == 0)
+            init_history(config, buf + 8);
+        else if (strncmp(buf, "rollup ", 7) == 0)
+            init_rollup(config, buf + 7);
+        else if (strncmp(buf, "rollup_output ", 14) == 0)
+            init_rollup_output(config, buf + 14);
+        else if (strncmp(buf, "deadband ", 9) == 0)
+            init_deadband(config, buf + 9);
+        else if (strncmp(buf, "deadband_sensor ", 16) == 0)
+            init_deadband_sensor(config, buf + 16);
         else
             throw std::runtime_error{ "Invalid config file" };
     }
+
+    // samples going nowhere are a config mistake
+    if (config.influx_db_.host_.empty() && config.file_.path_.empty() &&
+        config.udp_.address_.empty() && config.tcp_.address_.empty() && config.unix_.address_.empty())
+        throw std::runtime_error{ "no output, set influx, file, udp, tcp or unix" };
+
+    // the history is only served by the metrics endpoint
+    if (config.history_ && config.metrics_address_.empty())
+        throw std::runtime_error{ "history needs metrics" };
+
+    // uploading rollups only without a window would upload nothing
+    auto const rollup_only = [&](const std::optional<rollup_output> & output) {
+        return output.value_or(config.rollup_output_) == rollup_output::rollup;
+    };
+    if (config.rollup_windows_.empty() &&
+        (rollup_only(config.influx_db_.output_) || rollup_only(config.file_.output_) ||
+         rollup_only(config.udp_.output_) || rollup_only(config.tcp_.output_) || rollup_only(config.unix_.output_)))
+        throw std::runtime_error{ "rollup output needs rollup windows" };
 }
 
 inline therm_config parse_arguments(int const argc, char ** argv)
@@ -311,7 +1085,7 @@ inline therm_config parse_arguments(int const argc, char ** argv)
 
     try
     {
-        if (argc < 3)
+        if (argc < 2)
             throw std::invalid_argument{ "too few argument" };
 
         constexpr auto * opts{ "p:n:c:d" };
@@ -341,15 +1115,19 @@ inline therm_config parse_arguments(int const argc, char ** argv)
             }
         }
 
-        if (config.senor_name_.empty() || config.senor_name_.empty())
+        // a single sensor needs a name, otherwise sensors are discovered from w1_root
+        if (!config.w1_slave_path_.empty() && config.senor_name_.empty())
+            throw std::invalid_argument{ "invalid argument" };
+        if (config.senor_name_.size() >= sample::name_capacity)
             throw std::invalid_argument{ "invalid argument" };
     }
     catch (std::invalid_argument const &)
     {
         std::cerr
-            << "usage: " << argv[0] << " [options] -p <path> -n <name>" << std::endl
-            << '\t' << "-p <path>" << '\t' << "Set the w1_slave path" << std::endl
+            << "usage: " << argv[0] << " [options] [-p <path> -n <name>]" << std::endl
+            << '\t' << "-p <path>" << '\t' << "Set the w1_slave path, scan all sensors if absent" << std::endl
             << '\t' << "-n <name>" << '\t' << "Set the senor name" << std::endl
+            << '\t' << "-c <path>" << '\t' << "Set the config file" << std::endl
             << '\t' << "-d       " << '\t' << "daemonlize if set" << std::endl;
         exit(EXIT_FAILURE);
     }
@@ -382,6 +1160,9 @@ inline void daemonlize()
 
 int main(int argc, char ** argv)
 {
+    // before sqlite or libcurl allocate anything, their buffers are then reused instead of freed
+    lib_heap::install();
+
     auto const config = parse_arguments(argc, argv);
 
     if (config.daemonlize_)
@@ -389,11 +1170,70 @@ int main(int argc, char ** argv)
 
     init_log(argv[0]);
 
-    init_signal_handle();
+    // before any thread is spawned, they inherit the blocked signals
+    auto const signal_fd = init_signal_handle();
+
+    // the recent readings, warmed from the backlog before anything is drained out of it
+    std::optional<history> recent;
+    if (config.history_)
+        recent.emplace(*config.history_);
+
+    // influxdb with its backlog, unless only local outputs are wanted
+    std::optional<storage_t> storage;
+    if (!config.influx_db_.host_.empty())
+        storage.emplace(init_storage(config, recent ? &*recent : nullptr));
 
-    auto storage = init_storage(config);
+    // local sinks next to influxdb, never held up by it
+    std::optional<file_sink> file;
+    if (!config.file_.path_.empty())
+    {
+        file.emplace(config.file_.path_.c_str(), config.file_.options_);
+        syslog(LOG_USER | LOG_INFO, "writing line protocol to %s\n", config.file_.path_.c_str());
+    }
 
-    w1_therm_run(storage, config);
+    std::optional<socket_sink> udp, tcp, unix_socket;
+    if (!config.udp_.address_.empty())
+    {
+        udp.emplace(config.udp_.mode_, config.udp_.address_, config.udp_.options_);
+        syslog(LOG_USER | LOG_INFO, "sending line protocol to udp %s\n", config.udp_.address_.c_str());
+    }
+    if (!config.tcp_.address_.empty())
+    {
+        tcp.emplace(config.tcp_.mode_, config.tcp_.address_, config.tcp_.options_);
+        syslog(LOG_USER | LOG_INFO, "sending line protocol to tcp %s\n", config.tcp_.address_.c_str());
+    }
+    if (!config.unix_.address_.empty())
+    {
+        unix_socket.emplace(config.unix_.mode_, config.unix_.address_, config.unix_.options_);
+        syslog(LOG_USER | LOG_INFO, "sending line protocol to %s\n", config.unix_.address_.c_str());
+    }
+
+    {
+        // the spool log & the blocks have a single writer, nothing can spill next to them
+        auto const single_writer = !config.spool_.dir_.empty() || config.sqlite_db_.block_points_ != 0;
+        auto const policy = single_writer && config.queue_overflow_ == overflow_policy::spill
+                          ? overflow_policy::drop_oldest
+                          : config.queue_overflow_;
+
+        // each gateway worker feeds rings of its own, the sampler's stay lock-free
+        fanout upload{ config.gateway_address_.empty() ? 0 : config.gateway_.workers_ };
+        if (storage)
+            upload.add(*storage, config.queue_capacity_, policy, config.sqlite_db_.path_.c_str(),
+                       sink_output(config, config.influx_db_.output_));
+        if (file)
+            upload.add(*file, config.file_.queue_capacity_, config.file_.queue_overflow_, nullptr,
+                       sink_output(config, config.file_.output_));
+        if (udp)
+            upload.add(*udp, config.udp_.queue_capacity_, config.udp_.queue_overflow_, nullptr,
+                       sink_output(config, config.udp_.output_));
+        if (tcp)
+            upload.add(*tcp, config.tcp_.queue_capacity_, config.tcp_.queue_overflow_, nullptr,
+                       sink_output(config, config.tcp_.output_));
+        if (unix_socket)
+            upload.add(*unix_socket, config.unix_.queue_capacity_, config.unix_.queue_overflow_, nullptr,
+                       sink_output(config, config.unix_.output_));
+        w1_therm_run(upload, config, signal_fd.get(), recent ? &*recent : nullptr);
+    }
 
     deinit_log();
 }